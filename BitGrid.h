@@ -0,0 +1,142 @@
+#ifndef BITGRID_H
+#define BITGRID_H
+
+#include <vector>
+
+// Two dimensional grid of bits packed into 32-bit words, row by row
+class BitGrid
+{
+private:
+	int sizeX;
+	int sizeY;
+	std::vector<unsigned int> words;
+
+public:
+	BitGrid()
+	{
+		sizeX = 0;
+		sizeY = 0;
+	};
+	BitGrid(int x, int y)
+	{
+		resize(x, y);
+	};
+
+	static int popcount(unsigned int v)
+	{
+		v = v - ((v >> 1) & 0x55555555u);
+		v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+		return (int)((((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+	};
+
+	void resize(int x, int y)
+	{
+		sizeX = x;
+		sizeY = y;
+		words.assign((x*y+31)/32, 0);
+	};
+
+	int getSizeX() const
+	{
+		return sizeX;
+	};
+	int getSizeY() const
+	{
+		return sizeY;
+	};
+
+	bool isValidIndex(int x, int y) const
+	{
+		return
+			x>=0 && x<sizeX &&
+			y>=0 && y<sizeY;
+	};
+
+	int index(int x, int y) const
+	{
+		return x+y*sizeX;
+	};
+
+	bool test(int i) const
+	{
+		return (words[i >> 5] >> (i & 31)) & 1u;
+	};
+	bool test(int x, int y) const
+	{
+		return test(index(x,y));
+	};
+	// Coordinates outside of grid are treated as cleared
+	bool safe_test(int x, int y) const
+	{
+		return isValidIndex(x,y) && test(index(x,y));
+	};
+
+	void set(int i)
+	{
+		words[i >> 5] |= 1u << (i & 31);
+	};
+	void set(int x, int y)
+	{
+		set(index(x,y));
+	};
+	void set(int x, int y, bool value)
+	{
+		if(value)
+			set(x,y);
+		else
+			clear(x,y);
+	};
+
+	void clear(int i)
+	{
+		words[i >> 5] &= ~(1u << (i & 31));
+	};
+	void clear(int x, int y)
+	{
+		clear(index(x,y));
+	};
+	void clearAll()
+	{
+		words.assign(words.size(), 0);
+	};
+
+	// Keeps the bits also set in "other", which must be of equal size
+	void andWith(const BitGrid& other)
+	{
+		for(int i=0; i<(int)words.size(); i++)
+			words[i] &= other.words[i];
+	};
+
+	// Number of set bits
+	int count() const
+	{
+		int sum = 0;
+		for(int i=0; i<(int)words.size(); i++)
+			sum += popcount(words[i]);
+		return sum;
+	};
+
+	int getWordCount() const
+	{
+		return (int)words.size();
+	};
+	unsigned int getWord(int i) const
+	{
+		return words[i];
+	};
+	unsigned int* getWords()
+	{
+		return &words[0];
+	};
+	const unsigned int* getWords() const
+	{
+		return &words[0];
+	};
+
+	bool operator==(const BitGrid& other) const
+	{
+		return sizeX == other.sizeX && sizeY == other.sizeY && words == other.words;
+	};
+};
+
+#endif
@@ -94,6 +94,24 @@ public:
 		return mLook;
 	};
 
+	// Get frustum properties.
+	float GetNearZ()const
+	{
+		return mNearZ;
+	};
+	float GetFarZ()const
+	{
+		return mFarZ;
+	};
+	float GetAspect()const
+	{
+		return mAspect;
+	};
+	float GetFovY()const
+	{
+		return mFovY;
+	};
+
 	// Set frustum.
 	void SetLens(float fovY, float aspect, float zn, float zf)
 	{
@@ -110,6 +128,20 @@ public:
 		XMStoreFloat4x4(&mProj, P);
 	};
 
+	// Define camera space via LookAt parameters.
+	void LookAt(const XMFLOAT3& pos, const XMFLOAT3& target, const XMFLOAT3& up)
+	{
+		XMVECTOR P = XMLoadFloat3(&pos);
+		XMVECTOR L = XMVector3Normalize(XMLoadFloat3(&target) - P);
+		XMVECTOR R = XMVector3Normalize(XMVector3Cross(XMLoadFloat3(&up), L));
+		XMVECTOR U = XMVector3Cross(L, R);
+
+		XMStoreFloat3(&mPosition, P);
+		XMStoreFloat3(&mLook, L);
+		XMStoreFloat3(&mRight, R);
+		XMStoreFloat3(&mUp, U);
+	};
+
 	// Get View/Proj matrices.
 	XMMATRIX View()
 	{
@@ -0,0 +1,260 @@
+#ifndef D3D11RENDERDEVICE_H
+#define D3D11RENDERDEVICE_H
+
+#include "Util.h"
+#include "RenderDevice.h"
+
+//
+// Render device forwarding every call to a D3D11 device context
+//
+
+static_assert(topology_triangleList == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST &&
+	topology_triangleStrip == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP &&
+	topology_firstPatchList == D3D11_PRIMITIVE_TOPOLOGY_1_CONTROL_POINT_PATCHLIST &&
+	topology_lastPatchList == D3D11_PRIMITIVE_TOPOLOGY_32_CONTROL_POINT_PATCHLIST,
+	"RenderTopology must match D3D11_PRIMITIVE_TOPOLOGY");
+
+class D3D11RenderDevice : public RenderDevice
+{
+private:
+	ID3D11DeviceContext* context;
+
+	// Queries of every frame in flight, created on first use
+	struct TimerFrame
+	{
+		UINT64 frame;
+		bool issued;
+		int num_timestamps;
+		ID3D11Query* disjoint;
+		ID3D11Query* timestamps[maxTimestamps];
+	};
+	TimerFrame timerFrames[num_timerFrames];
+	TimerFrame* currentTimerFrame;
+
+	ID3D11Query* createQuery(D3D11_QUERY type)
+	{
+		ID3D11Device* device = 0;
+		context->GetDevice(&device);
+		D3D11_QUERY_DESC desc;
+		desc.Query = type;
+		desc.MiscFlags = 0;
+		ID3D11Query* query = 0;
+		HR(device->CreateQuery(&desc, &query));
+		ReleaseCOM(device);
+		return query;
+	};
+
+public:
+	D3D11RenderDevice(ID3D11DeviceContext* context)
+	{
+		this->context = context;
+		memset(timerFrames, 0, sizeof(timerFrames));
+		currentTimerFrame = 0;
+	};
+	~D3D11RenderDevice()
+	{
+		for(int i=0; i<num_timerFrames; i++)
+		{
+			ReleaseCOM(timerFrames[i].disjoint);
+			for(int k=0; k<maxTimestamps; k++)
+				ReleaseCOM(timerFrames[i].timestamps[k]);
+		}
+	};
+
+	ID3D11DeviceContext* getContext()
+	{
+		return context;
+	};
+
+	bool isHeadless() const
+	{
+		return false;
+	};
+
+	void setInputLayout(ID3D11InputLayout* layout)
+	{
+		stats.num_stateBinds++;
+		context->IASetInputLayout(layout);
+	};
+	void setPrimitiveTopology(UINT topology)
+	{
+		stats.num_stateBinds++;
+		this->topology = topology;
+		context->IASetPrimitiveTopology((D3D11_PRIMITIVE_TOPOLOGY)topology);
+	};
+	void setVertexBuffers(UINT startSlot, UINT num_buffers, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+	{
+		stats.num_stateBinds++;
+		context->IASetVertexBuffers(startSlot, num_buffers, buffers, strides, offsets);
+	};
+	void setIndexBuffer(ID3D11Buffer* buffer, UINT format, UINT offset)
+	{
+		stats.num_stateBinds++;
+		context->IASetIndexBuffer(buffer, (DXGI_FORMAT)format, offset);
+	};
+
+	void setRasterizerState(ID3D11RasterizerState* state)
+	{
+		stats.num_stateBinds++;
+		context->RSSetState(state);
+	};
+	void setDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+	{
+		stats.num_stateBinds++;
+		context->OMSetDepthStencilState(state, stencilRef);
+	};
+	void setViewports(UINT num_viewports, const D3D11_VIEWPORT* viewports)
+	{
+		stats.num_stateBinds++;
+		context->RSSetViewports(num_viewports, viewports);
+	};
+	void setRenderTargets(UINT num_views, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil)
+	{
+		stats.num_stateBinds++;
+		context->OMSetRenderTargets(num_views, renderTargets, depthStencil);
+	};
+	void setPSShaderResources(UINT startSlot, UINT num_views, ID3D11ShaderResourceView* const* views)
+	{
+		stats.num_stateBinds++;
+		context->PSSetShaderResources(startSlot, num_views, views);
+	};
+	void clearTessellation()
+	{
+		stats.num_stateBinds++;
+		context->HSSetShader(0, 0, 0);
+		context->DSSetShader(0, 0, 0);
+	};
+	void clearRenderTarget(ID3D11RenderTargetView* view, const float color[4])
+	{
+		context->ClearRenderTargetView(view, color);
+	};
+	void clearDepthStencil(ID3D11DepthStencilView* view, UINT flags, float depth, UINT8 stencil)
+	{
+		context->ClearDepthStencilView(view, flags, depth, stencil);
+	};
+
+	void applyPass(ID3DX11EffectPass* pass)
+	{
+		stats.num_passes++;
+		pass->Apply(0, context);
+	};
+
+	void draw(UINT num_vertices, UINT startVertex)
+	{
+		stats.num_draws++;
+		stats.num_instances++;
+		stats.num_indices += num_vertices;
+		countPrimitives(num_vertices);
+		context->Draw(num_vertices, startVertex);
+	};
+	void drawIndexed(UINT num_indices, UINT startIndex, INT baseVertex)
+	{
+		stats.num_draws++;
+		stats.num_instances++;
+		stats.num_indices += num_indices;
+		countPrimitives(num_indices);
+		context->DrawIndexed(num_indices, startIndex, baseVertex);
+	};
+	void drawIndexedInstanced(UINT num_indices, UINT num_instances, UINT startIndex, INT baseVertex, UINT startInstance)
+	{
+		stats.num_draws++;
+		stats.num_instances += num_instances;
+		stats.num_indices += num_indices*num_instances;
+		countPrimitives(num_indices*num_instances);
+		context->DrawIndexedInstanced(num_indices, num_instances, startIndex, baseVertex, startInstance);
+	};
+
+	void updateBuffer(ID3D11Buffer* buffer, UINT offset, const void* data, UINT bytes)
+	{
+		stats.num_bufferUpdates++;
+		stats.num_updatedBytes += bytes;
+		D3D11_BOX box;
+		box.left = offset;
+		box.right = offset+bytes;
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+		context->UpdateSubresource(buffer, 0, &box, data, 0, 0);
+	};
+	void* map(ID3D11Buffer* buffer, UINT type, UINT offset, UINT bytes)
+	{
+		stats.num_bufferUpdates++;
+		stats.num_updatedBytes += bytes;
+		D3D11_MAPPED_SUBRESOURCE mappedData;
+		HR(context->Map(buffer, 0, (D3D11_MAP)type, 0, &mappedData));
+		return (unsigned char*)mappedData.pData + offset;
+	};
+	void unmap(ID3D11Buffer* buffer)
+	{
+		context->Unmap(buffer, 0);
+	};
+
+	void copyResource(ID3D11Resource* dest, ID3D11Resource* source)
+	{
+		context->CopyResource(dest, source);
+	};
+	void generateMips(ID3D11ShaderResourceView* view)
+	{
+		context->GenerateMips(view);
+	};
+
+	void beginTimerFrame(UINT64 frame)
+	{
+		TimerFrame& timer = timerFrames[frame % num_timerFrames];
+		if(!timer.disjoint)
+			timer.disjoint = createQuery(D3D11_QUERY_TIMESTAMP_DISJOINT);
+		timer.frame = frame;
+		timer.issued = false;
+		timer.num_timestamps = 0;
+		context->Begin(timer.disjoint);
+		currentTimerFrame = &timer;
+	};
+	int writeTimestamp()
+	{
+		TimerFrame* timer = currentTimerFrame;
+		if(!timer || timer->num_timestamps == maxTimestamps)
+			return -1;
+		ID3D11Query*& query = timer->timestamps[timer->num_timestamps];
+		if(!query)
+			query = createQuery(D3D11_QUERY_TIMESTAMP);
+		context->End(query);
+		return timer->num_timestamps++;
+	};
+	void endTimerFrame()
+	{
+		if(!currentTimerFrame)
+			return;
+		context->End(currentTimerFrame->disjoint);
+		currentTimerFrame->issued = true;
+		currentTimerFrame = 0;
+	};
+	bool readTimerFrame(UINT64 frame, std::vector<float>& ms)
+	{
+		TimerFrame& timer = timerFrames[frame % num_timerFrames];
+		if(!timer.issued || timer.frame != frame)
+			return false;
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		if(context->GetData(timer.disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			return false;
+		timer.issued = false;
+		if(disjoint.Disjoint || timer.num_timestamps == 0)
+			return false;
+
+		ms.resize(timer.num_timestamps);
+		UINT64 first = 0;
+		for(int i=0; i<timer.num_timestamps; i++)
+		{
+			UINT64 ticks = 0;
+			if(context->GetData(timer.timestamps[i], &ticks, sizeof(ticks), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+				return false;
+			if(i == 0)
+				first = ticks;
+			ms[i] = (float)((double)(ticks-first)*1000.0/(double)disjoint.Frequency);
+		}
+		return true;
+	};
+};
+
+#endif
@@ -4,10 +4,19 @@
 #include <d3dx11.h>
 
 #include "GeometryFactory.h"
+#include "MazeMesh.h"
 #include "Terrain.h"
 #include "LightHelper.h"
 #include "Game.h"
 #include "ShaderManager.h"
+#include "RenderDevice.h"
+#include "DrawList.h"
+#include "InstanceRing.h"
+#include "MeshArena.h"
+#include "MeshWelder.h"
+#include "MeshOptimizer.h"
+#include "ObjImporter.h"
+#include "MeshCache.h"
 #include <vector>
 
 struct BoundingSphere
@@ -21,7 +30,7 @@ class DXDrawManager
 {
 private:
 	ID3D11Device* dxDevice;
-	ID3D11DeviceContext* dxDeviceContext;
+	RenderDevice* renderDevice;
 	ShaderManager *shaderManager;
 
 	FXStandard* fx;
@@ -39,27 +48,47 @@ private:
 	ID3D11ShaderResourceView* mWavesMapSRV;
 	XMFLOAT4X4 mGrassTexTransform;
 
-	ID3D11Buffer* mShapesVB;
-	ID3D11Buffer* mShapesIB;
+	// Every mesh drawn by the manager, by DrawMesh
+	MeshArena arena;
+	MeshHandle meshes[num_drawMeshes];
 
-	ID3D11Buffer* vbuff_mesh;
-	ID3D11Buffer* ibuff_mesh;
-	UINT num_index_mesh;
+	// Imported meshes are welded and reordered before they go into the
+	// arena
+	ObjImporter objImporter;
+	MeshWelder meshWelder;
+	MeshOptimizer meshOptimizer;
+	MeshWelder::Stats weldStats[num_drawMeshes];
+	MeshOptimizer::Stats meshStats[num_drawMeshes];
 
-	vector<int> vertexOffsets;
-	vector<UINT> indexOffsets;
-	vector<UINT> indexCounts;
+	// OBJ parsed by the import benchmark, any file can be typed in
+	char importBenchmarkPath[MAX_PATH];
 
-	BoundingSphere mSceneBounds;
+	// Imported meshes are cached packed in "Cache", and only built again
+	// when their source changes
+	MeshCache meshCache;
+	float meshLoadMs;
+
+	// Baked walls of the maze, rebuilt when maze revision changes
+	int mazeRevision;
+	MazeMeshBaker mazeBaker;
 
-	ID3D11DepthStencilView* mDynamicCubeMapDSV;
-	ID3D11RenderTargetView* mDynamicCubeMapRTV[6];
-	ID3D11ShaderResourceView* mDynamicCubeMapSRV;
-	D3D11_VIEWPORT mCubeMapViewport;
-	static const int CubeMapSize = 256;
+	BoundingSphere mSceneBounds;
 
 	ID3D11ShaderResourceView* mStoneNormalTexSRV;
 
+	// Instances of sorted runs, rewritten every pass
+	InstanceRing instanceRing;
+	std::vector<XMFLOAT4X4> instanceWorlds;
+	bool useInstancing;
+	static const int minInstances = 2;
+	static const int instanceRingSize = 16384;
+	int num_instancedDraws;
+
+	// Arena starts out with room for the shapes and a baked maze
+	static const int arenaVertices = 65536;
+	static const int arenaIndices = 196608;
+	float maxFragmentation;		// arena is compacted after a maze bake past this
+
 protected:
 public:
 	XMFLOAT4X4 mLightView;
@@ -69,25 +98,32 @@ public:
 	ID3D11Buffer* mScreenQuadVB;
 	ID3D11Buffer* mScreenQuadIB;
 
-	DXDrawManager(ID3D11Device* dxDevice, ID3D11DeviceContext* dxDeviceContext)
+	// Packets of the current frame, sorted when submitted
+	DrawList drawList;
+	DrawList drawList_shadowMap;
+	DrawList drawList_cubeMap;
+
+	DXDrawManager(ID3D11Device* dxDevice, RenderDevice* renderDevice)
 	{
 		this->dxDevice = dxDevice;
-		this->dxDeviceContext = dxDeviceContext;
+		this->renderDevice = renderDevice;
 		shaderManager = ShaderManager::getInstance();
 		useNormalMap = false;
 
 		// Init geometry
-		mShapesVB = 0;
-		mShapesIB = 0;
 		mScreenQuadVB = 0;
 		mScreenQuadIB = 0;
-		vbuff_mesh = 0;
-		ibuff_mesh = 0;
+		for(int i=0; i<num_drawMeshes; i++)
+			meshes[i] = -1;
+		memset(weldStats, 0, sizeof(weldStats));
+		memset(meshStats, 0, sizeof(meshStats));
+		meshLoadMs = 0.0f;
+		strncpy_s(importBenchmarkPath, getObjPath().c_str(), _TRUNCATE);
+		mazeRevision = -1;
+		maxFragmentation = 0.5f;
+		useInstancing = true;
+		num_instancedDraws = 0;
 
-		mDynamicCubeMapDSV = 0;
-		mDynamicCubeMapSRV = 0;
-		for(int i=0; i<6; i++)
-			mDynamicCubeMapRTV[i] = 0;
 		mStoneNormalTexSRV = 0;
 
 
@@ -168,31 +204,35 @@ public:
 			materials.push_back(mBoxMat);
 		}
 
+		// Mirror, reflects the dynamic cube map
+		if(true)
+		{
+			Material mMirrorMat;
+			mMirrorMat.Ambient  = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
+			mMirrorMat.Diffuse  = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
+			mMirrorMat.Specular = XMFLOAT4(0.8f, 0.8f, 0.8f, 96.0f);
+			mMirrorMat.Reflect  = XMFLOAT4(0.6f, 0.6f, 0.6f, 1.0f);
+			materials.push_back(mMirrorMat);
+		}
+
 		XMMATRIX grassTexScale = XMMatrixScaling(1.0f, 1.0f, 1.0f);
 		XMStoreFloat4x4(&mGrassTexTransform, grassTexScale);
 
 		mSceneBounds.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
 		mSceneBounds.Radius = 100.0f;
 
+		arena.init(dxDevice, arenaVertices, arenaIndices);
 		buildGeometry();
 		buildScreenQuadGeometry();
+		instanceRing.init(dxDevice, instanceRingSize);
 	};
 	~DXDrawManager()
 	{
 		ReleaseCOM(mGrassMapSRV);
 		ReleaseCOM(mWavesMapSRV);
 
-		ReleaseCOM(mShapesVB);
-		ReleaseCOM(mShapesIB);
 		ReleaseCOM(mScreenQuadVB);
 		ReleaseCOM(mScreenQuadIB);
-		ReleaseCOM(vbuff_mesh);
-		ReleaseCOM(ibuff_mesh);
-
-		ReleaseCOM(mDynamicCubeMapDSV);
-		ReleaseCOM(mDynamicCubeMapSRV);
-		for(int i = 0; i < 6; ++i)
-			ReleaseCOM(mDynamicCubeMapRTV[i]);
 
 		ReleaseCOM(mStoneNormalTexSRV);
 	};
@@ -214,56 +254,135 @@ public:
 
 		return n;
 	}
+	static void toVertices(const GeometryFactory::MeshData& mesh, vector<Vertex::posNormTexTan>& vertices)
+	{
+		vertices.resize(mesh.Vertices.size());
+		for(int i=0; i<(int)mesh.Vertices.size(); i++)
+		{
+			vertices[i].Pos    = mesh.Vertices[i].Position;
+			vertices[i].Normal = mesh.Vertices[i].Normal;
+			vertices[i].Tex	   = mesh.Vertices[i].TexC;
+			vertices[i].TangentU = mesh.Vertices[i].TangentU;
+			vertices[i].Handedness = mesh.Vertices[i].Handedness;
+		}
+	}
+	MeshHandle addMesh(const GeometryFactory::MeshData& mesh)
+	{
+		vector<Vertex::posNormTexTan> vertices;
+		toVertices(mesh, vertices);
+		return arena.add(renderDevice, vertices.empty() ? 0 : &vertices[0], vertices.size(), mesh.Indices.empty() ? 0 : &mesh.Indices[0], mesh.Indices.size());
+	}
+	MeshHandle importMesh(DrawMesh id, GeometryFactory::MeshData& mesh)
+	{
+		meshWelder.weld(mesh, weldStats[id]);
+		meshOptimizer.optimize(mesh, meshStats[id]);
+		return addMesh(mesh);
+	}
+	// Takes the mesh from its cache file if that was built from "stamp",
+	// otherwise "build" fills in the mesh, which is imported and cached.
+	// A stamp of 0 means the source is missing, so any cache file does.
+	template<typename Build>
+	MeshHandle loadMesh(DrawMesh id, const char* cachePath, UINT64 stamp, Build build)
+	{
+		Stopwatch watch;
+		if(!meshCache.open(cachePath, stamp))
+		{
+			GeometryFactory::MeshData mesh;
+			if(!build(mesh))
+				return importMesh(id, mesh);
+			meshWelder.weld(mesh, weldStats[id]);
+			meshOptimizer.optimize(mesh, meshStats[id]);
+			meshCache.build(mesh, stamp);
+			if(stamp != 0)
+				meshCache.save(cachePath);
+		}
+		MeshHandle handle = meshCache.addTo(&arena, renderDevice);
+		meshCache.close();
+		meshLoadMs += watch.elapsedMs();
+		return handle;
+	}
 	void buildMeshGeometry()
 	{
-		GeometryFactory geoGen;
-
 		//
 		// Create mesh from OBJ-format
 		//
 
-		GeometryFactory::MeshData mesh_obj;
-		geoGen.readObjFile(&mesh_obj);
-
-		vector<Vertex::posNormTexTan> vertices(mesh_obj.Vertices.size());
-		for(int i=0; i<(int)mesh_obj.Vertices.size(); i++)
+		std::string path = getObjPath();
+		if(path.empty())
 		{
-			vertices[i].Pos    = mesh_obj.Vertices[i].Position;
-			vertices[i].Normal = mesh_obj.Vertices[i].Normal;
-			vertices[i].Tex	   = mesh_obj.Vertices[i].TexC;
-			vertices[i].TangentU = mesh_obj.Vertices[i].TangentU;
+			std::string message = std::string("Couldn't read a mesh from ") + getMeshFileName();
+			MessageBoxA(0, message.c_str(), 0, 0);
+			GeometryFactory::MeshData none;
+			meshes[::mesh_obj] = importMesh(::mesh_obj, none);
+			return;
 		}
-
-		std::vector<UINT> indices(mesh_obj.Indices.size());
-		for(int i=0; i<(int)mesh_obj.Indices.size(); i++)
+		std::string cachePath = "Cache/" + path.substr(path.find_last_of("/\\")+1) + ".mesh";
+		meshes[::mesh_obj] = loadMesh(::mesh_obj, cachePath.c_str(), MeshCache::fileStamp(path.c_str()), [&](GeometryFactory::MeshData& mesh) -> bool
 		{
-			indices[i] = mesh_obj.Indices[i];
+			if(objImporter.load(path.c_str(), mesh))
+				return true;
+			std::string message = "Couldn't load '" + path + "', named in " + getMeshFileName();
+			MessageBoxA(0, message.c_str(), 0, 0);
+			return false;
+		});
+	}
+	// Names the OBJ drawn as mesh_obj on its first line, so the mesh can
+	// be changed without building again
+	static const char* getMeshFileName()
+	{
+		return "mesh.txt";
+	}
+	static std::string getObjPath()
+	{
+		std::string line;
+		std::ifstream f(getMeshFileName());
+		if(f.is_open())
+			std::getline(f, line);
+		size_t end = line.find_last_not_of(" \t\r");
+		return end == std::string::npos ? std::string() : line.substr(0, end+1);
+	}
+	// Times parsing of the benchmark OBJ, serial against parallel, whether
+	// or not the mesh came from the cache
+	void runImportBenchmark()
+	{
+		if(!objImporter.runBenchmark(importBenchmarkPath))
+		{
+			std::string message = std::string("Couldn't open '") + importBenchmarkPath + "'";
+			MessageBoxA(0, message.c_str(), 0, 0);
 		}
-		num_index_mesh = indices.size();
-
-		//
-		// Create buffers
-		//
-
-		D3D11_BUFFER_DESC desc_buff;
-		desc_buff.Usage = D3D11_USAGE_IMMUTABLE;
-		desc_buff.ByteWidth = sizeof(Vertex::posNormTexTan)*vertices.size();
-		desc_buff.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		desc_buff.CPUAccessFlags = 0;
-		desc_buff.MiscFlags = 0;
-		D3D11_SUBRESOURCE_DATA vinitData;
-		vinitData.pSysMem = &vertices[0];
-		HR(dxDevice->CreateBuffer(&desc_buff, &vinitData, &vbuff_mesh));
+	}
+	MeshArena* getMeshArena()
+	{
+		return &arena;
+	}
+	// Walls of the baked maze as rectangles of tiles
+	const std::vector<MazeMeshBaker::TileRect>& getMazeRects() const
+	{
+		return mazeBaker.getWallRects();
+	};
 
-		D3D11_BUFFER_DESC ibd;
-		ibd.Usage = D3D11_USAGE_IMMUTABLE;
-		ibd.ByteWidth = sizeof(UINT) * indices.size();
-		ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		ibd.CPUAccessFlags = 0;
-		ibd.MiscFlags = 0;
-		D3D11_SUBRESOURCE_DATA iinitData;
-		iinitData.pSysMem = &indices[0];
-		HR(dxDevice->CreateBuffer(&ibd, &iinitData, &ibuff_mesh));
+	void updateMazeGeometry(Maze* maze)
+	{
+		// Only bake when tiles have changed
+		if(maze->getRevision() == mazeRevision)
+			return;
+		mazeRevision = maze->getRevision();
+
+		arena.remove(meshes[mesh_maze]);
+		meshes[mesh_maze] = -1;
+
+		GeometryFactory::MeshData mesh_maze;
+		mazeBaker.bake(maze, mesh_maze);
+		if(mesh_maze.Indices.empty())
+			return;
+
+		// Like every other mesh, shares corners and gets tangents from its uvs
+		meshWelder.weld(mesh_maze, weldStats[::mesh_maze]);
+		meshes[::mesh_maze] = addMesh(mesh_maze);
+
+		// Walls come and go with every bake, compact before holes pile up
+		if(arena.fragmentation > maxFragmentation)
+			arena.defragment(renderDevice);
 	}
 	void buildGeometry()
 	{
@@ -278,93 +397,41 @@ public:
 		HR(D3DX11CreateShaderResourceViewFromFile(dxDevice, 
 			L"Textures/stones_nmap.dds", 0, 0, &mStoneNormalTexSRV, 0 ));
 
-		GeometryFactory::MeshData box;
-		GeometryFactory::MeshData grid;
-		GeometryFactory::MeshData sphere;
+		//
+		// Shapes are cached by their parameters, the hills are part of
+		// the code so changing them needs a new MeshCache::version
+		//
 
 		GeometryFactory geoGen;
 
-		geoGen.CreateBox(1.0f, 1.0f, 1.0f, box);
-		geoGen.CreateSphere(0.5f, 20, 20, sphere);
-		geoGen.CreateGrid(160.0f, 160.0f, 50, 50, grid);
-
-		vertexOffsets.push_back(0);
-		vertexOffsets.push_back(box.Vertices.size());
-		vertexOffsets.push_back(vertexOffsets[1]+grid.Vertices.size());
-
-		indexCounts.push_back(box.Indices.size());
-		indexCounts.push_back(grid.Indices.size());
-		indexCounts.push_back(sphere.Indices.size());
-
-		indexOffsets.push_back(0);
-		indexOffsets.push_back(indexCounts[0]);
-		indexOffsets.push_back(indexOffsets[1] + indexOffsets[1]);
-
-		UINT totalVertexCount = 
-			box.Vertices.size() + 
-			grid.Vertices.size() + 
-			sphere.Vertices.size();
-
-		UINT totalIndexCount = 0;
-		for each(int i in indexCounts)
-			totalIndexCount += i;
-
-		std::vector<Vertex::posNormTexTan> vertices(totalVertexCount);
-		UINT k = 0;
-		for(size_t i=0; i<box.Vertices.size(); i++, k++)
+		float boxSize[] = {1.0f, 1.0f, 1.0f};
+		meshes[mesh_box] = loadMesh(mesh_box, "Cache/box.mesh", MeshCache::hashStamp(boxSize, sizeof(boxSize)), [&](GeometryFactory::MeshData& box) -> bool
 		{
-			vertices[k].Pos    = box.Vertices[i].Position;
-			vertices[k].Normal = box.Vertices[i].Normal;
-			vertices[k].Tex = box.Vertices[i].TexC;
-			vertices[k].TangentU = box.Vertices[i].TangentU;
-		}
+			geoGen.CreateBox(boxSize[0], boxSize[1], boxSize[2], box);
+			return true;
+		});
 
-		for(size_t i=0; i<grid.Vertices.size(); i++, k++)
+		float sphereSize[] = {0.5f, 20.0f, 20.0f};
+		meshes[mesh_sphere] = loadMesh(mesh_sphere, "Cache/sphere.mesh", MeshCache::hashStamp(sphereSize, sizeof(sphereSize)), [&](GeometryFactory::MeshData& sphere) -> bool
 		{
-			XMFLOAT3 p = grid.Vertices[i].Position;
-			p.y = getHillHeight(p.x, p.z);
-			vertices[k].Pos    = p;
-			vertices[k].Normal = getHillNormal(p.x, p.z);
-			vertices[k].Tex = grid.Vertices[i].TexC;
-			vertices[k].TangentU = grid.Vertices[i].TangentU;
-		}
+			geoGen.CreateSphere(sphereSize[0], (UINT)sphereSize[1], (UINT)sphereSize[2], sphere);
+			return true;
+		});
 
-		for(size_t i=0; i<sphere.Vertices.size(); i++, k++)
+		float gridSize[] = {160.0f, 160.0f, 50.0f, 50.0f};
+		meshes[mesh_grid] = loadMesh(mesh_grid, "Cache/grid.mesh", MeshCache::hashStamp(gridSize, sizeof(gridSize)), [&](GeometryFactory::MeshData& grid) -> bool
 		{
-			vertices[k].Pos    = sphere.Vertices[i].Position;
-			vertices[k].Normal = sphere.Vertices[i].Normal;
-			vertices[k].Tex = sphere.Vertices[i].TexC;
-			vertices[k].TangentU = sphere.Vertices[i].TangentU;
-		}
-
-		D3D11_BUFFER_DESC vbd;
-		vbd.Usage = D3D11_USAGE_IMMUTABLE;
-		vbd.ByteWidth = sizeof(Vertex::posNormTexTan) * totalVertexCount;
-		vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		vbd.CPUAccessFlags = 0;
-		vbd.MiscFlags = 0;
-		D3D11_SUBRESOURCE_DATA vinitData;
-		vinitData.pSysMem = &vertices[0];
-		HR(dxDevice->CreateBuffer(&vbd, &vinitData, &mShapesVB));
-
-		//
-		// Pack all indices into one index buffer
-		//
-
-		std::vector<UINT> indices;
-		indices.insert(indices.end(), box.Indices.begin(), box.Indices.end());
-		indices.insert(indices.end(), grid.Indices.begin(), grid.Indices.end());
-		indices.insert(indices.end(), sphere.Indices.begin(), sphere.Indices.end());
-
-		D3D11_BUFFER_DESC ibd;
-		ibd.Usage = D3D11_USAGE_IMMUTABLE;
-		ibd.ByteWidth = sizeof(UINT) * totalIndexCount;
-		ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		ibd.CPUAccessFlags = 0;
-		ibd.MiscFlags = 0;
-		D3D11_SUBRESOURCE_DATA iinitData;
-		iinitData.pSysMem = &indices[0];
-		HR(dxDevice->CreateBuffer(&ibd, &iinitData, &mShapesIB));
+			geoGen.CreateGrid(gridSize[0], gridSize[1], (UINT)gridSize[2], (UINT)gridSize[3], grid);
+
+			// Hills go in before the tangents are built
+			for(int i=0; i<(int)grid.Vertices.size(); i++)
+			{
+				XMFLOAT3& p = grid.Vertices[i].Position;
+				p.y = getHillHeight(p.x, p.z);
+				grid.Vertices[i].Normal = getHillNormal(p.x, p.z);
+			}
+			return true;
+		});
 	};
 	void buildScreenQuadGeometry()
 	{
@@ -411,6 +478,16 @@ public:
 		iinitData.pSysMem = &quad.Indices[0];
 		HR(dxDevice->CreateBuffer(&ibd, &iinitData, &mScreenQuadIB));
 	}
+	// Light casting the shadow and the sphere its casters are kept in
+	const DirectionalLight& getDirLight() const
+	{
+		return mDirLight;
+	}
+	const BoundingSphere& getSceneBounds() const
+	{
+		return mSceneBounds;
+	}
+
 	void buildShadowTransform()
 	{
 		// Only the first "main" light casts a shadow.
@@ -456,31 +533,29 @@ public:
 		fx->SetSpotLights(&mSpotLight);
 		fx->SetNormalMap(mStoneNormalTexSRV);
 
-		UINT stride = sizeof(Vertex::posNormTexTan);
-		UINT offset = 0;
-		
 		// Set input layout, topology, context
-		dxDeviceContext->IASetInputLayout(shaderManager->layout_posNormTexTan);
-		dxDeviceContext->IASetVertexBuffers(0, 1, &mShapesVB, &stride, &offset);
-		dxDeviceContext->IASetIndexBuffer(mShapesIB, DXGI_FORMAT_R32_UINT, 0);
+		renderDevice->setInputLayout(shaderManager->layout_packed);
+		arena.bind(renderDevice);
 	}
 	void prepareFrame_shadowMap()
 	{
 		// Set input layout, topology, context
-		dxDeviceContext->IASetInputLayout(shaderManager->layout_posNormTex);
-		dxDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
+		renderDevice->setInputLayout(shaderManager->layout_packed);
+		renderDevice->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
+		arena.bind(renderDevice);
+	}
 
-		UINT stride = sizeof(Vertex::posNormTexTan);
-		UINT offset = 0;
-		dxDeviceContext->IASetVertexBuffers(0, 1, &mShapesVB, &stride, &offset);
-		dxDeviceContext->IASetIndexBuffer(mShapesIB, DXGI_FORMAT_R32_UINT, 0);
+	// Index buffer and position bounds of "mesh" for the draws that follow
+	template<typename FX>
+	void setMesh(FX* fx, MeshHandle mesh)
+	{
+		const MeshRange& range = arena.getRange(mesh);
+		fx->SetPosBounds(range.posScale, range.posOffset);
+		arena.bindIndices(renderDevice, mesh);
 	}
+
 	void drawMesh_shadowMap(int id_material,  CXMMATRIX viewProj, UINT passNr)
 	{
-		UINT stride = sizeof(Vertex::posNormTexTan);
-		UINT offset = 0;
-		dxDeviceContext->IASetVertexBuffers(0, 1, &vbuff_mesh, &stride, &offset);
-
 		XMMATRIX world = XMMatrixTranslation(0.0f, 30.0f, 0.0f);
 		XMMATRIX worldViewProj = world*viewProj;
 
@@ -490,10 +565,11 @@ public:
 		fx->SetWorldViewProj(worldViewProj);
 		fx->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
 		fx->SetDiffuseMap(mWavesMapSRV);
+		setMesh(fx, meshes[mesh_obj]);
 
-		dxDeviceContext->RSSetState(shaderManager->states.NoCullRS);
-		fx->TessBuildShadowMapTech->GetPassByIndex(passNr)->Apply(0, dxDeviceContext);
-		dxDeviceContext->Draw(num_index_mesh, 0);
+		renderDevice->setRasterizerState(shaderManager->states.NoCullRS);
+		renderDevice->applyPass(fx->TessBuildShadowMapTech->GetPassByIndex(passNr));
+		arena.drawIndexed(renderDevice, meshes[mesh_obj]);
 	}
 	void drawObject_shadowMap(int id_object, int id_material, CXMMATRIX world, CXMMATRIX viewProj, UINT passNr)
 	{
@@ -506,10 +582,51 @@ public:
 		fx->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
 		fx->SetDiffuseMap(mWavesMapSRV);
 		fx->SetNormalMap(mStoneNormalTexSRV);
+		setMesh(fx, meshes[id_object]);
+
+		renderDevice->setRasterizerState(shaderManager->states.NoCullRS);
+		renderDevice->applyPass(fx->TessBuildShadowMapTech->GetPassByIndex(passNr));
+		arena.drawIndexed(renderDevice, meshes[id_object]);
+	}
+	void drawMaze_shadowMap(CXMMATRIX world, CXMMATRIX viewProj, UINT passNr)
+	{
+		if(!arena.isValid(meshes[mesh_maze]))
+			return;
+
+		XMMATRIX worldViewProj = world*viewProj;
+
+		FXBuildShadowMap* fx = shaderManager->effects.fx_buildShadowMap;
+		fx->SetWorld(world);
+		fx->SetWorldInvTranspose(Util::InverseTranspose(world));
+		fx->SetWorldViewProj(worldViewProj);
+		fx->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
+		fx->SetDiffuseMap(mWavesMapSRV);
+		fx->SetNormalMap(mStoneNormalTexSRV);
+		setMesh(fx, meshes[mesh_maze]);
 
-		dxDeviceContext->RSSetState(shaderManager->states.NoCullRS);
-		fx->TessBuildShadowMapTech->GetPassByIndex(passNr)->Apply(0, dxDeviceContext);
-		dxDeviceContext->DrawIndexed(indexCounts[id_object], indexOffsets[id_object], vertexOffsets[id_object]);
+		renderDevice->setRasterizerState(shaderManager->states.NoCullRS);
+		renderDevice->applyPass(fx->TessBuildShadowMapTech->GetPassByIndex(passNr));
+		arena.drawIndexed(renderDevice, meshes[mesh_maze]);
+	}
+	void drawMaze(int id_material, CXMMATRIX world, CXMMATRIX viewProj, UINT passNr)
+	{
+		if(!arena.isValid(meshes[mesh_maze]))
+			return;
+
+		XMMATRIX worldViewProj = world*viewProj;
+
+		fx->SetWorld(world);
+		fx->SetViewProj(viewProj);
+		fx->SetWorldViewProj(worldViewProj);
+		fx->SetShadowTransform(XMLoadFloat4x4(&mShadowTransform));
+		fx->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
+		fx->SetMaterial(materials[id_material]);
+		fx->SetDiffuseMap(mWavesMapSRV);
+		fx->SetUseNormalMap(true);
+		setMesh(fx, meshes[mesh_maze]);
+
+		renderDevice->applyPass(fx->tech_tess->GetPassByIndex(passNr));
+		arena.drawIndexed(renderDevice, meshes[mesh_maze]);
 	}
 	void drawObject(int id_object, int id_material, CXMMATRIX world, CXMMATRIX viewProj, UINT passNr)
 	{
@@ -523,18 +640,14 @@ public:
 		fx->SetMaterial(materials[id_material]);
 		fx->SetDiffuseMap(mWavesMapSRV);
 		fx->SetUseNormalMap(true);
+		setMesh(fx, meshes[id_object]);
 		
-		
-		fx->tech_tess->GetPassByIndex(passNr)->Apply(0, dxDeviceContext);
-		dxDeviceContext->DrawIndexed(indexCounts[id_object], indexOffsets[id_object], vertexOffsets[id_object]);
+		renderDevice->applyPass(fx->tech_tess->GetPassByIndex(passNr));
+		arena.drawIndexed(renderDevice, meshes[id_object]);
 	}
 	void drawMesh(int id_material, CXMMATRIX viewProj, UINT passNr)
 	{
-		UINT stride = sizeof(Vertex::posNormTexTan);
-		UINT offset = 0;
-		dxDeviceContext->IASetInputLayout(shaderManager->layout_posNormTexTan);
-		dxDeviceContext->IASetVertexBuffers(0, 1, &vbuff_mesh, &stride, &offset);
-		dxDeviceContext->IASetIndexBuffer(mShapesIB, DXGI_FORMAT_R32_UINT, 0);
+		renderDevice->setInputLayout(shaderManager->layout_packed);
 
 		XMMATRIX world = XMMatrixTranslation(0.0f, 30.0f, 0.0f);
 		XMMATRIX worldViewProj = world*viewProj;
@@ -547,17 +660,17 @@ public:
 		fx->SetMaterial(materials[id_material]);
 		fx->SetDiffuseMap(mWavesMapSRV);
 		fx->SetUseNormalMap(useNormalMap);
+		setMesh(fx, meshes[mesh_obj]);
 
-		fx->tech_tess->GetPassByIndex(passNr)->Apply(0, dxDeviceContext);
-		dxDeviceContext->Draw(num_index_mesh, 0);
+		renderDevice->applyPass(fx->tech_tess->GetPassByIndex(passNr));
+		arena.drawIndexed(renderDevice, meshes[mesh_obj]);
 	}
 	void prepareFrameInstanced(UINT* stride, ID3D11Buffer* instancedBuffer)
 	{
-		ID3D11Buffer* vbs[2] = {mShapesVB, instancedBuffer};
+		ID3D11Buffer* vbs[2] = {arena.getVertexBuffer(), instancedBuffer};
 		UINT offset[2] = {0,0};
 
-		dxDeviceContext->IASetVertexBuffers(0, 2, vbs, stride, offset);
-		dxDeviceContext->IASetIndexBuffer(mShapesIB, DXGI_FORMAT_R32_UINT, 0);
+		renderDevice->setVertexBuffers(0, 2, vbs, stride, offset);
 	}
 
 	void drawObjectInstanced(int id_object, int id_material, int num_instances, CXMMATRIX viewProj, UINT passNr)
@@ -567,17 +680,230 @@ public:
 		fx->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
 		fx->SetMaterial(materials[id_material]);
 		fx->SetDiffuseMap(mWavesMapSRV);
+		setMesh(fx, meshes[id_object]);
 
-		fx->tech_tess_inst->GetPassByIndex(passNr)->Apply(0, dxDeviceContext);
+		renderDevice->applyPass(fx->tech_tess_inst->GetPassByIndex(passNr));
 
-		dxDeviceContext->DrawIndexedInstanced(
-			indexCounts[id_object],
-			num_instances,
-			indexOffsets[id_object], 
-			vertexOffsets[id_object],
-			0);
+		arena.drawIndexedInstanced(renderDevice, meshes[id_object], num_instances, 0);
 	}
 
+	//
+	// Sorted submission
+	//
+
+	template<typename FX>
+	static void setTessSettings(FX* fx, const TessSettings& tess)
+	{
+		fx->SetHeightScale(tess.heightScale);
+		fx->SetMaxTessDistance(tess.maxTessDistance);
+		fx->SetMinTessDistance(tess.minTessDistance);
+		fx->SetMinTessFactor(tess.minTessFactor);
+		fx->SetMaxTessFactor(tess.maxTessFactor);
+	}
+	ID3DX11EffectTechnique* getTechnique(int technique, bool instanced)
+	{
+		if(technique == technique_shadow)
+		{
+			FXBuildShadowMap* fx_shadow = shaderManager->effects.fx_buildShadowMap;
+			return instanced ? fx_shadow->InstTessBuildShadowMapTech : fx_shadow->TessBuildShadowMapTech;
+		}
+		if(instanced || technique == technique_tessInstanced)
+			return shaderManager->effects.fx_standard->tech_tess_inst;
+		return shaderManager->effects.fx_standard->tech_tess;
+	}
+
+	// Every mesh shares the arena buffers, so any of them can be instanced
+	static bool isInstanceable(const DrawPacket& packet)
+	{
+		return packet.instanceBuffer == 0;
+	}
+	static bool isSameState(const DrawPacket& a, const DrawPacket& b)
+	{
+		return a.technique == b.technique && a.pass == b.pass && a.material == b.material &&
+			a.mesh == b.mesh && a.tess == b.tess && a.rasterizerState == b.rasterizerState;
+	}
+
+	// Binds the arena for "mesh" and "instanceBuffer" unless "bound"
+	// (vertex, instance and index buffer) already holds them, only the
+	// instance buffer and the index width change between packets
+	void bindPacketBuffers(MeshHandle mesh, ID3D11Buffer* instanceBuffer, ID3D11Buffer* bound[3])
+	{
+		ID3D11Buffer* vb = arena.getVertexBuffer();
+		ID3D11Buffer* ib = arena.getIndexBuffer(mesh);
+
+		if(vb != bound[0] || instanceBuffer != bound[1])
+		{
+			ID3D11Buffer* vbs[2] = {vb, instanceBuffer};
+			UINT stride[2] = {sizeof(Vertex::packed), sizeof(Vertex::InstancedData)};
+			UINT offset[2] = {0, 0};
+			renderDevice->setVertexBuffers(0, instanceBuffer ? 2 : 1, vbs, stride, offset);
+			bound[0] = vb;
+			bound[1] = instanceBuffer;
+		}
+		if(ib != bound[2])
+		{
+			renderDevice->setIndexBuffer(ib, arena.getIndexFormat(mesh), 0);
+			bound[2] = ib;
+		}
+	}
+	void drawPacketGeometry(const DrawPacket& packet, int num_instances, UINT startInstance)
+	{
+		if(num_instances > 0)
+			arena.drawIndexedInstanced(renderDevice, meshes[packet.mesh], num_instances, startInstance);
+		else
+			arena.drawIndexed(renderDevice, meshes[packet.mesh]);
+	}
+
+	// Sorts and draws the packets of a pass. Variables shared by
+	// neighbouring packets are only set when they change, and runs of
+	// packets with equal state become one instanced draw from the ring.
+	void submitList(DrawList& list, CXMMATRIX viewProj, bool shadowPass)
+	{
+		list.sort();
+
+		// Same for every packet
+		FXBuildShadowMap* fx_shadow = shaderManager->effects.fx_buildShadowMap;
+		if(shadowPass)
+		{
+			fx_shadow->SetViewProj(viewProj);
+			fx_shadow->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
+			fx_shadow->SetDiffuseMap(mWavesMapSRV);
+			fx_shadow->SetNormalMap(mStoneNormalTexSRV);
+		}
+		else
+		{
+			fx->SetViewProj(viewProj);
+			fx->SetShadowTransform(XMLoadFloat4x4(&mShadowTransform));
+			fx->SetTexTransform(XMLoadFloat4x4(&mGrassTexTransform));
+			fx->SetDiffuseMap(mWavesMapSRV);
+		}
+		ID3D11InputLayout* layout_frame = shaderManager->layout_packed;
+
+		ID3D11InputLayout* boundLayout = 0;
+		ID3D11Buffer* bound[3] = {0, 0, 0};
+		const DrawPacket* last = 0;
+		for(int i=0; i<list.size(); )
+		{
+			const DrawPacket& packet = list.get(i);
+
+			// Run of packets sharing all state
+			int end = i+1;
+			if(useInstancing && isInstanceable(packet))
+			{
+				while(end<list.size() && end-i<instanceRing.getCapacity() && isSameState(packet, list.get(end)))
+					end++;
+				if(end-i < minInstances)
+					end = i+1;
+			}
+			int num_run = end-i;
+
+			if(!arena.isValid(meshes[packet.mesh]))
+			{
+				i = end;
+				continue;
+			}
+
+			ID3D11Buffer* instanceBuffer = packet.instanceBuffer;
+			int num_instances = packet.num_instances;
+			UINT startInstance = 0;
+			if(num_run > 1)
+			{
+				instanceWorlds.resize(num_run);
+				for(int k=0; k<num_run; k++)
+					instanceWorlds[k] = list.get(i+k).world;
+				startInstance = instanceRing.write(renderDevice, &instanceWorlds[0], num_run);
+				instanceBuffer = instanceRing.getBuffer();
+				num_instances = num_run;
+			}
+			bool instanced = instanceBuffer != 0;
+
+			ID3D11InputLayout* layout = instanced ? shaderManager->layout_inst_packed : layout_frame;
+			if(layout != boundLayout)
+			{
+				renderDevice->setInputLayout(layout);
+				boundLayout = layout;
+			}
+			bindPacketBuffers(meshes[packet.mesh], instanceBuffer, bound);
+
+			if(!last || packet.mesh != last->mesh)
+			{
+				const MeshRange& range = arena.getRange(meshes[packet.mesh]);
+				if(shadowPass)
+				{
+					fx_shadow->SetPosBounds(range.posScale, range.posOffset);
+				}
+				else
+				{
+					fx->SetPosBounds(range.posScale, range.posOffset);
+					fx->SetUseNormalMap(packet.mesh == mesh_obj ? useNormalMap : true);
+				}
+			}
+			if(!shadowPass && (!last || packet.material != last->material))
+				fx->SetMaterial(materials[packet.material]);
+			if(!last || packet.tess != last->tess)
+			{
+				if(shadowPass)
+					setTessSettings(fx_shadow, list.getTess(packet.tess));
+				else
+					setTessSettings(fx, list.getTess(packet.tess));
+			}
+			if(!last || packet.rasterizerState != last->rasterizerState)
+				renderDevice->setRasterizerState(packet.rasterizerState);
+
+			// Instances carry their own world matrix
+			if(!instanced)
+			{
+				XMMATRIX world = XMLoadFloat4x4(&packet.world);
+				if(shadowPass)
+				{
+					fx_shadow->SetWorld(world);
+					fx_shadow->SetWorldInvTranspose(Util::InverseTranspose(world));
+					fx_shadow->SetWorldViewProj(world*viewProj);
+				}
+				else
+				{
+					fx->SetWorld(world);
+					fx->SetWorldViewProj(world*viewProj);
+				}
+			}
+			else
+			{
+				num_instancedDraws++;
+			}
+
+			renderDevice->applyPass(getTechnique(packet.technique, instanced)->GetPassByIndex(packet.pass));
+			drawPacketGeometry(packet, instanced ? num_instances : 0, startInstance);
+			last = &packet;
+			i = end;
+		}
+
+		// Leave layout as prepareFrame set it, the arena is still bound
+		// and every draw after this binds the index buffer of its mesh
+		if(boundLayout && boundLayout != layout_frame)
+			renderDevice->setInputLayout(layout_frame);
+	}
+	void submit(DrawList& list, CXMMATRIX viewProj)
+	{
+		submitList(list, viewProj, false);
+	}
+	void submit_shadowMap(DrawList& list, CXMMATRIX viewProj)
+	{
+		submitList(list, viewProj, true);
+	}
+
+	// Resets per frame statistics
+	void beginFrame()
+	{
+		instanceRing.resetStats();
+		num_instancedDraws = 0;
+	}
+
+	// Device the draw calls go to, swapped when recording a frame
+	void setRenderDevice(RenderDevice* renderDevice)
+	{
+		this->renderDevice = renderDevice;
+	};
+
 	void buildMenu(TwBar* menu)
 	{
 		// Lights
@@ -605,6 +931,75 @@ public:
 		TwDefine("Settings/Lights opened=false");
 
 		TwAddVarRW(menu, "Use normal mapp", TW_TYPE_BOOLCPP, &useNormalMap, "group=Render");
+
+		// Baked maze
+		TwAddVarRO(menu, "Maze walls", TW_TYPE_INT32, &mazeBaker.num_walls, "group='Maze mesh'");
+		TwAddVarRO(menu, "Maze culled faces", TW_TYPE_INT32, &mazeBaker.num_culledFaces, "group='Maze mesh'");
+		TwAddVarRO(menu, "Maze quads", TW_TYPE_INT32, &mazeBaker.num_quads, "group='Maze mesh'");
+		TwAddVarRO(menu, "Maze triangles", TW_TYPE_INT32, &mazeBaker.num_triangles, "group='Maze mesh'");
+		TwAddVarRO(menu, "Maze bake (ms)", TW_TYPE_FLOAT, &mazeBaker.bakeMs, "group='Maze mesh'");
+		TwAddVarRO(menu, "Maze welded vertices", TW_TYPE_INT32, &weldStats[mesh_maze].num_welded, "group='Maze mesh'");
+		TwAddVarRO(menu, "Maze weld (ms)", TW_TYPE_FLOAT, &weldStats[mesh_maze].weldMs, "group='Maze mesh'");
+		TwDefine("Settings/'Maze mesh' group=Render opened=false");
+
+		arena.buildMenu(menu);
+		TwAddVarRW(menu, "Arena max fragmentation", TW_TYPE_FLOAT, &maxFragmentation, "group='Mesh arena' min=0 max=1 step=0.05");
+
+		// Parse and merge times of the OBJ file
+		TwAddVarRO(menu, "OBJ file (MB)", TW_TYPE_FLOAT, &objImporter.fileMB, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ chunks", TW_TYPE_INT32, &objImporter.num_chunks, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ positions", TW_TYPE_INT32, &objImporter.num_positions, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ triangles", TW_TYPE_INT32, &objImporter.num_triangles, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ polygons", TW_TYPE_INT32, &objImporter.num_polygons, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ invalid faces", TW_TYPE_INT32, &objImporter.num_invalidFaces, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ vertices", TW_TYPE_INT32, &objImporter.num_vertices, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ parse (ms)", TW_TYPE_FLOAT, &objImporter.parseMs, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ parse (MB/s)", TW_TYPE_FLOAT, &objImporter.parseMBps, "group='OBJ import'");
+		TwAddVarRO(menu, "OBJ merge (ms)", TW_TYPE_FLOAT, &objImporter.mergeMs, "group='OBJ import'");
+		TwAddVarRW(menu, "Benchmark OBJ", TW_TYPE_CSSTRING(sizeof(importBenchmarkPath)), importBenchmarkPath, "group='OBJ import' help='OBJ parsed by the import benchmark, bypasses the mesh cache'");
+		TwAddVarRO(menu, "Benchmark file (MB)", TW_TYPE_FLOAT, &objImporter.benchmark.fileMB, "group='OBJ import'");
+		TwAddVarRO(menu, "Benchmark chunks", TW_TYPE_INT32, &objImporter.benchmark.num_chunks, "group='OBJ import'");
+		TwAddVarRO(menu, "Serial parse (ms)", TW_TYPE_FLOAT, &objImporter.benchmark.serialMs, "group='OBJ import'");
+		TwAddVarRO(menu, "Serial parse (MB/s)", TW_TYPE_FLOAT, &objImporter.benchmark.serialMBps, "group='OBJ import'");
+		TwAddVarRO(menu, "Parallel parse (ms)", TW_TYPE_FLOAT, &objImporter.benchmark.parallelMs, "group='OBJ import'");
+		TwAddVarRO(menu, "Parallel parse (MB/s)", TW_TYPE_FLOAT, &objImporter.benchmark.parallelMBps, "group='OBJ import'");
+		TwAddVarRO(menu, "Parallel speedup", TW_TYPE_FLOAT, &objImporter.benchmark.speedup, "group='OBJ import' precision=2");
+		TwDefine("Settings/'OBJ import' group=Render opened=false");
+
+		// Vertex cache and overdraw order at import
+		TwAddVarRO(menu, "Optimized box", TW_TYPE_CSSTRING(sizeof(meshStats[mesh_box].text)), meshStats[mesh_box].text, "group='Mesh optimizer' label='Box'");
+		TwAddVarRO(menu, "Optimized sphere", TW_TYPE_CSSTRING(sizeof(meshStats[mesh_sphere].text)), meshStats[mesh_sphere].text, "group='Mesh optimizer' label='Sphere'");
+		TwAddVarRO(menu, "Optimized grid", TW_TYPE_CSSTRING(sizeof(meshStats[mesh_grid].text)), meshStats[mesh_grid].text, "group='Mesh optimizer' label='Grid'");
+		TwAddVarRO(menu, "Optimized OBJ", TW_TYPE_CSSTRING(sizeof(meshStats[mesh_obj].text)), meshStats[mesh_obj].text, "group='Mesh optimizer' label='OBJ'");
+		TwAddVarRO(menu, "OBJ welded vertices", TW_TYPE_INT32, &weldStats[mesh_obj].num_welded, "group='Mesh optimizer'");
+		TwAddVarRO(menu, "OBJ mirrored vertices", TW_TYPE_INT32, &weldStats[mesh_obj].num_mirrored, "group='Mesh optimizer'");
+		TwAddVarRO(menu, "OBJ weld (ms)", TW_TYPE_FLOAT, &weldStats[mesh_obj].weldMs, "group='Mesh optimizer'");
+		TwAddVarRO(menu, "OBJ tangents (ms)", TW_TYPE_FLOAT, &weldStats[mesh_obj].tangentMs, "group='Mesh optimizer'");
+		TwAddVarRO(menu, "OBJ clusters", TW_TYPE_INT32, &meshStats[mesh_obj].num_clusters, "group='Mesh optimizer'");
+		TwAddVarRO(menu, "OBJ optimize (ms)", TW_TYPE_FLOAT, &meshStats[mesh_obj].optimizeMs, "group='Mesh optimizer'");
+		TwDefine("Settings/'Mesh optimizer' group=Render opened=false");
+
+		TwAddVarRO(menu, "Cache hits", TW_TYPE_INT32, &meshCache.num_hits, "group='Mesh cache'");
+		TwAddVarRO(menu, "Cache builds", TW_TYPE_INT32, &meshCache.num_builds, "group='Mesh cache'");
+		TwAddVarRO(menu, "Cache written (bytes)", TW_TYPE_INT32, &meshCache.num_savedBytes, "group='Mesh cache'");
+		TwAddVarRO(menu, "Mesh load (ms)", TW_TYPE_FLOAT, &meshLoadMs, "group='Mesh cache'");
+		TwDefine("Settings/'Mesh cache' group=Render opened=false");
+
+		// Sorted submission, state changes in submission and sorted order
+		TwAddVarRO(menu, "Main packets", TW_TYPE_INT32, &drawList.num_packets, "group='Draw list'");
+		TwAddVarRO(menu, "Main changes unsorted", TW_TYPE_INT32, &drawList.num_stateChanges_unsorted, "group='Draw list'");
+		TwAddVarRO(menu, "Main changes sorted", TW_TYPE_INT32, &drawList.num_stateChanges, "group='Draw list'");
+		TwAddVarRO(menu, "Main sort (ms)", TW_TYPE_FLOAT, &drawList.sortMs, "group='Draw list'");
+		TwAddVarRO(menu, "Shadow packets", TW_TYPE_INT32, &drawList_shadowMap.num_packets, "group='Draw list'");
+		TwAddVarRO(menu, "Shadow changes unsorted", TW_TYPE_INT32, &drawList_shadowMap.num_stateChanges_unsorted, "group='Draw list'");
+		TwAddVarRO(menu, "Shadow changes sorted", TW_TYPE_INT32, &drawList_shadowMap.num_stateChanges, "group='Draw list'");
+		TwAddVarRO(menu, "Shadow sort (ms)", TW_TYPE_FLOAT, &drawList_shadowMap.sortMs, "group='Draw list'");
+		TwAddVarRW(menu, "Instance runs", TW_TYPE_BOOLCPP, &useInstancing, "group='Draw list'");
+		TwAddVarRO(menu, "Instanced draws", TW_TYPE_INT32, &num_instancedDraws, "group='Draw list'");
+		TwAddVarRO(menu, "Instances written", TW_TYPE_INT32, &instanceRing.num_instances, "group='Draw list'");
+		TwAddVarRO(menu, "Instance maps", TW_TYPE_INT32, &instanceRing.num_writes, "group='Draw list'");
+		TwAddVarRO(menu, "Instance discards", TW_TYPE_INT32, &instanceRing.num_discards, "group='Draw list'");
+		TwDefine("Settings/'Draw list' group=Render opened=false");
 	};
 };
 
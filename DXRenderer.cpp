@@ -8,11 +8,27 @@ DXRenderer::DXRenderer()
 	dxDevice = 0;
 	dxDeviceContext = 0,
 	dxSwapChain = 0;
+	renderDevice = 0;
+	d3dRenderDevice = 0;
+	recordingDevice = new RecordingRenderDevice();
+	memset(&recordBenchmark, 0, sizeof(recordBenchmark));
+	memset(&cullBenchmark, 0, sizeof(cullBenchmark));
 	tex_depthStencil = 0;
 	view_renderTarget = 0;
 	view_depthStencil = 0;
 	mSmap = 0;
-	instancedBuffer = 0;
+	mStaticSmap = 0;
+	mDynamicCube = 0;
+	useDynamicCube = true;
+	useShadowCache = true;
+	invalidateStaticShadows();
+	num_staticShadowDraws = 0;
+	num_shadowCastersCulled = 0;
+	pelletInstanceBuffer = 0;
+	num_pelletInstances = 0;
+	cacheEffectWrites = true;
+	num_effectWrites = 0;
+	num_effectSkippedWrites = 0;
 
 	// DX settings
 	msaa_quality = 0;
@@ -25,6 +41,15 @@ DXRenderer::DXRenderer()
 	drawPlane   = false;
 	drawSky   = true;
 	drawMesh   = false;
+	drawBakedMaze = true;
+	useDrawList = true;
+	useFrustumCulling = true;
+	useOcclusionCulling = true;
+	occluderRevision = -1;
+	memset(&occluderWorld, 0, sizeof(occluderWorld));
+	usePVS = true;
+	num_pvsVisible = 0;
+	num_pvsSkipped = 0;
 
 	tess_heightScale = 10.7f;
 	tess_maxTessDistance = 5.0f;
@@ -44,12 +69,16 @@ DXRenderer::~DXRenderer()
 		dxDeviceContext->ClearState();
 	ReleaseCOM(dxDeviceContext);
 	ReleaseCOM(dxDevice);
-	ReleaseCOM(instancedBuffer);
+	SafeDelete(d3dRenderDevice);
+	SafeDelete(recordingDevice);
+	ReleaseCOM(pelletInstanceBuffer);
 
 	// Delete managers
 	delete drawManager;
 	delete mSky;
 	SafeDelete(mSmap);
+	SafeDelete(mStaticSmap);
+	SafeDelete(mDynamicCube);
 	shaderManager->~ShaderManager();
 
 	// Terminate tweakbar
@@ -63,9 +92,11 @@ void DXRenderer::init(HWND winId)
 	initDX();
 	shaderManager = ShaderManager::getInstance();
 	shaderManager->init(dxDevice);
-	drawManager = new DXDrawManager(dxDevice, dxDeviceContext);
-	mSky = new Sky(dxDevice, L"Textures/Skyboxes/plain.dds", 5000.0f);
-	mSmap = new ShadowMap(dxDevice, SMapSize, SMapSize);
+	drawManager = new DXDrawManager(dxDevice, renderDevice);
+	mSky = new Sky(dxDevice, drawManager->getMeshArena(), renderDevice, L"Textures/Skyboxes/plain.dds", 5000.0f);
+	vertexFetchBenchmark.init(dxDevice);
+	updateShadowMaps();
+	mDynamicCube = new DynamicCubeMap(dxDevice, CubeMapSize);
 
 	Terrain::InitInfo info;
 	info.path_heightMap = L"Textures/Terrain/_terrain.raw";
@@ -93,7 +124,7 @@ void DXRenderer::init(HWND winId)
 
 	// Init game
 	initGameEntities();
-	initInstanceBuffer();
+	initPelletInstanceBuffer();
 	buildMenu();
 }
 
@@ -103,6 +134,48 @@ void TW_CALL tw_recompileShaders(void *clientData)
 	in->recompileShaders();                            
 }
 
+void TW_CALL tw_recordFrames(void *clientData)
+{ 
+	DXRenderer *in = static_cast<DXRenderer *>(clientData); // scene pointer is stored in clientData
+	in->recordFrames();
+}
+
+void TW_CALL tw_beginStatsCsv(void *clientData)
+{ 
+	DXRenderer *in = static_cast<DXRenderer *>(clientData); // scene pointer is stored in clientData
+	in->beginStatsCsv();
+}
+
+void TW_CALL tw_endStatsCsv(void *clientData)
+{ 
+	DXRenderer *in = static_cast<DXRenderer *>(clientData); // scene pointer is stored in clientData
+	in->endStatsCsv();
+}
+
+void TW_CALL tw_rebakePVS(void *clientData)
+{ 
+	DXRenderer *in = static_cast<DXRenderer *>(clientData); // scene pointer is stored in clientData
+	in->rebakePVS();
+}
+
+void TW_CALL tw_exportTrace(void *clientData)
+{ 
+	Profiler *in = static_cast<Profiler *>(clientData); // profiler pointer is stored in clientData
+	in->exportTrace("profile_trace.json");
+}
+
+void TW_CALL tw_runImportBenchmark(void *clientData)
+{ 
+	DXDrawManager *in = static_cast<DXDrawManager *>(clientData); // draw manager pointer is stored in clientData
+	in->runImportBenchmark();
+}
+
+void TW_CALL tw_runCullBenchmark(void *clientData)
+{ 
+	DXRenderer *in = static_cast<DXRenderer *>(clientData); // scene pointer is stored in clientData
+	in->runCullBenchmark();
+}
+
 void DXRenderer::buildMenu()
 {
 	// Create menu in renderer
@@ -122,8 +195,105 @@ void DXRenderer::buildMenu()
 	TwAddVarRW(menu, "Render pacman", TW_TYPE_BOOLCPP, &drawPacman, "group=Render");
 	TwAddVarRW(menu, "Render sky", TW_TYPE_BOOLCPP, &drawSky, "group=Render");
 	TwAddVarRW(menu, "Render mesh", TW_TYPE_BOOLCPP, &drawMesh, "group=Render");
+	TwAddVarRW(menu, "Baked maze", TW_TYPE_BOOLCPP, &drawBakedMaze, "group=Render");
+	TwAddVarRW(menu, "Sorted draw list", TW_TYPE_BOOLCPP, &useDrawList, "group=Render");
 	TwDefine("Settings/Render opened=false");
 
+	// Render device
+	TwAddVarRO(menu, "Frame draws", TW_TYPE_INT32, &frameStats.num_draws, "group='Render device'");
+	TwAddVarRO(menu, "Frame instances", TW_TYPE_INT32, &frameStats.num_instances, "group='Render device'");
+	TwAddVarRO(menu, "Frame state binds", TW_TYPE_INT32, &frameStats.num_stateBinds, "group='Render device'");
+	TwAddVarRO(menu, "Frame passes", TW_TYPE_INT32, &frameStats.num_passes, "group='Render device'");
+	TwAddVarRO(menu, "Frame buffer updates", TW_TYPE_INT32, &frameStats.num_bufferUpdates, "group='Render device'");
+	TwAddVarRO(menu, "Frame updated bytes", TW_TYPE_INT32, &frameStats.num_updatedBytes, "group='Render device'");
+	TwAddVarRO(menu, "Frame triangles", TW_TYPE_INT32, &frameStats.num_triangles, "group='Render device'");
+	TwAddVarRO(menu, "Frame patches", TW_TYPE_INT32, &frameStats.num_patches, "group='Render device'");
+	TwAddVarRW(menu, "Cache effect writes", TW_TYPE_BOOLCPP, &cacheEffectWrites, "group='Render device'");
+	TwAddVarRO(menu, "Frame effect writes", TW_TYPE_INT32, &num_effectWrites, "group='Render device'");
+	TwAddVarRO(menu, "Frame skipped writes", TW_TYPE_INT32, &num_effectSkippedWrites, "group='Render device'");
+	TwAddButton(menu, "Record frames", tw_recordFrames, this, "group='Render device'");
+	TwAddVarRO(menu, "Recorded frames", TW_TYPE_INT32, &recordBenchmark.num_frames, "group='Render device'");
+	TwAddVarRO(menu, "Recorded frame (ms)", TW_TYPE_FLOAT, &recordBenchmark.frameMs, "group='Render device'");
+	TwAddVarRO(menu, "Recorded commands", TW_TYPE_INT32, &recordBenchmark.num_commands, "group='Render device'");
+	TwAddVarRO(menu, "Recorded draws", TW_TYPE_INT32, &recordBenchmark.stats.num_draws, "group='Render device'");
+	TwAddVarRO(menu, "Recorded state binds", TW_TYPE_INT32, &recordBenchmark.stats.num_stateBinds, "group='Render device'");
+	TwAddVarRO(menu, "Recorded passes", TW_TYPE_INT32, &recordBenchmark.stats.num_passes, "group='Render device'");
+	TwDefine("Settings/'Render device' group=Render opened=false");
+
+	// Culling
+	TwAddVarRW(menu, "Frustum culling", TW_TYPE_BOOLCPP, &useFrustumCulling, "group=Culling");
+	TwAddVarRW(menu, "Cull path", TW_TYPE_INT32, &culler.path, "group=Culling min=0 max=2 help='0 scalar, 1 SSE, 2 AVX'");
+	TwAddVarRW(menu, "Cull threads", TW_TYPE_BOOLCPP, &culler.useThreads, "group=Culling");
+	TwAddVarRO(menu, "Cull spheres", TW_TYPE_INT32, &culler.num_spheres, "group=Culling");
+	TwAddVarRO(menu, "Cull visible", TW_TYPE_INT32, &culler.num_visible, "group=Culling");
+	TwAddVarRO(menu, "Cull (ms)", TW_TYPE_FLOAT, &culler.cullMs, "group=Culling precision=4");
+	TwAddVarRO(menu, "Cull rate (M/s)", TW_TYPE_FLOAT, &culler.spheresPerSec, "group=Culling");
+	TwAddButton(menu, "Cull benchmark", tw_runCullBenchmark, this, "group=Culling");
+	TwAddVarRO(menu, "Bench spheres", TW_TYPE_INT32, &cullBenchmark.num_spheres, "group=Culling");
+	TwAddVarRO(menu, "Bench scalar (ms)", TW_TYPE_FLOAT, &cullBenchmark.scalarMs, "group=Culling");
+	TwAddVarRO(menu, "Bench SSE (ms)", TW_TYPE_FLOAT, &cullBenchmark.sseMs, "group=Culling");
+	TwAddVarRO(menu, "Bench AVX (ms)", TW_TYPE_FLOAT, &cullBenchmark.avxMs, "group=Culling");
+	TwAddVarRO(menu, "Bench threaded (ms)", TW_TYPE_FLOAT, &cullBenchmark.threadedMs, "group=Culling");
+	TwAddVarRO(menu, "Bench frame unculled (ms)", TW_TYPE_FLOAT, &cullBenchmark.frameMs_unculled, "group=Culling");
+	TwAddVarRO(menu, "Bench frame culled (ms)", TW_TYPE_FLOAT, &cullBenchmark.frameMs_culled, "group=Culling");
+	TwAddVarRW(menu, "Occlusion culling", TW_TYPE_BOOLCPP, &useOcclusionCulling, "group=Culling");
+	TwAddVarRW(menu, "Occlusion threads", TW_TYPE_BOOLCPP, &occlusion.useThreads, "group=Culling");
+	TwAddVarRO(menu, "Occluders", TW_TYPE_INT32, &occlusion.num_occluders, "group=Culling");
+	TwAddVarRO(menu, "Occluder triangles", TW_TYPE_INT32, &occlusion.num_triangles, "group=Culling");
+	TwAddVarRO(menu, "Occlusion tested", TW_TYPE_INT32, &occlusion.num_tested, "group=Culling");
+	TwAddVarRO(menu, "Occluded", TW_TYPE_INT32, &occlusion.num_occluded, "group=Culling");
+	TwAddVarRO(menu, "Occluded (%)", TW_TYPE_FLOAT, &occlusion.occludedPercent, "group=Culling precision=1");
+	TwAddVarRO(menu, "Occlusion raster (ms)", TW_TYPE_FLOAT, &occlusion.rasterMs, "group=Culling precision=4");
+	TwAddVarRO(menu, "Occlusion test (ms)", TW_TYPE_FLOAT, &occlusion.testMs, "group=Culling precision=4");
+	TwAddVarRO(menu, "Occlusion (ms)", TW_TYPE_FLOAT, &occlusion.cullMs, "group=Culling precision=4");
+	TwDefine("Settings/Culling group=Render opened=false");
+
+	// Potentially visible sets
+	TwAddVarRW(menu, "Use PVS", TW_TYPE_BOOLCPP, &usePVS, "group=PVS");
+	TwAddVarRW(menu, "PVS samples per side", TW_TYPE_INT32, &pvs.samplesPerSide, "group=PVS min=1 max=8");
+	TwAddVarRW(menu, "PVS rays per sample", TW_TYPE_INT32, &pvs.raysPerSample, "group=PVS min=4 max=4096 step=64");
+	TwAddButton(menu, "Rebake PVS", tw_rebakePVS, this, "group=PVS");
+	TwAddVarRO(menu, "PVS bake (ms)", TW_TYPE_FLOAT, &pvs.bakeMs, "group=PVS");
+	TwAddVarRO(menu, "PVS rows", TW_TYPE_INT32, &pvs.num_rows, "group=PVS");
+	TwAddVarRO(menu, "PVS rays", TW_TYPE_INT32, &pvs.num_rays, "group=PVS");
+	TwAddVarRO(menu, "PVS raw (bytes)", TW_TYPE_INT32, &pvs.rawBytes, "group=PVS");
+	TwAddVarRO(menu, "PVS size (bytes)", TW_TYPE_INT32, &pvs.compressedBytes, "group=PVS");
+	TwAddVarRO(menu, "PVS tiles per row", TW_TYPE_FLOAT, &pvs.avgVisible, "group=PVS");
+	TwAddVarRO(menu, "PVS camera tiles", TW_TYPE_INT32, &num_pvsVisible, "group=PVS");
+	TwAddVarRO(menu, "PVS skipped draws", TW_TYPE_INT32, &num_pvsSkipped, "group=PVS");
+	TwDefine("Settings/PVS group=Render opened=false");
+
+	// Shadows
+	TwAddVarRW(menu, "Cascades", TW_TYPE_INT32, &cascades.num_cascades, "group=Shadows min=1 max=4");
+	TwAddVarRW(menu, "Shadow map size", TW_TYPE_INT32, &cascades.mapSize, "group=Shadows min=256 max=4096 step=256");
+	TwAddVarRW(menu, "Split lambda", TW_TYPE_FLOAT, &cascades.lambda, "group=Shadows min=0 max=1 step=0.05");
+	TwAddVarRW(menu, "Shadow distance", TW_TYPE_FLOAT, &cascades.shadowDistance, "group=Shadows min=10 step=10");
+	TwAddVarRW(menu, "Static shadow cache", TW_TYPE_BOOLCPP, &useShadowCache, "group=Shadows");
+	TwAddVarRO(menu, "Static shadow draws", TW_TYPE_INT32, &num_staticShadowDraws, "group=Shadows");
+	TwAddVarRO(menu, "Shadow casters culled", TW_TYPE_INT32, &num_shadowCastersCulled, "group=Shadows");
+	TwDefine("Settings/Shadows group=Render opened=false");
+
+	// Dynamic cube map
+	TwAddVarRW(menu, "Dynamic reflections", TW_TYPE_BOOLCPP, &useDynamicCube, "group=Reflections");
+	TwAddVarRW(menu, "Faces per frame", TW_TYPE_INT32, &mDynamicCube->facesPerFrame, "group=Reflections min=1 max=6");
+	TwAddVarRW(menu, "Skip unchanged faces", TW_TYPE_BOOLCPP, &mDynamicCube->skipUnchanged, "group=Reflections");
+	TwAddVarRO(menu, "Faces drawn", TW_TYPE_INT32, &mDynamicCube->num_facesDrawn, "group=Reflections");
+	TwAddVarRO(menu, "Faces skipped", TW_TYPE_INT32, &mDynamicCube->num_facesSkipped, "group=Reflections");
+	TwAddVarRO(menu, "Face packets culled", TW_TYPE_INT32, &mDynamicCube->num_packetsCulled, "group=Reflections");
+	TwDefine("Settings/Reflections group=Render opened=false");
+
+	// Per pass counters over the last frames, "avg (min - max)"
+	renderStats.buildMenu(menu);
+	TwAddButton(menu, "Start stats CSV", tw_beginStatsCsv, this, "group='Pass stats' help='Writes one row per frame to render_stats.csv'");
+	TwAddButton(menu, "Stop stats CSV", tw_endStatsCsv, this, "group='Pass stats'");
+	TwDefine("Settings/'Pass stats' group=Render opened=false");
+
+	// Profiler, rows of scopes appear once they have run
+	Profiler* profiler = Profiler::getInstance();
+	profiler->buildMenu(menu);
+	TwAddButton(menu, "Export trace", tw_exportTrace, profiler, "group=Profiler help='Writes profile_trace.json for chrome://tracing'");
+	TwDefine("Settings/Profiler opened=false");
+
 	//// Lights
 	//TwAddVarRW(menu, "DirAmbient", TW_TYPE_COLOR4F, &mDirLight.Ambient, "group='Dir light'");
 	//TwAddVarRW(menu, "DirDiffuse", TW_TYPE_COLOR4F, &mDirLight.Diffuse, "group='Dir light'");
@@ -182,6 +352,8 @@ void DXRenderer::buildMenu()
 	mTerrain.buildMenu(menu);
 	mSky->buildMenu(menu);
 	drawManager->buildMenu(menu);
+	TwAddButton(menu, "Import benchmark", tw_runImportBenchmark, drawManager, "group='OBJ import'");
+	vertexFetchBenchmark.buildMenu(menu);
 	TwAddVarRW(menu, "Camera walkmode", TW_TYPE_BOOLCPP, &lockCamera, "group=Camera");
 	TwAddVarRW(menu, "Camera height", TW_TYPE_FLOAT, &mCam.height, "group=Camera");
 	TwAddVarRW(menu, "Camera smooth factor", TW_TYPE_FLOAT, &mCam.smoothFactor, "group=Camera");
@@ -192,6 +364,7 @@ void DXRenderer::buildMenu()
 	TwAddSeparator(menu, NULL, NULL);
 	pacman.entity->buildMenu(menu);
 	pacman.maze->buildMenu(menu);
+	pacman.buildMenu(menu);
 	//sound.buildMenu(menu);
 }
 
@@ -219,6 +392,8 @@ void DXRenderer::initDX()
 		QMessageBox::information(0, "Error", "D3D11CreateDevice Failed.");
 		return;
 	}
+	d3dRenderDevice = new D3D11RenderDevice(dxDeviceContext);
+	renderDevice = d3dRenderDevice;
 	if(featureLevel != D3D_FEATURE_LEVEL_11_0 )
 	{
 		QMessageBox::information(0, "Error", "Direct3D Feature Level 11 unsupported.");
@@ -342,7 +517,7 @@ void DXRenderer::resizeDX()
 	HR(dxDevice->CreateDepthStencilView(tex_depthStencil, 0, &view_depthStencil));
 
 	// Bind render target view and depth/stencil view to pipeline
-	dxDeviceContext->OMSetRenderTargets(
+	renderDevice->setRenderTargets(
 		1,						// nr of render targets
 		&view_renderTarget,		// first element of array of rendertargets
 		view_depthStencil);		// pointer to depth/stencil view
@@ -354,7 +529,7 @@ void DXRenderer::resizeDX()
 	viewport_screen.Height   = static_cast<float>(clientHeight);
 	viewport_screen.MinDepth = 0.0f;
 	viewport_screen.MaxDepth = 1.0f;
-	dxDeviceContext->RSSetViewports(
+	renderDevice->setViewports(
 		1,								// nr of viewports
 		&viewport_screen);				// viewport array
 }
@@ -374,6 +549,8 @@ void DXRenderer::initGameEntities()
 
 void DXRenderer::update(float dt)
 {
+	PROFILE_SCOPE("Update");
+
 	// Control camera
 	if(GetAsyncKeyState('W') & 0x8000 )
 		mCam.Walk(10.0f*dt);
@@ -431,34 +608,67 @@ void DXRenderer::update(float dt)
 
 	// Update game
 	pacman.run(dt);
+	updatePelletInstances();
+	drawManager->updateMazeGeometry(pacman.maze);
+	updateOccluders();
+	pvs.update(pacman.maze);
+
+	// Ghost matrices, shared by all passes
+	ghostWorlds.resize(pacman.agents->size());
+	if(!ghostWorlds.empty())
+		pacman.agents->buildWorlds(pacman.maze, &ghostWorlds[0], 0.7f);
 
 	drawManager->buildShadowTransform();
 	mCam.UpdateViewMatrix();
+	const BoundingSphere& sceneBounds = drawManager->getSceneBounds();
+	cascades.update(mCam, drawManager->getDirLight().Direction, sceneBounds.Center, sceneBounds.Radius);
 
 	
 }
 
 void DXRenderer::renderFrame()
 {
-	mSmap->BindDsvAndSetNullRenderTarget(dxDeviceContext);
+	PROFILE_SCOPE("Render frame");
+	Profiler* profiler = Profiler::getInstance();
+	profiler->beginGpuFrame(renderDevice);
+	renderStats.beginFrame(renderDevice->stats, shaderManager->effects.getWrites());
+	drawManager->beginFrame();
+	shaderManager->effects.setCacheWrites(cacheEffectWrites);
+	updateShadowMaps();
+	markPass(pass_shadow);
 	DrawSceneToShadowMap();
-	dxDeviceContext->RSSetState(0);
+	markPass(pass_cubeMap);
+	DrawSceneToCubeMap();
+	markPass(pass_main);
+	renderDevice->setRasterizerState(0);
 
 	// Restore the back and depth buffer to the OM stage.
 	ID3D11RenderTargetView* renderTargets[1] = {view_renderTarget};
-	dxDeviceContext->OMSetRenderTargets(1, renderTargets, view_depthStencil);
-	dxDeviceContext->RSSetViewports(1, &viewport_screen);
+	renderDevice->setRenderTargets(1, renderTargets, view_depthStencil);
+	renderDevice->setViewports(1, &viewport_screen);
+
+	// Drawn where the clear below hides it
+	vertexFetchBenchmark.draw(renderDevice);
 
 	// Clear render target & depth/stencil
-	dxDeviceContext->ClearRenderTargetView(view_renderTarget, reinterpret_cast<const float*>(&Colors::DeepBlue));
-	dxDeviceContext->ClearDepthStencilView(view_depthStencil, D3D11_CLEAR_DEPTH|D3D11_CLEAR_STENCIL, 1.0f, 0);
+	renderDevice->clearRenderTarget(view_renderTarget, reinterpret_cast<const float*>(&Colors::DeepBlue));
+	renderDevice->clearDepthStencil(view_depthStencil, D3D11_CLEAR_DEPTH|D3D11_CLEAR_STENCIL, 1.0f, 0);
 
 	// Set per frame constants.
 	FXStandard* fx = shaderManager->effects.fx_standard;
 	fx->SetEyePosW(mCam.GetPosition());
-	fx->SetCubeMap(mSky->CubeMapSRV());
+	fx->SetCubeMap(isDynamicCubeReady() ? mDynamicCube->CubeMapSRV() : mSky->CubeMapSRV());
 	fx->SetShadowMap(mSmap->DepthMapSRV());
 
+	// Cascades
+	XMFLOAT3 eyeDir;
+	XMStoreFloat3(&eyeDir, XMVector3Normalize(mCam.GetLookXM()));
+	fx->SetCascadeTransforms(cascades.transform);
+	fx->SetCascadeSplits(XMFLOAT4(cascades.splits));
+	fx->SetEyeDirW(eyeDir);
+	fx->SetNumCascades(cascades.num_cascades);
+	fx->SetShadowTexelSize(1.0f/cascades.mapSize);
+
 	// Tessellation settings
 	fx->SetHeightScale(tess_heightScale);
 	fx->SetMaxTessDistance(tess_maxTessDistance);
@@ -466,13 +676,13 @@ void DXRenderer::renderFrame()
 	fx->SetMinTessFactor(tess_minTessFactor);
 	fx->SetMaxTessFactor(tess_maxTessFactor);
 
-	dxDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
+	renderDevice->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
 	//dxDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	drawManager->prepareFrame();
 
 	if(wireframe_enable)
-		dxDeviceContext->RSSetState(shaderManager->states.WireframeRS);
+		renderDevice->setRasterizerState(shaderManager->states.WireframeRS);
 
 
 	//
@@ -483,49 +693,199 @@ void DXRenderer::renderFrame()
 	
 	
 	if(drawTerrain)
-		mTerrain.draw(dxDeviceContext, &mCam);
+		mTerrain.draw(renderDevice, &mCam);
 
-	dxDeviceContext->RSSetState(0);
+	renderDevice->setRasterizerState(0);
 
 	// FX sets tessellation stages, but it does not disable them.  So do that here
 	// to turn off tessellation.
-	dxDeviceContext->HSSetShader(0, 0, 0);
-	dxDeviceContext->DSSetShader(0, 0, 0);
-	dxDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	renderDevice->clearTessellation();
+	renderDevice->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// Debug view depth buffer.
-	if(GetAsyncKeyState('Z') & 0x8000)
+	markPass(pass_debug);
+	if(!renderDevice->isHeadless() && (GetAsyncKeyState('Z') & 0x8000))
 	{
-		DrawScreenQuad(mSmap->DepthMapSRV());
+		DrawScreenQuad(mSmap->FirstSliceSRV());
 	}
 
+	markPass(pass_sky);
 	if(drawSky)
-		mSky->Draw(dxDeviceContext, &mCam);
+		mSky->Draw(renderDevice, &mCam);
 
 	// restore default states, as the SkyFX changes them in the effect file.
-	dxDeviceContext->RSSetState(0);
-	dxDeviceContext->OMSetDepthStencilState(0, 0);
+	renderDevice->setRasterizerState(0);
+	renderDevice->setDepthStencilState(0, 0);
 
 	// Unbind shadow map as a shader input because we are going to render to it next frame.
 	// The shadow might be at any slot, so clear all slots.
 	ID3D11ShaderResourceView* nullSRV[16] = { 0 };
-	dxDeviceContext->PSSetShaderResources(0, 16, nullSRV);
+	renderDevice->setPSShaderResources(0, 16, nullSRV);
+	renderStats.endFrame(renderDevice->stats, shaderManager->effects.getWrites());
+
+	// Menu and present need the real context
+	if(renderDevice->isHeadless())
+		return;
 
 	// Draw menu
 	TwDraw(); 
+	profiler->endGpuFrame(renderDevice);
 
 	// Show the finished frame
-	HR(dxSwapChain->Present(0, 0));
+	{
+		PROFILE_SCOPE("Present");
+		HR(dxSwapChain->Present(0, 0));
+	}
+
+	frameStats = renderDevice->stats;
+	renderDevice->stats.reset();
+	num_effectWrites = shaderManager->effects.getWrites();
+	num_effectSkippedWrites = shaderManager->effects.getSkippedWrites();
+	shaderManager->effects.resetStats();
+}
+
+// Device and effect counts from here on go to "pass"
+void DXRenderer::markPass(int pass)
+{
+	renderStats.beginPass(pass, renderDevice->stats, shaderManager->effects.getWrites());
+}
+
+void DXRenderer::beginStatsCsv()
+{
+	renderStats.beginCsv("render_stats.csv");
+}
+
+void DXRenderer::endStatsCsv()
+{
+	renderStats.endCsv();
+}
+
+void DXRenderer::recordFrames()
+{
+	static const int num_frames = 100;
+
+	// Everything renderFrame does except reaching the GPU
+	renderDevice = recordingDevice;
+	drawManager->setRenderDevice(recordingDevice);
+
+	Stopwatch watch;
+	for(int i=0; i<num_frames; i++)
+	{
+		recordingDevice->clear();
+		renderFrame();
+	}
+	recordBenchmark.num_frames = num_frames;
+	recordBenchmark.frameMs = watch.elapsedMs()/num_frames;
+	recordBenchmark.num_commands = (int)recordingDevice->getCommands().size();
+	recordBenchmark.stats = recordingDevice->stats;
+
+	renderDevice = d3dRenderDevice;
+	drawManager->setRenderDevice(d3dRenderDevice);
+	shaderManager->effects.resetStats();
+
+	// Static shadows and cube faces drawn while recording never reached the GPU
+	invalidateStaticShadows();
+	mDynamicCube->invalidate();
+}
+
+void DXRenderer::runCullBenchmark()
+{
+	const int num_spheres = 1<<20;
+	const int num_runs = 10;
+	cullBenchmark.num_spheres = num_spheres;
+
+	// Random spheres around the camera
+	SphereCuller bench;
+	bench.reserve(num_spheres);
+	XMFLOAT3 eye = mCam.GetPosition();
+	for(int i=0; i<num_spheres; i++)
+	{
+		bench.add(
+			eye.x + MathUtil::RandF(-500.0f, 500.0f),
+			eye.y + MathUtil::RandF(-500.0f, 500.0f),
+			eye.z + MathUtil::RandF(-500.0f, 500.0f),
+			MathUtil::RandF(0.1f, 5.0f));
+	}
+
+	XMFLOAT4 planes[6];
+	Util::extractFrustumPlanes(planes, mCam.ViewProjDebug());
+	std::vector<int> visible;
+	float* results[4] = {&cullBenchmark.scalarMs, &cullBenchmark.sseMs, &cullBenchmark.avxMs, &cullBenchmark.threadedMs};
+	for(int r=0; r<4; r++)
+	{
+		bench.path = MathUtil::Min(r, (int)cull_avx);
+		bench.useThreads = r == 3;
+		float ms = 0.0f;
+		for(int i=0; i<num_runs; i++)
+		{
+			bench.cull(planes, visible);
+			ms += bench.cullMs;
+		}
+		*results[r] = ms/num_runs;
+	}
+
+	// Frame time gained on the current scene
+	bool culling = useFrustumCulling;
+	useFrustumCulling = false;
+	recordFrames();
+	cullBenchmark.frameMs_unculled = recordBenchmark.frameMs;
+	useFrustumCulling = true;
+	recordFrames();
+	cullBenchmark.frameMs_culled = recordBenchmark.frameMs;
+	useFrustumCulling = culling;
+}
+
+// Occluder boxes follow the wall rectangles of the baked maze, placed
+// like the baked mesh with the world matrix of tile (0, 0)
+void DXRenderer::updateOccluders()
+{
+	XMFLOAT4X4 world;
+	XMStoreFloat4x4(&world, pacman.maze->getTileWorld(0,0));
+	if(occluderRevision == pacman.maze->getRevision() && memcmp(&world, &occluderWorld, sizeof(world)) == 0)
+		return;
+	occluderRevision = pacman.maze->getRevision();
+	occluderWorld = world;
+
+	occlusion.clearOccluders();
+	const std::vector<MazeMeshBaker::TileRect>& rects = drawManager->getMazeRects();
+	for(int i=0; i<(int)rects.size(); i++)
+	{
+		const MazeMeshBaker::TileRect& r = rects[i];
+		occlusion.addOccluderBox(XMLoadFloat4x4(&world),
+			XMFLOAT3(r.x-0.5f, -0.5f, r.y-0.5f),
+			XMFLOAT3(r.x+r.w-0.5f, 0.5f, r.y+r.h-0.5f));
+	}
 }
 
 void DXRenderer::drawGame()
 {
+	PROFILE_SCOPE("Draw game");
+	PROFILE_GPU_SCOPE(renderDevice, "Draw game");
 	FXStandard* fx = shaderManager->effects.fx_standard;
 	XMMATRIX viewProj = mCam.ViewProj();
 
 	ID3DX11EffectTechnique* tech = fx->tech_tess;
 	D3DX11_TECHNIQUE_DESC techDesc;
 	tech->GetDesc(&techDesc);
+
+	if(useDrawList)
+	{
+		const BitGrid* visibleTiles = getCameraPVS();
+		num_pvsVisible = visibleTiles ? visibleTiles->count() : 0;
+		num_pvsSkipped = 0;
+		collectDraws(drawManager->drawList, false, techDesc.Passes, layer_all, mCam.View(), mCam.ViewProjDebug(), visibleTiles);
+		if(useOcclusionCulling && drawPacman)
+		{
+			occlusion.render(mCam.ViewProjDebug());
+			drawManager->drawList.cullOccluded(occlusion);
+		}
+		drawManager->submit(drawManager->drawList, viewProj);
+
+		// Terrain follows with the frame state
+		renderDevice->setRasterizerState(wireframe_enable ? shaderManager->states.WireframeRS : 0);
+		return;
+	}
+
 	for(UINT pass = 0; pass<techDesc.Passes; pass++)
 	{
 		// Draw plane
@@ -546,103 +906,273 @@ void DXRenderer::drawGame()
 		{
 			
 
-			// Draw maze
-			for(int y = 0; y<pacman.maze->getSizeY(); y++)
+			// Draw maze, baked mesh is in tile units
+			if(drawBakedMaze)
 			{
-				for(int x = 0; x<pacman.maze->getSizeX(); x++)
+				drawManager->drawMaze(1, pacman.maze->getTileWorld(0,0), viewProj, pass);
+			}
+			else
+			{
+				const XMMATRIX* wallWorlds = pacman.maze->getWallWorlds();
+				for(int i = 0; i<pacman.maze->getWallCount(); i++)
 				{
-					XMMATRIX world = (XMMATRIX)pacman.maze->getPosition(x,y);
-					XMMATRIX scale = XMMatrixScalingFromVector(XMVectorReplicate(1.0f));
-
-					if(pacman.maze->getTile(x,y)==1)
-					{
-						drawManager->drawObject(0, 1, scale*world, viewProj, pass);
-					}
-					if(pacman.maze->getTile(x,y)==0)
-					{
-						scale = XMMatrixScalingFromVector(XMVectorReplicate(0.1f));
-						drawManager->drawObject(0, 1, scale*world, viewProj, pass);
-					}
+					drawManager->drawObject(0, 1, wallWorlds[i], viewProj, pass);
 				}
 			}
 
+			// Draw pellets -- with instancing, eaten pellets have zero scale
+			if(num_pelletInstances > 0)
+			{
+				UINT stride[2] = {sizeof(Vertex::packed), sizeof(Vertex::InstancedData)};
+				drawManager->prepareFrameInstanced(stride, pelletInstanceBuffer);
+				renderDevice->setInputLayout(shaderManager->layout_inst_packed);
+				drawManager->drawObjectInstanced(0, 1, num_pelletInstances, viewProj, pass);
+				drawManager->prepareFrame();
+			}
+
 			// Draw game entities
 			XMMATRIX world = (XMMATRIX)pacman.entity->getPos();
 			XMMATRIX scale = XMMatrixScalingFromVector(XMVectorReplicate(0.7f));
 			drawManager->drawObject(0, 2, scale*world, viewProj, pass);
+
+			// Draw ghosts
+			for(int i=0; i<(int)ghostWorlds.size(); i++)
+			{
+				drawManager->drawObject(0, 3, XMLoadFloat4x4(&ghostWorlds[i]), viewProj, pass);
+			}
 		}
 
 		// Draw mesh
 		if(drawMesh)
 		{
-			dxDeviceContext->RSSetState(shaderManager->states.NoCullRS);
+			renderDevice->setRasterizerState(shaderManager->states.NoCullRS);
 			if(wireframe_enable)
-				dxDeviceContext->RSSetState(shaderManager->states.WireframeRS);
-			drawManager->drawMesh(0, viewProj, pass);
-			dxDeviceContext->RSSetState(0);
+				renderDevice->setRasterizerState(shaderManager->states.WireframeRS);
+			drawManager->drawMesh(5, viewProj, pass);
+			renderDevice->setRasterizerState(0);
 		}
 	}
+}
 
-	//
-	// Instancing
-	//
+// Rebakes with the current PVS settings
+void DXRenderer::rebakePVS()
+{
+	pvs.bake(pacman.maze);
+}
+
+// Row of the tile holding the camera. None outside of the maze, or above
+// or below the walls where the camera can see past them.
+const BitGrid* DXRenderer::getCameraPVS()
+{
+	if(!usePVS || !drawPacman)
+		return 0;
+
+	XMVECTOR det;
+	XMMATRIX toTiles = XMMatrixInverse(&det, pacman.maze->getTileWorld(0,0));
+	XMFLOAT3 local;
+	XMStoreFloat3(&local, XMVector3TransformCoord(mCam.GetPositionXM(), toTiles));
+	if(local.y > 0.5f || local.y < -0.5f)
+		return 0;
+	return pvs.getRow((int)floorf(local.x+0.5f), (int)floorf(local.z+0.5f));
+}
 
-	//// Draw pacman 
-	//if(drawPacman)
-	//{
-
-	//	UINT stride[2] = {sizeof(Vertex::posNormTexTan), sizeof(Vertex::InstancedData)};
-
-	//	tech = fx->tech_tess_inst;
-	//	tech->GetDesc(&techDesc);
-	//	for(UINT pass = 0; pass<techDesc.Passes; pass++)
-	//	{
-	//		// Draw maze -- with instancing!
-	//		// mapp world matrices to instance buffer
-	//		num_visibleObjects = 0;
-	//		D3D11_MAPPED_SUBRESOURCE mappedData; 
-	//		dxDeviceContext->Map(instancedBuffer, 0, D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mappedData);
-	//		Vertex::InstancedData* data = reinterpret_cast<Vertex::InstancedData*>(mappedData.pData);
-	//		static float timer = 1.0f;
-	//		timer += 0.001;
-	//		XMStoreFloat4x4(&data[10].World, XMMatrixTranslation(8.0f,5.0f,100.0f));
-	//		/*	for(int y = 0; y<pacman.maze->getSizeY(); y++)
-	//		{
-	//		for(int x = 0; x<pacman.maze->getSizeX(); x++)
-	//		{
-	//		XMMATRIX world = (XMMATRIX)pacman.maze->getPosition(x,y);
-	//		XMMATRIX scale = XMMatrixScalingFromVector(XMVectorReplicate(2.0f));
-	//		if(pacman.maze->getTile(x,y)==1)
-	//		{
-	//		XMFLOAT4X4 inst_World; XMStoreFloat4x4(&inst_World, scale*world);
-	//		data[num_visibleObjects].World = inst_World;
-	//		num_visibleObjects++;
-	//		}
-	//		if(pacman.maze->getTile(x,y)==0)
-	//		{
-	//		scale = XMMatrixScalingFromVector(XMVectorReplicate(0.1f));
-	//		XMFLOAT4X4 inst_World; XMStoreFloat4x4(&inst_World, scale*world);
-	//		data[num_visibleObjects].World = inst_World;
-	//		num_visibleObjects++;
-	//		}
-	//		}
-	//		}*/
-	//		dxDeviceContext->Unmap(instancedBuffer, 0);
-	//		// draw instance buffer
-	//		drawManager->prepareFrameInstanced(stride, instancedBuffer);
-	//		// Set input layout, topology, context
-	//		dxDeviceContext->IASetInputLayout(shaderManager->layout_inst_posNormTexTan);
-
-	//		drawManager->drawObjectInstanced(0, 2, pacman.maze->getSizeY(), viewProj, pass);
-	//	}
-	//}
+// Unit box on every set tile, in tile order, returns the number added
+int DXRenderer::addTileBoxes(DrawList& list, const BitGrid& tiles, CXMMATRIX scale, int technique, UINT pass, int tess, ID3D11RasterizerState* rasterizerState)
+{
+	const float boxRadius = 0.8660254f;	// half diagonal of the unit box
+	int count = 0;
+	for(int w=0; w<tiles.getWordCount(); w++)
+	{
+		unsigned int bits = tiles.getWord(w);
+		for(int b=0; bits!=0; b++, bits>>=1)
+		{
+			if(!(bits & 1u))
+				continue;
+			int tile = w*32+b;
+			XMMATRIX world = scale*pacman.maze->getTileWorld(tile % tiles.getSizeX(), tile / tiles.getSizeX());
+			list.addBounded(mesh_box, 1, world, technique, pass, tess, rasterizerState, boxRadius);
+			count++;
+		}
+	}
+	return count;
+}
+
+// Same objects as the immediate paths of drawGame and DrawSceneToShadowMap,
+// depth is sorted along "view" and bounded packets are culled against
+// "cullViewProj". With "visibleTiles" only maze objects on set tiles are
+// collected.
+void DXRenderer::collectDraws(DrawList& list, bool shadowPass, UINT num_passes, int layers, CXMMATRIX view, CXMMATRIX cullViewProj, const BitGrid* visibleTiles)
+{
+	ID3D11RasterizerState* noCullRS = shaderManager->states.NoCullRS;
+	ID3D11RasterizerState* wireframeRS = wireframe_enable ? shaderManager->states.WireframeRS : 0;
+	int technique = shadowPass ? technique_shadow : technique_tess;
+	ID3D11RasterizerState* rasterizerState = shadowPass ? noCullRS : wireframeRS;
+	ID3D11RasterizerState* rasterizerState_mesh = shadowPass || !wireframeRS ? noCullRS : wireframeRS;
+	bool drawStatic = (layers & layer_static) != 0;
+	bool drawDynamic = (layers & layer_dynamic) != 0;
+
+	list.begin(view);
+	int tess_frame = list.addTess(TessSettings(tess_heightScale, tess_maxTessDistance, tess_minTessDistance, tess_minTessFactor, tess_maxTessFactor));
+	int tess_mesh = list.addTess(TessSettings(mesh_heightScale, 5.0f, 100.0f, 1.0f, mesh_maxTessFactor));
+	int tess_pacman = shadowPass ? list.addTess(TessSettings(0.0f, 5.0f, 100.0f, 1.0f, mesh_maxTessFactor)) : tess_mesh;
+	const float boxRadius = 0.8660254f;	// half diagonal of the unit box
+
+	for(UINT pass = 0; pass<num_passes; pass++)
+	{
+		if(drawPlane && drawStatic)
+			list.add(mesh_grid, 0, XMMatrixIdentity(), technique, pass, tess_frame, rasterizerState);
+
+		if(drawPacman && drawStatic)
+		{
+			// Maze
+			if(drawBakedMaze)
+			{
+				list.add(mesh_maze, 1, pacman.maze->getTileWorld(0,0), technique, pass, tess_pacman, rasterizerState);
+			}
+			else if(visibleTiles)
+			{
+				pvsTiles = pacman.maze->getWalls();
+				pvsTiles.andWith(*visibleTiles);
+				int num_added = addTileBoxes(list, pvsTiles, XMMatrixIdentity(), technique, pass, tess_pacman, rasterizerState);
+				num_pvsSkipped += pacman.maze->getWallCount()-num_added;
+			}
+			else
+			{
+				const XMMATRIX* wallWorlds = pacman.maze->getWallWorlds();
+				for(int i = 0; i<pacman.maze->getWallCount(); i++)
+					list.addBounded(mesh_box, 1, wallWorlds[i], technique, pass, tess_pacman, rasterizerState, boxRadius);
+			}
+		}
+
+		if(drawPacman && drawDynamic)
+		{
+			// Pellets, one draw from the persistent instance buffer where
+			// only changed slots are uploaded and eaten ones have zero scale.
+			// Dynamic so eating one leaves the static shadow cache valid.
+			if(num_pelletInstances > 0)
+				list.addInstanced(mesh_box, 1, XMMatrixIdentity(), technique, pass, tess_pacman, rasterizerState, pelletInstanceBuffer, num_pelletInstances);
+
+			// Game entities
+			XMMATRIX world = (XMMATRIX)pacman.entity->getPos();
+			XMMATRIX scale = XMMatrixScalingFromVector(XMVectorReplicate(0.7f));
+			Float2 p = pacman.entity->getTilePos();
+			if(!visibleTiles || MazePVS::isVisible(*visibleTiles, p.x, p.y))
+				list.addBounded(mesh_box, 2, scale*world, technique, pass, tess_pacman, rasterizerState, boxRadius);
+			else
+				num_pvsSkipped++;
+			for(int i=0; i<(int)ghostWorlds.size(); i++)
+			{
+				Float2 g = pacman.agents->getTilePos(i);
+				if(!visibleTiles || MazePVS::isVisible(*visibleTiles, g.x, g.y))
+					list.addBounded(mesh_box, 3, XMLoadFloat4x4(&ghostWorlds[i]), technique, pass, tess_pacman, rasterizerState, boxRadius);
+				else
+					num_pvsSkipped++;
+			}
+		}
+
+		if(drawMesh && drawStatic)
+			list.add(mesh_obj, 5, XMMatrixTranslation(0.0f, 30.0f, 0.0f), technique, pass, tess_mesh, rasterizerState_mesh);
+	}
+
+	if(!useFrustumCulling)
+		return;
+
+	XMFLOAT4 planes[6];
+	Util::extractFrustumPlanes(planes, cullViewProj);
+	if(shadowPass)
+	{
+		list.cull(shadowCuller, planes);
+		num_shadowCastersCulled += list.num_culled;
+	}
+	else
+	{
+		list.cull(culler, planes);
+	}
+}
+
+// True if the static casters or the light have changed since the static
+// shadow map was drawn. Tessellation of the cached casters follows the
+// eye position at the time they were drawn.
+bool DXRenderer::updateStaticShadowKey(int cascade)
+{
+	StaticShadowKey key;
+	memset(&key, 0, sizeof(key));
+	key.shadowTransform = cascades.transform[cascade];
+	XMStoreFloat4x4(&key.mazeWorld, pacman.maze->getTileWorld(0,0));
+	key.mazeRevision = pacman.maze->getRevision();
+	key.flags = (drawPlane ? 1 : 0) | (drawPacman ? 2 : 0) | (drawMesh ? 4 : 0) | (drawBakedMaze ? 8 : 0);
+	key.tess[0] = tess_heightScale;
+	key.tess[1] = tess_maxTessDistance;
+	key.tess[2] = tess_minTessDistance;
+	key.tess[3] = tess_minTessFactor;
+	key.tess[4] = tess_maxTessFactor;
+	key.tess[5] = mesh_heightScale;
+	key.tess[6] = mesh_maxTessFactor;
+
+	if(staticShadowValid[cascade] && memcmp(&key, &staticShadowKey[cascade], sizeof(key)) == 0)
+		return false;
+	staticShadowKey[cascade] = key;
+	staticShadowValid[cascade] = true;
+	return true;
+}
+
+void DXRenderer::invalidateStaticShadows()
+{
+	for(int i=0; i<ShadowCascades::maxCascades; i++)
+		staticShadowValid[i] = false;
+}
+
+// Recreates the shadow maps when the resolution or cascade count changed
+void DXRenderer::updateShadowMaps()
+{
+	cascades.num_cascades = MathUtil::Clamp(cascades.num_cascades, 1, (int)ShadowCascades::maxCascades);
+	if(mSmap && (int)mSmap->Width() == cascades.mapSize && (int)mSmap->SliceCount() == cascades.num_cascades)
+		return;
+
+	SafeDelete(mSmap);
+	SafeDelete(mStaticSmap);
+	mSmap = new ShadowMap(dxDevice, cascades.mapSize, cascades.mapSize, cascades.num_cascades);
+	mStaticSmap = new ShadowMap(dxDevice, cascades.mapSize, cascades.mapSize, cascades.num_cascades);
+	invalidateStaticShadows();
 }
 
 void DXRenderer::DrawSceneToShadowMap()
 {
-	XMMATRIX view     = XMLoadFloat4x4(&drawManager->mLightView);
-	XMMATRIX proj     = XMLoadFloat4x4(&drawManager->mLightProj);
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+	PROFILE_SCOPE("Shadow maps");
+	PROFILE_GPU_SCOPE(renderDevice, "Shadow maps");
+	bool cached = useDrawList && useShadowCache;
+	num_shadowCastersCulled = 0;
+
+	// Static casters of cascades that changed, copied below the dynamic ones
+	if(cached)
+	{
+		for(int i=0; i<cascades.num_cascades; i++)
+		{
+			if(updateStaticShadowKey(i))
+			{
+				DrawCascadeToShadowMap(i, mStaticSmap, layer_static, true);
+				num_staticShadowDraws++;
+			}
+		}
+		mSmap->CopyFrom(renderDevice, mStaticSmap);
+	}
+	else
+	{
+		invalidateStaticShadows();
+	}
+
+	for(int i=0; i<cascades.num_cascades; i++)
+		DrawCascadeToShadowMap(i, mSmap, cached ? layer_dynamic : layer_all, !cached);
+}
+
+void DXRenderer::DrawCascadeToShadowMap(int cascade, ShadowMap* target, int layers, bool clear)
+{
+	if(clear)
+		target->BindDsvAndSetNullRenderTarget(renderDevice, cascade);
+	else
+		target->BindDsv(renderDevice, cascade);
+
+	XMMATRIX viewProj = cascades.getViewProj(cascade);
 
 	FXBuildShadowMap* fx = shaderManager->effects.fx_buildShadowMap;
 	fx->SetEyePosW(mCam.GetPosition());
@@ -661,6 +1191,14 @@ void DXRenderer::DrawSceneToShadowMap()
 	ID3DX11EffectTechnique* tech = fx->TessBuildShadowMapTech;
 	D3DX11_TECHNIQUE_DESC techDesc;
 	tech->GetDesc(&techDesc);
+
+	if(useDrawList)
+	{
+		collectDraws(drawManager->drawList_shadowMap, true, techDesc.Passes, layers, cascades.getView(cascade), viewProj, 0);
+		drawManager->submit_shadowMap(drawManager->drawList_shadowMap, viewProj);
+		return;
+	}
+
 	for(UINT pass = 0; pass < techDesc.Passes; pass++)
 	{
 		// Draw land
@@ -686,42 +1224,146 @@ void DXRenderer::DrawSceneToShadowMap()
 		{
 			fx->SetHeightScale(0.0f);
 			// Draw maze
-			for(int y = 0; y<pacman.maze->getSizeY(); y++)
+			if(drawBakedMaze)
 			{
-				for(int x = 0; x<pacman.maze->getSizeX(); x++)
+				drawManager->drawMaze_shadowMap(pacman.maze->getTileWorld(0,0), viewProj, pass);
+			}
+			else
+			{
+				const XMMATRIX* wallWorlds = pacman.maze->getWallWorlds();
+				for(int i = 0; i<pacman.maze->getWallCount(); i++)
 				{
-					XMMATRIX world = (XMMATRIX)pacman.maze->getPosition(x,y);
-					XMMATRIX scale = XMMatrixScalingFromVector(XMVectorReplicate(1.0f));
-
-					if(pacman.maze->getTile(x,y)==1)
-					{
-						drawManager->drawObject_shadowMap(0, 1, scale*world, viewProj, pass);
-					}
-					if(pacman.maze->getTile(x,y)==0)
-					{
-						scale = XMMatrixScalingFromVector(XMVectorReplicate(0.1f));
-						drawManager->drawObject_shadowMap(0, 1, scale*world, viewProj, pass);
-					}
+					drawManager->drawObject_shadowMap(0, 1, wallWorlds[i], viewProj, pass);
 				}
 			}
 
+			// Draw pellets
+			XMMATRIX pelletScale = XMMatrixScalingFromVector(XMVectorReplicate(0.1f));
+			for(int i = 0; i<pacman.pellets->getSlotCount(); i++)
+			{
+				Int2 tile = pacman.pellets->getSlotTile(i);
+				if(pacman.pellets->isAlive(tile.x, tile.y))
+					drawManager->drawObject_shadowMap(0, 1, pelletScale*pacman.maze->getTileWorld(tile.x, tile.y), viewProj, pass);
+			}
+
 			// Draw game entities
 			XMMATRIX world = (XMMATRIX)pacman.entity->getPos();
 			XMMATRIX scale = XMMatrixScalingFromVector(XMVectorReplicate(0.7f));
 			drawManager->drawObject_shadowMap(0, 2, scale*world, viewProj, pass);
+
+			// Draw ghosts
+			for(int i=0; i<(int)ghostWorlds.size(); i++)
+			{
+				drawManager->drawObject_shadowMap(0, 3, XMLoadFloat4x4(&ghostWorlds[i]), viewProj, pass);
+			}
 		}
 	}
 }
 
+// Nothing but the mesh reflects the cube, and only sorted submission
+// draws its faces
+bool DXRenderer::isDynamicCubeReady()
+{
+	return useDynamicCube && useDrawList && drawMesh && mDynamicCube->isComplete();
+}
+
+void DXRenderer::DrawSceneToCubeMap()
+{
+	PROFILE_SCOPE("Cube map");
+	PROFILE_GPU_SCOPE(renderDevice, "Cube map");
+	mDynamicCube->beginFrame();
+	if(!useDynamicCube || !useDrawList || !drawMesh)
+		return;
+
+	// Centred on the mesh, which is left out so it does not hide the scene
+	mDynamicCube->setPosition(XMFLOAT3(0.0f, 30.0f, 0.0f));
+	drawMesh = false;
+
+	// Faces reflect the sky and are not shadowed, the cascades only cover
+	// the frustum of the camera
+	FXStandard* fx = shaderManager->effects.fx_standard;
+	fx->SetCubeMap(mSky->CubeMapSRV());
+	fx->SetShadowMap(mSmap->DepthMapSRV());
+	fx->SetCascadeSplits(XMFLOAT4(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX));
+	fx->SetNumCascades(1);
+
+	D3DX11_TECHNIQUE_DESC techDesc;
+	fx->tech_tess->GetDesc(&techDesc);
+
+	// Visit faces until the budget is spent, unchanged faces are free
+	int budget = mDynamicCube->facesPerFrame;
+	int visited = 0;
+	for(; visited<DynamicCubeMap::num_faces && budget>0; visited++)
+	{
+		int face = mDynamicCube->getScheduledFace(visited);
+		Camera faceCam;
+		mDynamicCube->buildFaceCamera(face, faceCam);
+
+		DrawList& list = drawManager->drawList_cubeMap;
+		collectDraws(list, false, techDesc.Passes, layer_all, faceCam.View(), faceCam.ViewProj(), 0);
+		mDynamicCube->num_packetsCulled += list.num_culled;
+
+		// Packets seen by the face and anything else changing its pixels
+		int flags = (drawTerrain ? 1 : 0) | (drawSky ? 2 : 0) | (wireframe_enable ? 4 : 0);
+		UINT64 hash = list.hash(DrawList::hashSeed);
+		hash = DrawList::hashBytes(hash, &drawManager->getDirLight(), sizeof(DirectionalLight));
+		hash = DrawList::hashBytes(hash, &flags, sizeof(flags));
+		if(!mDynamicCube->updateFaceHash(face, hash))
+		{
+			mDynamicCube->num_facesSkipped++;
+			continue;
+		}
+
+		DrawCubeMapFace(face, faceCam, list);
+		mDynamicCube->num_facesDrawn++;
+		budget--;
+	}
+	mDynamicCube->endSchedule(visited);
+	drawMesh = true;
+
+	if(mDynamicCube->num_facesDrawn > 0)
+		mDynamicCube->GenerateMips(renderDevice);
+}
+
+void DXRenderer::DrawCubeMapFace(int face, Camera& faceCam, DrawList& list)
+{
+	mDynamicCube->BindFace(renderDevice, face, reinterpret_cast<const float*>(&Colors::DeepBlue));
+
+	FXStandard* fx = shaderManager->effects.fx_standard;
+	fx->SetEyePosW(faceCam.GetPosition());
+	fx->SetHeightScale(tess_heightScale);
+	fx->SetMaxTessDistance(tess_maxTessDistance);
+	fx->SetMinTessDistance(tess_minTessDistance);
+	fx->SetMinTessFactor(tess_minTessFactor);
+	fx->SetMaxTessFactor(tess_maxTessFactor);
+
+	renderDevice->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
+	drawManager->prepareFrame();
+	drawManager->submit(list, faceCam.ViewProj());
+
+	if(drawTerrain)
+		mTerrain.draw(renderDevice, &faceCam);
+
+	renderDevice->setRasterizerState(0);
+	renderDevice->clearTessellation();
+	renderDevice->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+	if(drawSky)
+		mSky->Draw(renderDevice, &faceCam);
+
+	renderDevice->setRasterizerState(0);
+	renderDevice->setDepthStencilState(0, 0);
+}
+
 void DXRenderer::DrawScreenQuad(ID3D11ShaderResourceView* resource)
 {
 	UINT stride = sizeof(Vertex::posNormTex);
 	UINT offset = 0;
 
-	dxDeviceContext->IASetInputLayout(shaderManager->layout_posNormTex);
-	dxDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	dxDeviceContext->IASetVertexBuffers(0, 1, &drawManager->mScreenQuadVB, &stride, &offset);
-	dxDeviceContext->IASetIndexBuffer(drawManager->mScreenQuadIB, DXGI_FORMAT_R32_UINT, 0);
+	renderDevice->setInputLayout(shaderManager->layout_posNormTex);
+	renderDevice->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	renderDevice->setVertexBuffers(0, 1, &drawManager->mScreenQuadVB, &stride, &offset);
+	renderDevice->setIndexBuffer(drawManager->mScreenQuadIB, DXGI_FORMAT_R32_UINT, 0);
 
 	// Scale and shift quad to lower-right corner.
 	XMMATRIX world(
@@ -740,28 +1382,73 @@ void DXRenderer::DrawScreenQuad(ID3D11ShaderResourceView* resource)
 		fx->SetWorldViewProj(world);
 		fx->SetTexture(resource);
 
-		tech->GetPassByIndex(p)->Apply(0, dxDeviceContext);
-		dxDeviceContext->DrawIndexed(6, 0, 0);
+		renderDevice->applyPass(tech->GetPassByIndex(p));
+		renderDevice->drawIndexed(6, 0, 0);
 	}
 }
 
-void DXRenderer::initInstanceBuffer()
+Vertex::InstancedData DXRenderer::getPelletInstance(int x, int y)
 {
-	std::vector<Vertex::InstancedData> instances(pacman.maze->getSizeY() * pacman.maze->getSizeX());
-	
-	for(int i = 0; i<(int)instances.size(); i++)
+	Vertex::InstancedData instance;
+	XMMATRIX world = XMMatrixScaling(0.0f, 0.0f, 0.0f);
+	if(pacman.pellets->isAlive(x,y))
+		world = XMMatrixScalingFromVector(XMVectorReplicate(0.1f))*pacman.maze->getTileWorld(x,y);
+	XMStoreFloat4x4(&instance.World, world);
+	return instance;
+}
+
+void DXRenderer::initPelletInstanceBuffer()
+{
+	ReleaseCOM(pelletInstanceBuffer);
+
+	Pellets* pellets = pacman.pellets;
+	num_pelletInstances = pellets->getSlotCount();
+	if(num_pelletInstances == 0)
+		return;
+
+	std::vector<Vertex::InstancedData> instances(num_pelletInstances);
+	for(int i = 0; i<num_pelletInstances; i++)
 	{
-		XMFLOAT4X4 identity; XMStoreFloat4x4(&identity, XMMatrixIdentity());//XMMatrixTranslation(i,i,i)
-		instances[i].World = identity;
+		Int2 tile = pellets->getSlotTile(i);
+		instances[i] = getPelletInstance(tile.x, tile.y);
 	}
 
+	// Default usage, pellets change rarely so slots are patched with UpdateSubresource
 	D3D11_BUFFER_DESC vbd;
-	vbd.Usage = D3D11_USAGE_DYNAMIC;
+	vbd.Usage = D3D11_USAGE_DEFAULT;
 	vbd.ByteWidth = sizeof(Vertex::InstancedData) * instances.size();
 	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	vbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	vbd.CPUAccessFlags = 0;
 	vbd.MiscFlags = 0;
 	vbd.StructureByteStride = 0;
+	D3D11_SUBRESOURCE_DATA vinitData;
+	vinitData.pSysMem = &instances[0];
+	HR(dxDevice->CreateBuffer(&vbd, &vinitData, &pelletInstanceBuffer));
 
-	HR(dxDevice->CreateBuffer(&vbd, 0, &instancedBuffer));
+	// Buffer is up to date
+	pellets->clearDirty();
 }
+
+void DXRenderer::updatePelletInstances()
+{
+	Pellets* pellets = pacman.pellets;
+
+	// Slot layout changed, recreate buffer
+	if(pellets->getSlotCount() != num_pelletInstances)
+	{
+		initPelletInstanceBuffer();
+		return;
+	}
+
+	// Only touch slots of tiles that changed this frame
+	const std::vector<int>& dirtyTiles = pellets->getDirtyTiles();
+	for(int i = 0; i<(int)dirtyTiles.size(); i++)
+	{
+		int slot = pellets->getSlot(dirtyTiles[i]);
+		Int2 tile = pellets->getTile(dirtyTiles[i]);
+		Vertex::InstancedData instance = getPelletInstance(tile.x, tile.y);
+
+		renderDevice->updateBuffer(pelletInstanceBuffer, slot*sizeof(Vertex::InstancedData), &instance, sizeof(instance));
+	}
+	pellets->clearDirty();
+}
\ No newline at end of file
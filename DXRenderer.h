@@ -9,8 +9,17 @@
 #include "Game.h"
 #include "ShaderManager.h"
 #include "ShadowMap.h"
+#include "ShadowCascades.h"
+#include "DynamicCubeMap.h"
 #include "Sky.h"
 #include "Sound.h"
+#include "D3D11RenderDevice.h"
+#include "FrustumCull.h"
+#include "OcclusionCull.h"
+#include "MazePVS.h"
+#include "Profiler.h"
+#include "RenderStats.h"
+#include "VertexFetchBenchmark.h"
 
 class DXRenderer
 {
@@ -23,6 +32,60 @@ private:
 	ID3D11DeviceContext* dxDeviceContext;
 	IDXGISwapChain* dxSwapChain;
 
+	// Device all frame calls go through, the recording device replaces
+	// the D3D11 one while frames are recorded
+	RenderDevice* renderDevice;
+	D3D11RenderDevice* d3dRenderDevice;
+	RecordingRenderDevice* recordingDevice;
+	RenderDeviceStats frameStats;	// calls of last presented frame
+	RenderStats renderStats;		// per pass, recorded frames included
+
+	// Effect variable writes of last presented frame, writes repeating
+	// the value already in the effect are skipped when cached
+	bool cacheEffectWrites;
+	int num_effectWrites;
+	int num_effectSkippedWrites;
+
+	struct RecordBenchmark
+	{
+		int num_frames;
+		float frameMs;			// CPU time of one recorded frame
+		int num_commands;
+		RenderDeviceStats stats;	// calls of one recorded frame
+	};
+	RecordBenchmark recordBenchmark;
+
+	// Frustum culling of bounded draw list packets
+	SphereCuller culler;
+	bool useFrustumCulling;
+
+	struct CullBenchmark
+	{
+		int num_spheres;
+		float scalarMs;
+		float sseMs;
+		float avxMs;
+		float threadedMs;
+		float frameMs_unculled;		// recorded frame without culling
+		float frameMs_culled;
+	};
+	CullBenchmark cullBenchmark;
+
+	// Occlusion culling of the main view, the occluders are the merged
+	// wall boxes of the maze and are rebuilt when the maze changes
+	OcclusionCuller occlusion;
+	bool useOcclusionCulling;
+	int occluderRevision;
+	XMFLOAT4X4 occluderWorld;
+
+	// Tiles seen from the camera tile limit the maze objects of the main
+	// view while the camera is inside the maze
+	MazePVS pvs;
+	bool usePVS;
+	BitGrid pvsTiles;		// objects on visible tiles, rebuilt per draw
+	int num_pvsVisible;		// tiles in the row of the camera tile
+	int num_pvsSkipped;		// packets of last frame
+
 	ID3D11RenderTargetView* view_renderTarget;
 	ID3D11DepthStencilView* view_depthStencil;
 	ID3D11Texture2D* tex_depthStencil;
@@ -39,12 +102,39 @@ private:
 	bool lockCamera;
 	bool lockPacmanCamera;
 
+	// One slice per cascade
 	ShadowMap* mSmap;
-	static const int SMapSize = 2048;
+	ShadowCascades cascades;
+
+	// Casters that only move when the maze changes are drawn to
+	// mStaticSmap, which is copied to mSmap every frame before the game
+	// entities and pellets are drawn on top. Each cascade is redrawn on
+	// its own.
+	ShadowMap* mStaticSmap;
+	bool useShadowCache;
+	struct StaticShadowKey
+	{
+		XMFLOAT4X4 shadowTransform;
+		XMFLOAT4X4 mazeWorld;
+		int mazeRevision;
+		int flags;			// objects drawn
+		float tess[7];
+	};
+	StaticShadowKey staticShadowKey[ShadowCascades::maxCascades];
+	bool staticShadowValid[ShadowCascades::maxCascades];
+	int num_staticShadowDraws;
+	int num_shadowCastersCulled;	// last frame
+	SphereCuller shadowCuller;
+
+	// Environment around the mesh, a few faces redrawn per frame
+	DynamicCubeMap* mDynamicCube;
+	bool useDynamicCube;
+	static const int CubeMapSize = 256;
 
 	DXDrawManager *drawManager;
 	Sky* mSky;
 	Terrain mTerrain;
+	VertexFetchBenchmark vertexFetchBenchmark;
 
 	// Tessellation
 	float tess_heightScale;
@@ -56,9 +146,12 @@ private:
 	float mesh_maxTessFactor;
 	float mesh_heightScale;
 
-	std::vector<Vertex::InstancedData> instancedData;
-	ID3D11Buffer* instancedBuffer;
-	int num_visibleObjects;
+	// One instance slot per pellet, only dirty slots are rewritten
+	ID3D11Buffer* pelletInstanceBuffer;
+	int num_pelletInstances;
+
+	// Scaled world matrix of every ghost, built once per frame
+	std::vector<XMFLOAT4X4> ghostWorlds;
 
 	// Settings
 	bool drawPacman;
@@ -66,6 +159,8 @@ private:
 	bool drawPlane;
 	bool drawSky;
 	bool drawMesh;
+	bool drawBakedMaze;
+	bool useDrawList;
 
 	// Sound 
 	// -- disclaimers, mem leak when creating sound buffers, 
@@ -92,13 +187,32 @@ public:
 	float getAspectRatio();
 
 	void initGameEntities();
-	void initInstanceBuffer();
+	void initPelletInstanceBuffer();
+	void updatePelletInstances();
+	Vertex::InstancedData getPelletInstance(int x, int y);
 
 	void update(float dt);
+	void updateShadowMaps();
+	void invalidateStaticShadows();
 	void DrawSceneToShadowMap();
+	void DrawCascadeToShadowMap(int cascade, ShadowMap* target, int layers, bool clear);
+	bool isDynamicCubeReady();
+	void DrawSceneToCubeMap();
+	void DrawCubeMapFace(int face, Camera& faceCam, DrawList& list);
 
 	void renderFrame();
+	void markPass(int pass);
+	void beginStatsCsv();
+	void endStatsCsv();
+	void recordFrames();
+	void runCullBenchmark();
+	void updateOccluders();
+	void rebakePVS();
+	const BitGrid* getCameraPVS();
+	int addTileBoxes(DrawList& list, const BitGrid& tiles, CXMMATRIX scale, int technique, UINT pass, int tess, ID3D11RasterizerState* rasterizerState);
 	void drawGame();
+	void collectDraws(DrawList& list, bool shadowPass, UINT num_passes, int layers, CXMMATRIX view, CXMMATRIX cullViewProj, const BitGrid* visibleTiles);
+	bool updateStaticShadowKey(int cascade);
 	void DrawScreenQuad(ID3D11ShaderResourceView* resource);
 
 };
@@ -55,10 +55,13 @@ public:
 	};
 	void renderFrame()
 	{
+		Profiler* profiler = Profiler::getInstance();
+		profiler->beginFrame();
 		timer.tick();
 		calcFPS();
 		renderer->update(timer.getDeltaTime());
 		renderer->renderFrame();
+		profiler->endFrame();
 	};
 	QPaintEngine* paintEngine() const {return 0;}; //Overrides Qt paint engine; prevents flicker
 
@@ -0,0 +1,383 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include <vector>
+#include <string.h>
+#include <math.h>
+#include "Util.h"
+#include "GameTimer.h"
+#include "FrustumCull.h"
+#include "OcclusionCull.h"
+
+//
+// Draw list
+//
+// Draws are collected as packets during a pass and sorted by a 64-bit key
+// before submission, so packets sharing technique, material and mesh end
+// up next to each other and the state between them only has to be set
+// once. Within equal state packets go front to back.
+//
+// Key, most significant first:
+//	pass		4 bits
+//	technique	4 bits
+//	material	8 bits
+//	mesh		8 bits
+//	tess		8 bits	index of the tessellation settings
+//	depth		32 bits	view depth as float bits, negative depth clamped to 0
+//
+
+enum DrawTechnique
+{
+	technique_tess,
+	technique_tessInstanced,
+	technique_shadow
+};
+
+// Objects collected for a pass, static ones only change with the maze
+enum DrawLayer
+{
+	layer_static = 1,
+	layer_dynamic = 2,
+	layer_all = layer_static | layer_dynamic
+};
+
+// Geometry a packet draws, shapes match the object ids of DXDrawManager
+enum DrawMesh
+{
+	mesh_box,
+	mesh_grid,
+	mesh_sphere,
+	mesh_obj,
+	mesh_maze,
+	num_drawMeshes
+};
+
+struct TessSettings
+{
+	float heightScale;
+	float maxTessDistance;
+	float minTessDistance;
+	float minTessFactor;
+	float maxTessFactor;
+
+	TessSettings()
+	{
+		heightScale = 0.0f;
+		maxTessDistance = 5.0f;
+		minTessDistance = 100.0f;
+		minTessFactor = 1.0f;
+		maxTessFactor = 1.0f;
+	};
+
+	TessSettings(float heightScale, float maxTessDistance, float minTessDistance, float minTessFactor, float maxTessFactor)
+	{
+		this->heightScale = heightScale;
+		this->maxTessDistance = maxTessDistance;
+		this->minTessDistance = minTessDistance;
+		this->minTessFactor = minTessFactor;
+		this->maxTessFactor = maxTessFactor;
+	};
+
+	bool operator==(const TessSettings& other) const
+	{
+		return memcmp(this, &other, sizeof(TessSettings)) == 0;
+	};
+};
+
+struct DrawPacket
+{
+	XMFLOAT4X4 world;
+	int mesh;
+	int material;
+	int technique;
+	UINT pass;
+	int tess;
+	ID3D11RasterizerState* rasterizerState;
+
+	// Instanced packets draw "num_instances" from "instanceBuffer"
+	ID3D11Buffer* instanceBuffer;
+	int num_instances;
+
+	// World space bounding sphere radius around the translation of
+	// "world", FLT_MAX if the packet is never culled
+	float radius;
+};
+
+class DrawList
+{
+private:
+	struct SortItem
+	{
+		UINT64 key;
+		int packet;
+	};
+
+	std::vector<DrawPacket> packets;
+	std::vector<SortItem> items;
+	std::vector<SortItem> scratch;
+	std::vector<TessSettings> tessSettings;
+	std::vector<int> visible;
+	XMFLOAT4 viewDepth;		// third column of view matrix
+
+	static UINT64 makeKey(const DrawPacket& packet, float depth)
+	{
+		UINT depthBits = 0;
+		if(depth > 0.0f)
+			memcpy(&depthBits, &depth, sizeof(depthBits));	// positive floats order like their bits
+
+		return
+			((UINT64)(packet.pass & 0xf) << 60) |
+			((UINT64)(packet.technique & 0xf) << 56) |
+			((UINT64)(packet.material & 0xff) << 48) |
+			((UINT64)(packet.mesh & 0xff) << 40) |
+			((UINT64)(packet.tess & 0xff) << 32) |
+			(UINT64)depthBits;
+	};
+
+	// State changes needed to draw packets in the order of "order"
+	int countStateChanges(const std::vector<SortItem>& order) const
+	{
+		int changes = 0;
+		const DrawPacket* last = 0;
+		for(int i=0; i<(int)order.size(); i++)
+		{
+			const DrawPacket& p = packets[order[i].packet];
+			if(!last || p.technique != last->technique || p.pass != last->pass)
+				changes++;
+			if(!last || p.material != last->material)
+				changes++;
+			if(!last || p.mesh != last->mesh || p.instanceBuffer != last->instanceBuffer)
+				changes++;
+			if(!last || p.tess != last->tess)
+				changes++;
+			if(!last || p.rasterizerState != last->rasterizerState)
+				changes++;
+			last = &p;
+		}
+		return changes;
+	};
+
+public:
+	// Statistics of last sort
+	int num_packets;
+	int num_stateChanges_unsorted;	// in submission order
+	int num_stateChanges;			// in sorted order
+	int num_radixPasses;			// byte passes not skipped
+	int num_culled;					// by last cull
+	int num_occluded;				// by last occlusion cull
+	float sortMs;
+
+	DrawList()
+	{
+		viewDepth = XMFLOAT4(0.0f, 0.0f, 1.0f, 0.0f);
+		num_packets = 0;
+		num_stateChanges_unsorted = 0;
+		num_stateChanges = 0;
+		num_radixPasses = 0;
+		num_culled = 0;
+		num_occluded = 0;
+		sortMs = 0.0f;
+	};
+
+	// Clears packets, depth is measured along the view direction of "view"
+	void begin(CXMMATRIX view)
+	{
+		packets.clear();
+		items.clear();
+		tessSettings.clear();
+		num_culled = 0;
+		num_occluded = 0;
+		XMFLOAT4X4 v;
+		XMStoreFloat4x4(&v, view);
+		viewDepth = XMFLOAT4(v._13, v._23, v._33, v._43);
+	};
+
+	// Index of "settings", equal settings share an index
+	int addTess(const TessSettings& settings)
+	{
+		for(int i=0; i<(int)tessSettings.size(); i++)
+		{
+			if(tessSettings[i] == settings)
+				return i;
+		}
+		tessSettings.push_back(settings);
+		return (int)tessSettings.size()-1;
+	};
+
+	const TessSettings& getTess(int index) const
+	{
+		return tessSettings[index];
+	};
+
+	void add(int mesh, int material, CXMMATRIX world, int technique, UINT pass, int tess, ID3D11RasterizerState* rasterizerState)
+	{
+		addInstanced(mesh, material, world, technique, pass, tess, rasterizerState, 0, 0);
+	};
+
+	// Packet culled by its bounding sphere, "localRadius" is scaled by the
+	// largest axis scale of "world"
+	void addBounded(int mesh, int material, CXMMATRIX world, int technique, UINT pass, int tess, ID3D11RasterizerState* rasterizerState, float localRadius)
+	{
+		addInstanced(mesh, material, world, technique, pass, tess, rasterizerState, 0, 0);
+
+		DrawPacket& packet = packets.back();
+		float scale = 0.0f;
+		const float* m = &packet.world._11;
+		for(int row=0; row<3; row++)
+		{
+			const float* r = m+row*4;
+			scale = MathUtil::Max(scale, r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+		}
+		packet.radius = localRadius*sqrtf(scale);
+	};
+
+	void addInstanced(int mesh, int material, CXMMATRIX world, int technique, UINT pass, int tess, ID3D11RasterizerState* rasterizerState, ID3D11Buffer* instanceBuffer, int num_instances)
+	{
+		DrawPacket packet;
+		XMStoreFloat4x4(&packet.world, world);
+		packet.mesh = mesh;
+		packet.material = material;
+		packet.technique = technique;
+		packet.pass = pass;
+		packet.tess = tess;
+		packet.rasterizerState = rasterizerState;
+		packet.instanceBuffer = instanceBuffer;
+		packet.num_instances = num_instances;
+		packet.radius = FLT_MAX;
+
+		float depth =
+			packet.world._41*viewDepth.x +
+			packet.world._42*viewDepth.y +
+			packet.world._43*viewDepth.z + viewDepth.w;
+
+		SortItem item;
+		item.key = makeKey(packet, depth);
+		item.packet = (int)packets.size();
+		items.push_back(item);
+		packets.push_back(packet);
+	};
+
+	// Drops packets whose bounding sphere is outside "planes", call before
+	// sort. Remaining packets keep their order.
+	void cull(SphereCuller& culler, const XMFLOAT4 planes[6])
+	{
+		culler.clear();
+		culler.reserve((int)items.size());
+		for(int i=0; i<(int)items.size(); i++)
+		{
+			const DrawPacket& packet = packets[items[i].packet];
+			culler.add(packet.world._41, packet.world._42, packet.world._43, packet.radius);
+		}
+		culler.cull(planes, visible);
+
+		// Visible indices ascend, so compacting in place is safe
+		for(int i=0; i<(int)visible.size(); i++)
+			items[i] = items[visible[i]];
+		num_culled = (int)items.size()-(int)visible.size();
+		items.resize(visible.size());
+	};
+
+	// Drops bounded packets hidden behind the occluders of "occlusion",
+	// which must have been rendered for this view. Call before sort.
+	void cullOccluded(OcclusionCuller& occlusion)
+	{
+		occlusion.beginTests();
+		int count = 0;
+		for(int i=0; i<(int)items.size(); i++)
+		{
+			const DrawPacket& packet = packets[items[i].packet];
+			if(packet.radius == FLT_MAX || occlusion.testSphere(XMFLOAT3(packet.world._41, packet.world._42, packet.world._43), packet.radius))
+				items[count++] = items[i];
+		}
+		occlusion.endTests();
+		num_occluded = (int)items.size()-count;
+		items.resize(count);
+	};
+
+	// Stable LSD radix sort over the key bytes, bytes equal in every key
+	// are skipped which leaves only a few passes for a typical frame
+	void sort()
+	{
+		Stopwatch watch;
+		num_packets = (int)items.size();
+		num_stateChanges_unsorted = countStateChanges(items);
+		num_radixPasses = 0;
+
+		int count[8][256];
+		memset(count, 0, sizeof(count));
+		for(int i=0; i<num_packets; i++)
+		{
+			UINT64 key = items[i].key;
+			for(int b=0; b<8; b++)
+				count[b][(key >> (b*8)) & 0xff]++;
+		}
+
+		scratch.resize(num_packets);
+		for(int b=0; b<8 && num_packets>1; b++)
+		{
+			int shift = b*8;
+			if(count[b][(items[0].key >> shift) & 0xff] == num_packets)
+				continue;
+
+			int offset[256];
+			int sum = 0;
+			for(int i=0; i<256; i++)
+			{
+				offset[i] = sum;
+				sum += count[b][i];
+			}
+			for(int i=0; i<num_packets; i++)
+				scratch[offset[(items[i].key >> shift) & 0xff]++] = items[i];
+			items.swap(scratch);
+			num_radixPasses++;
+		}
+
+		num_stateChanges = countStateChanges(items);
+		sortMs = watch.elapsedMs();
+	};
+
+	// FNV-1a hash of what the remaining packets draw, equal lists give
+	// equal hashes. "seed" chains hashes of other state.
+	UINT64 hash(UINT64 seed) const
+	{
+		UINT64 h = seed;
+		for(int i=0; i<(int)items.size(); i++)
+		{
+			const DrawPacket& packet = packets[items[i].packet];
+			h = hashBytes(h, &packet.world, sizeof(packet.world));
+			h = hashBytes(h, &packet.mesh, sizeof(packet.mesh));
+			h = hashBytes(h, &packet.material, sizeof(packet.material));
+			h = hashBytes(h, &packet.pass, sizeof(packet.pass));
+			h = hashBytes(h, &packet.rasterizerState, sizeof(packet.rasterizerState));
+			h = hashBytes(h, &packet.instanceBuffer, sizeof(packet.instanceBuffer));
+			h = hashBytes(h, &packet.num_instances, sizeof(packet.num_instances));
+			h = hashBytes(h, &tessSettings[packet.tess], sizeof(TessSettings));
+		}
+		return h;
+	};
+
+	static UINT64 hashBytes(UINT64 h, const void* data, int bytes)
+	{
+		const unsigned char* p = (const unsigned char*)data;
+		for(int i=0; i<bytes; i++)
+		{
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	};
+	static const UINT64 hashSeed = 14695981039346656037ULL;
+
+	int size() const
+	{
+		return (int)items.size();
+	};
+
+	// Packet "i" in sorted order
+	const DrawPacket& get(int i) const
+	{
+		return packets[items[i].packet];
+	};
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef DYNAMICCUBEMAP_H
+#define DYNAMICCUBEMAP_H
+
+#include "Util.h"
+#include "Camera.h"
+#include "RenderDevice.h"
+
+//
+// Dynamic cube map
+//
+// Environment captured around a point, one face at a time. Faces are
+// visited round-robin and at most "facesPerFrame" of them are drawn each
+// frame, so a full capture is spread over several frames. Every face keeps
+// a hash of what it saw when it was drawn, a face whose hash has not
+// changed is skipped without using up the budget.
+//
+
+class DynamicCubeMap
+{
+public:
+	static const int num_faces = 6;
+
+	// Settings
+	int facesPerFrame;
+	bool skipUnchanged;
+	float nearZ;
+	float farZ;
+
+	// Statistics of last frame
+	int num_facesDrawn;
+	int num_facesSkipped;
+	int num_packetsCulled;
+
+	DynamicCubeMap(ID3D11Device* device, UINT size)
+	{
+		mSize = size;
+		facesPerFrame = 1;
+		skipUnchanged = true;
+		nearZ = 0.1f;
+		farZ = 1000.0f;
+		mNextFace = 0;
+		mPosition = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		invalidate();
+		beginFrame();
+
+		mViewport.TopLeftX = 0.0f;
+		mViewport.TopLeftY = 0.0f;
+		mViewport.Width    = static_cast<float>(size);
+		mViewport.Height   = static_cast<float>(size);
+		mViewport.MinDepth = 0.0f;
+		mViewport.MaxDepth = 1.0f;
+
+		// Cube texture with a render target per face, mips are generated
+		// after faces are drawn
+		D3D11_TEXTURE2D_DESC texDesc;
+		texDesc.Width = size;
+		texDesc.Height = size;
+		texDesc.MipLevels = 0;
+		texDesc.ArraySize = num_faces;
+		texDesc.SampleDesc.Count = 1;
+		texDesc.SampleDesc.Quality = 0;
+		texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		texDesc.Usage = D3D11_USAGE_DEFAULT;
+		texDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+		texDesc.CPUAccessFlags = 0;
+		texDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS | D3D11_RESOURCE_MISC_TEXTURECUBE;
+
+		ID3D11Texture2D* cubeTex = 0;
+		HR(device->CreateTexture2D(&texDesc, 0, &cubeTex));
+
+		D3D11_RENDER_TARGET_VIEW_DESC rtvDesc;
+		rtvDesc.Format = texDesc.Format;
+		rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2DARRAY;
+		rtvDesc.Texture2DArray.ArraySize = 1;
+		rtvDesc.Texture2DArray.MipSlice = 0;
+		for(int i = 0; i < num_faces; ++i)
+		{
+			rtvDesc.Texture2DArray.FirstArraySlice = i;
+			HR(device->CreateRenderTargetView(cubeTex, &rtvDesc, &mRTV[i]));
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		srvDesc.Format = texDesc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+		srvDesc.TextureCube.MostDetailedMip = 0;
+		srvDesc.TextureCube.MipLevels = -1;
+		HR(device->CreateShaderResourceView(cubeTex, &srvDesc, &mSRV));
+
+		// Views hold their own references.
+		ReleaseCOM(cubeTex);
+
+		// Depth buffer shared by all faces
+		D3D11_TEXTURE2D_DESC depthTexDesc;
+		depthTexDesc.Width = size;
+		depthTexDesc.Height = size;
+		depthTexDesc.MipLevels = 1;
+		depthTexDesc.ArraySize = 1;
+		depthTexDesc.SampleDesc.Count = 1;
+		depthTexDesc.SampleDesc.Quality = 0;
+		depthTexDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		depthTexDesc.Usage = D3D11_USAGE_DEFAULT;
+		depthTexDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+		depthTexDesc.CPUAccessFlags = 0;
+		depthTexDesc.MiscFlags = 0;
+
+		ID3D11Texture2D* depthTex = 0;
+		HR(device->CreateTexture2D(&depthTexDesc, 0, &depthTex));
+
+		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc;
+		dsvDesc.Format = depthTexDesc.Format;
+		dsvDesc.Flags = 0;
+		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+		dsvDesc.Texture2D.MipSlice = 0;
+		HR(device->CreateDepthStencilView(depthTex, &dsvDesc, &mDSV));
+
+		ReleaseCOM(depthTex);
+	};
+	~DynamicCubeMap()
+	{
+		ReleaseCOM(mSRV);
+		ReleaseCOM(mDSV);
+		for(int i = 0; i < num_faces; ++i)
+			ReleaseCOM(mRTV[i]);
+	};
+
+	ID3D11ShaderResourceView* CubeMapSRV()
+	{
+		return mSRV;
+	};
+
+	// True once every face has been drawn, before that the cube holds
+	// undefined texels
+	bool isComplete() const
+	{
+		for(int i=0; i<num_faces; i++)
+		{
+			if(!mFaceValid[i])
+				return false;
+		}
+		return true;
+	};
+
+	// Moving the capture point invalidates every face
+	void setPosition(const XMFLOAT3& position)
+	{
+		if(memcmp(&position, &mPosition, sizeof(XMFLOAT3)) != 0)
+			invalidate();
+		mPosition = position;
+	};
+	XMFLOAT3 getPosition() const
+	{
+		return mPosition;
+	};
+
+	void invalidate()
+	{
+		for(int i=0; i<num_faces; i++)
+			mFaceValid[i] = false;
+	};
+
+	void beginFrame()
+	{
+		num_facesDrawn = 0;
+		num_facesSkipped = 0;
+		num_packetsCulled = 0;
+	};
+
+	// Face "i" of the round-robin order starting at the first face not
+	// visited last frame
+	int getScheduledFace(int i) const
+	{
+		return (mNextFace+i) % num_faces;
+	};
+	void endSchedule(int num_visited)
+	{
+		mNextFace = (mNextFace+num_visited) % num_faces;
+	};
+
+	// Camera looking down the axis of "face", with a 90 degree frustum so
+	// the six faces cover all directions
+	void buildFaceCamera(int face, Camera& camera) const
+	{
+		static const XMFLOAT3 looks[num_faces] =
+		{
+			XMFLOAT3(+1.0f, 0.0f, 0.0f),
+			XMFLOAT3(-1.0f, 0.0f, 0.0f),
+			XMFLOAT3(0.0f, +1.0f, 0.0f),
+			XMFLOAT3(0.0f, -1.0f, 0.0f),
+			XMFLOAT3(0.0f, 0.0f, +1.0f),
+			XMFLOAT3(0.0f, 0.0f, -1.0f)
+		};
+		static const XMFLOAT3 ups[num_faces] =
+		{
+			XMFLOAT3(0.0f, 1.0f, 0.0f),
+			XMFLOAT3(0.0f, 1.0f, 0.0f),
+			XMFLOAT3(0.0f, 0.0f, -1.0f),
+			XMFLOAT3(0.0f, 0.0f, +1.0f),
+			XMFLOAT3(0.0f, 1.0f, 0.0f),
+			XMFLOAT3(0.0f, 1.0f, 0.0f)
+		};
+
+		XMFLOAT3 target(mPosition.x+looks[face].x, mPosition.y+looks[face].y, mPosition.z+looks[face].z);
+		camera.LookAt(mPosition, target, ups[face]);
+		camera.SetLens(0.5f*XM_PI, 1.0f, nearZ, farZ);
+		camera.UpdateViewMatrix();
+	};
+
+	// True if "hash" differs from the content "face" was last drawn with,
+	// the hash is kept as the new content
+	bool updateFaceHash(int face, UINT64 hash)
+	{
+		if(skipUnchanged && mFaceValid[face] && mFaceHash[face] == hash)
+			return false;
+		mFaceHash[face] = hash;
+		mFaceValid[face] = true;
+		return true;
+	};
+
+	void BindFace(RenderDevice* dc, int face, const float clearColor[4])
+	{
+		dc->setViewports(1, &mViewport);
+		dc->setRenderTargets(1, &mRTV[face], mDSV);
+		dc->clearRenderTarget(mRTV[face], clearColor);
+		dc->clearDepthStencil(mDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
+	};
+
+	void GenerateMips(RenderDevice* dc)
+	{
+		dc->generateMips(mSRV);
+	};
+
+private:
+	DynamicCubeMap(const DynamicCubeMap& rhs);
+	DynamicCubeMap& operator=(const DynamicCubeMap& rhs);
+
+private:
+	UINT mSize;
+	XMFLOAT3 mPosition;
+	int mNextFace;
+
+	UINT64 mFaceHash[num_faces];
+	bool mFaceValid[num_faces];
+
+	ID3D11RenderTargetView* mRTV[num_faces];
+	ID3D11DepthStencilView* mDSV;
+	ID3D11ShaderResourceView* mSRV;
+	D3D11_VIEWPORT mViewport;
+};
+
+#endif
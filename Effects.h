@@ -13,6 +13,8 @@ public:
 	Effect(ID3D11Device* device, const std::wstring& filename)
 	{
 		fx = 0;
+		cacheWrites = true;
+		resetStats();
 
 		// Check last letter in path
 		char ending = filename[filename.length()-1];
@@ -75,8 +77,52 @@ public:
 		ReleaseCOM(fx);
 	}
 
+	// Statistics since last resetStats
+	int num_writes;
+	int num_skippedWrites;
+
+	// When false every write is forwarded to the effect
+	bool cacheWrites;
+
+	void resetStats()
+	{
+		num_writes = 0;
+		num_skippedWrites = 0;
+	}
+
 protected:
 	ID3DX11Effect* fx;
+
+	// Last value written to an effect variable. Values are compared by
+	// their bytes, for resources that is the view pointer.
+	template<typename T>
+	struct Shadow
+	{
+		T value;
+		bool valid;
+
+		Shadow()
+		{
+			valid = false;
+		}
+	};
+
+	// True if "value" differs from the last written value and has to be
+	// forwarded to the effect. Effects11 only uploads constant buffers
+	// touched since last Apply, so a skipped write also saves the upload.
+	template<typename T>
+	bool changed(Shadow<T>& shadow, const void* value)
+	{
+		if(cacheWrites && shadow.valid && memcmp(&shadow.value, value, sizeof(T)) == 0)
+		{
+			num_skippedWrites++;
+			return false;
+		}
+		memcpy(&shadow.value, value, sizeof(T));
+		shadow.valid = true;
+		num_writes++;
+		return true;
+	}
 };
 
 
@@ -95,77 +141,134 @@ public:
 
 	// Per object
 	ID3DX11EffectMatrixVariable* world;
+	Shadow<XMFLOAT4X4> last_world;
 	void SetWorld(CXMMATRIX M)
 	{
+		if(!changed(last_world, &M))
+			return;
 		world->SetMatrix(reinterpret_cast<const float*>(&M));
 		XMMATRIX worldInvTranspose = Util::InverseTranspose(M);
 		SetWorldInvTranspose(worldInvTranspose);
 	}
 
 	ID3DX11EffectMatrixVariable* worldInvTranspose;
-	void SetWorldInvTranspose(CXMMATRIX M)				{worldInvTranspose->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	Shadow<XMFLOAT4X4> last_worldInvTranspose;
+	void SetWorldInvTranspose(CXMMATRIX M)				{ if(changed(last_worldInvTranspose, &M)) worldInvTranspose->SetMatrix(reinterpret_cast<const float*>(&M)); }
 	ID3DX11EffectMatrixVariable* viewProj;
-	void SetViewProj(CXMMATRIX M)                       {viewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	Shadow<XMFLOAT4X4> last_viewProj;
+	void SetViewProj(CXMMATRIX M)                       { if(changed(last_viewProj, &M)) viewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
 	ID3DX11EffectMatrixVariable* worldViewProj;
-	void SetWorldViewProj(CXMMATRIX M)					{worldViewProj->SetMatrix(reinterpret_cast<const float*>(&M));}
+	Shadow<XMFLOAT4X4> last_worldViewProj;
+	void SetWorldViewProj(CXMMATRIX M)					{ if(changed(last_worldViewProj, &M)) worldViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
 	ID3DX11EffectVariable* fx_material;
-	void SetMaterial(const Material& material)			{fx_material->SetRawValue(&material, 0, sizeof(Material));}
+	Shadow<Material> last_material;
+	void SetMaterial(const Material& material)			{ if(changed(last_material, &material)) fx_material->SetRawValue(&material, 0, sizeof(Material)); }
 	ID3DX11EffectMatrixVariable* texTransform;
-	void SetTexTransform(CXMMATRIX M)                   { texTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	Shadow<XMFLOAT4X4> last_texTransform;
+	void SetTexTransform(CXMMATRIX M)                   { if(changed(last_texTransform, &M)) texTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
 	ID3DX11EffectMatrixVariable* shadowTransform;
-	void SetShadowTransform(CXMMATRIX M)                { shadowTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	Shadow<XMFLOAT4X4> last_shadowTransform;
+	void SetShadowTransform(CXMMATRIX M)                { if(changed(last_shadowTransform, &M)) shadowTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
+
+	// Bounds of the packed positions of the mesh
+	ID3DX11EffectVectorVariable* posScale;
+	Shadow<XMFLOAT3> last_posScale;
+	ID3DX11EffectVectorVariable* posOffset;
+	Shadow<XMFLOAT3> last_posOffset;
+	void SetPosBounds(const XMFLOAT3& scale, const XMFLOAT3& offset)
+	{
+		if(changed(last_posScale, &scale)) posScale->SetRawValue(&scale, 0, sizeof(XMFLOAT3));
+		if(changed(last_posOffset, &offset)) posOffset->SetRawValue(&offset, 0, sizeof(XMFLOAT3));
+	}
 
 	// Per frame
 	ID3DX11EffectVectorVariable* eyePosW;
-	void SetEyePosW(const XMFLOAT3& v)					{eyePosW->SetRawValue(&v, 0, sizeof(XMFLOAT3));}
+	Shadow<XMFLOAT3> last_eyePosW;
+	void SetEyePosW(const XMFLOAT3& v)					{ if(changed(last_eyePosW, &v)) eyePosW->SetRawValue(&v, 0, sizeof(XMFLOAT3)); }
 	ID3DX11EffectVariable* fx_dirLights;
-	void SetDirLights(const DirectionalLight* lights)	{fx_dirLights->SetRawValue(lights, 0, sizeof(DirectionalLight));}
+	Shadow<DirectionalLight> last_dirLights;
+	void SetDirLights(const DirectionalLight* lights)	{ if(changed(last_dirLights, lights)) fx_dirLights->SetRawValue(lights, 0, sizeof(DirectionalLight)); }
 	ID3DX11EffectVariable* fx_pointLights; 
-	void SetPointLights(const PointLight* lights)		{fx_pointLights->SetRawValue(lights, 0, sizeof(PointLight));}
+	Shadow<PointLight> last_pointLights;
+	void SetPointLights(const PointLight* lights)		{ if(changed(last_pointLights, lights)) fx_pointLights->SetRawValue(lights, 0, sizeof(PointLight)); }
 	ID3DX11EffectVariable* fx_spotLights;
-	void SetSpotLights(const SpotLight* lights)			{fx_spotLights->SetRawValue(lights, 0, sizeof(SpotLight));}
+	Shadow<SpotLight> last_spotLights;
+	void SetSpotLights(const SpotLight* lights)			{ if(changed(last_spotLights, lights)) fx_spotLights->SetRawValue(lights, 0, sizeof(SpotLight)); }
 
 	// Resources
 	ID3DX11EffectShaderResourceVariable* diffuseMap;
-	void SetDiffuseMap(ID3D11ShaderResourceView* tex)   {diffuseMap->SetResource(tex); }
+	Shadow<ID3D11ShaderResourceView*> last_diffuseMap;
+	void SetDiffuseMap(ID3D11ShaderResourceView* tex)   { if(changed(last_diffuseMap, &tex)) diffuseMap->SetResource(tex); }
 	ID3DX11EffectShaderResourceVariable* shadowMap;
-	void SetShadowMap(ID3D11ShaderResourceView* tex)    { shadowMap->SetResource(tex); }
+	Shadow<ID3D11ShaderResourceView*> last_shadowMap;
+	void SetShadowMap(ID3D11ShaderResourceView* tex)    { if(changed(last_shadowMap, &tex)) shadowMap->SetResource(tex); }
 	ID3DX11EffectShaderResourceVariable* cubeMap;
-	void SetCubeMap(ID3D11ShaderResourceView* tex)      { cubeMap->SetResource(tex); }
+	Shadow<ID3D11ShaderResourceView*> last_cubeMap;
+	void SetCubeMap(ID3D11ShaderResourceView* tex)      { if(changed(last_cubeMap, &tex)) cubeMap->SetResource(tex); }
 	ID3DX11EffectShaderResourceVariable* normalMap;
-	void SetNormalMap(ID3D11ShaderResourceView* tex)      { normalMap->SetResource(tex); }
-
+	Shadow<ID3D11ShaderResourceView*> last_normalMap;
+	void SetNormalMap(ID3D11ShaderResourceView* tex)      { if(changed(last_normalMap, &tex)) normalMap->SetResource(tex); }
+
+	// Cascaded shadows, always four transforms and splits
+	ID3DX11EffectMatrixVariable* cascadeTransforms;
+	Shadow<XMFLOAT4X4[4]> last_cascadeTransforms;
+	void SetCascadeTransforms(const XMFLOAT4X4* M)      { if(changed(last_cascadeTransforms, M)) cascadeTransforms->SetMatrixArray(reinterpret_cast<const float*>(M), 0, 4); }
+	ID3DX11EffectVectorVariable* cascadeSplits;
+	Shadow<XMFLOAT4> last_cascadeSplits;
+	void SetCascadeSplits(const XMFLOAT4& v)            { if(changed(last_cascadeSplits, &v)) cascadeSplits->SetRawValue(&v, 0, sizeof(XMFLOAT4)); }
+	ID3DX11EffectVectorVariable* eyeDirW;
+	Shadow<XMFLOAT3> last_eyeDirW;
+	void SetEyeDirW(const XMFLOAT3& v)                  { if(changed(last_eyeDirW, &v)) eyeDirW->SetRawValue(&v, 0, sizeof(XMFLOAT3)); }
+	ID3DX11EffectScalarVariable* numCascades;
+	Shadow<int> last_numCascades;
+	void SetNumCascades(int i)                          { if(changed(last_numCascades, &i)) numCascades->SetInt(i); }
+	ID3DX11EffectScalarVariable* shadowTexelSize;
+	Shadow<float> last_shadowTexelSize;
+	void SetShadowTexelSize(float f)                    { if(changed(last_shadowTexelSize, &f)) shadowTexelSize->SetFloat(f); }
 
 	// Tessellation
 	ID3DX11EffectScalarVariable* heightScale;
-	void SetHeightScale(float f)                        { heightScale->SetFloat(f); }
+	Shadow<float> last_heightScale;
+	void SetHeightScale(float f)                        { if(changed(last_heightScale, &f)) heightScale->SetFloat(f); }
 	ID3DX11EffectScalarVariable* maxTessDistance;
-	void SetMaxTessDistance(float f)                    { maxTessDistance->SetFloat(f); }
+	Shadow<float> last_maxTessDistance;
+	void SetMaxTessDistance(float f)                    { if(changed(last_maxTessDistance, &f)) maxTessDistance->SetFloat(f); }
 	ID3DX11EffectScalarVariable* minTessDistance;
-	void SetMinTessDistance(float f)                    { minTessDistance->SetFloat(f); }
+	Shadow<float> last_minTessDistance;
+	void SetMinTessDistance(float f)                    { if(changed(last_minTessDistance, &f)) minTessDistance->SetFloat(f); }
 	ID3DX11EffectScalarVariable* minTessFactor;
-	void SetMinTessFactor(float f)                      { minTessFactor->SetFloat(f); }
+	Shadow<float> last_minTessFactor;
+	void SetMinTessFactor(float f)                      { if(changed(last_minTessFactor, &f)) minTessFactor->SetFloat(f); }
 	ID3DX11EffectScalarVariable* maxTessFactor;
-	void SetMaxTessFactor(float f)                      { maxTessFactor->SetFloat(f); }
+	Shadow<float> last_maxTessFactor;
+	void SetMaxTessFactor(float f)                      { if(changed(last_maxTessFactor, &f)) maxTessFactor->SetFloat(f); }
 	ID3DX11EffectScalarVariable* useNormalMap;
-	void SetUseNormalMap(bool f)                      { useNormalMap->SetBool(f); }
+	Shadow<bool> last_useNormalMap;
+	void SetUseNormalMap(bool f)                      { if(changed(last_useNormalMap, &f)) useNormalMap->SetBool(f); }
 
 	// Terrain
 	ID3DX11EffectScalarVariable* texelCellSpaceU;
-	void SetTexelCellSpaceU(float f)                    { texelCellSpaceU->SetFloat(f); }
+	Shadow<float> last_texelCellSpaceU;
+	void SetTexelCellSpaceU(float f)                    { if(changed(last_texelCellSpaceU, &f)) texelCellSpaceU->SetFloat(f); }
 	ID3DX11EffectScalarVariable* texelCellSpaceV;
-	void SetTexelCellSpaceV(float f)                    { texelCellSpaceV->SetFloat(f); }
+	Shadow<float> last_texelCellSpaceV;
+	void SetTexelCellSpaceV(float f)                    { if(changed(last_texelCellSpaceV, &f)) texelCellSpaceV->SetFloat(f); }
 	ID3DX11EffectScalarVariable* worldCellSpace;
-	void SetWorldCellSpace(float f)                    { worldCellSpace->SetFloat(f); }
+	Shadow<float> last_worldCellSpace;
+	void SetWorldCellSpace(float f)                    { if(changed(last_worldCellSpace, &f)) worldCellSpace->SetFloat(f); }
 	ID3DX11EffectVectorVariable* worldFrustumPlanes;
-	void SetWorldFrustumPlanes(XMFLOAT4 planes[6])      { worldFrustumPlanes->SetFloatVectorArray(reinterpret_cast<float*>(planes), 0, 6); }
+	Shadow<XMFLOAT4[6]> last_worldFrustumPlanes;
+	void SetWorldFrustumPlanes(XMFLOAT4 planes[6])      { if(changed(last_worldFrustumPlanes, planes)) worldFrustumPlanes->SetFloatVectorArray(reinterpret_cast<float*>(planes), 0, 6); }
 	
 	ID3DX11EffectShaderResourceVariable* layerMapArray;
-	void SetLayerMapArray(ID3D11ShaderResourceView* tex)   { layerMapArray->SetResource(tex); }
+	Shadow<ID3D11ShaderResourceView*> last_layerMapArray;
+	void SetLayerMapArray(ID3D11ShaderResourceView* tex)   { if(changed(last_layerMapArray, &tex)) layerMapArray->SetResource(tex); }
 	ID3DX11EffectShaderResourceVariable* blendMap;
-	void SetBlendMap(ID3D11ShaderResourceView* tex)        { blendMap->SetResource(tex); }
+	Shadow<ID3D11ShaderResourceView*> last_blendMap;
+	void SetBlendMap(ID3D11ShaderResourceView* tex)        { if(changed(last_blendMap, &tex)) blendMap->SetResource(tex); }
 	ID3DX11EffectShaderResourceVariable* heightMap;
-	void SetHeightMap(ID3D11ShaderResourceView* tex)       { heightMap->SetResource(tex); }
+	Shadow<ID3D11ShaderResourceView*> last_heightMap;
+	void SetHeightMap(ID3D11ShaderResourceView* tex)       { if(changed(last_heightMap, &tex)) heightMap->SetResource(tex); }
 
 	FXStandard(ID3D11Device* device, const std::wstring& filename) : Effect(device, filename)
 	{
@@ -183,6 +286,8 @@ public:
 		fx_material = fx->GetVariableByName("gMaterial");
 		texTransform      = fx->GetVariableByName("gTexTransform")->AsMatrix();
 		shadowTransform   = fx->GetVariableByName("gShadowTransform")->AsMatrix();
+		posScale          = fx->GetVariableByName("gPosScale")->AsVector();
+		posOffset         = fx->GetVariableByName("gPosOffset")->AsVector();
 
 		// Per frame
 		eyePosW           = fx->GetVariableByName("gEyePosW")->AsVector();
@@ -196,6 +301,13 @@ public:
 		cubeMap           = fx->GetVariableByName("gCubeMap")->AsShaderResource();
 		normalMap         = fx->GetVariableByName("gNormalMap")->AsShaderResource();
 
+		// Cascaded shadows
+		cascadeTransforms = fx->GetVariableByName("gCascadeTransforms")->AsMatrix();
+		cascadeSplits     = fx->GetVariableByName("gCascadeSplits")->AsVector();
+		eyeDirW           = fx->GetVariableByName("gEyeDirW")->AsVector();
+		numCascades       = fx->GetVariableByName("gNumCascades")->AsScalar();
+		shadowTexelSize   = fx->GetVariableByName("gShadowTexelSize")->AsScalar();
+
 		// Tessellation
 		heightScale       = fx->GetVariableByName("gHeightScale")->AsScalar();
 		maxTessDistance   = fx->GetVariableByName("gMaxTessDistance")->AsScalar();
@@ -220,26 +332,32 @@ public:
 class FXBuildShadowMap : public Effect
 {
 public:
-	void SetViewProj(CXMMATRIX M)                       { ViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
-	void SetWorldViewProj(CXMMATRIX M)                  { WorldViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
-	void SetWorld(CXMMATRIX M)                          { World->SetMatrix(reinterpret_cast<const float*>(&M)); }
-	void SetWorldInvTranspose(CXMMATRIX M)              { WorldInvTranspose->SetMatrix(reinterpret_cast<const float*>(&M)); }
-	void SetTexTransform(CXMMATRIX M)                   { TexTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
-	void SetEyePosW(const XMFLOAT3& v)                  { EyePosW->SetRawValue(&v, 0, sizeof(XMFLOAT3)); }
+	void SetViewProj(CXMMATRIX M)                       { if(changed(last_viewProj, &M)) ViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	void SetWorldViewProj(CXMMATRIX M)                  { if(changed(last_worldViewProj, &M)) WorldViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	void SetWorld(CXMMATRIX M)                          { if(changed(last_world, &M)) World->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	void SetWorldInvTranspose(CXMMATRIX M)              { if(changed(last_worldInvTranspose, &M)) WorldInvTranspose->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	void SetTexTransform(CXMMATRIX M)                   { if(changed(last_texTransform, &M)) TexTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	void SetEyePosW(const XMFLOAT3& v)                  { if(changed(last_eyePosW, &v)) EyePosW->SetRawValue(&v, 0, sizeof(XMFLOAT3)); }
+	void SetPosBounds(const XMFLOAT3& scale, const XMFLOAT3& offset)
+	{
+		if(changed(last_posScale, &scale)) PosScale->SetRawValue(&scale, 0, sizeof(XMFLOAT3));
+		if(changed(last_posOffset, &offset)) PosOffset->SetRawValue(&offset, 0, sizeof(XMFLOAT3));
+	}
 
-	void SetHeightScale(float f)                        { HeightScale->SetFloat(f); }
-	void SetMaxTessDistance(float f)                    { MaxTessDistance->SetFloat(f); }
-	void SetMinTessDistance(float f)                    { MinTessDistance->SetFloat(f); }
-	void SetMinTessFactor(float f)                      { MinTessFactor->SetFloat(f); }
-	void SetMaxTessFactor(float f)                      { MaxTessFactor->SetFloat(f); }
+	void SetHeightScale(float f)                        { if(changed(last_heightScale, &f)) HeightScale->SetFloat(f); }
+	void SetMaxTessDistance(float f)                    { if(changed(last_maxTessDistance, &f)) MaxTessDistance->SetFloat(f); }
+	void SetMinTessDistance(float f)                    { if(changed(last_minTessDistance, &f)) MinTessDistance->SetFloat(f); }
+	void SetMinTessFactor(float f)                      { if(changed(last_minTessFactor, &f)) MinTessFactor->SetFloat(f); }
+	void SetMaxTessFactor(float f)                      { if(changed(last_maxTessFactor, &f)) MaxTessFactor->SetFloat(f); }
 
-	void SetDiffuseMap(ID3D11ShaderResourceView* tex)   { DiffuseMap->SetResource(tex); }
-	void SetNormalMap(ID3D11ShaderResourceView* tex)    { NormalMap->SetResource(tex); }
+	void SetDiffuseMap(ID3D11ShaderResourceView* tex)   { if(changed(last_diffuseMap, &tex)) DiffuseMap->SetResource(tex); }
+	void SetNormalMap(ID3D11ShaderResourceView* tex)    { if(changed(last_normalMap, &tex)) NormalMap->SetResource(tex); }
 
 	ID3DX11EffectTechnique* BuildShadowMapTech;
 	ID3DX11EffectTechnique* BuildShadowMapAlphaClipTech;
 	ID3DX11EffectTechnique* TessBuildShadowMapTech;
 	ID3DX11EffectTechnique* TessBuildShadowMapAlphaClipTech;
+	ID3DX11EffectTechnique* InstTessBuildShadowMapTech;
 
 	ID3DX11EffectMatrixVariable* ViewProj;
 	ID3DX11EffectMatrixVariable* WorldViewProj;
@@ -247,6 +365,8 @@ public:
 	ID3DX11EffectMatrixVariable* WorldInvTranspose;
 	ID3DX11EffectMatrixVariable* TexTransform;
 	ID3DX11EffectVectorVariable* EyePosW;
+	ID3DX11EffectVectorVariable* PosScale;
+	ID3DX11EffectVectorVariable* PosOffset;
 	ID3DX11EffectScalarVariable* HeightScale;
 	ID3DX11EffectScalarVariable* MaxTessDistance;
 	ID3DX11EffectScalarVariable* MinTessDistance;
@@ -256,6 +376,23 @@ public:
 	ID3DX11EffectShaderResourceVariable* DiffuseMap;
 	ID3DX11EffectShaderResourceVariable* NormalMap;
 
+	// Last written values
+	Shadow<XMFLOAT4X4> last_viewProj;
+	Shadow<XMFLOAT4X4> last_worldViewProj;
+	Shadow<XMFLOAT4X4> last_world;
+	Shadow<XMFLOAT4X4> last_worldInvTranspose;
+	Shadow<XMFLOAT4X4> last_texTransform;
+	Shadow<XMFLOAT3> last_eyePosW;
+	Shadow<XMFLOAT3> last_posScale;
+	Shadow<XMFLOAT3> last_posOffset;
+	Shadow<float> last_heightScale;
+	Shadow<float> last_maxTessDistance;
+	Shadow<float> last_minTessDistance;
+	Shadow<float> last_minTessFactor;
+	Shadow<float> last_maxTessFactor;
+	Shadow<ID3D11ShaderResourceView*> last_diffuseMap;
+	Shadow<ID3D11ShaderResourceView*> last_normalMap;
+
 	FXBuildShadowMap(ID3D11Device* device, const std::wstring& filename) : Effect(device, filename)
 	{
 		BuildShadowMapTech           = fx->GetTechniqueByName("BuildShadowMapTech");
@@ -263,6 +400,7 @@ public:
 
 		TessBuildShadowMapTech           = fx->GetTechniqueByName("TessBuildShadowMapTech");
 		TessBuildShadowMapAlphaClipTech  = fx->GetTechniqueByName("TessBuildShadowMapAlphaClipTech");
+		InstTessBuildShadowMapTech       = fx->GetTechniqueByName("InstTessBuildShadowMapTech");
 
 		ViewProj          = fx->GetVariableByName("gViewProj")->AsMatrix();
 		WorldViewProj     = fx->GetVariableByName("gWorldViewProj")->AsMatrix();
@@ -270,6 +408,8 @@ public:
 		WorldInvTranspose = fx->GetVariableByName("gWorldInvTranspose")->AsMatrix();
 		TexTransform      = fx->GetVariableByName("gTexTransform")->AsMatrix();
 		EyePosW           = fx->GetVariableByName("gEyePosW")->AsVector();
+		PosScale          = fx->GetVariableByName("gPosScale")->AsVector();
+		PosOffset         = fx->GetVariableByName("gPosOffset")->AsVector();
 		HeightScale       = fx->GetVariableByName("gHeightScale")->AsScalar();
 		MaxTessDistance   = fx->GetVariableByName("gMaxTessDistance")->AsScalar();
 		MinTessDistance   = fx->GetVariableByName("gMinTessDistance")->AsScalar();
@@ -289,15 +429,24 @@ public:
 		SkyTech       = fx->GetTechniqueByName("SkyTech");
 		WorldViewProj = fx->GetVariableByName("gWorldViewProj")->AsMatrix();
 		CubeMap       = fx->GetVariableByName("gCubeMap")->AsShaderResource();
+		PosScale      = fx->GetVariableByName("gPosScale")->AsVector();
+		PosOffset     = fx->GetVariableByName("gPosOffset")->AsVector();
 	};
 	~FXSkybox(){}
 
 	void SetWorldViewProj(CXMMATRIX M)                  { WorldViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
 	void SetCubeMap(ID3D11ShaderResourceView* cubemap)  { CubeMap->SetResource(cubemap); }
+	void SetPosBounds(const XMFLOAT3& scale, const XMFLOAT3& offset)
+	{
+		PosScale->SetRawValue(&scale, 0, sizeof(XMFLOAT3));
+		PosOffset->SetRawValue(&offset, 0, sizeof(XMFLOAT3));
+	}
 
 	ID3DX11EffectTechnique* SkyTech;
 
 	ID3DX11EffectMatrixVariable* WorldViewProj;
+	ID3DX11EffectVectorVariable* PosScale;
+	ID3DX11EffectVectorVariable* PosOffset;
 
 	ID3DX11EffectShaderResourceVariable* CubeMap;
 };
@@ -331,6 +480,34 @@ public:
 	ID3DX11EffectShaderResourceVariable* Texture;
 };
 
+class FXVertexFetch : public Effect
+{
+public:
+	FXVertexFetch(ID3D11Device* device, const std::wstring& filename) : Effect(device, filename)
+	{
+		PackedTech    = fx->GetTechniqueByName("PackedTech");
+		UnpackedTech  = fx->GetTechniqueByName("UnpackedTech");
+		WorldViewProj = fx->GetVariableByName("gWorldViewProj")->AsMatrix();
+		PosScale      = fx->GetVariableByName("gPosScale")->AsVector();
+		PosOffset     = fx->GetVariableByName("gPosOffset")->AsVector();
+	};
+	~FXVertexFetch(){}
+
+	void SetWorldViewProj(CXMMATRIX M)  { WorldViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
+	void SetPosBounds(const XMFLOAT3& scale, const XMFLOAT3& offset)
+	{
+		PosScale->SetRawValue(&scale, 0, sizeof(XMFLOAT3));
+		PosOffset->SetRawValue(&offset, 0, sizeof(XMFLOAT3));
+	}
+
+	ID3DX11EffectTechnique* PackedTech;
+	ID3DX11EffectTechnique* UnpackedTech;
+
+	ID3DX11EffectMatrixVariable* WorldViewProj;
+	ID3DX11EffectVectorVariable* PosScale;
+	ID3DX11EffectVectorVariable* PosOffset;
+};
+
 // Manager class
 class Effects
 {
@@ -339,6 +516,7 @@ public:
 	FXBuildShadowMap* fx_buildShadowMap;
 	FXSkybox* fx_skybox;
 	FXShowTexture* fx_showTexture;
+	FXVertexFetch* fx_vertexFetch;
 
 	Effects()
 	{
@@ -349,6 +527,7 @@ public:
 		SafeDelete(fx_buildShadowMap);
 		SafeDelete(fx_skybox);
 		SafeDelete(fx_showTexture);
+		SafeDelete(fx_vertexFetch);
 	}
 	
 	void init(ID3D11Device* device)
@@ -357,6 +536,7 @@ public:
 		fx_buildShadowMap = new FXBuildShadowMap(device, L"FX/Output/BuildShadowMap.fxo");
 		fx_skybox = new FXSkybox(device, L"FX/Output/Sky.fxo");
 		fx_showTexture = new FXShowTexture(device, L"FX/Output/ShowTexture.fxo");
+		fx_vertexFetch = new FXVertexFetch(device, L"FX/Output/VertexFetch.fxo");
 	}
 	void recompile(ID3D11Device* device)
 	{
@@ -365,6 +545,27 @@ public:
 		fx_buildShadowMap = new FXBuildShadowMap(device, L"FX/BuildShadowMap.fx");
 		fx_skybox = new FXSkybox(device, L"FX/Sky.fx");
 		fx_showTexture = new FXShowTexture(device, L"FX/ShowTexture.fx");
+		fx_vertexFetch = new FXVertexFetch(device, L"FX/VertexFetch.fx");
+	}
+
+	// Variable writes of the effects using shadow state
+	void resetStats()
+	{
+		fx_standard->resetStats();
+		fx_buildShadowMap->resetStats();
+	}
+	int getWrites()
+	{
+		return fx_standard->num_writes + fx_buildShadowMap->num_writes;
+	}
+	int getSkippedWrites()
+	{
+		return fx_standard->num_skippedWrites + fx_buildShadowMap->num_skippedWrites;
+	}
+	void setCacheWrites(bool cacheWrites)
+	{
+		fx_standard->cacheWrites = cacheWrites;
+		fx_buildShadowMap->cacheWrites = cacheWrites;
 	}
 
 private:
@@ -0,0 +1,329 @@
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+
+#include <ppl.h>
+#include <vector>
+#include "GameEntity.h"
+#include "FacingRotation.h"
+
+// Agents (ghosts, NPCs) stored as structure of arrays, batch updates
+// and spatial queries only touch the arrays they need
+class EntityStore
+{
+private:
+	// Number of agents below which batch updates stay on calling thread
+	static const int parallelThreshold = 4096;
+
+	unsigned int nextRandom(int i)
+	{
+		// xorshift, one state per agent keeps update thread safe
+		unsigned int x = seed[i];
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		seed[i] = x;
+		return x;
+	};
+
+	void updateAgent(int i, float dt, Maze* maze)
+	{
+		// True: agent is moving between two grid points
+		if(offset[i]>0.0f)
+		{
+			offset[i]-=dt*speed;
+			return;
+		}
+
+		// False: agent is at intersection, follow steering if it leads
+		// somewhere, otherwise pick a random open direction but avoid
+		// U-turns unless it is a dead end
+		static const int dirs[4][2] = {{1,0}, {-1,0}, {0,1}, {0,-1}};
+		int open[4];
+		int num_open = 0;
+		for(int d=0; d<4; d++)
+		{
+			if(dirs[d][0] == -dirX[i] && dirs[d][1] == -dirY[i])
+				continue;
+			if(maze->getTile(tileX[i]+dirs[d][0], tileY[i]+dirs[d][1]) != 1)
+				open[num_open++] = d;
+		}
+
+		bool steered = (steerX[i]!=0 || steerY[i]!=0) &&
+			maze->getTile(tileX[i]+steerX[i], tileY[i]+steerY[i]) != 1;
+		if(steered)
+		{
+			dirX[i] = steerX[i];
+			dirY[i] = steerY[i];
+			steerX[i] = 0;
+			steerY[i] = 0;
+		}
+		// True: dead end, turn around
+		else if(num_open == 0)
+		{
+			dirX[i] = -dirX[i];
+			dirY[i] = -dirY[i];
+			if(maze->getTile(tileX[i]+dirX[i], tileY[i]+dirY[i]) == 1)
+				return; // boxed in
+		}
+		else
+		{
+			int d = open[nextRandom(i) % num_open];
+			dirX[i] = dirs[d][0];
+			dirY[i] = dirs[d][1];
+		}
+
+		// Perform movement
+		tileX[i] += dirX[i];
+		tileY[i] += dirY[i];
+		offset[i] += 1.0f;
+		if(offset[i]<=0.0f)
+			offset[i] = 1.0f;
+	};
+
+public:
+	// Tile the agent is moving towards
+	std::vector<int> tileX;
+	std::vector<int> tileY;
+	// Distance left to target tile, hides transition between grid
+	std::vector<float> offset;
+	std::vector<int> dirX;
+	std::vector<int> dirY;
+	// Preferred direction at next intersection, zero means wander
+	std::vector<int> steerX;
+	std::vector<int> steerY;
+	std::vector<unsigned int> seed;
+	// Rotation quaternion, turned towards current direction every update
+	std::vector<float> rotX;
+	std::vector<float> rotY;
+	std::vector<float> rotZ;
+	std::vector<float> rotW;
+
+	float speed;
+	float radius;
+	float turningSpeed;	// same meaning as in GameEntity
+	bool slerpRotations;	// false: plain nlerp, cheaper but uneven speed
+
+	EntityStore()
+	{
+		speed = 3.5f;
+		radius = 0.35f;
+		turningSpeed = 8.0f;
+		slerpRotations = true;
+	};
+
+	int size() const
+	{
+		return (int)tileX.size();
+	};
+
+	void clear()
+	{
+		tileX.clear();
+		tileY.clear();
+		offset.clear();
+		dirX.clear();
+		dirY.clear();
+		steerX.clear();
+		steerY.clear();
+		seed.clear();
+		rotX.clear();
+		rotY.clear();
+		rotZ.clear();
+		rotW.clear();
+	};
+
+	void reserve(int count)
+	{
+		tileX.reserve(count);
+		tileY.reserve(count);
+		offset.reserve(count);
+		dirX.reserve(count);
+		dirY.reserve(count);
+		steerX.reserve(count);
+		steerY.reserve(count);
+		seed.reserve(count);
+		rotX.reserve(count);
+		rotY.reserve(count);
+		rotZ.reserve(count);
+		rotW.reserve(count);
+	};
+
+	// True if every array has an element for every agent
+	bool isConsistent() const
+	{
+		size_t count = tileX.size();
+		return tileY.size()==count && offset.size()==count &&
+			dirX.size()==count && dirY.size()==count &&
+			steerX.size()==count && steerY.size()==count &&
+			seed.size()==count &&
+			rotX.size()==count && rotY.size()==count && rotZ.size()==count && rotW.size()==count;
+	};
+
+	// Exchanges agent arrays with "other", settings are kept
+	void swapState(EntityStore& other)
+	{
+		tileX.swap(other.tileX);
+		tileY.swap(other.tileY);
+		offset.swap(other.offset);
+		dirX.swap(other.dirX);
+		dirY.swap(other.dirY);
+		steerX.swap(other.steerX);
+		steerY.swap(other.steerY);
+		seed.swap(other.seed);
+		rotX.swap(other.rotX);
+		rotY.swap(other.rotY);
+		rotZ.swap(other.rotZ);
+		rotW.swap(other.rotW);
+	};
+
+	int spawn(int x, int y)
+	{
+		int index = size();
+		tileX.push_back(x);
+		tileY.push_back(y);
+		offset.push_back(0.0f);
+		dirX.push_back(1);
+		dirY.push_back(0);
+		steerX.push_back(0);
+		steerY.push_back(0);
+		seed.push_back(2463534242u + 7919u*index);
+		const float* facing = FacingRotation::get(1, 0);
+		rotX.push_back(facing[0]);
+		rotY.push_back(facing[1]);
+		rotZ.push_back(facing[2]);
+		rotW.push_back(facing[3]);
+		return index;
+	};
+
+	// Spawns agents spread over the empty tiles of the maze
+	void spawnRandom(Maze* maze, int count)
+	{
+		std::vector<Int2> emptyTiles;
+		for(int y=0; y<maze->getSizeY(); y++)
+			for(int x=0; x<maze->getSizeX(); x++)
+				if(maze->getTile(x,y) == 0)
+					emptyTiles.push_back(Int2(x,y));
+		if(emptyTiles.empty())
+			return;
+
+		reserve(size()+count);
+		for(int i=0; i<count; i++)
+		{
+			Int2 tile = emptyTiles[(i*7919) % emptyTiles.size()];
+			spawn(tile.x, tile.y);
+		}
+	};
+
+	void update(float dt, Maze* maze)
+	{
+		int num_agents = size();
+		if(num_agents < parallelThreshold)
+		{
+			for(int i=0; i<num_agents; i++)
+				updateAgent(i, dt, maze);
+			updateRotations(dt);
+			return;
+		}
+
+		// Agents are independent, update in chunks on worker threads
+		const int chunkSize = 1024;
+		int num_chunks = (num_agents+chunkSize-1)/chunkSize;
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int end = MathUtil::Min(num_agents, (chunk+1)*chunkSize);
+			for(int i=chunk*chunkSize; i<end; i++)
+				updateAgent(i, dt, maze);
+		});
+		updateRotations(dt);
+	};
+
+	// Turns every agent towards the direction it is moving in
+	void updateRotations(float dt)
+	{
+		int num_agents = size();
+		if(num_agents == 0)
+			return;
+
+		float t = turningSpeed*dt;
+		if(num_agents < parallelThreshold)
+		{
+			FacingRotation::interpolate(&rotX[0], &rotY[0], &rotZ[0], &rotW[0], &dirX[0], &dirY[0], t, 0, num_agents, slerpRotations);
+			return;
+		}
+
+		// Chunk size is a multiple of four so only last chunk has a remainder
+		const int chunkSize = 1024;
+		int num_chunks = (num_agents+chunkSize-1)/chunkSize;
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int end = MathUtil::Min(num_agents, (chunk+1)*chunkSize);
+			FacingRotation::interpolate(&rotX[0], &rotY[0], &rotZ[0], &rotW[0], &dirX[0], &dirY[0], t, chunk*chunkSize, end, slerpRotations);
+		});
+	};
+
+	// Writes scale*rotation*translation*tile matrix of every agent to
+	// "out", which must hold size() matrices
+	void buildWorlds(Maze* maze, XMFLOAT4X4* out, float scale)
+	{
+		int num_agents = size();
+		XMMATRIX S = XMMatrixScaling(scale, scale, scale);
+		auto compose = [&](int i)
+		{
+			XMMATRIX R = XMMatrixRotationQuaternion(XMVectorSet(rotX[i], rotY[i], rotZ[i], rotW[i]));
+			// Translation hides transition between grid, no need for a multiply
+			R.r[3] = XMVectorSet(-dirX[i]*offset[i], 0.0f, -dirY[i]*offset[i], 1.0f);
+
+			XMMATRIX W;
+			if(maze->getWalls().isValidIndex(tileX[i], tileY[i]))
+				W = maze->getTileWorld(tileX[i], tileY[i]);
+			else
+				W = (XMMATRIX)maze->getPosition(tileX[i], tileY[i]);
+			XMStoreFloat4x4(&out[i], S*R*W);
+		};
+
+		// Tile worlds are rebuilt lazily, do it before going wide
+		maze->getTileWorld(0, 0);
+		if(num_agents < parallelThreshold)
+		{
+			for(int i=0; i<num_agents; i++)
+				compose(i);
+			return;
+		}
+
+		const int chunkSize = 1024;
+		int num_chunks = (num_agents+chunkSize-1)/chunkSize;
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int end = MathUtil::Min(num_agents, (chunk+1)*chunkSize);
+			for(int i=chunk*chunkSize; i<end; i++)
+				compose(i);
+		});
+	};
+
+	// Continuous position in tile space
+	Float2 getTilePos(int i) const
+	{
+		return Float2(
+			tileX[i] - dirX[i]*offset[i],
+			tileY[i] - dirY[i]*offset[i]);
+	};
+
+	// Nearest tile to the continuous position
+	Int2 getNearestTile(int i) const
+	{
+		Float2 p = getTilePos(i);
+		return Int2((int)floorf(p.x+0.5f), (int)floorf(p.y+0.5f));
+	};
+
+	D3DXMATRIX getPos(int i, Maze* maze) const
+	{
+		// Hides transition between grid
+		D3DXMATRIX translation;
+		D3DXMatrixTranslation(&translation, -dirX[i]*offset[i], 0, -dirY[i]*offset[i]);
+		D3DXMATRIX rotation;
+		D3DXQUATERNION q(rotX[i], rotY[i], rotZ[i], rotW[i]);
+		D3DXMatrixRotationQuaternion(&rotation, &q);
+		return rotation*translation*maze->getPosition(tileX[i],tileY[i]);
+	};
+};
+#endif
@@ -5,6 +5,7 @@
 //=============================================================================
 
 #include "LightHelper.fx"
+#include "VertexPacking.fx"
  
 cbuffer cbPerFrame
 {
@@ -14,6 +15,16 @@ cbuffer cbPerFrame
 	float3 gEyePosW;
 };
 
+// Cascaded shadow map of the directional light
+cbuffer cbShadow
+{
+	float4x4 gCascadeTransforms[4];
+	float4 gCascadeSplits;		// view depth where each cascade ends
+	float3 gEyeDirW;
+	int gNumCascades;
+	float gShadowTexelSize;
+};
+
 cbuffer cbTess
 {
 	float gHeightScale;
@@ -47,7 +58,7 @@ cbuffer cbPerObject
 	Material gMaterial;
 };
 
-Texture2D gShadowMap;
+Texture2DArray gShadowMap;
 Texture2D gDiffuseMap;
 Texture2D gNormalMap;
 TextureCube gCubeMap;
@@ -87,12 +98,13 @@ SamplerComparisonState samShadow
     ComparisonFunc = LESS;
 };
 
+// Vertex::packed
 struct VertexIn
 {
-	float3 PosL    : POSITION;
-	float3 NormalL : NORMAL;
+	float4 PosQ    : POSITION;
+	float2 NormalQ : NORMAL;
 	float2 Tex     : TEXCOORD;
-	float3 TangentL : TANGENT;
+	float2 TangentQ : TANGENT;
 };
 
 struct VertexOut
@@ -101,19 +113,39 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
 	float2 Tex     : TEXCOORD0;
-	float3 TangentW : TANGENT;
+	float4 TangentW : TANGENT;
 	float4 ShadowPosH : TEXCOORD1;
 };
 
+// Shadow factor of the cascade covering "posW", lit beyond the last one
+float CascadeShadowFactor(float3 posW)
+{
+	float depth = dot(posW - gEyePosW, gEyeDirW);
+	if(depth > gCascadeSplits[gNumCascades-1])
+		return 1.0f;
+
+	int cascade = 0;
+	[unroll]
+	for(int i = 0; i < 3; ++i)
+	{
+		if(depth > gCascadeSplits[i])
+			cascade = i+1;
+	}
+
+	float4 shadowPosH = mul(float4(posW, 1.0f), gCascadeTransforms[cascade]);
+	return CalcCascadeShadowFactor(samShadow, gShadowMap, shadowPosH, cascade, gShadowTexelSize);
+}
+
 // Normal
 VertexOut VS(VertexIn vin)
 {
 	VertexOut vout;
+	float3 posL = DecodePosition(vin.PosQ);
 	
 	// Transform to world space space.
-	vout.PosW    = mul(float4(vin.PosL, 1.0f), gWorld).xyz;
-	vout.NormalW = mul(vin.NormalL, (float3x3)gWorldInvTranspose);
-	vout.TangentW = mul(vin.TangentL, (float3x3)gWorld);
+	vout.PosW    = mul(float4(posL, 1.0f), gWorld).xyz;
+	vout.NormalW = mul(DecodeOctahedral(vin.NormalQ), (float3x3)gWorldInvTranspose);
+	vout.TangentW = float4(mul(DecodeOctahedral(vin.TangentQ), (float3x3)gWorld), DecodeHandedness(vin.PosQ));
 		
 	// Transform to homogeneous clip space.
 	vout.PosH = mul(float4(vout.PosW, 1.0f), gViewProj);
@@ -122,7 +154,7 @@ VertexOut VS(VertexIn vin)
 	vout.Tex = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
 	
 	// Generate projective tex-coords to project shadow map onto scene.
-	vout.ShadowPosH = mul(float4(vin.PosL, 1.0f), gShadowTransform);
+	vout.ShadowPosH = mul(float4(posL, 1.0f), gShadowTransform);
 
 	return vout;
 }
@@ -135,7 +167,7 @@ struct tess_VertexOut
 {
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
-	float3 TangentW : TANGENT;
+	float4 TangentW : TANGENT;
 	float2 Tex     : TEXCOORD0;
 	float  TessFactor : TESS;
 };
@@ -145,9 +177,9 @@ tess_VertexOut tess_VS(VertexIn vin)
 	tess_VertexOut vout;
 	
 	// Transform to world space space.
-	vout.PosW    = mul(float4(vin.PosL, 1.0f), gWorld).xyz;
-	vout.NormalW = mul(vin.NormalL, (float3x3)gWorldInvTranspose);
-	vout.TangentW = mul(vin.TangentL, (float3x3)gWorld);
+	vout.PosW    = mul(float4(DecodePosition(vin.PosQ), 1.0f), gWorld).xyz;
+	vout.NormalW = mul(DecodeOctahedral(vin.NormalQ), (float3x3)gWorldInvTranspose);
+	vout.TangentW = float4(mul(DecodeOctahedral(vin.TangentQ), (float3x3)gWorld), DecodeHandedness(vin.PosQ));
 
 	// Output vertex attributes for interpolation across triangle.
 	vout.Tex = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
@@ -166,11 +198,11 @@ tess_VertexOut tess_VS(VertexIn vin)
 
 struct inst_VertexIn
 {
-	float3 PosL    : POSITION;
-	float3 NormalL : NORMAL;
+	float4 PosQ    : POSITION;
+	float2 NormalQ : NORMAL;
 	float2 Tex     : TEXCOORD;
-	float3 TangentL : TANGENT;
-	column_major float4x4 World  : WORLD;
+	float2 TangentQ : TANGENT;
+	row_major float4x4 World  : WORLD;
 	uint InstanceId : SV_InstanceID;
 };
 
@@ -183,9 +215,9 @@ tess_VertexOut inst_VS(inst_VertexIn vin)
 	tess_VertexOut vout;
 	
 	// Transform to world space space.
-	vout.PosW    = mul(float4(vin.PosL, 1.0f), vin.World).xyz;
-	vout.NormalW = mul(vin.NormalL, (float3x3)vin.World);
-	vout.TangentW = mul(vin.TangentL, (float3x3)vin.World);
+	vout.PosW    = mul(float4(DecodePosition(vin.PosQ), 1.0f), vin.World).xyz;
+	vout.NormalW = mul(DecodeOctahedral(vin.NormalQ), (float3x3)vin.World);
+	vout.TangentW = float4(mul(DecodeOctahedral(vin.TangentQ), (float3x3)vin.World), DecodeHandedness(vin.PosQ));
 		
 	// Output vertex attributes for interpolation across triangle.
 	vout.Tex = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
@@ -224,7 +256,7 @@ struct HullOut
 {
 	float3 PosW     : POSITION;
     float3 NormalW  : NORMAL;
-	float3 TangentW : TANGENT;
+	float4 TangentW : TANGENT;
 	float2 Tex      : TEXCOORD;
 };
 
@@ -255,7 +287,7 @@ struct DomainOut
 	float4 PosH       : SV_POSITION;
     float3 PosW       : POSITION;
     float3 NormalW    : NORMAL;
-	float3 TangentW   : TANGENT;
+	float4 TangentW   : TANGENT;
 	float2 Tex        : TEXCOORD0;
 	float4 ShadowPosH : TEXCOORD1;
 };
@@ -347,7 +379,7 @@ float4 tess_PS(DomainOut pin) : SV_Target
 
 	// Only the first light casts a shadow.
 	float3 shadow = float3(1.0f, 1.0f, 1.0f);
-	shadow[0] = CalcShadowFactor(samShadow, gShadowMap, pin.ShadowPosH);
+	shadow[0] = CascadeShadowFactor(pin.PosW);
 
 	// Sum the light contribution from each light source.
 	float4 A, D, S;
@@ -378,7 +410,7 @@ float4 tess_PS(DomainOut pin) : SV_Target
 	float3 reflectionVector = reflect(incident, bumpedNormalW);
 	float4 reflectionColor  = gCubeMap.Sample(samAnisotropic, reflectionVector);
 
-	litColor += 0.0f*reflectionColor;
+	litColor += gMaterial.Reflect*reflectionColor;
 	
 	// Show normal map
 	//litColor = float4(bumpedNormalW, 1.0f);
@@ -424,7 +456,7 @@ float4 PS(VertexOut pin) : SV_Target
 
 	// Only the first light casts a shadow.
 	float3 shadow = float3(1.0f, 1.0f, 1.0f);
-	shadow[0] = CalcShadowFactor(samShadow, gShadowMap, pin.ShadowPosH);
+	shadow[0] = CascadeShadowFactor(pin.PosW);
 
 	// Sum the light contribution from each light source.
 	float4 A, D, S;
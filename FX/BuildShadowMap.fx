@@ -9,6 +9,8 @@
 // geometry the eye sees.
 //=============================================================================
 
+#include "VertexPacking.fx"
+
 cbuffer cbPerFrame
 {
 	float3 gEyePosW;
@@ -40,10 +42,11 @@ SamplerState samLinear
 	AddressV = Wrap;
 };
 
+// Vertex::packed, tangent is not read
 struct VertexIn
 {
-	float3 PosL     : POSITION;
-	float3 NormalL  : NORMAL;
+	float4 PosQ     : POSITION;
+	float2 NormalQ  : NORMAL;
 	float2 Tex      : TEXCOORD;
 };
 
@@ -57,7 +60,7 @@ VertexOut VS(VertexIn vin)
 {
 	VertexOut vout;
 
-	vout.PosH = mul(float4(vin.PosL, 1.0f), gWorldViewProj);
+	vout.PosH = mul(float4(DecodePosition(vin.PosQ), 1.0f), gWorldViewProj);
 	vout.Tex  = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
 
 	return vout;
@@ -75,8 +78,8 @@ TessVertexOut TessVS(VertexIn vin)
 {
 	TessVertexOut vout;
 
-	vout.PosW     = mul(float4(vin.PosL, 1.0f), gWorld).xyz;
-	vout.NormalW  = mul(vin.NormalL, (float3x3)gWorldInvTranspose);
+	vout.PosW     = mul(float4(DecodePosition(vin.PosQ), 1.0f), gWorld).xyz;
+	vout.NormalW  = mul(DecodeOctahedral(vin.NormalQ), (float3x3)gWorldInvTranspose);
 	vout.Tex      = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
 
 	float d = distance(vout.PosW, gEyePosW);
@@ -93,6 +96,30 @@ TessVertexOut TessVS(VertexIn vin)
 	return vout;
 }
 
+// Instanced, world matrix per instance
+struct InstVertexIn
+{
+	float4 PosQ     : POSITION;
+	float2 NormalQ  : NORMAL;
+	float2 Tex      : TEXCOORD;
+	row_major float4x4 World : WORLD;
+};
+
+TessVertexOut InstTessVS(InstVertexIn vin)
+{
+	TessVertexOut vout;
+
+	vout.PosW     = mul(float4(DecodePosition(vin.PosQ), 1.0f), vin.World).xyz;
+	vout.NormalW  = mul(DecodeOctahedral(vin.NormalQ), (float3x3)vin.World);
+	vout.Tex      = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
+
+	float d = distance(vout.PosW, gEyePosW);
+	float tess = saturate( (gMinTessDistance - d) / (gMinTessDistance - gMaxTessDistance) );
+	vout.TessFactor = gMinTessFactor + tess*(gMaxTessFactor-gMinTessFactor);
+
+	return vout;
+}
+
 struct PatchTess
 {
 	float EdgeTess[3] : SV_TessFactor;
@@ -274,6 +301,20 @@ technique11 TessBuildShadowMapTech
     }
 }
 
+technique11 InstTessBuildShadowMapTech
+{
+    pass P0
+    {
+        SetVertexShader( CompileShader( vs_5_0, InstTessVS() ) );
+		SetHullShader( CompileShader( hs_5_0, HS() ) );
+        SetDomainShader( CompileShader( ds_5_0, DS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( NULL );
+
+		SetRasterizerState(Depth);
+    }
+}
+
 technique11 TessBuildShadowMapAlphaClipTech
 {
     pass P0
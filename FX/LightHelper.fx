@@ -200,15 +200,15 @@ void ComputeSpotLight(Material mat, SpotLight L, float3 pos, float3 normal, floa
 //---------------------------------------------------------------------------------------
 // Transforms a normal map sample to world space.
 //---------------------------------------------------------------------------------------
-float3 NormalSampleToWorldSpace(float3 normalMapSample, float3 unitNormalW, float3 tangentW)
+float3 NormalSampleToWorldSpace(float3 normalMapSample, float3 unitNormalW, float4 tangentW)
 {
 	// Uncompress each component from [0,1] to [-1,1].
 	float3 normalT = 2.0f*normalMapSample - 1.0f;
 
 	// Build orthonormal basis.
 	float3 N = unitNormalW;
-	float3 T = normalize(tangentW - dot(tangentW, N)*N);
-	float3 B = cross(N, T);
+	float3 T = normalize(tangentW.xyz - dot(tangentW.xyz, N)*N);
+	float3 B = tangentW.w*cross(N, T);
 
 	float3x3 TBN = float3x3(T, B, N);
 
@@ -253,5 +253,37 @@ float CalcShadowFactor(SamplerComparisonState samShadow,
 			shadowPosH.xy + offsets[i], depth).r;
 	}
 
+	return percentLit /= 9.0f;
+}
+
+//---------------------------------------------------------------------------------------
+// Same test against one slice of a cascaded shadow map, "dx" is the
+// texel size of the map.
+//---------------------------------------------------------------------------------------
+
+float CalcCascadeShadowFactor(SamplerComparisonState samShadow, 
+                              Texture2DArray shadowMap, 
+                              float4 shadowPosH,
+                              float cascade,
+                              float dx)
+{
+	shadowPosH.xyz /= shadowPosH.w;
+	float depth = shadowPosH.z;
+
+	float percentLit = 0.0f;
+	const float2 offsets[9] = 
+	{
+		float2(-dx,  -dx), float2(0.0f,  -dx), float2(dx,  -dx),
+		float2(-dx, 0.0f), float2(0.0f, 0.0f), float2(dx, 0.0f),
+		float2(-dx,  +dx), float2(0.0f,  +dx), float2(dx,  +dx)
+	};
+
+	[unroll]
+	for(int i = 0; i < 9; ++i)
+	{
+		percentLit += shadowMap.SampleCmpLevelZero(samShadow, 
+			float3(shadowPosH.xy + offsets[i], cascade), depth).r;
+	}
+
 	return percentLit /= 9.0f;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 // Effect used to shade sky dome.
 //=============================================================================
 
+#include "VertexPacking.fx"
+
 cbuffer cbPerFrame
 {
 	float4x4 gWorldViewProj;
@@ -19,9 +21,10 @@ SamplerState samTriLinearSam
 	AddressV = Wrap;
 };
 
+// Vertex::packed, only the position is read
 struct VertexIn
 {
-	float3 PosL : POSITION;
+	float4 PosQ : POSITION;
 };
 
 struct VertexOut
@@ -33,12 +36,13 @@ struct VertexOut
 VertexOut VS(VertexIn vin)
 {
 	VertexOut vout;
+	float3 posL = DecodePosition(vin.PosQ);
 	
 	// Set z = w so that z/w = 1 (i.e., skydome always on far plane).
-	vout.PosH = mul(float4(vin.PosL, 1.0f), gWorldViewProj).xyww;
+	vout.PosH = mul(float4(posL, 1.0f), gWorldViewProj).xyww;
 	
 	// Use local vertex position as cubemap lookup vector.
-	vout.PosL = vin.PosL;
+	vout.PosL = posL;
 	
 	return vout;
 }
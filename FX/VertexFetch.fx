@@ -0,0 +1,94 @@
+//=============================================================================
+// VertexFetch.fx
+//
+// Draws the vertex fetch benchmark. Both techniques read every element
+// of their vertex and do the same work after decoding, so only the
+// vertex format differs between them: Vertex::packed, or the 48 byte
+// float vertex the arena used before packing.
+//=============================================================================
+
+#include "VertexPacking.fx"
+
+cbuffer cbPerObject
+{
+	float4x4 gWorldViewProj;
+};
+
+// Vertex::packed
+struct PackedVertexIn
+{
+	float4 PosQ    : POSITION;
+	float2 NormalQ : NORMAL;
+	float2 Tex     : TEXCOORD;
+	float2 TangentQ : TANGENT;
+};
+
+// Vertex::posNormTexTan
+struct UnpackedVertexIn
+{
+	float3 PosL       : POSITION;
+	float3 NormalL    : NORMAL;
+	float2 Tex        : TEXCOORD;
+	float3 TangentL   : TANGENT;
+	float  Handedness : HANDEDNESS;
+};
+
+struct VertexOut
+{
+	float4 PosH  : SV_POSITION;
+	float4 Color : COLOR;
+};
+
+VertexOut Shade(float3 posL, float3 normalL, float2 tex, float3 tangentL, float handedness)
+{
+	VertexOut vout;
+	vout.PosH = mul(float4(posL, 1.0f), gWorldViewProj);
+	float3 bitangentL = handedness*cross(normalL, tangentL);
+	vout.Color = float4(0.5f*normalL + 0.5f*bitangentL, tex.x + tex.y);
+	return vout;
+}
+
+VertexOut PackedVS(PackedVertexIn vin)
+{
+	return Shade(DecodePosition(vin.PosQ), DecodeOctahedral(vin.NormalQ), vin.Tex, DecodeOctahedral(vin.TangentQ), DecodeHandedness(vin.PosQ));
+}
+
+VertexOut UnpackedVS(UnpackedVertexIn vin)
+{
+	return Shade(vin.PosL, vin.NormalL, vin.Tex, vin.TangentL, vin.Handedness);
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+	return pin.Color;
+}
+
+// Every format shades the same pixels, whatever was drawn before it
+DepthStencilState NoDepthDSS
+{
+	DepthEnable = FALSE;
+};
+
+technique11 PackedTech
+{
+	pass P0
+	{
+		SetVertexShader( CompileShader( vs_5_0, PackedVS() ) );
+		SetGeometryShader( NULL );
+		SetPixelShader( CompileShader( ps_5_0, PS() ) );
+
+		SetDepthStencilState(NoDepthDSS, 0);
+	}
+}
+
+technique11 UnpackedTech
+{
+	pass P0
+	{
+		SetVertexShader( CompileShader( vs_5_0, UnpackedVS() ) );
+		SetGeometryShader( NULL );
+		SetPixelShader( CompileShader( ps_5_0, PS() ) );
+
+		SetDepthStencilState(NoDepthDSS, 0);
+	}
+}
@@ -0,0 +1,36 @@
+//=============================================================================
+// VertexPacking.fx
+//
+// Decodes Vertex::packed, the vertex of the mesh arena. Texture
+// coordinates are half floats and need no decoding.
+//=============================================================================
+
+// Bounds of the mesh being drawn, snorm16 positions map to
+// gPosOffset +- gPosScale
+cbuffer cbMeshBounds
+{
+	float3 gPosScale = float3(1.0f, 1.0f, 1.0f);
+	float3 gPosOffset;
+};
+
+float3 DecodePosition(float4 posQ)
+{
+	return gPosOffset + gPosScale*posQ.xyz;
+}
+
+// Sign of the bitangent, cross(normal, tangent) is flipped where the
+// texture is mirrored
+float DecodeHandedness(float4 posQ)
+{
+	return posQ.w < 0.0f ? -1.0f : 1.0f;
+}
+
+// Unit vector from the octahedron folded onto [-1,1]^2
+float3 DecodeOctahedral(float2 e)
+{
+	float3 v = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	float t = saturate(-v.z);
+	v.x += v.x >= 0.0f ? -t : t;
+	v.y += v.y >= 0.0f ? -t : t;
+	return normalize(v);
+}
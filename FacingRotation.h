@@ -0,0 +1,153 @@
+#ifndef FACINGROTATION_H
+#define FACINGROTATION_H
+
+#include <xmmintrin.h>
+#include <math.h>
+
+// Rotations of entities facing one of the four maze directions, and
+// batch kernels turning structure of arrays quaternions towards them.
+//
+// Table entries equal LookAtLH(0, dir, up = -y) converted to quaternion,
+// which is what entities used to build every frame.
+class FacingRotation
+{
+private:
+	// x, y, z, w for +x, -x, +z, -z
+	static const float* table(int i)
+	{
+		static const float facings[4][4] = {
+			{0.70710678f, 0.0f,  0.70710678f, 0.0f},
+			{0.70710678f, 0.0f, -0.70710678f, 0.0f},
+			{0.0f,        0.0f,  1.0f,        0.0f},
+			{1.0f,        0.0f,  0.0f,        0.0f}};
+		return facings[i];
+	};
+
+	// Fitted correction of t which makes nlerp follow slerp closely,
+	// "d" is the absolute cosine between the quaternions
+	static float correctT(float d, float t)
+	{
+		float a = 1.0904f + d*(-3.2452f + d*(3.55645f - d*1.43519f));
+		float b = 0.848013f + d*(-1.06021f + d*0.215638f);
+		float k = a*(t-0.5f)*(t-0.5f) + b;
+		return t + t*(t-0.5f)*(t-1.0f)*k;
+	};
+	static __m128 correctT(__m128 d, __m128 t)
+	{
+		__m128 half = _mm_set1_ps(0.5f);
+		__m128 a = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d,
+			_mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d,
+			_mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))))));
+		__m128 b = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d,
+			_mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)))));
+		__m128 th = _mm_sub_ps(t, half);
+		__m128 k = _mm_add_ps(_mm_mul_ps(a, _mm_mul_ps(th, th)), b);
+		__m128 t1 = _mm_sub_ps(t, _mm_set1_ps(1.0f));
+		return _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, th), t1), k));
+	};
+
+	static void interpolateOne(float& qx, float& qy, float& qz, float& qw, const float* target, float t, bool slerp)
+	{
+		float tx = target[0], ty = target[1], tz = target[2], tw = target[3];
+		float d = qx*tx + qy*ty + qz*tz + qw*tw;
+
+		// Take shortest arc
+		if(d < 0.0f)
+		{
+			tx = -tx; ty = -ty; tz = -tz; tw = -tw;
+			d = -d;
+		}
+		if(slerp)
+			t = correctT(d, t);
+
+		qx += t*(tx-qx);
+		qy += t*(ty-qy);
+		qz += t*(tz-qz);
+		qw += t*(tw-qw);
+		float invLength = 1.0f/sqrtf(qx*qx + qy*qy + qz*qz + qw*qw);
+		qx *= invLength;
+		qy *= invLength;
+		qz *= invLength;
+		qw *= invLength;
+	};
+
+public:
+	static int index(int dx, int dy)
+	{
+		if(dx > 0)
+			return 0;
+		if(dx < 0)
+			return 1;
+		if(dy > 0)
+			return 2;
+		return 3;
+	};
+
+	// Quaternion (x, y, z, w) facing direction (dx, dy) of the maze
+	static const float* get(int dx, int dy)
+	{
+		return table(index(dx, dy));
+	};
+
+	// Turns quaternions [begin, end) a fraction "t" towards the facing of
+	// their direction, four at a time. Slerp uses nlerp with corrected t,
+	// otherwise plain nlerp.
+	static void interpolate(float* qx, float* qy, float* qz, float* qw, const int* dirX, const int* dirY, float t, int begin, int end, bool slerp)
+	{
+		t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+
+		int i = begin;
+		__m128 vt = _mm_set1_ps(t);
+		__m128 signBit = _mm_set1_ps(-0.0f);
+		__m128 one = _mm_set1_ps(1.0f);
+		for(; i+4<=end; i+=4)
+		{
+			const float* f0 = get(dirX[i+0], dirY[i+0]);
+			const float* f1 = get(dirX[i+1], dirY[i+1]);
+			const float* f2 = get(dirX[i+2], dirY[i+2]);
+			const float* f3 = get(dirX[i+3], dirY[i+3]);
+			__m128 tx = _mm_setr_ps(f0[0], f1[0], f2[0], f3[0]);
+			__m128 ty = _mm_setr_ps(f0[1], f1[1], f2[1], f3[1]);
+			__m128 tz = _mm_setr_ps(f0[2], f1[2], f2[2], f3[2]);
+			__m128 tw = _mm_setr_ps(f0[3], f1[3], f2[3], f3[3]);
+
+			__m128 x = _mm_loadu_ps(qx+i);
+			__m128 y = _mm_loadu_ps(qy+i);
+			__m128 z = _mm_loadu_ps(qz+i);
+			__m128 w = _mm_loadu_ps(qw+i);
+
+			__m128 d = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(x, tx), _mm_mul_ps(y, ty)),
+				_mm_add_ps(_mm_mul_ps(z, tz), _mm_mul_ps(w, tw)));
+
+			// Take shortest arc, flip target where cosine is negative
+			__m128 sign = _mm_and_ps(d, signBit);
+			tx = _mm_xor_ps(tx, sign);
+			ty = _mm_xor_ps(ty, sign);
+			tz = _mm_xor_ps(tz, sign);
+			tw = _mm_xor_ps(tw, sign);
+			d = _mm_xor_ps(d, sign);
+
+			__m128 s = slerp ? correctT(d, vt) : vt;
+			x = _mm_add_ps(x, _mm_mul_ps(s, _mm_sub_ps(tx, x)));
+			y = _mm_add_ps(y, _mm_mul_ps(s, _mm_sub_ps(ty, y)));
+			z = _mm_add_ps(z, _mm_mul_ps(s, _mm_sub_ps(tz, z)));
+			w = _mm_add_ps(w, _mm_mul_ps(s, _mm_sub_ps(tw, w)));
+
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+				_mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+			__m128 invLength = _mm_div_ps(one, length);
+			_mm_storeu_ps(qx+i, _mm_mul_ps(x, invLength));
+			_mm_storeu_ps(qy+i, _mm_mul_ps(y, invLength));
+			_mm_storeu_ps(qz+i, _mm_mul_ps(z, invLength));
+			_mm_storeu_ps(qw+i, _mm_mul_ps(w, invLength));
+		}
+
+		// Remainder
+		for(; i<end; i++)
+			interpolateOne(qx[i], qy[i], qz[i], qw[i], get(dirX[i], dirY[i]), t, slerp);
+	};
+};
+
+#endif
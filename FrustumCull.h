@@ -0,0 +1,288 @@
+#ifndef FRUSTUMCULL_H
+#define FRUSTUMCULL_H
+
+#include <vector>
+#include <float.h>
+#include <intrin.h>
+#include <immintrin.h>
+#include <ppl.h>
+#include "Util.h"
+#include "GameTimer.h"
+#include "Profiler.h"
+
+//
+// Sphere frustum culling
+//
+// Spheres are kept as structure of arrays and tested against the six
+// planes of Util::extractFrustumPlanes, whose normals point inwards. A
+// sphere is culled when it lies entirely behind one plane. Eight spheres
+// are tested at a time with AVX, four with SSE on CPUs without it. Large
+// sets are split in chunks culled on worker threads, each chunk writes
+// its own index list and the lists are joined in order, so the result is
+// the same for every path and thread count.
+//
+
+enum CullPath
+{
+	cull_scalar,
+	cull_sse,
+	cull_avx
+};
+
+class SphereCuller
+{
+private:
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+
+	// Visible indices per chunk, "chunkCounts" of them are valid
+	std::vector<std::vector<int>> chunkVisible;
+	std::vector<int> chunkCounts;
+
+	bool avxSupported;
+
+	static const int chunkSize = 4096;
+	static const int parallelThreshold = 16384;
+
+	// AVX needs CPU support and an OS saving the upper ymm halves
+	static bool detectAvx()
+	{
+		int info[4];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1<<27)) != 0;
+		bool avx = (info[2] & (1<<28)) != 0;
+		if(!osxsave || !avx)
+			return false;
+		return (_xgetbv(0) & 6) == 6;
+	};
+
+	bool visibleOne(const XMFLOAT4* planes, int i) const
+	{
+		for(int p=0; p<6; p++)
+		{
+			float d = planes[p].x*centerX[i] + planes[p].y*centerY[i] + planes[p].z*centerZ[i] + planes[p].w;
+			if(d < -radius[i])
+				return false;
+		}
+		return true;
+	};
+
+	// Writes visible indices of [begin, end) to "out", returns their count
+	int cullScalar(const XMFLOAT4* planes, int begin, int end, int* out) const
+	{
+		int count = 0;
+		for(int i=begin; i<end; i++)
+		{
+			if(visibleOne(planes, i))
+				out[count++] = i;
+		}
+		return count;
+	};
+
+	int cullSse(const XMFLOAT4* planes, int begin, int end, int* out) const
+	{
+		__m128 px[6], py[6], pz[6], pw[6];
+		for(int p=0; p<6; p++)
+		{
+			px[p] = _mm_set1_ps(planes[p].x);
+			py[p] = _mm_set1_ps(planes[p].y);
+			pz[p] = _mm_set1_ps(planes[p].z);
+			pw[p] = _mm_set1_ps(planes[p].w);
+		}
+
+		int count = 0;
+		int i = begin;
+		for(; i+4<=end; i+=4)
+		{
+			__m128 x = _mm_loadu_ps(&centerX[i]);
+			__m128 y = _mm_loadu_ps(&centerY[i]);
+			__m128 z = _mm_loadu_ps(&centerZ[i]);
+			__m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+
+			__m128 inside = _mm_cmpeq_ps(x, x);
+			for(int p=0; p<6; p++)
+			{
+				__m128 d = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(x, px[p]), _mm_mul_ps(y, py[p])),
+					_mm_add_ps(_mm_mul_ps(z, pz[p]), pw[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+			}
+
+			// Compact, one store per visible sphere
+			unsigned long mask = (unsigned long)_mm_movemask_ps(inside);
+			unsigned long bit;
+			while(_BitScanForward(&bit, mask))
+			{
+				out[count++] = i+(int)bit;
+				mask &= mask-1;
+			}
+		}
+		return count + cullScalar(planes, i, end, out+count);
+	};
+
+	int cullAvx(const XMFLOAT4* planes, int begin, int end, int* out) const
+	{
+		__m256 px[6], py[6], pz[6], pw[6];
+		for(int p=0; p<6; p++)
+		{
+			px[p] = _mm256_set1_ps(planes[p].x);
+			py[p] = _mm256_set1_ps(planes[p].y);
+			pz[p] = _mm256_set1_ps(planes[p].z);
+			pw[p] = _mm256_set1_ps(planes[p].w);
+		}
+
+		int count = 0;
+		int i = begin;
+		for(; i+8<=end; i+=8)
+		{
+			__m256 x = _mm256_loadu_ps(&centerX[i]);
+			__m256 y = _mm256_loadu_ps(&centerY[i]);
+			__m256 z = _mm256_loadu_ps(&centerZ[i]);
+			__m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[i]));
+
+			__m256 inside = _mm256_cmp_ps(x, x, _CMP_EQ_OQ);
+			for(int p=0; p<6; p++)
+			{
+				__m256 d = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(x, px[p]), _mm256_mul_ps(y, py[p])),
+					_mm256_add_ps(_mm256_mul_ps(z, pz[p]), pw[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+			}
+
+			unsigned long mask = (unsigned long)_mm256_movemask_ps(inside);
+			unsigned long bit;
+			while(_BitScanForward(&bit, mask))
+			{
+				out[count++] = i+(int)bit;
+				mask &= mask-1;
+			}
+		}
+
+		// Avoid the penalty of mixing AVX and the SSE code that follows
+		_mm256_zeroupper();
+		return count + cullSse(planes, i, end, out+count);
+	};
+
+	int cullRange(const XMFLOAT4* planes, int begin, int end, int* out) const
+	{
+		if(path == cull_avx)
+			return cullAvx(planes, begin, end, out);
+		if(path == cull_sse)
+			return cullSse(planes, begin, end, out);
+		return cullScalar(planes, begin, end, out);
+	};
+
+	SphereCuller(const SphereCuller&);
+	SphereCuller& operator=(const SphereCuller&);
+
+public:
+	// Widest path by default, lowered to what the CPU supports
+	int path;
+	bool useThreads;
+
+	// Statistics of last cull
+	int num_spheres;
+	int num_visible;
+	int num_chunks;
+	float cullMs;
+	float spheresPerSec;	// millions of spheres tested per second
+
+	SphereCuller()
+	{
+		avxSupported = detectAvx();
+		path = avxSupported ? cull_avx : cull_sse;
+		useThreads = true;
+		num_spheres = 0;
+		num_visible = 0;
+		num_chunks = 0;
+		cullMs = 0.0f;
+		spheresPerSec = 0.0f;
+	};
+
+	bool hasAvx() const
+	{
+		return avxSupported;
+	};
+
+	void clear()
+	{
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		radius.clear();
+	};
+
+	void reserve(int count)
+	{
+		centerX.reserve(count);
+		centerY.reserve(count);
+		centerZ.reserve(count);
+		radius.reserve(count);
+	};
+
+	// Returns index of the sphere, FLT_MAX radius is never culled
+	int add(float x, float y, float z, float r)
+	{
+		centerX.push_back(x);
+		centerY.push_back(y);
+		centerZ.push_back(z);
+		radius.push_back(r);
+		return (int)radius.size()-1;
+	};
+
+	int size() const
+	{
+		return (int)radius.size();
+	};
+
+	// Fills "visible" with indices of spheres inside "planes", ascending
+	void cull(const XMFLOAT4 planes[6], std::vector<int>& visible)
+	{
+		PROFILE_SCOPE("Frustum cull");
+		Stopwatch watch;
+		if(path == cull_avx && !avxSupported)
+			path = cull_sse;
+
+		num_spheres = size();
+		num_chunks = 1;
+		if(useThreads && num_spheres >= parallelThreshold)
+			num_chunks = (num_spheres+chunkSize-1)/chunkSize;
+
+		visible.resize(num_spheres);
+		if(num_chunks == 1)
+		{
+			num_visible = num_spheres > 0 ? cullRange(planes, 0, num_spheres, &visible[0]) : 0;
+		}
+		else
+		{
+			if((int)chunkVisible.size() < num_chunks)
+				chunkVisible.resize(num_chunks);
+			chunkCounts.resize(num_chunks);
+			Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+			{
+				PROFILE_SCOPE("Cull chunk");
+				int begin = chunk*chunkSize;
+				int end = MathUtil::Min(num_spheres, begin+chunkSize);
+				std::vector<int>& out = chunkVisible[chunk];
+				out.resize(chunkSize);
+				chunkCounts[chunk] = cullRange(planes, begin, end, &out[0]);
+			});
+
+			num_visible = 0;
+			for(int chunk=0; chunk<num_chunks; chunk++)
+			{
+				if(chunkCounts[chunk] > 0)
+					memcpy(&visible[num_visible], &chunkVisible[chunk][0], chunkCounts[chunk]*sizeof(int));
+				num_visible += chunkCounts[chunk];
+			}
+		}
+		visible.resize(num_visible);
+
+		cullMs = watch.elapsedMs();
+		spheresPerSec = cullMs > 0.0f ? num_spheres/(cullMs*1000.0f) : 0.0f;
+	};
+};
+
+#endif
@@ -0,0 +1,502 @@
+#include "Game.h"
+#include "GameTimer.h"
+
+void TW_CALL tw_runSpatialBenchmark(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->runSpatialBenchmark();
+}
+
+void TW_CALL tw_runPathBenchmark(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->runPathBenchmark();
+}
+
+void TW_CALL tw_runRotationBenchmark(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->runRotationBenchmark();
+}
+
+void TW_CALL tw_runSnapshotBenchmark(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->runSnapshotBenchmark();
+}
+
+void TW_CALL tw_rewind(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->rewind();
+}
+
+void TW_CALL tw_quickSave(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->quickSave();
+}
+
+void TW_CALL tw_quickLoad(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->quickLoad();
+}
+
+void TW_CALL tw_respawnPellets(void *clientData)
+{
+	Game *in = static_cast<Game *>(clientData); // scene pointer is stored in clientData
+	in->respawnPellets();
+}
+
+void Game::runSpatialBenchmark()
+{
+	static const int agentCounts[num_benchmarks] = {1000, 10000, 100000};
+	const float dt = 1.0f/60.0f;
+	const int num_ticks = 30;
+
+	for(int b=0; b<num_benchmarks; b++)
+	{
+		SpatialBenchmark& bench = benchmarks[b];
+		bench.num_agents = agentCounts[b];
+
+		EntityStore store;
+		store.spawnRandom(maze, bench.num_agents);
+		SpatialHash hash(maze->getSizeX()*maze->getSizeY());
+		Pellets benchPellets;
+		benchPellets.reset(maze);
+
+		Stopwatch watch;
+		hash.build(store);
+		bench.buildMs = watch.elapsedMs();
+
+		// Average per tick cost of a simulated game loop
+		std::vector<Int2> pairs;
+		bench.updateMs = 0.0f;
+		bench.pairsMs = 0.0f;
+		bench.pelletsMs = 0.0f;
+		for(int tick=0; tick<num_ticks; tick++)
+		{
+			store.update(dt, maze);
+
+			watch.start();
+			hash.update(store);
+			bench.updateMs += watch.elapsedMs();
+
+			watch.start();
+			hash.findOverlapPairs(store, pairs);
+			bench.pairsMs += watch.elapsedMs();
+
+			// Every agent eats the pellet on its nearest tile, as pacman does
+			watch.start();
+			for(int i=0; i<store.size(); i++)
+			{
+				Int2 tile = store.getNearestTile(i);
+				benchPellets.consume(tile.x, tile.y);
+			}
+			bench.pelletsMs += watch.elapsedMs();
+			benchPellets.clearDirty();
+		}
+		bench.updateMs /= num_ticks;
+		bench.pairsMs /= num_ticks;
+		bench.pelletsMs /= num_ticks;
+		bench.num_pairs = (int)pairs.size();
+	}
+}
+
+void Game::runPathBenchmark()
+{
+	// Random pairs of empty tiles, same set for every run
+	std::vector<Int2> tiles = getEmptyTiles();
+	if(tiles.empty())
+		return;
+	const int num_requests = 500;
+	std::vector<PathRequest> requests(num_requests);
+	unsigned int seed = 12345u;
+	for(int i=0; i<num_requests; i++)
+	{
+		seed = seed*1664525u + 1013904223u;
+		Int2 start = tiles[(seed >> 8) % tiles.size()];
+		seed = seed*1664525u + 1013904223u;
+		Int2 goal = tiles[(seed >> 8) % tiles.size()];
+		requests[i] = PathRequest(start, goal);
+	}
+	pathBenchmark.num_requests = num_requests;
+
+	// Separate instance keeps game cache and statistics untouched
+	Pathfinder finder(maze);
+
+	finder.useJumpPoints = false;
+	finder.beginBatch(requests);
+	finder.waitBatch();
+	pathBenchmark.aStarMs = finder.lastBatchMs;
+
+	finder.useJumpPoints = true;
+	finder.clearCache();
+	finder.beginBatch(requests);
+	finder.waitBatch();
+	pathBenchmark.jumpPointsMs = finder.lastBatchMs;
+
+	// Every request is now a cache hit
+	finder.beginBatch(requests);
+	finder.waitBatch();
+	pathBenchmark.cachedMs = finder.lastBatchMs;
+}
+
+void Game::runRotationBenchmark()
+{
+	const int num_entities = 10000;
+	const int num_ticks = 30;
+	const float dt = 1.0f/60.0f;
+	rotationBenchmark.num_entities = num_entities;
+
+	EntityStore store;
+	store.spawnRandom(maze, num_entities);
+	for(int i=0; i<num_entities; i++)
+	{
+		static const int dirs[4][2] = {{1,0}, {-1,0}, {0,1}, {0,-1}};
+		store.dirX[i] = dirs[i%4][0];
+		store.dirY[i] = dirs[i%4][1];
+	}
+	std::vector<D3DXQUATERNION> rotations(num_entities);
+	for(int i=0; i<num_entities; i++)
+		rotations[i] = D3DXQUATERNION(store.rotX[i], store.rotY[i], store.rotZ[i], store.rotW[i]);
+	std::vector<D3DXMATRIX> d3dxWorlds(num_entities);
+	std::vector<XMFLOAT4X4> batchWorlds(num_entities);
+
+	// Old path, what GameEntity did per entity every frame
+	Stopwatch watch;
+	for(int tick=0; tick<num_ticks; tick++)
+	{
+		for(int i=0; i<num_entities; i++)
+		{
+			D3DXMATRIX mat_rot;
+			D3DXVECTOR3 vec_eye(0.0f, 0.0f, 0.0f);
+			D3DXVECTOR3 vec_at((float)store.dirX[i], 0.0f, (float)store.dirY[i]);
+			D3DXVECTOR3 vec_up(0.0f, -1.0f, 0.0f);
+			D3DXMatrixLookAtLH(&mat_rot, &vec_eye, &vec_at, &vec_up);
+			D3DXQUATERNION qua_rot;
+			D3DXQuaternionRotationMatrix(&qua_rot, &mat_rot);
+			D3DXQUATERNION qua_out;
+			D3DXQuaternionSlerp(&qua_out, &rotations[i], &qua_rot, store.turningSpeed*dt);
+			rotations[i] = qua_out;
+		}
+	}
+	rotationBenchmark.lookAtRotateMs = watch.elapsedMs()/num_ticks;
+
+	watch.start();
+	for(int tick=0; tick<num_ticks; tick++)
+	{
+		for(int i=0; i<num_entities; i++)
+		{
+			D3DXMATRIX translation;
+			D3DXMatrixTranslation(&translation, -store.dirX[i]*store.offset[i], 0, -store.dirY[i]*store.offset[i]);
+			D3DXMATRIX rotation;
+			D3DXMatrixRotationQuaternion(&rotation, &rotations[i]);
+			d3dxWorlds[i] = rotation*translation*maze->getPosition(store.tileX[i], store.tileY[i]);
+		}
+	}
+	rotationBenchmark.d3dxComposeMs = watch.elapsedMs()/num_ticks;
+
+	// New path
+	watch.start();
+	for(int tick=0; tick<num_ticks; tick++)
+		store.updateRotations(dt);
+	rotationBenchmark.batchRotateMs = watch.elapsedMs()/num_ticks;
+
+	watch.start();
+	for(int tick=0; tick<num_ticks; tick++)
+		store.buildWorlds(maze, &batchWorlds[0], 1.0f);
+	rotationBenchmark.batchComposeMs = watch.elapsedMs()/num_ticks;
+
+	// Largest angle between old and new rotations
+	float minCos = 1.0f;
+	for(int i=0; i<num_entities; i++)
+	{
+		const D3DXQUATERNION& q = rotations[i];
+		float c = fabsf(q.x*store.rotX[i] + q.y*store.rotY[i] + q.z*store.rotZ[i] + q.w*store.rotW[i]);
+		minCos = MathUtil::Min(minCos, c);
+	}
+	rotationBenchmark.maxErrorDeg = 2.0f*acosf(minCos)*180.0f/XM_PI;
+}
+
+//
+// Snapshots
+//
+
+// Section ids, bump snapshotVersion when layout changes
+enum SnapshotSection
+{
+	section_walls = 1,
+	section_pellets,
+	section_pacman,
+	section_tileX,
+	section_tileY,
+	section_offset,
+	section_dirX,
+	section_dirY,
+	section_steerX,
+	section_steerY,
+	section_seed,
+	section_rotX,
+	section_rotY,
+	section_rotZ,
+	section_rotW
+};
+
+void Game::writeSnapshot(std::vector<unsigned char>& out, const EntityStore& store)
+{
+	SnapshotWriter writer(out);
+	writer.write(snapshotMagic);
+	writer.write(snapshotVersion);
+	writer.write(maze->getSizeX());
+	writer.write(maze->getSizeY());
+	writer.write(num_pelletsEaten);
+
+	const BitGrid& walls = maze->getWalls();
+	const BitGrid& alive = pellets->getBits();
+	GameEntity::State pacmanState = entity->getState();
+	writer.writeArray<unsigned int>(section_walls, walls.getWords(), walls.getWordCount());
+	writer.writeArray<unsigned int>(section_pellets, alive.getWords(), alive.getWordCount());
+	writer.writeArray<unsigned char>(section_pacman, (const unsigned char*)&pacmanState, sizeof(pacmanState));
+
+	// Tiles fit in 16 bits and directions in 8
+	writer.writeArray<short>(section_tileX, store.tileX);
+	writer.writeArray<short>(section_tileY, store.tileY);
+	writer.writeArray<float>(section_offset, store.offset);
+	writer.writeArray<signed char>(section_dirX, store.dirX);
+	writer.writeArray<signed char>(section_dirY, store.dirY);
+	writer.writeArray<signed char>(section_steerX, store.steerX);
+	writer.writeArray<signed char>(section_steerY, store.steerY);
+	writer.writeArray<unsigned int>(section_seed, store.seed);
+	writer.writeArray<float>(section_rotX, store.rotX);
+	writer.writeArray<float>(section_rotY, store.rotY);
+	writer.writeArray<float>(section_rotZ, store.rotZ);
+	writer.writeArray<float>(section_rotW, store.rotW);
+}
+
+bool Game::readSnapshot(const std::vector<unsigned char>& in, EntityStore& store)
+{
+	if(!decodeSnapshot(in, decodedSnapshot))
+		return false;
+	applySnapshot(decodedSnapshot, store);
+	return true;
+}
+
+// Reads and checks a snapshot without touching the game, so a bad
+// snapshot leaves the game as it was
+bool Game::decodeSnapshot(const std::vector<unsigned char>& in, DecodedSnapshot& out) const
+{
+	SnapshotReader reader(in);
+	unsigned int magic, version;
+	int sizeX, sizeY;
+	if(!reader.read(magic) || !reader.read(version) || !reader.read(sizeX) || !reader.read(sizeY) || !reader.read(out.pelletsEaten))
+		return false;
+	if(magic!=snapshotMagic || version!=snapshotVersion || sizeX!=maze->getSizeX() || sizeY!=maze->getSizeY())
+		return false;
+
+	out.walls.resize(sizeX, sizeY);
+	out.alive.resize(sizeX, sizeY);
+	EntityStore& restored = out.store;
+	bool ok =
+		reader.readArray<unsigned int>(section_walls, out.walls.getWords(), out.walls.getWordCount()) &&
+		reader.readArray<unsigned int>(section_pellets, out.alive.getWords(), out.alive.getWordCount()) &&
+		reader.readArray<unsigned char>(section_pacman, (unsigned char*)&out.pacmanState, sizeof(out.pacmanState)) &&
+		reader.readArray<short>(section_tileX, restored.tileX) &&
+		reader.readArray<short>(section_tileY, restored.tileY) &&
+		reader.readArray<float>(section_offset, restored.offset) &&
+		reader.readArray<signed char>(section_dirX, restored.dirX) &&
+		reader.readArray<signed char>(section_dirY, restored.dirY) &&
+		reader.readArray<signed char>(section_steerX, restored.steerX) &&
+		reader.readArray<signed char>(section_steerY, restored.steerY) &&
+		reader.readArray<unsigned int>(section_seed, restored.seed) &&
+		reader.readArray<float>(section_rotX, restored.rotX) &&
+		reader.readArray<float>(section_rotY, restored.rotY) &&
+		reader.readArray<float>(section_rotZ, restored.rotZ) &&
+		reader.readArray<float>(section_rotW, restored.rotW);
+	return ok && restored.isConsistent();
+}
+
+// Moves a decoded snapshot into the game, "decoded" gets the old agents
+void Game::applySnapshot(DecodedSnapshot& decoded, EntityStore& store)
+{
+	// Drop paths requested for the old state
+	pathfinder->waitBatch();
+
+	int revision = maze->getRevision();
+	maze->setWalls(decoded.walls);
+	if(maze->getRevision() != revision)
+		pellets->reset(maze);
+	pellets->setBits(decoded.alive);
+	entity->setState(decoded.pacmanState);
+	store.swapState(decoded.store);
+
+	num_pelletsEaten = decoded.pelletsEaten;
+	num_pelletsRemaining = pellets->getRemaining();
+}
+
+void Game::recordSnapshot()
+{
+	Stopwatch watch;
+	writeSnapshot(snapshotBuffer, *agents);
+	history->push(snapshotBuffer);
+	snapshotMs = watch.elapsedMs();
+
+	snapshotBytes = history->lastBytes;
+	snapshotNewBytes = history->lastNewBytes;
+	historyBytes = history->getPageBytes();
+}
+
+// Goes back "rewindTicks" ticks, or as far as history reaches
+bool Game::rewind()
+{
+	if(history->size() == 0)
+		return false;
+
+	Stopwatch watch;
+	int age = MathUtil::Min(rewindTicks, history->size()-1);
+	bool ok = history->get(age, snapshotBuffer) && readSnapshot(snapshotBuffer, *agents);
+	restoreMs = watch.elapsedMs();
+	return ok;
+}
+
+void Game::quickSave()
+{
+	writeSnapshot(quickSaveBuffer, *agents);
+}
+
+bool Game::quickLoad()
+{
+	if(quickSaveBuffer.empty())
+		return false;
+
+	Stopwatch watch;
+	bool ok = readSnapshot(quickSaveBuffer, *agents);
+	restoreMs = watch.elapsedMs();
+	return ok;
+}
+
+void Game::runSnapshotBenchmark()
+{
+	static const int agentCounts[num_snapshotBenchmarks] = {10000, 100000};
+	const float dt = 1.0f/60.0f;
+
+	for(int b=0; b<num_snapshotBenchmarks; b++)
+	{
+		SnapshotBenchmark& bench = snapshotBenchmarks[b];
+		bench.num_agents = agentCounts[b];
+
+		EntityStore store;
+		store.spawnRandom(maze, bench.num_agents);
+		SnapshotRing ring(historySize);
+		std::vector<unsigned char> buffer;
+
+		// Fill the ring with simulated ticks, first snapshot shares nothing
+		Stopwatch watch;
+		float totalMs = 0.0f;
+		double totalNewBytes = 0.0;
+		for(int tick=0; tick<historySize; tick++)
+		{
+			store.update(dt, maze);
+
+			watch.start();
+			writeSnapshot(buffer, store);
+			ring.push(buffer);
+			totalMs += watch.elapsedMs();
+			if(tick > 0)
+				totalNewBytes += ring.lastNewBytes;
+		}
+		bench.snapshotMs = totalMs/historySize;
+		bench.bytes = ring.lastBytes;
+		bench.newBytes = (int)(totalNewBytes/(historySize-1));
+		bench.ringBytes = ring.getPageBytes();
+
+		// Decode every snapshot in the ring, applying it would change
+		// the running game
+		DecodedSnapshot decoded;
+		watch.start();
+		for(int age=0; age<ring.size(); age++)
+		{
+			ring.get(age, buffer);
+			decodeSnapshot(buffer, decoded);
+		}
+		bench.decodeMs = watch.elapsedMs()/ring.size();
+	}
+}
+
+void Game::buildMenu(TwBar* menu)
+{
+	TwAddVarRO(menu, "Pellets eaten", TW_TYPE_INT32, &num_pelletsEaten, "group=Pellets");
+	TwAddVarRO(menu, "Pellets remaining", TW_TYPE_INT32, &num_pelletsRemaining, "group=Pellets");
+	TwAddButton(menu, "Respawn pellets", tw_respawnPellets, this, "group=Pellets");
+	TwDefine("Settings/Pellets group='Game' opened=false");
+
+	TwAddVarRW(menu, "Ghosts chase", TW_TYPE_BOOLCPP, &ghostsChase, "group=Pathfinding");
+	TwAddVarRW(menu, "Jump points", TW_TYPE_BOOLCPP, &pathfinder->useJumpPoints, "group=Pathfinding");
+	TwAddVarRO(menu, "Path queries", TW_TYPE_INT32, &pathfinder->num_queries, "group=Pathfinding");
+	TwAddVarRO(menu, "Path cache hits", TW_TYPE_INT32, &pathfinder->num_cacheHits, "group=Pathfinding");
+	TwAddVarRO(menu, "Path hit rate", TW_TYPE_FLOAT, &pathfinder->hitRate, "group=Pathfinding precision=1");
+	TwAddVarRO(menu, "Path cache entries", TW_TYPE_INT32, &pathfinder->num_cacheEntries, "group=Pathfinding");
+	TwAddVarRO(menu, "Path invalidations", TW_TYPE_INT32, &pathfinder->num_invalidations, "group=Pathfinding");
+	TwAddVarRO(menu, "Path avg latency (ms)", TW_TYPE_FLOAT, &pathfinder->avgLatencyMs, "group=Pathfinding precision=4");
+	TwAddVarRO(menu, "Path max latency (ms)", TW_TYPE_FLOAT, &pathfinder->maxLatencyMs, "group=Pathfinding precision=4");
+	TwAddVarRO(menu, "Path batch (ms)", TW_TYPE_FLOAT, &pathfinder->lastBatchMs, "group=Pathfinding precision=4");
+	TwAddButton(menu, "Benchmark paths", tw_runPathBenchmark, this, "group=Pathfinding");
+	TwAddVarRO(menu, "Bench requests", TW_TYPE_INT32, &pathBenchmark.num_requests, "group=Pathfinding");
+	TwAddVarRO(menu, "Bench A* (ms)", TW_TYPE_FLOAT, &pathBenchmark.aStarMs, "group=Pathfinding");
+	TwAddVarRO(menu, "Bench JPS (ms)", TW_TYPE_FLOAT, &pathBenchmark.jumpPointsMs, "group=Pathfinding");
+	TwAddVarRO(menu, "Bench cached (ms)", TW_TYPE_FLOAT, &pathBenchmark.cachedMs, "group=Pathfinding");
+	TwDefine("Settings/Pathfinding group='Game' opened=false");
+
+	TwAddVarRW(menu, "Ghost slerp", TW_TYPE_BOOLCPP, &agents->slerpRotations, "group=Rotation");
+	TwAddButton(menu, "Benchmark rotations", tw_runRotationBenchmark, this, "group=Rotation");
+	TwAddVarRO(menu, "Rotation entities", TW_TYPE_INT32, &rotationBenchmark.num_entities, "group=Rotation");
+	TwAddVarRO(menu, "LookAt rotate (ms)", TW_TYPE_FLOAT, &rotationBenchmark.lookAtRotateMs, "group=Rotation");
+	TwAddVarRO(menu, "Batch rotate (ms)", TW_TYPE_FLOAT, &rotationBenchmark.batchRotateMs, "group=Rotation");
+	TwAddVarRO(menu, "D3DX compose (ms)", TW_TYPE_FLOAT, &rotationBenchmark.d3dxComposeMs, "group=Rotation");
+	TwAddVarRO(menu, "Batch compose (ms)", TW_TYPE_FLOAT, &rotationBenchmark.batchComposeMs, "group=Rotation");
+	TwAddVarRO(menu, "Max error (deg)", TW_TYPE_FLOAT, &rotationBenchmark.maxErrorDeg, "group=Rotation");
+	TwDefine("Settings/Rotation group='Game' opened=false");
+
+	TwAddVarRW(menu, "Record history", TW_TYPE_BOOLCPP, &recordHistory, "group=Snapshots");
+	TwAddVarRW(menu, "Rewind ticks", TW_TYPE_INT32, &rewindTicks, "group=Snapshots min=0 max=119");
+	TwAddButton(menu, "Rewind", tw_rewind, this, "group=Snapshots");
+	TwAddButton(menu, "Quick save", tw_quickSave, this, "group=Snapshots");
+	TwAddButton(menu, "Quick load", tw_quickLoad, this, "group=Snapshots");
+	TwAddVarRO(menu, "Snapshot (ms)", TW_TYPE_FLOAT, &snapshotMs, "group=Snapshots");
+	TwAddVarRO(menu, "Restore (ms)", TW_TYPE_FLOAT, &restoreMs, "group=Snapshots");
+	TwAddVarRO(menu, "Snapshot bytes", TW_TYPE_INT32, &snapshotBytes, "group=Snapshots");
+	TwAddVarRO(menu, "Snapshot new bytes", TW_TYPE_INT32, &snapshotNewBytes, "group=Snapshots");
+	TwAddVarRO(menu, "History bytes", TW_TYPE_INT32, &historyBytes, "group=Snapshots");
+	TwAddButton(menu, "Benchmark snapshots", tw_runSnapshotBenchmark, this, "group=Snapshots");
+	for(int b=0; b<num_snapshotBenchmarks; b++)
+	{
+		static const char* names[num_snapshotBenchmarks] = {"10k", "100k"};
+		std::string group = std::string("group='Snapshots ") + names[b] + "'";
+		std::string prefix = std::string("Snapshot ") + names[b];
+		TwAddVarRO(menu, (prefix+" save (ms)").c_str(), TW_TYPE_FLOAT, &snapshotBenchmarks[b].snapshotMs, group.c_str());
+		TwAddVarRO(menu, (prefix+" decode (ms)").c_str(), TW_TYPE_FLOAT, &snapshotBenchmarks[b].decodeMs, group.c_str());
+		TwAddVarRO(menu, (prefix+" bytes").c_str(), TW_TYPE_INT32, &snapshotBenchmarks[b].bytes, group.c_str());
+		TwAddVarRO(menu, (prefix+" new bytes").c_str(), TW_TYPE_INT32, &snapshotBenchmarks[b].newBytes, group.c_str());
+		TwAddVarRO(menu, (prefix+" ring bytes").c_str(), TW_TYPE_INT32, &snapshotBenchmarks[b].ringBytes, group.c_str());
+		TwDefine((std::string("Settings/'Snapshots ") + names[b] + "' group=Snapshots opened=false").c_str());
+	}
+	TwDefine("Settings/Snapshots group='Game' opened=false");
+
+	TwAddVarRO(menu, "Hash rebuilds", TW_TYPE_INT32, &spatialHash->num_rebuilds, "group=Collision");
+	TwAddVarRO(menu, "Hash skipped updates", TW_TYPE_INT32, &spatialHash->num_skippedUpdates, "group=Collision");
+	TwAddButton(menu, "Benchmark spatial hash", tw_runSpatialBenchmark, this, "group=Collision");
+	for(int b=0; b<num_benchmarks; b++)
+	{
+		static const char* names[num_benchmarks] = {"1k", "10k", "100k"};
+		std::string group = std::string("group='Collision ") + names[b] + "'";
+		std::string prefix = names[b];
+		TwAddVarRO(menu, (prefix+" build (ms)").c_str(), TW_TYPE_FLOAT, &benchmarks[b].buildMs, group.c_str());
+		TwAddVarRO(menu, (prefix+" update (ms)").c_str(), TW_TYPE_FLOAT, &benchmarks[b].updateMs, group.c_str());
+		TwAddVarRO(menu, (prefix+" pairs (ms)").c_str(), TW_TYPE_FLOAT, &benchmarks[b].pairsMs, group.c_str());
+		TwAddVarRO(menu, (prefix+" pellets (ms)").c_str(), TW_TYPE_FLOAT, &benchmarks[b].pelletsMs, group.c_str());
+		TwAddVarRO(menu, (prefix+" overlaps").c_str(), TW_TYPE_INT32, &benchmarks[b].num_pairs, group.c_str());
+		TwDefine((std::string("Settings/'Collision ") + names[b] + "' group=Collision opened=false").c_str());
+	}
+	TwDefine("Settings/Collision group='Game' opened=false");
+}
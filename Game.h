@@ -10,24 +10,146 @@ converted to "y = height, z = width"
 #include <d3dx10.h>
 #include <vector>
 #include "GameEntity.h"
+#include "EntityStore.h"
+#include "SpatialHash.h"
+#include "Pellets.h"
+#include "Pathfinder.h"
+#include "GameSnapshot.h"
 
 class Game{
 public:
+	struct SpatialBenchmark
+	{
+		int num_agents;
+		float buildMs;
+		float updateMs;
+		float pairsMs;
+		float pelletsMs;
+		int num_pairs;
+	};
+
+	struct RotationBenchmark
+	{
+		int num_entities;
+		float lookAtRotateMs;
+		float batchRotateMs;
+		float d3dxComposeMs;
+		float batchComposeMs;
+		float maxErrorDeg;
+	};
+
+	struct SnapshotBenchmark
+	{
+		int num_agents;
+		float snapshotMs;
+		float decodeMs;		// decode only, nothing is applied
+		int bytes;			// size of one snapshot
+		int newBytes;		// average bytes not shared with previous snapshot
+		int ringBytes;		// page memory of full ring
+	};
+
+	// Snapshot read into scratch state, not yet applied to the game
+	struct DecodedSnapshot
+	{
+		int pelletsEaten;
+		BitGrid walls;
+		BitGrid alive;
+		GameEntity::State pacmanState;
+		EntityStore store;
+	};
+
+	struct PathBenchmark
+	{
+		int num_requests;
+		float jumpPointsMs;
+		float aStarMs;
+		float cachedMs;
+	};
+
 	static const int sizeXY=30;
+	static const int num_benchmarks=3;
+	static const int num_snapshotBenchmarks=2;
+	static const int historySize=120;
 	Maze *maze;
 	GameEntity *entity;
+	EntityStore *agents;
+	SpatialHash *spatialHash;
+	Pellets *pellets;
+	Pathfinder *pathfinder;
+
+	std::vector<Int2> overlapPairs;
+	int num_ghosts;
+	int num_pelletsEaten;
+	int num_pelletsRemaining;
+	SpatialBenchmark benchmarks[num_benchmarks];
+	std::vector<PathRequest> pathRequests;
+	bool ghostsChase;
+	float reloadTimer;
+	PathBenchmark pathBenchmark;
+	RotationBenchmark rotationBenchmark;
+
+	// Snapshot of every tick for rollback
+	SnapshotRing *history;
+	std::vector<unsigned char> snapshotBuffer;
+	std::vector<unsigned char> quickSaveBuffer;
+	DecodedSnapshot decodedSnapshot;
+	bool recordHistory;
+	int rewindTicks;
+	float snapshotMs;
+	float restoreMs;
+	int snapshotBytes;
+	int snapshotNewBytes;
+	int historyBytes;
+	SnapshotBenchmark snapshotBenchmarks[num_snapshotBenchmarks];
 
 	//Constructor
 	Game()
 	{
 		maze = new Maze();
 		entity = new GameEntity(maze);
+
+		// Ghosts
+		num_ghosts = 4;
+		agents = new EntityStore();
+		agents->spawnRandom(maze, num_ghosts);
+
+		spatialHash = new SpatialHash(maze->getSizeX()*maze->getSizeY());
+		spatialHash->build(*agents);
+
+		// Pellets on every empty tile
+		pellets = new Pellets();
+		pellets->reset(maze);
+		num_pelletsEaten = 0;
+		num_pelletsRemaining = pellets->getRemaining();
+		ZeroMemory(benchmarks, sizeof(benchmarks));
+
+		// Ghosts hunt pacman along shortest paths
+		pathfinder = new Pathfinder(maze);
+		ghostsChase = true;
+		reloadTimer = 0.0f;
+		ZeroMemory(&pathBenchmark, sizeof(pathBenchmark));
+		ZeroMemory(&rotationBenchmark, sizeof(rotationBenchmark));
+
+		history = new SnapshotRing(historySize);
+		recordHistory = true;
+		rewindTicks = 60;
+		snapshotMs = 0.0f;
+		restoreMs = 0.0f;
+		snapshotBytes = 0;
+		snapshotNewBytes = 0;
+		historyBytes = 0;
+		ZeroMemory(snapshotBenchmarks, sizeof(snapshotBenchmarks));
 	};
 
 	~Game()
 	{
+		delete pathfinder;
+		delete history;
 		delete maze;
 		delete entity;
+		delete agents;
+		delete spatialHash;
+		delete pellets;
 	};
 
 	//Functions
@@ -36,12 +158,113 @@ public:
 		////Resource
 		//static float updateSpeed=0.0f;
 		//updateSpeed+=dt;
+		updateMaze(dt);
+		updatePaths();
 		updateEntities(dt);
+		updateCollisions();
+		requestPaths();
+
+		if(recordHistory)
+			recordSnapshot();
+	};
+
+	// Picks up edits to the labyrinth file while the game runs
+	void updateMaze(float dt)
+	{
+		reloadTimer += dt;
+		if(reloadTimer < 0.5f)
+			return;
+		reloadTimer = 0.0f;
+
+		if(maze->reloadIfChanged())
+		{
+			pellets->reset(maze);
+			num_pelletsRemaining = pellets->getRemaining();
+		}
+	};
+
+	// Steers ghosts with the paths requested last frame
+	void updatePaths()
+	{
+		if(!pathfinder->isBatchPending())
+			return;
+
+		const std::vector<PathResult>& results = pathfinder->waitBatch();
+		int num_results = MathUtil::Min((int)results.size(), agents->size());
+		for(int i=0; i<num_results; i++)
+		{
+			const std::vector<Int2>& path = results[i].path;
+			if(results[i].found && path.size() > 1)
+			{
+				agents->steerX[i] = path[1].x - path[0].x;
+				agents->steerY[i] = path[1].y - path[0].y;
+			}
+		}
+	};
+
+	// Paths are resolved on worker threads while the frame is drawn
+	void requestPaths()
+	{
+		if(!ghostsChase)
+			return;
+
+		Int2 goal = entity->getTile();
+		pathRequests.resize(agents->size());
+		for(int i=0; i<agents->size(); i++)
+			pathRequests[i] = PathRequest(Int2(agents->tileX[i], agents->tileY[i]), goal);
+		pathfinder->beginBatch(pathRequests);
 	};
 
 	void updateEntities(float dt)
 	{
 		entity->update(dt);
+		agents->update(dt, maze);
 	};
+
+	void updateCollisions()
+	{
+		spatialHash->update(*agents);
+		spatialHash->findOverlapPairs(*agents, overlapPairs);
+
+		// Pacman eats the pellet it stands on
+		Int2 tile = entity->getTile();
+		if(pellets->consume(tile.x, tile.y))
+		{
+			num_pelletsEaten++;
+			num_pelletsRemaining = pellets->getRemaining();
+		}
+	};
+
+	void respawnPellets()
+	{
+		pellets->respawn();
+		num_pelletsRemaining = pellets->getRemaining();
+	};
+
+	std::vector<Int2> getEmptyTiles()
+	{
+		std::vector<Int2> tiles;
+		for(int y=0; y<maze->getSizeY(); y++)
+			for(int x=0; x<maze->getSizeX(); x++)
+				if(maze->getTile(x,y) == 0)
+					tiles.push_back(Int2(x,y));
+		return tiles;
+	};
+
+	void runSpatialBenchmark();
+	void runPathBenchmark();
+	void runRotationBenchmark();
+	void runSnapshotBenchmark();
+
+	// Snapshots, restoring returns false if data does not match this game
+	void writeSnapshot(std::vector<unsigned char>& out, const EntityStore& store);
+	bool readSnapshot(const std::vector<unsigned char>& in, EntityStore& store);
+	bool decodeSnapshot(const std::vector<unsigned char>& in, DecodedSnapshot& out) const;
+	void applySnapshot(DecodedSnapshot& decoded, EntityStore& store);
+	void recordSnapshot();
+	bool rewind();
+	void quickSave();
+	bool quickLoad();
+	void buildMenu(TwBar* menu);
 };
-#endif
\ No newline at end of file
+#endif
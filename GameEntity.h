@@ -3,6 +3,7 @@
 
 #include "Maze.h"
 #include "Util.h"
+#include "FacingRotation.h"
 
 typedef struct Int2{
 	Int2(){x=0; y=0;}
@@ -34,6 +35,17 @@ private:
 	Maze *maze;
 
 public:
+	// Everything that changes while playing, used by snapshots
+	struct State
+	{
+		Int2 pos;
+		float pos_offset;
+		Int2 dir_queue;
+		Int2 dir;
+		bool isMoving;
+		D3DXQUATERNION qua_rot_tween;
+	};
+
 	GameEntity(Maze *maze)
 	{
 		this->maze = maze;
@@ -128,14 +140,9 @@ public:
 
 	void interpolateRotation(float dt)
 	{
-		// Create quaternion facing in rotation we want to interpolate to
-		D3DXMATRIX mat_rot;
-		D3DXVECTOR3 vec_eye(0.0f, 0.0f, 0.0f);
-		D3DXVECTOR3 vec_at((float)dir.x, 0.0f, (float)dir.y);
-		D3DXVECTOR3 vec_up(0.0f, -1.0f, 0.0f);
-		D3DXMatrixLookAtLH(&mat_rot, &vec_eye, &vec_at, &vec_up);
-		D3DXQUATERNION qua_rot;
-		D3DXQuaternionRotationMatrix(&qua_rot,&mat_rot);
+		// Quaternion facing in rotation we want to interpolate to
+		const float* facing = FacingRotation::get(dir.x, dir.y);
+		D3DXQUATERNION qua_rot(facing[0], facing[1], facing[2], facing[3]);
 
 		// Interpolate old rotation with new rotation using quaternions
 		D3DXQUATERNION qua_out;
@@ -157,6 +164,43 @@ public:
 		return mat_rot_tween*translation*maze->getPosition(pos.x,pos.y);
 	};
 
+	// Interpolated position in tile space
+	Float2 getTilePos()
+	{
+		return Float2(pos.x - dir.x*pos_offset, pos.y - dir.y*pos_offset);
+	};
+
+	// Nearest tile to the interpolated position
+	Int2 getTile()
+	{
+		Float2 p = getTilePos();
+		return Int2((int)floorf(p.x+0.5f), (int)floorf(p.y+0.5f));
+	};
+
+	State getState()
+	{
+		// Cleared so padding bytes compare equal in snapshots
+		State state;
+		ZeroMemory(&state, sizeof(state));
+		state.pos = pos;
+		state.pos_offset = pos_offset;
+		state.dir_queue = dir_queue;
+		state.dir = dir;
+		state.isMoving = isMoving;
+		state.qua_rot_tween = qua_rot_tween;
+		return state;
+	};
+
+	void setState(const State& state)
+	{
+		pos = state.pos;
+		pos_offset = state.pos_offset;
+		dir_queue = state.dir_queue;
+		dir = state.dir;
+		isMoving = state.isMoving;
+		qua_rot_tween = state.qua_rot_tween;
+	};
+
 	D3DXMATRIX debug_getPos()
 	{
 		// Return
@@ -0,0 +1,314 @@
+#ifndef GAMESNAPSHOT_H
+#define GAMESNAPSHOT_H
+
+#include <vector>
+#include <string.h>
+#include "MathUtil.h"
+
+//
+// Binary game state snapshots
+//
+// A snapshot is a header followed by sections, each section starts on a
+// page boundary so a change inside one array never dirties the pages of
+// another. Arrays may be stored with a smaller element type than in
+// memory (tiles as short, directions as char).
+//
+
+static const int snapshotPageSize = 1024;
+static const unsigned int snapshotMagic = 0x4e534d50;	// "PMSN"
+static const unsigned int snapshotVersion = 1;
+
+class SnapshotWriter
+{
+private:
+	std::vector<unsigned char>& out;
+
+	unsigned char* reserve(int bytes)
+	{
+		int pos = (int)out.size();
+		out.resize(pos+bytes);
+		return &out[pos];
+	};
+
+public:
+	SnapshotWriter(std::vector<unsigned char>& out) : out(out)
+	{
+		out.clear();
+	};
+
+	void align()
+	{
+		int size = (int)out.size();
+		out.resize((size+snapshotPageSize-1)/snapshotPageSize*snapshotPageSize, 0);
+	};
+
+	template<typename T>
+	void write(const T& value)
+	{
+		memcpy(reserve(sizeof(T)), &value, sizeof(T));
+	};
+
+	// Section header is 16 bytes so array data stays aligned
+	template<typename Stored, typename T>
+	void writeArray(unsigned int id, const T* data, int count)
+	{
+		align();
+		write(id);
+		write(count);
+		write((unsigned int)sizeof(Stored));
+		write((unsigned int)0);
+
+		if(count == 0)
+			return;
+		Stored* dst = (Stored*)reserve(count*sizeof(Stored));
+		for(int i=0; i<count; i++)
+			dst[i] = (Stored)data[i];
+	};
+
+	template<typename Stored, typename T>
+	void writeArray(unsigned int id, const std::vector<T>& data)
+	{
+		writeArray<Stored>(id, data.empty() ? 0 : &data[0], (int)data.size());
+	};
+};
+
+// Reads sections back in the order they were written, every read
+// returns false if the data does not match what is expected
+class SnapshotReader
+{
+private:
+	const std::vector<unsigned char>& in;
+	int pos;
+
+	void align()
+	{
+		pos = (pos+snapshotPageSize-1)/snapshotPageSize*snapshotPageSize;
+	};
+
+public:
+	SnapshotReader(const std::vector<unsigned char>& in) : in(in)
+	{
+		pos = 0;
+	};
+
+	template<typename T>
+	bool read(T& value)
+	{
+		if(pos+(int)sizeof(T) > (int)in.size())
+			return false;
+		memcpy(&value, &in[pos], sizeof(T));
+		pos += sizeof(T);
+		return true;
+	};
+
+	// Reads section header, returns element count or -1
+	template<typename Stored>
+	int readArrayHeader(unsigned int id)
+	{
+		align();
+		unsigned int readId, elementSize, reserved;
+		int count;
+		if(!read(readId) || !read(count) || !read(elementSize) || !read(reserved))
+			return -1;
+		if(readId != id || elementSize != sizeof(Stored) || count < 0)
+			return -1;
+		// Divided rather than multiplied, a corrupt count cannot overflow
+		if(pos > (int)in.size() || count > ((int)in.size()-pos)/(int)sizeof(Stored))
+			return -1;
+		return count;
+	};
+
+	template<typename Stored, typename T>
+	bool readArray(unsigned int id, T* data, int count)
+	{
+		if(readArrayHeader<Stored>(id) != count)
+			return false;
+		if(count == 0)
+			return true;
+
+		const Stored* src = (const Stored*)&in[pos];
+		for(int i=0; i<count; i++)
+			data[i] = (T)src[i];
+		pos += count*sizeof(Stored);
+		return true;
+	};
+
+	template<typename Stored, typename T>
+	bool readArray(unsigned int id, std::vector<T>& data)
+	{
+		int count = readArrayHeader<Stored>(id);
+		if(count < 0)
+			return false;
+		data.resize(count);
+		if(count == 0)
+			return true;
+
+		const Stored* src = (const Stored*)&in[pos];
+		for(int i=0; i<count; i++)
+			data[i] = (T)src[i];
+		pos += count*sizeof(Stored);
+		return true;
+	};
+};
+
+// Fixed number of most recent snapshots. Snapshots are split in pages,
+// a page equal to the same page of the previous snapshot is shared
+// instead of copied, pages are reference counted and recycled.
+class SnapshotRing
+{
+private:
+	struct Page
+	{
+		int refs;
+		int bytes;
+		unsigned char data[snapshotPageSize];
+	};
+
+	struct Entry
+	{
+		std::vector<Page*> pages;
+		int bytes;
+	};
+
+	std::vector<Entry> entries;
+	int head;	// slot of next push
+	int count;
+
+	std::vector<Page*> allPages;
+	std::vector<Page*> freePages;
+	std::vector<Page*> scratchPages;
+
+	Page* allocPage()
+	{
+		if(freePages.empty())
+		{
+			Page* page = new Page();
+			allPages.push_back(page);
+			return page;
+		}
+		Page* page = freePages.back();
+		freePages.pop_back();
+		return page;
+	};
+
+	void releasePages(std::vector<Page*>& pages)
+	{
+		for(int i=0; i<(int)pages.size(); i++)
+		{
+			if(--pages[i]->refs == 0)
+				freePages.push_back(pages[i]);
+		}
+		pages.clear();
+	};
+
+	int slot(int age) const
+	{
+		int capacity = (int)entries.size();
+		return (head-1-age+2*capacity) % capacity;
+	};
+
+	SnapshotRing(const SnapshotRing&);
+	SnapshotRing& operator=(const SnapshotRing&);
+
+public:
+	// Statistics of last push
+	int lastBytes;
+	int lastNewBytes;
+
+	SnapshotRing(int capacity)
+	{
+		entries.resize(capacity);
+		head = 0;
+		count = 0;
+		lastBytes = 0;
+		lastNewBytes = 0;
+	};
+
+	~SnapshotRing()
+	{
+		for(int i=0; i<(int)allPages.size(); i++)
+			delete allPages[i];
+	};
+
+	int size() const
+	{
+		return count;
+	};
+
+	int capacity() const
+	{
+		return (int)entries.size();
+	};
+
+	void clear()
+	{
+		for(int i=0; i<(int)entries.size(); i++)
+			releasePages(entries[i].pages);
+		head = 0;
+		count = 0;
+	};
+
+	void push(const std::vector<unsigned char>& blob)
+	{
+		const Entry* prev = count > 0 ? &entries[slot(0)] : 0;
+		int bytes = (int)blob.size();
+		int num_pages = (bytes+snapshotPageSize-1)/snapshotPageSize;
+
+		scratchPages.clear();
+		lastNewBytes = 0;
+		for(int p=0; p<num_pages; p++)
+		{
+			const unsigned char* src = &blob[p*snapshotPageSize];
+			int pageBytes = MathUtil::Min(snapshotPageSize, bytes-p*snapshotPageSize);
+
+			// Unchanged page, share it with previous snapshot
+			if(prev && p<(int)prev->pages.size())
+			{
+				Page* old = prev->pages[p];
+				if(old->bytes == pageBytes && memcmp(old->data, src, pageBytes) == 0)
+				{
+					old->refs++;
+					scratchPages.push_back(old);
+					continue;
+				}
+			}
+
+			Page* page = allocPage();
+			page->refs = 1;
+			page->bytes = pageBytes;
+			memcpy(page->data, src, pageBytes);
+			scratchPages.push_back(page);
+			lastNewBytes += pageBytes;
+		}
+
+		// Overwrites oldest snapshot once ring is full
+		Entry& entry = entries[head];
+		releasePages(entry.pages);
+		entry.pages.swap(scratchPages);
+		entry.bytes = bytes;
+		head = (head+1) % entries.size();
+		count = MathUtil::Min(count+1, (int)entries.size());
+		lastBytes = bytes;
+	};
+
+	// Copies snapshot "age" pushes back (0 is newest) to "out"
+	bool get(int age, std::vector<unsigned char>& out) const
+	{
+		if(age < 0 || age >= count)
+			return false;
+
+		const Entry& entry = entries[slot(age)];
+		out.resize(entry.bytes);
+		for(int p=0; p<(int)entry.pages.size(); p++)
+			memcpy(&out[p*snapshotPageSize], entry.pages[p]->data, entry.pages[p]->bytes);
+		return true;
+	};
+
+	// Memory held by pages in use
+	int getPageBytes() const
+	{
+		return ((int)allPages.size()-(int)freePages.size())*snapshotPageSize;
+	};
+};
+
+#endif
@@ -122,4 +122,33 @@ public:
 
 };
 
+// Measures wall time of isolated pieces of code, used by the in-app benchmarks
+class Stopwatch
+{
+private:
+	double secondsPerCount;
+	__int64 int_StartTime;
+
+public:
+	Stopwatch()
+	{
+		__int64 countsPerSec;
+		QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+		secondsPerCount=1.0/(double)countsPerSec;
+		start();
+	}
+
+	void start()
+	{
+		QueryPerformanceCounter((LARGE_INTEGER*)&int_StartTime);
+	};
+
+	// Milliseconds since last call to start()
+	float elapsedMs()const
+	{
+		__int64 t; QueryPerformanceCounter((LARGE_INTEGER*)&t);
+		return (float)((t-int_StartTime)*secondsPerCount*1000.0);
+	};
+};
+
 #endif
\ No newline at end of file
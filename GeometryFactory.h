@@ -8,27 +8,37 @@ class GeometryFactory
 public:
 	struct Vertex
 	{
-		Vertex(){}
+		Vertex() : Handedness(1.0f){}
 		Vertex(const XMFLOAT3& p, const XMFLOAT3& n, const XMFLOAT3& t, const XMFLOAT2& uv)
-			: Position(p), Normal(n), TangentU(t), TexC(uv){}
+			: Position(p), Normal(n), TangentU(t), TexC(uv), Handedness(1.0f){}
 		Vertex(
 			float px, float py, float pz, 
 			float nx, float ny, float nz,
 			float tx, float ty, float tz,
 			float u, float v)
 			: Position(px,py,pz), Normal(nx,ny,nz),
-			  TangentU(tx, ty, tz), TexC(u,v){}
+			  TangentU(tx, ty, tz), TexC(u,v), Handedness(1.0f){}
 
 		XMFLOAT3 Position;
 		XMFLOAT3 Normal;
 		XMFLOAT3 TangentU;
 		XMFLOAT2 TexC;
+		float Handedness;	// w of the tangent frame, bitangent is cross(Normal, TangentU)*w
+	};
+
+	// Range of indices drawn with one material
+	struct Subset
+	{
+		std::string Material;
+		UINT StartIndex;
+		UINT IndexCount;
 	};
 
 	struct MeshData
 	{
 		std::vector<Vertex> Vertices;
 		std::vector<UINT> Indices;
+		std::vector<Subset> Subsets;	// empty if the whole mesh has one material
 	};
 
 	///<summary>
@@ -352,33 +362,9 @@ public:
 		meshData.Indices[5] = 3;
 	}
 
-	vector<XMFLOAT3> vertex_pos;
-	vector<XMFLOAT2> vertex_uv;
-	vector<XMFLOAT3> vertex_norm;
-	vector<XMFLOAT3> vertex_tan;
-
-	void readVertices(stringstream& stream)
-	{
-		XMFLOAT3 pos;
-		stream >> pos.x >> pos.y >> pos.z;
-		vertex_pos.push_back(pos);
-	}
-	void readTextureUV(stringstream& stream)
-	{
-		XMFLOAT2 uv;
-		stream >> uv.x >> uv.y;
-		vertex_uv.push_back(uv);
-	}
-	void readNormals(stringstream& stream)
-	{
-		XMFLOAT3 normal;
-		stream >> normal.x >> normal.y >> normal.z;
-		vertex_norm.push_back(normal);
-	}
-	XMFLOAT3 createTangent(XMFLOAT3 v[3], XMFLOAT2 t[3]);
-
-	void readObjFile(MeshData* meshData);
-	void readFaces(stringstream& f, MeshData* meshData);
+	// Reads an indexed mesh from a Wavefront OBJ file, false if it could
+	// not be read
+	bool readObjFile(const char* path, MeshData* meshData);
 private:
 	void Subdivide(MeshData& meshData);
 	void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount, MeshData& meshData);
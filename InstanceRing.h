@@ -0,0 +1,99 @@
+#ifndef INSTANCERING_H
+#define INSTANCERING_H
+
+#include "ShaderManager.h"
+#include "RenderDevice.h"
+
+// Dynamic instance buffer written front to back. Each write appends with
+// MAP_WRITE_NO_OVERWRITE so instances already queued for the GPU are left
+// alone, when the end is reached the buffer is orphaned with MAP_WRITE_DISCARD
+// and writing starts over. Draws select their instances with the start
+// instance returned by write.
+class InstanceRing
+{
+private:
+	ID3D11Buffer* buffer;
+	int capacity;
+	int cursor;		// first free instance
+
+	InstanceRing(const InstanceRing&);
+	InstanceRing& operator=(const InstanceRing&);
+
+public:
+	// Statistics since last resetStats
+	int num_writes;
+	int num_discards;
+	int num_instances;
+
+	InstanceRing()
+	{
+		buffer = 0;
+		capacity = 0;
+		cursor = 0;
+		resetStats();
+	};
+	~InstanceRing()
+	{
+		ReleaseCOM(buffer);
+	};
+
+	void init(ID3D11Device* device, int capacity)
+	{
+		ReleaseCOM(buffer);
+		this->capacity = capacity;
+		cursor = capacity;	// first write discards
+
+		D3D11_BUFFER_DESC vbd;
+		vbd.Usage = D3D11_USAGE_DYNAMIC;
+		vbd.ByteWidth = sizeof(Vertex::InstancedData) * capacity;
+		vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		vbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		vbd.MiscFlags = 0;
+		vbd.StructureByteStride = 0;
+		HR(device->CreateBuffer(&vbd, 0, &buffer));
+	};
+
+	ID3D11Buffer* getBuffer()
+	{
+		return buffer;
+	};
+
+	int getCapacity() const
+	{
+		return capacity;
+	};
+
+	void resetStats()
+	{
+		num_writes = 0;
+		num_discards = 0;
+		num_instances = 0;
+	};
+
+	// Copies "count" world matrices (at most capacity) to the ring,
+	// returns the start instance of the first one
+	int write(RenderDevice* device, const XMFLOAT4X4* worlds, int count)
+	{
+		D3D11_MAP type = D3D11_MAP_WRITE_NO_OVERWRITE;
+		if(cursor+count > capacity)
+		{
+			type = D3D11_MAP_WRITE_DISCARD;
+			cursor = 0;
+			num_discards++;
+		}
+
+		UINT offset = cursor*sizeof(Vertex::InstancedData);
+		UINT bytes = count*sizeof(Vertex::InstancedData);
+		void* data = device->map(buffer, type, offset, bytes);
+		memcpy(data, worlds, bytes);
+		device->unmap(buffer);
+
+		int start = cursor;
+		cursor += count;
+		num_writes++;
+		num_instances += count;
+		return start;
+	};
+};
+
+#endif
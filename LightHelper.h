@@ -5,7 +5,7 @@
 
 struct DirectionalLight
 {
-	DirectionalLight() { ZeroMemory(this, sizeof(this)); }
+	DirectionalLight() { ZeroMemory(this, sizeof(*this)); }
 
 	XMFLOAT4 Ambient;
 	XMFLOAT4 Diffuse;
@@ -16,7 +16,7 @@ struct DirectionalLight
 
 struct PointLight
 {
-	PointLight() { ZeroMemory(this, sizeof(this)); }
+	PointLight() { ZeroMemory(this, sizeof(*this)); }
 
 	XMFLOAT4 Ambient;
 	XMFLOAT4 Diffuse;
@@ -33,7 +33,7 @@ struct PointLight
 
 struct SpotLight
 {
-	SpotLight() { ZeroMemory(this, sizeof(this)); }
+	SpotLight() { ZeroMemory(this, sizeof(*this)); }
 
 	XMFLOAT4 Ambient;
 	XMFLOAT4 Diffuse;
@@ -54,7 +54,7 @@ struct SpotLight
 
 struct Material
 {
-	Material() { ZeroMemory(this, sizeof(this)); }
+	Material() { ZeroMemory(this, sizeof(*this)); }
 
 	XMFLOAT4 Ambient;
 	XMFLOAT4 Diffuse;
@@ -0,0 +1,95 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <windows.h>
+
+//
+// Read only view of a whole file
+//
+// The file is mapped into memory instead of read, pages are loaded by the
+// OS as they are touched and nothing is copied into a buffer of our own.
+// An empty file opens with no data.
+//
+
+class MappedFile
+{
+private:
+	HANDLE file;
+	HANDLE mapping;
+	const char* view;
+	size_t size;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile()
+	{
+		file = INVALID_HANDLE_VALUE;
+		mapping = 0;
+		view = 0;
+		size = 0;
+	};
+	~MappedFile()
+	{
+		close();
+	};
+
+	// False if the file could not be opened or mapped
+	bool open(const char* path)
+	{
+		close();
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+		if(file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if(!GetFileSizeEx(file, &fileSize))
+		{
+			close();
+			return false;
+		}
+		size = (size_t)fileSize.QuadPart;
+		if(size == 0)
+			return true;
+
+		mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+		if(mapping)
+			view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if(!view)
+		{
+			close();
+			return false;
+		}
+		return true;
+	};
+
+	void close()
+	{
+		if(view)
+			UnmapViewOfFile(view);
+		if(mapping)
+			CloseHandle(mapping);
+		if(file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = 0;
+		view = 0;
+		size = 0;
+	};
+
+	bool isOpen() const
+	{
+		return file != INVALID_HANDLE_VALUE;
+	};
+	const char* getData() const
+	{
+		return view;
+	};
+	size_t getSize() const
+	{
+		return size;
+	};
+};
+
+#endif
@@ -3,7 +3,10 @@
 
 #include <d3dx10.h>
 #include <fstream>
+#include <malloc.h>
+#include <sys/stat.h>
 #include "Util.h"
+#include "BitGrid.h"
 using namespace std;
 
 class Maze{
@@ -12,24 +15,76 @@ private:
 	static const int sizeX=28;
 	static const int sizeY=31;
 	int grid[sizeX][sizeY];
+	BitGrid walls;	// packed copy of grid, set bit means wall
+	int revision;	// increased every time tiles change
+	time_t fileTime;	// modification time of labyrinth file at last load
 	D3DXQUATERNION qua_rot_tween;
 
+	// World matrix of every tile (x+y*sizeX) and of wall tiles only, 16 byte
+	// aligned for XMMATRIX. Rebuilt lazily when transform or tiles change.
+	XMMATRIX* tileWorlds;
+	XMMATRIX* wallWorlds;
+	int num_walls;
+	int tileWorldsRevision;
+	bool transformChanged;
+
+	void updateTileWorlds()
+	{
+		if(!transformChanged && tileWorldsRevision == revision)
+			return;
+
+		XMMATRIX transform = XMLoadFloat4x4((const XMFLOAT4X4*)&position);
+		num_walls = 0;
+		for(int y=0; y<sizeY; y++)
+		{
+			for(int x=0; x<sizeX; x++)
+			{
+				XMMATRIX world = XMMatrixTranslation(x-sizeX-10.0f, 20.0f, (float)(y-sizeY))*transform;
+				tileWorlds[x+y*sizeX] = world;
+				if(grid[x][y]==1)
+					wallWorlds[num_walls++] = world;
+			}
+		}
+
+		tileWorldsRevision = revision;
+		transformChanged = false;
+	};
+
+	Maze(const Maze&);
+	Maze& operator=(const Maze&);
+
 public:
 	Maze()
 	{
 		// World cordinates
 		D3DXMatrixIdentity(&position);
+		tileWorlds = (XMMATRIX*)_aligned_malloc(sizeof(XMMATRIX)*sizeX*sizeY, 16);
+		wallWorlds = (XMMATRIX*)_aligned_malloc(sizeof(XMMATRIX)*sizeX*sizeY, 16);
+		num_walls = 0;
+		tileWorldsRevision = -1;
+		transformChanged = true;
 
 		// Init grid
+		walls.resize(sizeX, sizeY);
+		revision = 0;
+		fileTime = 0;
 		createMaze();
 	};
 
+	~Maze()
+	{
+		_aligned_free(tileWorlds);
+		_aligned_free(wallWorlds);
+	};
+
 	void createMaze()
 	{
 		// Reset grid
 		for(int x=0; x<sizeX; x++)
 			for(int y=0; y<sizeY; y++)
 				grid[x][y]=0;
+		walls.clearAll();
+		revision++;
 
 		//// Create labyrinth
 		//for(int x=0; x<sizeX; x++)
@@ -41,35 +96,65 @@ public:
 		//	}	
 		//}
 
-		loadFromTextfile();
+		if(!loadFromTextfile())
+		{
+			string message =  "Unable to load: "+string(getFileName());
+			QMessageBox::information(0, "Error", message.c_str());
+		}
 	};
 
-	void loadFromTextfile()
+	// Reads the labyrinth file, false if it can't be opened or has fewer
+	// than sizeY lines of sizeX tiles, as while an editor is still writing
+	// it. Tiles are only changed once the whole file has been read.
+	bool loadFromTextfile()
 	{
-		//Load High Score
 		string line;
-		string fileName = "labyrinth.txt";
+		string fileName = getFileName();
 		ifstream f(fileName);
-		if(f.is_open())
+		if(!f.is_open())
+			return false;
+
+		struct _stat info;
+		time_t time = _stat(fileName.c_str(), &info)==0 ? info.st_mtime : 0;
+
+		int loaded[sizeX][sizeY];
+		for (int y=sizeY-1; y>=0; y--)
 		{
-			for (int y=sizeY-1; y>=0; y--)
-			{
-				getline(f,line);
-				for(int x=0; x<sizeX; x++)
-				{
-					if(line[x]=='#')
-						grid[x][y]=1;
-					else
-						grid[x][y]=0;
-				}
-			}
-			f.close();
+			if(!getline(f,line) || (int)line.size()<sizeX)
+				return false;
+			for(int x=0; x<sizeX; x++)
+				loaded[x][y] = line[x]=='#' ? 1 : 0;
 		}
-		else
+		f.close();
+
+		fileTime = time;
+		for(int y=0; y<sizeY; y++)
 		{
-			string message =  "Unable to find: "+fileName;
-			QMessageBox::information(0, "Error", message.c_str());
+			for(int x=0; x<sizeX; x++)
+			{
+				grid[x][y] = loaded[x][y];
+				walls.set(x, y, grid[x][y]==1);
+			}
 		}
+		revision++;
+		return true;
+	};
+
+	static const char* getFileName()
+	{
+		return "labyrinth.txt";
+	};
+
+	// Reloads labyrinth file if it was modified since last load,
+	// returns true if maze changed. A file that can't be read yet keeps
+	// the current maze and is tried again on the next call.
+	bool reloadIfChanged()
+	{
+		struct _stat info;
+		if(_stat(getFileName(), &info)!=0 || info.st_mtime==fileTime)
+			return false;
+
+		return loadFromTextfile();
 	};
 
 	D3DXMATRIX getPosition(int x, int y)
@@ -83,6 +168,32 @@ public:
 		return translation*position;
 	};
 
+	void setTransform(const D3DXMATRIX& transform)
+	{
+		position = transform;
+		transformChanged = true;
+	};
+
+	// Cached equivalent of getPosition(), only valid inside the maze
+	const XMMATRIX& getTileWorld(int x, int y)
+	{
+		updateTileWorlds();
+		return tileWorlds[x+y*sizeX];
+	};
+
+	// World matrices of wall tiles, in row order
+	const XMMATRIX* getWallWorlds()
+	{
+		updateTileWorlds();
+		return wallWorlds;
+	};
+
+	int getWallCount()
+	{
+		updateTileWorlds();
+		return num_walls;
+	};
+
 	int getSizeX()
 	{
 		return sizeX;
@@ -105,6 +216,40 @@ public:
 		return grid[x][y];
 	};
 
+	void setTile(int x, int y, int value)
+	{
+		if(!walls.isValidIndex(x,y) || grid[x][y]==value)
+			return;
+
+		grid[x][y] = value;
+		walls.set(x, y, value==1);
+		revision++;
+	};
+
+	const BitGrid& getWalls()
+	{
+		return walls;
+	};
+
+	// Replaces every tile, revision only changes if some tile differs
+	void setWalls(const BitGrid& newWalls)
+	{
+		if(newWalls.getSizeX()!=sizeX || newWalls.getSizeY()!=sizeY || newWalls==walls)
+			return;
+
+		walls = newWalls;
+		for(int x=0; x<sizeX; x++)
+			for(int y=0; y<sizeY; y++)
+				grid[x][y] = walls.test(x,y) ? 1 : 0;
+		revision++;
+	};
+
+	// Lets caches built from the tiles detect that they are stale
+	int getRevision()
+	{
+		return revision;
+	};
+
 	void buildMenu(TwBar* menu)
 	{
 		TwAddVarRW(menu, "Maze rotation", TW_TYPE_QUAT4F, &qua_rot_tween, "opened=false axisz=-z group=Maze");
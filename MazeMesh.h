@@ -0,0 +1,238 @@
+#ifndef MAZEMESH_H
+#define MAZEMESH_H
+
+#include "GeometryFactory.h"
+#include "Maze.h"
+#include "GameTimer.h"
+
+// Bakes every wall of a maze into a single mesh. Faces between two walls
+// are never visible and are dropped, the remaining coplanar faces are
+// greedily merged into as few quads as possible.
+//
+// The mesh is in tile units: tile (x, y) is the unit box centered at
+// (x, 0, y), so it is placed with the world matrix of tile (0, 0).
+class MazeMeshBaker
+{
+public:
+	// Rectangle of w*h wall tiles starting at tile (x, y)
+	struct TileRect
+	{
+		int x;
+		int y;
+		int w;
+		int h;
+	};
+
+private:
+	std::vector<unsigned char> visited;
+	std::vector<TileRect> rects;
+
+	static XMFLOAT3 cross(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(
+			a.y*b.z - a.z*b.y,
+			a.z*b.x - a.x*b.z,
+			a.x*b.y - a.y*b.x);
+	};
+
+	static float dot(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return a.x*b.x + a.y*b.y + a.z*b.z;
+	};
+
+	// Adds the axis aligned rectangle spanning [minP, maxP] (flat along
+	// the normal). "tangent" is the texture u direction, v is chosen so
+	// the winding and uv layout match GeometryFactory::CreateBox. Texture
+	// repeats once per tile.
+	void addQuad(const XMFLOAT3& minP, const XMFLOAT3& maxP, const XMFLOAT3& normal, const XMFLOAT3& tangent, GeometryFactory::MeshData& mesh)
+	{
+		XMFLOAT3 bitangent = cross(tangent, normal);
+		XMFLOAT3 size(maxP.x-minP.x, maxP.y-minP.y, maxP.z-minP.z);
+		float lenU = fabsf(dot(size, tangent));
+		float lenV = fabsf(dot(size, bitangent));
+
+		// Corner where both u and v start
+		XMFLOAT3 o(
+			tangent.x+bitangent.x < 0.0f ? maxP.x : minP.x,
+			tangent.y+bitangent.y < 0.0f ? maxP.y : minP.y,
+			tangent.z+bitangent.z < 0.0f ? maxP.z : minP.z);
+		XMFLOAT3 u(tangent.x*lenU, tangent.y*lenU, tangent.z*lenU);
+		XMFLOAT3 v(bitangent.x*lenV, bitangent.y*lenV, bitangent.z*lenV);
+
+		UINT base = mesh.Vertices.size();
+		mesh.Vertices.push_back(GeometryFactory::Vertex(o, normal, tangent, XMFLOAT2(0.0f, lenV)));
+		mesh.Vertices.push_back(GeometryFactory::Vertex(XMFLOAT3(o.x+v.x, o.y+v.y, o.z+v.z), normal, tangent, XMFLOAT2(0.0f, 0.0f)));
+		mesh.Vertices.push_back(GeometryFactory::Vertex(XMFLOAT3(o.x+u.x+v.x, o.y+u.y+v.y, o.z+u.z+v.z), normal, tangent, XMFLOAT2(lenU, 0.0f)));
+		mesh.Vertices.push_back(GeometryFactory::Vertex(XMFLOAT3(o.x+u.x, o.y+u.y, o.z+u.z), normal, tangent, XMFLOAT2(lenU, lenV)));
+
+		mesh.Indices.push_back(base+0);
+		mesh.Indices.push_back(base+1);
+		mesh.Indices.push_back(base+2);
+		mesh.Indices.push_back(base+0);
+		mesh.Indices.push_back(base+2);
+		mesh.Indices.push_back(base+3);
+		num_quads++;
+	};
+
+	bool isWall(Maze* maze, int x, int y)
+	{
+		// outside of maze is open, border faces stay
+		return maze->getWalls().safe_test(x,y);
+	};
+
+	// Top and bottom faces, one quad per wall rectangle
+	void mergeCaps(const std::vector<TileRect>& rects, float height, const XMFLOAT3& normal, const XMFLOAT3& tangent, GeometryFactory::MeshData& mesh)
+	{
+		for(int i=0; i<(int)rects.size(); i++)
+		{
+			const TileRect& r = rects[i];
+			addQuad(
+				XMFLOAT3(r.x-0.5f, height, r.y-0.5f),
+				XMFLOAT3(r.x+r.w-0.5f, height, r.y+r.h-0.5f),
+				normal, tangent, mesh);
+		}
+	};
+
+	// Runs of visible side faces facing (dx, dy). Walls are one tile high
+	// so merging on a side plane only happens along the run.
+	void mergeSides(Maze* maze, int dx, int dy, GeometryFactory::MeshData& mesh)
+	{
+		int sizeX = maze->getSizeX();
+		int sizeY = maze->getSizeY();
+		XMFLOAT3 normal((float)dx, 0.0f, (float)dy);
+		// Same tangents as the box faces
+		XMFLOAT3 tangent((float)-dy, 0.0f, (float)dx);
+
+		// Faces facing along x run along y and the other way around
+		int lines = dx!=0 ? sizeX : sizeY;
+		int length = dx!=0 ? sizeY : sizeX;
+		for(int line=0; line<lines; line++)
+		{
+			int start = -1;
+			for(int i=0; i<=length; i++)
+			{
+				int x = dx!=0 ? line : i;
+				int y = dx!=0 ? i : line;
+				bool visible = i<length && isWall(maze, x, y) && !isWall(maze, x+dx, y+dy);
+				if(visible)
+				{
+					if(start == -1)
+						start = i;
+					continue;
+				}
+				if(start == -1)
+					continue;
+
+				num_culledFaces -= i-start;
+				if(dx != 0)
+				{
+					float px = line + 0.5f*dx;
+					addQuad(XMFLOAT3(px, -0.5f, start-0.5f), XMFLOAT3(px, 0.5f, i-0.5f), normal, tangent, mesh);
+				}
+				else
+				{
+					float pz = line + 0.5f*dy;
+					addQuad(XMFLOAT3(start-0.5f, -0.5f, pz), XMFLOAT3(i-0.5f, 0.5f, pz), normal, tangent, mesh);
+				}
+				start = -1;
+			}
+		}
+	};
+
+public:
+	// Statistics of last bake
+	int num_walls;
+	int num_culledFaces;	// side faces hidden by a neighbouring wall
+	int num_quads;
+	int num_triangles;
+	float bakeMs;
+
+	MazeMeshBaker()
+	{
+		num_walls = 0;
+		num_culledFaces = 0;
+		num_quads = 0;
+		num_triangles = 0;
+		bakeMs = 0.0f;
+	};
+
+	// Greedy rectangles covering every wall tile once. Used for the top
+	// and bottom faces, and as boxes by anything that wants the walls in
+	// a few large pieces.
+	void findWallRects(Maze* maze, std::vector<TileRect>& out)
+	{
+		int sizeX = maze->getSizeX();
+		int sizeY = maze->getSizeY();
+		visited.assign(sizeX*sizeY, 0);
+		out.clear();
+
+		for(int y=0; y<sizeY; y++)
+		{
+			for(int x=0; x<sizeX; x++)
+			{
+				if(visited[x+y*sizeX] || !isWall(maze, x, y))
+					continue;
+
+				// Grow along x, then add rows while the whole span fits
+				int w = 1;
+				while(x+w<sizeX && !visited[x+w+y*sizeX] && isWall(maze, x+w, y))
+					w++;
+				int h = 1;
+				for(bool grow=true; grow && y+h<sizeY; )
+				{
+					for(int i=0; i<w; i++)
+					{
+						if(visited[x+i+(y+h)*sizeX] || !isWall(maze, x+i, y+h))
+						{
+							grow = false;
+							break;
+						}
+					}
+					if(grow)
+						h++;
+				}
+
+				for(int j=0; j<h; j++)
+					for(int i=0; i<w; i++)
+						visited[x+i+(y+j)*sizeX] = 1;
+
+				TileRect r;
+				r.x = x;
+				r.y = y;
+				r.w = w;
+				r.h = h;
+				out.push_back(r);
+			}
+		}
+	};
+
+	// Wall rectangles of the last bake
+	const std::vector<TileRect>& getWallRects() const
+	{
+		return rects;
+	};
+
+	void bake(Maze* maze, GeometryFactory::MeshData& mesh)
+	{
+		Stopwatch watch;
+		mesh.Vertices.clear();
+		mesh.Indices.clear();
+		num_quads = 0;
+
+		num_walls = maze->getWalls().count();
+		num_culledFaces = 4*num_walls;	// visible ones are subtracted below
+
+		findWallRects(maze, rects);
+		mergeCaps(rects, 0.5f, XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), mesh);
+		mergeCaps(rects, -0.5f, XMFLOAT3(0.0f, -1.0f, 0.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), mesh);
+		mergeSides(maze, 1, 0, mesh);
+		mergeSides(maze, -1, 0, mesh);
+		mergeSides(maze, 0, 1, mesh);
+		mergeSides(maze, 0, -1, mesh);
+
+		num_triangles = mesh.Indices.size()/3;
+		bakeMs = watch.elapsedMs();
+	};
+};
+
+#endif
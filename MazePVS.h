@@ -0,0 +1,250 @@
+#ifndef MAZEPVS_H
+#define MAZEPVS_H
+
+#include <vector>
+#include <math.h>
+#include <float.h>
+#include <ppl.h>
+#include "BitGrid.h"
+#include "Maze.h"
+#include "GameTimer.h"
+
+//
+// Potentially visible sets of the maze
+//
+// Every open tile gets a row with one bit per tile, set for tiles that
+// can be seen from it. Rows are baked by casting rays through the grid
+// from a few sample points inside the tile. A ray marks every tile it
+// crosses and stops at the first wall, which is marked as well, so walls
+// facing the tile are in the set. Rows are baked on worker threads and
+// baked again when the maze revision changes.
+//
+// Rows are stored as bytes with every run of zero bytes packed into a
+// zero and a run length, most of the maze is hidden from any one tile.
+//
+// Rays only sample the tile, a tile seen through a gap narrower than the
+// spacing of the rays can be missed.
+//
+
+class MazePVS
+{
+private:
+	int sizeX;
+	int sizeY;
+	int bakedRevision;
+	BitGrid hasRow;				// open tiles at bake time
+	std::vector<unsigned char> data;
+	std::vector<int> rowOffset;	// start of every row in "data", one extra at the end
+
+	// Last decompressed row
+	BitGrid row;
+	int rowTile;
+
+	// Marks tiles crossed by the ray from (px, py) along (dx, dy) in tile
+	// space, where tile (x, y) covers [x-0.5, x+0.5]
+	static void castRay(const BitGrid& walls, float px, float py, float dx, float dy, BitGrid& visible)
+	{
+		int x = (int)floorf(px+0.5f);
+		int y = (int)floorf(py+0.5f);
+		int stepX = dx > 0.0f ? 1 : -1;
+		int stepY = dy > 0.0f ? 1 : -1;
+		float deltaX = dx != 0.0f ? fabsf(1.0f/dx) : FLT_MAX;
+		float deltaY = dy != 0.0f ? fabsf(1.0f/dy) : FLT_MAX;
+		float nextX = dx != 0.0f ? (x+0.5f*stepX-px)/dx : FLT_MAX;
+		float nextY = dy != 0.0f ? (y+0.5f*stepY-py)/dy : FLT_MAX;
+
+		while(walls.isValidIndex(x, y))
+		{
+			visible.set(x, y);
+			if(walls.test(x, y))
+				break;
+			if(nextX < nextY)
+			{
+				x += stepX;
+				nextX += deltaX;
+			}
+			else
+			{
+				y += stepY;
+				nextY += deltaY;
+			}
+		}
+	};
+
+	static void compress(const BitGrid& bits, std::vector<unsigned char>& out)
+	{
+		out.clear();
+		int num_bytes = bits.getWordCount()*4;
+		for(int i=0; i<num_bytes; )
+		{
+			unsigned char b = (unsigned char)(bits.getWord(i >> 2) >> ((i & 3)*8));
+			if(b != 0)
+			{
+				out.push_back(b);
+				i++;
+				continue;
+			}
+
+			int run = 0;
+			while(i < num_bytes && run < 255 && (unsigned char)(bits.getWord(i >> 2) >> ((i & 3)*8)) == 0)
+			{
+				run++;
+				i++;
+			}
+			out.push_back(0);
+			out.push_back((unsigned char)run);
+		}
+	};
+
+	void decompress(int tile, BitGrid& out) const
+	{
+		out.resize(sizeX, sizeY);
+		unsigned int* words = out.getWords();
+		int pos = 0;
+		for(int i=rowOffset[tile]; i<rowOffset[tile+1]; i++)
+		{
+			if(data[i] == 0)
+			{
+				pos += data[++i];
+				continue;
+			}
+			words[pos >> 2] |= (unsigned int)data[i] << ((pos & 3)*8);
+			pos++;
+		}
+	};
+
+public:
+	// Settings, a new bake is needed for them to take effect
+	int samplesPerSide;		// sample points per tile are the square of this
+	int raysPerSample;
+
+	// Statistics of last bake
+	float bakeMs;
+	int num_rows;
+	int num_rays;
+	int rawBytes;			// rows stored as plain bits
+	int compressedBytes;
+	float avgVisible;		// tiles per row
+
+	MazePVS()
+	{
+		sizeX = 0;
+		sizeY = 0;
+		bakedRevision = -1;
+		rowTile = -1;
+		samplesPerSide = 3;
+		raysPerSample = 1024;
+		bakeMs = 0.0f;
+		num_rows = 0;
+		num_rays = 0;
+		rawBytes = 0;
+		compressedBytes = 0;
+		avgVisible = 0.0f;
+	};
+
+	// Bakes if the maze changed since the last bake, true if it did
+	bool update(Maze* maze)
+	{
+		if(maze->getRevision() == bakedRevision)
+			return false;
+		bake(maze);
+		return true;
+	};
+
+	void bake(Maze* maze)
+	{
+		Stopwatch watch;
+		const BitGrid& walls = maze->getWalls();
+		sizeX = walls.getSizeX();
+		sizeY = walls.getSizeY();
+		bakedRevision = maze->getRevision();
+		rowTile = -1;
+
+		int num_tiles = sizeX*sizeY;
+		int samples = MathUtil::Max(1, samplesPerSide);
+		int rays = MathUtil::Max(4, raysPerSample);
+
+		// Every tile compresses into its own row, joined in order below
+		std::vector<std::vector<unsigned char>> rows(num_tiles);
+		std::vector<int> counts(num_tiles, 0);
+		Concurrency::parallel_for(0, num_tiles, [&](int tile)
+		{
+			int x = tile % sizeX;
+			int y = tile / sizeX;
+			if(walls.test(tile))
+				return;
+
+			BitGrid visible(sizeX, sizeY);
+			for(int sy=0; sy<samples; sy++)
+			{
+				for(int sx=0; sx<samples; sx++)
+				{
+					float px = x-0.5f + (sx+0.5f)/samples;
+					float py = y-0.5f + (sy+0.5f)/samples;
+					for(int r=0; r<rays; r++)
+					{
+						float angle = 2.0f*XM_PI*r/rays;
+						castRay(walls, px, py, cosf(angle), sinf(angle), visible);
+					}
+				}
+			}
+			compress(visible, rows[tile]);
+			counts[tile] = visible.count();
+		});
+
+		hasRow = walls;
+		for(int i=0; i<hasRow.getWordCount(); i++)
+			hasRow.getWords()[i] = ~walls.getWord(i);
+
+		data.clear();
+		rowOffset.resize(num_tiles+1);
+		num_rows = 0;
+		int num_visible = 0;
+		for(int tile=0; tile<num_tiles; tile++)
+		{
+			rowOffset[tile] = (int)data.size();
+			data.insert(data.end(), rows[tile].begin(), rows[tile].end());
+			if(!walls.test(tile))
+			{
+				num_rows++;
+				num_visible += counts[tile];
+			}
+		}
+		rowOffset[num_tiles] = (int)data.size();
+
+		num_rays = num_rows*samples*samples*rays;
+		rawBytes = num_rows*walls.getWordCount()*4;
+		compressedBytes = (int)data.size();
+		avgVisible = num_rows > 0 ? (float)num_visible/num_rows : 0.0f;
+		bakeMs = watch.elapsedMs();
+	};
+
+	// Tiles seen from tile (x, y), 0 outside of the maze or inside walls.
+	// Stays valid until the next call.
+	const BitGrid* getRow(int x, int y)
+	{
+		if(!hasRow.isValidIndex(x, y) || !hasRow.test(x, y))
+			return 0;
+
+		int tile = hasRow.index(x, y);
+		if(tile != rowTile)
+		{
+			decompress(tile, row);
+			rowTile = tile;
+		}
+		return &row;
+	};
+
+	// True if any tile overlapped by a tile sized box at the continuous
+	// tile position (x, y) is set in "visible"
+	static bool isVisible(const BitGrid& visible, float x, float y)
+	{
+		int x0 = (int)floorf(x);
+		int y0 = (int)floorf(y);
+		return
+			visible.safe_test(x0, y0) || visible.safe_test(x0+1, y0) ||
+			visible.safe_test(x0, y0+1) || visible.safe_test(x0+1, y0+1);
+	};
+};
+
+#endif
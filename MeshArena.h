@@ -0,0 +1,630 @@
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+#include "ShaderManager.h"
+#include "RenderDevice.h"
+
+//
+// Mesh arena
+//
+// Every mesh lives in one large vertex buffer and one of two large index
+// buffers, so the buffers stay bound from one draw to the next and a mesh
+// is only a range of each. Ranges are handed out from a free list, best
+// fit with neighbouring free ranges joined again when a mesh is removed.
+// Indices are relative to the first vertex of their mesh, a draw passes
+// the vertex offset as base vertex, so any mesh of up to 65536 vertices
+// goes in the 16-bit index buffer and only larger ones in the 32-bit one.
+//
+// Vertices are stored as Vertex::packed. Positions are quantized inside
+// the bounds of their mesh, which a draw sets with the position bounds of
+// the effect.
+//
+// All buffers are mirrored in memory. When a range no longer fits, the
+// arena is first compacted if that would leave room, otherwise the
+// buffers are recreated at twice the size from the mirror. Compacting
+// moves meshes towards the front and uploads the used part again, handles
+// keep pointing at their mesh.
+//
+
+typedef int MeshHandle;
+
+struct MeshRange
+{
+	UINT startVertex;
+	UINT num_vertices;
+	UINT startIndex;		// in the index buffer of its width
+	UINT num_indices;
+	bool wideIndices;		// 32-bit indices
+
+	// Position is posOffset + posScale*snorm
+	XMFLOAT3 posScale;
+	XMFLOAT3 posOffset;
+};
+
+// Free ranges of a buffer in units of one element
+class RangeAllocator
+{
+private:
+	struct Block
+	{
+		UINT offset;
+		UINT size;
+	};
+	std::vector<Block> freeBlocks;		// sorted by offset, never touching
+	UINT capacity;
+
+public:
+	RangeAllocator()
+	{
+		capacity = 0;
+	};
+
+	void reset(UINT capacity, UINT used)
+	{
+		this->capacity = capacity;
+		freeBlocks.clear();
+		if(used < capacity)
+		{
+			Block block = {used, capacity-used};
+			freeBlocks.push_back(block);
+		}
+	};
+
+	// Smallest free block "size" fits in, false if there is none
+	bool allocate(UINT size, UINT& offset)
+	{
+		if(size == 0)
+		{
+			offset = 0;
+			return true;
+		}
+
+		int best = -1;
+		for(int i=0; i<(int)freeBlocks.size(); i++)
+		{
+			if(freeBlocks[i].size >= size && (best < 0 || freeBlocks[i].size < freeBlocks[best].size))
+				best = i;
+		}
+		if(best < 0)
+			return false;
+
+		offset = freeBlocks[best].offset;
+		freeBlocks[best].offset += size;
+		freeBlocks[best].size -= size;
+		if(freeBlocks[best].size == 0)
+			freeBlocks.erase(freeBlocks.begin()+best);
+		return true;
+	};
+
+	void free(UINT offset, UINT size)
+	{
+		if(size == 0)
+			return;
+
+		int i = 0;
+		while(i < (int)freeBlocks.size() && freeBlocks[i].offset < offset)
+			i++;
+		Block block = {offset, size};
+		freeBlocks.insert(freeBlocks.begin()+i, block);
+
+		// Join with next, then with previous
+		if(i+1 < (int)freeBlocks.size() && freeBlocks[i].offset+freeBlocks[i].size == freeBlocks[i+1].offset)
+		{
+			freeBlocks[i].size += freeBlocks[i+1].size;
+			freeBlocks.erase(freeBlocks.begin()+i+1);
+		}
+		if(i > 0 && freeBlocks[i-1].offset+freeBlocks[i-1].size == freeBlocks[i].offset)
+		{
+			freeBlocks[i-1].size += freeBlocks[i].size;
+			freeBlocks.erase(freeBlocks.begin()+i);
+		}
+	};
+
+	// Space added at the end joins the last free block if it reaches there
+	void grow(UINT newCapacity)
+	{
+		UINT oldCapacity = capacity;
+		capacity = newCapacity;
+		free(oldCapacity, newCapacity-oldCapacity);
+	};
+
+	UINT getCapacity() const
+	{
+		return capacity;
+	};
+	UINT getFree() const
+	{
+		UINT total = 0;
+		for(int i=0; i<(int)freeBlocks.size(); i++)
+			total += freeBlocks[i].size;
+		return total;
+	};
+	UINT getLargestFree() const
+	{
+		UINT largest = 0;
+		for(int i=0; i<(int)freeBlocks.size(); i++)
+			largest = MathUtil::Max(largest, freeBlocks[i].size);
+		return largest;
+	};
+	int getBlockCount() const
+	{
+		return (int)freeBlocks.size();
+	};
+};
+
+class MeshArena
+{
+private:
+	ID3D11Device* device;
+	ID3D11Buffer* vb;
+	ID3D11Buffer* ib16;
+	ID3D11Buffer* ib32;
+	std::vector<Vertex::packed> vertices;	// mirror of "vb"
+	std::vector<USHORT> indices16;			// mirror of "ib16"
+	std::vector<UINT> indices32;			// mirror of "ib32"
+	RangeAllocator vertexRanges;
+	RangeAllocator indexRanges16;
+	RangeAllocator indexRanges32;
+
+	// Handle is the index of its slot, free slots are reused
+	std::vector<MeshRange> slots;
+	std::vector<bool> slotUsed;
+	std::vector<int> freeSlots;
+
+	template<typename T>
+	ID3D11Buffer* createBuffer(const std::vector<T>& mirror, UINT bindFlags)
+	{
+		D3D11_BUFFER_DESC desc;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.ByteWidth = sizeof(T) * mirror.size();
+		desc.BindFlags = bindFlags;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+		desc.StructureByteStride = 0;
+		D3D11_SUBRESOURCE_DATA initData;
+		initData.pSysMem = &mirror[0];
+		ID3D11Buffer* buffer;
+		HR(device->CreateBuffer(&desc, &initData, &buffer));
+		return buffer;
+	};
+	void createBuffers()
+	{
+		ReleaseCOM(vb);
+		ReleaseCOM(ib16);
+		ReleaseCOM(ib32);
+		vb = createBuffer(vertices, D3D11_BIND_VERTEX_BUFFER);
+		ib16 = createBuffer(indices16, D3D11_BIND_INDEX_BUFFER);
+		ib32 = createBuffer(indices32, D3D11_BIND_INDEX_BUFFER);
+	};
+
+	// Copies "count" elements of a mirror from "first" on to its buffer
+	template<typename T>
+	void upload(RenderDevice* dc, ID3D11Buffer* buffer, const std::vector<T>& mirror, UINT first, UINT count)
+	{
+		if(count == 0)
+			return;
+		dc->updateBuffer(buffer, first*sizeof(T), &mirror[first], count*sizeof(T));
+		num_uploadedBytes += count*sizeof(T);
+	};
+
+	// Makes room for a range of "size" in "ranges" with mirror "mirror",
+	// compacting before growing when the free space would be enough. True
+	// if the mirror grew and the buffers have to be created again.
+	template<typename T>
+	bool reserve(RenderDevice* dc, RangeAllocator& ranges, std::vector<T>& mirror, UINT size)
+	{
+		if(ranges.getLargestFree() >= size)
+			return false;
+		if(ranges.getFree() >= size)
+		{
+			defragment(dc);
+			return false;
+		}
+
+		UINT capacity = MathUtil::Max(2*ranges.getCapacity(), ranges.getCapacity()+size);
+		mirror.resize(capacity);
+		ranges.grow(capacity);
+		num_grows++;
+		return true;
+	};
+
+	// Moves the ranges of "order" to the front of "mirror", "start" and
+	// "count" select the range of a slot
+	template<typename T>
+	UINT compact(std::vector<int>& order, std::vector<T>& mirror, UINT MeshRange::*start, UINT MeshRange::*count)
+	{
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return slots[a].*start < slots[b].*start; });
+		UINT cursor = 0;
+		for(int i=0; i<(int)order.size(); i++)
+		{
+			MeshRange& range = slots[order[i]];
+			if(range.*start != cursor && range.*count > 0)
+				memmove(&mirror[cursor], &mirror[range.*start], range.*count*sizeof(T));
+			range.*start = cursor;
+			cursor += range.*count;
+		}
+		return cursor;
+	};
+
+	// Makes room for "range" and places it, true if the buffers have to
+	// be created again
+	bool allocate(RenderDevice* dc, MeshRange& range)
+	{
+		bool grown = reserve(dc, vertexRanges, vertices, range.num_vertices);
+		if(range.wideIndices)
+			grown = reserve(dc, indexRanges32, indices32, range.num_indices) || grown;
+		else
+			grown = reserve(dc, indexRanges16, indices16, range.num_indices) || grown;
+
+		vertexRanges.allocate(range.num_vertices, range.startVertex);
+		if(range.wideIndices)
+			indexRanges32.allocate(range.num_indices, range.startIndex);
+		else
+			indexRanges16.allocate(range.num_indices, range.startIndex);
+		return grown;
+	};
+
+	// Uploads a range filled in the mirrors and hands out its handle
+	MeshHandle commit(RenderDevice* dc, const MeshRange& range, bool grown)
+	{
+		// New buffers start out with the whole mirror
+		if(grown)
+		{
+			createBuffers();
+		}
+		else
+		{
+			upload(dc, vb, vertices, range.startVertex, range.num_vertices);
+			if(range.wideIndices)
+				upload(dc, ib32, indices32, range.startIndex, range.num_indices);
+			else
+				upload(dc, ib16, indices16, range.startIndex, range.num_indices);
+		}
+
+		MeshHandle handle;
+		if(!freeSlots.empty())
+		{
+			handle = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			handle = (int)slots.size();
+			slots.push_back(range);
+			slotUsed.push_back(false);
+		}
+		slots[handle] = range;
+		slotUsed[handle] = true;
+		num_meshes++;
+		updateStats();
+		return handle;
+	};
+
+	//
+	// Packing
+	//
+
+	static short toSnorm16(float f)
+	{
+		f = MathUtil::Clamp(f, -1.0f, 1.0f);
+		return (short)(f >= 0.0f ? f*32767.0f+0.5f : f*32767.0f-0.5f);
+	};
+
+	// Unit vector on the octahedron |x|+|y|+|z| = 1, lower half folded
+	// over the diagonals onto [-1,1]^2
+	static void packOctahedral(const XMFLOAT3& v, short out[2])
+	{
+		float l = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+		float x = l > 0.0f ? v.x/l : 0.0f;
+		float y = l > 0.0f ? v.y/l : 0.0f;
+		if(v.z < 0.0f)
+		{
+			float fx = (1.0f-fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float fy = (1.0f-fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = fx;
+			y = fy;
+		}
+		out[0] = toSnorm16(x);
+		out[1] = toSnorm16(y);
+	};
+
+	static void packVertices(const Vertex::posNormTexTan* in, UINT count, Vertex::packed* out, MeshRange& range)
+	{
+		XMFLOAT3 lo(0.0f, 0.0f, 0.0f);
+		XMFLOAT3 hi(0.0f, 0.0f, 0.0f);
+		for(UINT i=0; i<count; i++)
+		{
+			const XMFLOAT3& p = in[i].Pos;
+			lo = i == 0 ? p : XMFLOAT3(MathUtil::Min(lo.x, p.x), MathUtil::Min(lo.y, p.y), MathUtil::Min(lo.z, p.z));
+			hi = i == 0 ? p : XMFLOAT3(MathUtil::Max(hi.x, p.x), MathUtil::Max(hi.y, p.y), MathUtil::Max(hi.z, p.z));
+		}
+
+		// Flat axes keep a scale, so decoding never divides by zero
+		const float minScale = 1e-6f;
+		range.posOffset = XMFLOAT3(0.5f*(lo.x+hi.x), 0.5f*(lo.y+hi.y), 0.5f*(lo.z+hi.z));
+		range.posScale = XMFLOAT3(
+			MathUtil::Max(0.5f*(hi.x-lo.x), minScale),
+			MathUtil::Max(0.5f*(hi.y-lo.y), minScale),
+			MathUtil::Max(0.5f*(hi.z-lo.z), minScale));
+
+		for(UINT i=0; i<count; i++)
+		{
+			const XMFLOAT3& p = in[i].Pos;
+			out[i].Pos[0] = toSnorm16((p.x-range.posOffset.x)/range.posScale.x);
+			out[i].Pos[1] = toSnorm16((p.y-range.posOffset.y)/range.posScale.y);
+			out[i].Pos[2] = toSnorm16((p.z-range.posOffset.z)/range.posScale.z);
+			out[i].Pos[3] = in[i].Handedness < 0.0f ? -32767 : 32767;
+			packOctahedral(in[i].Normal, out[i].Normal);
+			packOctahedral(in[i].TangentU, out[i].TangentU);
+			out[i].Tex[0] = XMConvertFloatToHalf(in[i].Tex.x);
+			out[i].Tex[1] = XMConvertFloatToHalf(in[i].Tex.y);
+		}
+	};
+
+	void updateStats()
+	{
+		usedVertices = vertexRanges.getCapacity()-vertexRanges.getFree();
+		usedIndices16 = indexRanges16.getCapacity()-indexRanges16.getFree();
+		usedIndices32 = indexRanges32.getCapacity()-indexRanges32.getFree();
+		vertexCapacity = vertexRanges.getCapacity();
+		indexCapacity = indexRanges16.getCapacity()+indexRanges32.getCapacity();
+		num_freeBlocks = vertexRanges.getBlockCount()+indexRanges16.getBlockCount()+indexRanges32.getBlockCount();
+
+		// Share of free vertices outside of the largest free block
+		UINT freeVertices = vertexRanges.getFree();
+		fragmentation = freeVertices > 0 ? 1.0f-(float)vertexRanges.getLargestFree()/freeVertices : 0.0f;
+
+		// Used bytes, and what they would be as posNormTexTan with 32-bit indices
+		vertexBytes = usedVertices*sizeof(Vertex::packed);
+		indexBytes = usedIndices16*sizeof(USHORT) + usedIndices32*sizeof(UINT);
+		unpackedVertexBytes = usedVertices*sizeof(Vertex::posNormTexTan);
+		unpackedIndexBytes = (usedIndices16+usedIndices32)*sizeof(UINT);
+	};
+
+	MeshArena(const MeshArena&);
+	MeshArena& operator=(const MeshArena&);
+
+public:
+	// Statistics
+	int num_meshes;
+	int usedVertices;
+	int usedIndices16;
+	int usedIndices32;
+	int vertexCapacity;
+	int indexCapacity;
+	int num_freeBlocks;
+	float fragmentation;
+	int num_grows;
+	int num_defragments;
+	int num_uploadedBytes;
+	int vertexBytes;
+	int indexBytes;
+	int unpackedVertexBytes;
+	int unpackedIndexBytes;
+
+	MeshArena()
+	{
+		device = 0;
+		vb = 0;
+		ib16 = 0;
+		ib32 = 0;
+		num_meshes = 0;
+		usedVertices = 0;
+		usedIndices16 = 0;
+		usedIndices32 = 0;
+		vertexCapacity = 0;
+		indexCapacity = 0;
+		num_freeBlocks = 0;
+		fragmentation = 0.0f;
+		num_grows = 0;
+		num_defragments = 0;
+		num_uploadedBytes = 0;
+		vertexBytes = 0;
+		indexBytes = 0;
+		unpackedVertexBytes = 0;
+		unpackedIndexBytes = 0;
+	};
+	~MeshArena()
+	{
+		ReleaseCOM(vb);
+		ReleaseCOM(ib16);
+		ReleaseCOM(ib32);
+	};
+
+	// The 32-bit index buffer starts out small, few meshes need it
+	void init(ID3D11Device* device, UINT vertexCapacity, UINT indexCapacity)
+	{
+		this->device = device;
+		vertices.assign(MathUtil::Max(vertexCapacity, 1u), Vertex::packed());
+		indices16.assign(MathUtil::Max(indexCapacity, 1u), 0);
+		indices32.assign(1, 0);
+		vertexRanges.reset((UINT)vertices.size(), 0);
+		indexRanges16.reset((UINT)indices16.size(), 0);
+		indexRanges32.reset((UINT)indices32.size(), 0);
+		slots.clear();
+		slotUsed.clear();
+		freeSlots.clear();
+		createBuffers();
+		updateStats();
+	};
+
+	// Packs a mesh into the arena, indices are relative to its first vertex
+	MeshHandle add(RenderDevice* dc, const Vertex::posNormTexTan* meshVertices, UINT num_vertices, const UINT* meshIndices, UINT num_indices)
+	{
+		MeshRange range;
+		range.num_vertices = num_vertices;
+		range.num_indices = num_indices;
+		range.wideIndices = num_vertices > 65536;
+		bool grown = allocate(dc, range);
+
+		if(num_vertices > 0)
+			packVertices(meshVertices, num_vertices, &vertices[range.startVertex], range);
+		if(range.wideIndices)
+		{
+			for(UINT i=0; i<num_indices; i++)
+				indices32[range.startIndex+i] = meshIndices[i];
+		}
+		else
+		{
+			for(UINT i=0; i<num_indices; i++)
+				indices16[range.startIndex+i] = (USHORT)meshIndices[i];
+		}
+		return commit(dc, range, grown);
+	};
+
+	// Adds a mesh that is packed already, such as one read from a
+	// MeshCache. Indices are 16 or 32-bit as "indexSize" says, and have to
+	// be 32-bit for meshes of more than 65536 vertices.
+	MeshHandle addPacked(RenderDevice* dc, const Vertex::packed* meshVertices, UINT num_vertices, const void* meshIndices, UINT indexSize, UINT num_indices, const XMFLOAT3& posScale, const XMFLOAT3& posOffset)
+	{
+		MeshRange range;
+		range.num_vertices = num_vertices;
+		range.num_indices = num_indices;
+		range.wideIndices = indexSize == sizeof(UINT);
+		range.posScale = posScale;
+		range.posOffset = posOffset;
+		bool grown = allocate(dc, range);
+
+		if(num_vertices > 0)
+			memcpy(&vertices[range.startVertex], meshVertices, num_vertices*sizeof(Vertex::packed));
+		if(num_indices > 0)
+		{
+			if(range.wideIndices)
+				memcpy(&indices32[range.startIndex], meshIndices, num_indices*sizeof(UINT));
+			else
+				memcpy(&indices16[range.startIndex], meshIndices, num_indices*sizeof(USHORT));
+		}
+		return commit(dc, range, grown);
+	};
+
+	// Packs vertices the way the arena stores them, "range" gets the
+	// position bounds
+	static void pack(const Vertex::posNormTexTan* in, UINT count, Vertex::packed* out, MeshRange& range)
+	{
+		packVertices(in, count, out, range);
+	};
+
+	// Ranges of the mesh become free, the contents stay until overwritten
+	void remove(MeshHandle handle)
+	{
+		if(!isValid(handle))
+			return;
+		const MeshRange& range = slots[handle];
+		vertexRanges.free(range.startVertex, range.num_vertices);
+		if(range.wideIndices)
+			indexRanges32.free(range.startIndex, range.num_indices);
+		else
+			indexRanges16.free(range.startIndex, range.num_indices);
+		slotUsed[handle] = false;
+		freeSlots.push_back(handle);
+		num_meshes--;
+		updateStats();
+	};
+
+	// Moves every mesh to the front of the buffers in the order they are
+	// stored and uploads what is used. Meshes are moved in order of their
+	// start, so a move never overwrites a mesh that has not moved yet.
+	void defragment(RenderDevice* dc)
+	{
+		std::vector<int> order;
+		std::vector<int> order16;
+		std::vector<int> order32;
+		for(int i=0; i<(int)slots.size(); i++)
+		{
+			if(!slotUsed[i])
+				continue;
+			order.push_back(i);
+			if(slots[i].wideIndices)
+				order32.push_back(i);
+			else
+				order16.push_back(i);
+		}
+
+		UINT num_vertices = compact(order, vertices, &MeshRange::startVertex, &MeshRange::num_vertices);
+		UINT num_indices16 = compact(order16, indices16, &MeshRange::startIndex, &MeshRange::num_indices);
+		UINT num_indices32 = compact(order32, indices32, &MeshRange::startIndex, &MeshRange::num_indices);
+
+		vertexRanges.reset((UINT)vertices.size(), num_vertices);
+		indexRanges16.reset((UINT)indices16.size(), num_indices16);
+		indexRanges32.reset((UINT)indices32.size(), num_indices32);
+		upload(dc, vb, vertices, 0, num_vertices);
+		upload(dc, ib16, indices16, 0, num_indices16);
+		upload(dc, ib32, indices32, 0, num_indices32);
+		num_defragments++;
+		updateStats();
+	};
+
+	bool isValid(MeshHandle handle) const
+	{
+		return handle >= 0 && handle < (int)slots.size() && slotUsed[handle];
+	};
+	const MeshRange& getRange(MeshHandle handle) const
+	{
+		return slots[handle];
+	};
+
+	ID3D11Buffer* getVertexBuffer()
+	{
+		return vb;
+	};
+	ID3D11Buffer* getIndexBuffer(MeshHandle handle)
+	{
+		return slots[handle].wideIndices ? ib32 : ib16;
+	};
+	DXGI_FORMAT getIndexFormat(MeshHandle handle) const
+	{
+		return slots[handle].wideIndices ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+	};
+
+	// Vertex buffer to slot 0 and the 16-bit index buffer most meshes
+	// use, layout and topology are left to the caller
+	void bind(RenderDevice* dc)
+	{
+		UINT stride = sizeof(Vertex::packed);
+		UINT offset = 0;
+		dc->setVertexBuffers(0, 1, &vb, &stride, &offset);
+		dc->setIndexBuffer(ib16, DXGI_FORMAT_R16_UINT, 0);
+	};
+	void bindIndices(RenderDevice* dc, MeshHandle handle)
+	{
+		dc->setIndexBuffer(getIndexBuffer(handle), getIndexFormat(handle), 0);
+	};
+
+	// Draws of a mesh, its index buffer has to be bound
+	void drawIndexed(RenderDevice* dc, MeshHandle handle)
+	{
+		const MeshRange& range = slots[handle];
+		dc->drawIndexed(range.num_indices, range.startIndex, range.startVertex);
+	};
+	void drawIndexedInstanced(RenderDevice* dc, MeshHandle handle, UINT num_instances, UINT startInstance)
+	{
+		const MeshRange& range = slots[handle];
+		dc->drawIndexedInstanced(range.num_indices, num_instances, range.startIndex, range.startVertex, startInstance);
+	};
+
+	void buildMenu(TwBar* menu)
+	{
+		TwAddVarRO(menu, "Arena meshes", TW_TYPE_INT32, &num_meshes, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena vertices", TW_TYPE_INT32, &usedVertices, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena vertex capacity", TW_TYPE_INT32, &vertexCapacity, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena 16-bit indices", TW_TYPE_INT32, &usedIndices16, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena 32-bit indices", TW_TYPE_INT32, &usedIndices32, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena index capacity", TW_TYPE_INT32, &indexCapacity, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena VB bytes", TW_TYPE_INT32, &vertexBytes, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena VB bytes unpacked", TW_TYPE_INT32, &unpackedVertexBytes, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena IB bytes", TW_TYPE_INT32, &indexBytes, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena IB bytes 32-bit", TW_TYPE_INT32, &unpackedIndexBytes, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena free blocks", TW_TYPE_INT32, &num_freeBlocks, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena fragmentation", TW_TYPE_FLOAT, &fragmentation, "group='Mesh arena' precision=2");
+		TwAddVarRO(menu, "Arena grows", TW_TYPE_INT32, &num_grows, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena defragments", TW_TYPE_INT32, &num_defragments, "group='Mesh arena'");
+		TwAddVarRO(menu, "Arena uploaded bytes", TW_TYPE_INT32, &num_uploadedBytes, "group='Mesh arena'");
+		TwDefine("Settings/'Mesh arena' group=Render opened=false");
+	};
+};
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <windows.h>
+#include "GeometryFactory.h"
+#include "MeshArena.h"
+#include "MappedFile.h"
+
+//
+// Binary mesh cache
+//
+// A mesh that has been imported, welded and optimized once is written
+// out the way the arena stores it, so later runs map the file and hand
+// its blocks to the arena without parsing or packing anything. A file
+// holds, each block starting on a 64 byte boundary:
+//  - the header
+//  - Vertex::packed vertices
+//  - 16-bit indices, or 32-bit for meshes of more than 65536 vertices
+//  - subsets, as index ranges with a material id
+//  - material names, one fixed size entry per id
+//
+// Every file carries a stamp of what it was built from, the write time of
+// the source file or a hash of the parameters of a generated shape. A
+// file is only used if its stamp and version match, otherwise the mesh
+// is built again and the file rewritten. Bump "version" whenever the
+// layout or the import steps change.
+//
+
+class MeshCache
+{
+public:
+	static const UINT version = 1;
+	static const UINT blockAlignment = 64;
+	static const int materialNameSize = 64;
+
+	struct Header
+	{
+		char magic[4];
+		UINT version;
+		UINT64 stamp;
+		UINT num_vertices;
+		UINT num_indices;
+		UINT indexSize;				// bytes per index
+		UINT num_subsets;
+		UINT num_materials;
+		XMFLOAT3 posScale;			// bounds, as in MeshRange
+		XMFLOAT3 posOffset;
+		UINT vertexOffset;			// bytes from the start of the file
+		UINT indexOffset;
+		UINT subsetOffset;
+		UINT materialOffset;
+		UINT fileSize;
+	};
+
+	struct Subset
+	{
+		UINT startIndex;
+		UINT indexCount;
+		UINT materialId;
+	};
+
+private:
+	MappedFile file;
+	std::vector<char> image;		// file contents built this run
+	const char* data;
+	const Header* header;
+
+	static UINT alignUp(UINT offset)
+	{
+		return (offset+blockAlignment-1) & ~(blockAlignment-1);
+	};
+
+	// Checks the blocks of "bytes" and points the accessors at them
+	bool parse(const char* bytes, size_t size, UINT64 stamp)
+	{
+		data = 0;
+		header = 0;
+		if(size < sizeof(Header))
+			return false;
+
+		const Header* h = (const Header*)bytes;
+		if(memcmp(h->magic, "AMSH", 4) != 0 || h->version != version || h->fileSize != size)
+			return false;
+		if(stamp != 0 && h->stamp != stamp)
+			return false;
+		if(h->indexSize != sizeof(USHORT) && h->indexSize != sizeof(UINT))
+			return false;
+		if(h->indexSize == sizeof(USHORT) && h->num_vertices > 65536)
+			return false;
+		if(h->vertexOffset < sizeof(Header) ||
+			h->vertexOffset % blockAlignment != 0 || h->indexOffset % blockAlignment != 0 ||
+			h->subsetOffset % blockAlignment != 0 || h->materialOffset % blockAlignment != 0)
+			return false;
+		if(h->vertexOffset + (UINT64)h->num_vertices*sizeof(Vertex::packed) > size ||
+			h->indexOffset + (UINT64)h->num_indices*h->indexSize > size ||
+			h->subsetOffset + (UINT64)h->num_subsets*sizeof(Subset) > size ||
+			h->materialOffset + (UINT64)h->num_materials*materialNameSize > size)
+			return false;
+
+		// Contents, so nothing read through the accessors or drawn from
+		// the arena can leave its block
+		const Subset* subsets = (const Subset*)(bytes+h->subsetOffset);
+		for(UINT i=0; i<h->num_subsets; i++)
+		{
+			if((UINT64)subsets[i].startIndex + subsets[i].indexCount > h->num_indices || subsets[i].materialId >= h->num_materials)
+				return false;
+		}
+		for(UINT i=0; i<h->num_materials; i++)
+		{
+			if(!memchr(bytes+h->materialOffset+i*materialNameSize, 0, materialNameSize))
+				return false;
+		}
+		for(UINT i=0; i<h->num_indices; i++)
+		{
+			UINT index = h->indexSize == sizeof(UINT) ? ((const UINT*)(bytes+h->indexOffset))[i] : ((const USHORT*)(bytes+h->indexOffset))[i];
+			if(index >= h->num_vertices)
+				return false;
+		}
+
+		data = bytes;
+		header = h;
+		return true;
+	};
+
+	MeshCache(const MeshCache&);
+	MeshCache& operator=(const MeshCache&);
+
+public:
+	// Statistics
+	int num_hits;
+	int num_builds;
+	int num_savedBytes;
+
+	MeshCache()
+	{
+		data = 0;
+		header = 0;
+		num_hits = 0;
+		num_builds = 0;
+		num_savedBytes = 0;
+	};
+
+	// Write time of a file, 0 if it does not exist
+	static UINT64 fileStamp(const char* path)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if(!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+			return 0;
+		return ((UINT64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	};
+
+	// FNV-1a of the parameters of a generated shape
+	static UINT64 hashStamp(const void* params, size_t bytes)
+	{
+		const unsigned char* p = (const unsigned char*)params;
+		UINT64 h = 14695981039346656037ull;
+		for(size_t i=0; i<bytes; i++)
+			h = (h ^ p[i])*1099511628211ull;
+		return h;
+	};
+
+	// Maps a cache file, false if it is missing, broken or does not match
+	// "stamp", so the caller builds the mesh again. A stamp of 0 takes the
+	// file whatever it was built from.
+	bool open(const char* path, UINT64 stamp)
+	{
+		close();
+		if(!file.open(path))
+			return false;
+		if(!parse(file.getData(), file.getSize(), stamp))
+		{
+			close();
+			return false;
+		}
+		num_hits++;
+		return true;
+	};
+
+	// Packs "mesh" into a file image in memory, ready to be saved
+	void build(const GeometryFactory::MeshData& mesh, UINT64 stamp)
+	{
+		close();
+		UINT num_vertices = (UINT)mesh.Vertices.size();
+		UINT num_indices = (UINT)mesh.Indices.size();
+
+		// Material ids in order of first use
+		std::vector<std::string> materials;
+		std::vector<Subset> subsets(mesh.Subsets.size());
+		for(int i=0; i<(int)mesh.Subsets.size(); i++)
+		{
+			const GeometryFactory::Subset& s = mesh.Subsets[i];
+			UINT id = (UINT)(std::find(materials.begin(), materials.end(), s.Material)-materials.begin());
+			if(id == materials.size())
+				materials.push_back(s.Material);
+			subsets[i].startIndex = s.StartIndex;
+			subsets[i].indexCount = s.IndexCount;
+			subsets[i].materialId = id;
+		}
+
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "AMSH", 4);
+		h.version = version;
+		h.stamp = stamp;
+		h.num_vertices = num_vertices;
+		h.num_indices = num_indices;
+		h.indexSize = num_vertices > 65536 ? sizeof(UINT) : sizeof(USHORT);
+		h.num_subsets = (UINT)subsets.size();
+		h.num_materials = (UINT)materials.size();
+		h.vertexOffset = alignUp(sizeof(Header));
+		h.indexOffset = alignUp(h.vertexOffset + num_vertices*sizeof(Vertex::packed));
+		h.subsetOffset = alignUp(h.indexOffset + num_indices*h.indexSize);
+		h.materialOffset = alignUp(h.subsetOffset + h.num_subsets*sizeof(Subset));
+		h.fileSize = h.materialOffset + h.num_materials*materialNameSize;
+
+		image.assign(h.fileSize, 0);
+		char* out = &image[0];
+
+		std::vector<Vertex::posNormTexTan> vertices(num_vertices);
+		for(UINT i=0; i<num_vertices; i++)
+		{
+			const GeometryFactory::Vertex& v = mesh.Vertices[i];
+			vertices[i].Pos = v.Position;
+			vertices[i].Normal = v.Normal;
+			vertices[i].Tex = v.TexC;
+			vertices[i].TangentU = v.TangentU;
+			vertices[i].Handedness = v.Handedness;
+		}
+		MeshRange range;
+		range.posScale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		range.posOffset = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		if(num_vertices > 0)
+			MeshArena::pack(&vertices[0], num_vertices, (Vertex::packed*)(out+h.vertexOffset), range);
+		h.posScale = range.posScale;
+		h.posOffset = range.posOffset;
+
+		for(UINT i=0; i<num_indices; i++)
+		{
+			if(h.indexSize == sizeof(UINT))
+				((UINT*)(out+h.indexOffset))[i] = mesh.Indices[i];
+			else
+				((USHORT*)(out+h.indexOffset))[i] = (USHORT)mesh.Indices[i];
+		}
+		if(!subsets.empty())
+			memcpy(out+h.subsetOffset, &subsets[0], subsets.size()*sizeof(Subset));
+		for(int i=0; i<(int)materials.size(); i++)
+			strncpy_s(out+h.materialOffset+i*materialNameSize, materialNameSize, materials[i].c_str(), _TRUNCATE);
+		memcpy(out, &h, sizeof(h));
+
+		parse(out, image.size(), stamp);
+		num_builds++;
+	};
+
+	// Writes the built image, false if the file could not be written. The
+	// folder of the file is created if it is missing.
+	bool save(const char* path)
+	{
+		if(image.empty())
+			return false;
+		std::string folder(path);
+		size_t slash = folder.find_last_of("/\\");
+		if(slash != std::string::npos)
+			CreateDirectoryA(folder.substr(0, slash).c_str(), 0);
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if(!out.is_open())
+			return false;
+		out.write(&image[0], image.size());
+		if(!out.good())
+			return false;
+		num_savedBytes += (int)image.size();
+		return true;
+	};
+
+	void close()
+	{
+		file.close();
+		std::vector<char>().swap(image);
+		data = 0;
+		header = 0;
+	};
+
+	bool isOpen() const
+	{
+		return header != 0;
+	};
+
+	// Hands the mesh straight from the view to the arena
+	MeshHandle addTo(MeshArena* arena, RenderDevice* dc) const
+	{
+		return arena->addPacked(dc, getVertices(), header->num_vertices, data+header->indexOffset, header->indexSize, header->num_indices, header->posScale, header->posOffset);
+	};
+
+	//
+	// Blocks of the open file
+	//
+
+	const Header* getHeader() const
+	{
+		return header;
+	};
+	const Vertex::packed* getVertices() const
+	{
+		return (const Vertex::packed*)(data+header->vertexOffset);
+	};
+	const void* getIndices() const
+	{
+		return data+header->indexOffset;
+	};
+	const Subset* getSubsets() const
+	{
+		return (const Subset*)(data+header->subsetOffset);
+	};
+	// Name of a material id, names longer than an entry are cut short
+	const char* getMaterialName(UINT id) const
+	{
+		return data+header->materialOffset+id*materialNameSize;
+	};
+};
+
+#endif
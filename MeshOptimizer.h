@@ -0,0 +1,430 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include "GeometryFactory.h"
+#include "GameTimer.h"
+
+//
+// Triangle and vertex order of imported meshes
+//
+// Meshes are run through three steps before they go to the GPU, after
+// MeshWelder has merged their identical vertices:
+//  - Triangles are reordered for the post-transform vertex cache with Tom
+//    Forsyth's linear-speed algorithm, which greedily picks the triangle
+//    whose vertices score highest from their place in a simulated LRU
+//    cache and from how few triangles they have left.
+//  - The cache ordered triangles are cut into clusters, which are sorted
+//    so clusters facing away from the centre of the mesh are drawn first
+//    and hide the ones behind them. Clusters are only cut where the cache
+//    would have been cold anyway, or where a cut costs less than
+//    "overdrawThreshold" times the cache misses of the cluster.
+//  - Vertices are renumbered in the order the triangles first use them,
+//    so vertex fetch walks the buffer front to back.
+//
+// The average cache miss ratio (ACMR, transformed vertices per triangle)
+// and the average transform to vertex ratio (ATVR, transformed vertices
+// per unique vertex, 1 is ideal) are measured with a FIFO cache of
+// "statsCacheSize" entries before and after.
+//
+
+class MeshOptimizer
+{
+private:
+	typedef GeometryFactory::Vertex Vertex;
+	typedef GeometryFactory::MeshData MeshData;
+
+	// Size of the LRU cache simulated while reordering
+	static const int forsythCacheSize = 32;
+
+	struct Cluster
+	{
+		int start;			// first triangle
+		int count;
+		float sortKey;
+	};
+	struct ClusterGreater
+	{
+		bool operator()(const Cluster& a, const Cluster& b) const
+		{
+			return a.sortKey > b.sortKey;
+		};
+	};
+
+	std::vector<float> valenceScore;	// scores by remaining triangles of a vertex
+
+	//
+	// Vertex cache order
+	//
+
+	float vertexScore(int cachePos, int remaining) const
+	{
+		if(remaining == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if(cachePos >= 0)
+		{
+			// The last triangle's vertices get a fixed score, so the next
+			// triangle does not simply reuse the same edge
+			if(cachePos < 3)
+				score = 0.75f;
+			else
+				score = powf(1.0f - (float)(cachePos-3)/(forsythCacheSize-3), 1.5f);
+		}
+		return score + valenceScore[MathUtil::Min(remaining, (int)valenceScore.size()-1)];
+	};
+
+	void reorderForCache(std::vector<UINT>& indices, int num_vertices)
+	{
+		int num_triangles = (int)indices.size()/3;
+
+		// Triangles of every vertex
+		std::vector<int> offset(num_vertices+1, 0);
+		for(int i=0; i<(int)indices.size(); i++)
+			offset[indices[i]+1]++;
+		for(int v=0; v<num_vertices; v++)
+			offset[v+1] += offset[v];
+		std::vector<int> adjacency(indices.size());
+		std::vector<int> remaining(num_vertices, 0);
+		for(int i=0; i<(int)indices.size(); i++)
+		{
+			int v = indices[i];
+			adjacency[offset[v]+remaining[v]] = i/3;
+			remaining[v]++;
+		}
+
+		int maxValence = 0;
+		for(int v=0; v<num_vertices; v++)
+			maxValence = MathUtil::Max(maxValence, remaining[v]);
+		valenceScore.resize(maxValence+1);
+		valenceScore[0] = 0.0f;
+		for(int i=1; i<=maxValence; i++)
+			valenceScore[i] = 2.0f*powf((float)i, -0.5f);
+
+		std::vector<int> cachePos(num_vertices, -1);
+		std::vector<float> score(num_vertices);
+		for(int v=0; v<num_vertices; v++)
+			score[v] = vertexScore(-1, remaining[v]);
+
+		std::vector<unsigned char> emitted(num_triangles, 0);
+
+		// Three extra entries hold vertices pushed out by the newest triangle
+		int cache[forsythCacheSize+3];
+		int cacheCount = 0;
+		std::vector<UINT> out;
+		out.reserve(indices.size());
+		int cursor = 0;
+		int best = -1;
+
+		for(int n=0; n<num_triangles; n++)
+		{
+			// Nothing useful in the cache, take the next triangle left
+			if(best < 0)
+			{
+				while(emitted[cursor])
+					cursor++;
+				best = cursor;
+			}
+
+			const UINT* tri = &indices[best*3];
+			emitted[best] = 1;
+			for(int k=0; k<3; k++)
+			{
+				out.push_back(tri[k]);
+
+				// Take the triangle off the vertex
+				int v = tri[k];
+				int* begin = &adjacency[offset[v]];
+				int* end = begin+remaining[v];
+				*std::find(begin, end, best) = *(end-1);
+				remaining[v]--;
+			}
+
+			// Triangle goes to the front, the rest keep their order
+			int newCache[forsythCacheSize+3];
+			int newCount = 0;
+			for(int k=0; k<3; k++)
+				newCache[newCount++] = tri[k];
+			for(int i=0; i<cacheCount; i++)
+			{
+				int v = cache[i];
+				if(v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+					newCache[newCount++] = v;
+			}
+
+			for(int i=0; i<newCount; i++)
+			{
+				int v = newCache[i];
+				cachePos[v] = i < forsythCacheSize ? i : -1;
+				score[v] = vertexScore(cachePos[v], remaining[v]);
+			}
+
+			// Rescore the triangles around the cache and keep the best
+			best = -1;
+			float bestScore = 0.0f;
+			for(int i=0; i<newCount; i++)
+			{
+				int v = newCache[i];
+				for(int j=offset[v]; j<offset[v]+remaining[v]; j++)
+				{
+					int t = adjacency[j];
+					float s = score[indices[t*3]] + score[indices[t*3+1]] + score[indices[t*3+2]];
+					if(s > bestScore)
+					{
+						best = t;
+						bestScore = s;
+					}
+				}
+			}
+
+			cacheCount = MathUtil::Min(newCount, forsythCacheSize);
+			memcpy(cache, newCache, cacheCount*sizeof(int));
+		}
+
+		indices.swap(out);
+	};
+
+	//
+	// Overdraw order
+	//
+
+	// Cache misses of triangles [start, start+count) in a FIFO cache kept
+	// as the time every vertex was pushed, anything "statsCacheSize"
+	// pushes old is gone
+	int countMisses(const std::vector<UINT>& indices, int start, int count, std::vector<UINT>& stamp, UINT& time) const
+	{
+		int misses = 0;
+		for(int i=start*3; i<(start+count)*3; i++)
+		{
+			UINT v = indices[i];
+			if(time-stamp[v] > (UINT)statsCacheSize)
+			{
+				stamp[v] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	};
+
+	// Every entry gets pushed out of the cache
+	void flushCache(UINT& time) const
+	{
+		time += statsCacheSize+1;
+	};
+
+	void reorderForOverdraw(const std::vector<Vertex>& vertices, std::vector<UINT>& indices, int& num_clusters)
+	{
+		int num_triangles = (int)indices.size()/3;
+		int num_vertices = (int)vertices.size();
+		std::vector<UINT> stamp(num_vertices, 0);
+		UINT time = statsCacheSize+1;
+
+		// Hard boundaries where all three vertices of a triangle miss
+		std::vector<Cluster> hard;
+		for(int t=0; t<num_triangles; t++)
+		{
+			if(countMisses(indices, t, 1, stamp, time) == 3 || t == 0)
+			{
+				Cluster c = {t, 0, 0.0f};
+				hard.push_back(c);
+			}
+			hard.back().count++;
+		}
+
+		// Soft boundaries inside each, where a cold start is cheap enough
+		std::vector<Cluster> clusters;
+		for(int h=0; h<(int)hard.size(); h++)
+		{
+			flushCache(time);
+			float acmr = (float)countMisses(indices, hard[h].start, hard[h].count, stamp, time)/hard[h].count;
+
+			flushCache(time);
+			Cluster c = {hard[h].start, 0, 0.0f};
+			int misses = 0;
+			for(int t=hard[h].start; t<hard[h].start+hard[h].count; t++)
+			{
+				misses += countMisses(indices, t, 1, stamp, time);
+				c.count++;
+				bool last = t == hard[h].start+hard[h].count-1;
+				if(last || misses <= overdrawThreshold*acmr*c.count)
+				{
+					clusters.push_back(c);
+					c.start = t+1;
+					c.count = 0;
+					misses = 0;
+					flushCache(time);
+				}
+			}
+		}
+		num_clusters += (int)clusters.size();
+
+		// Clusters facing away from the centre are drawn first
+		std::vector<XMFLOAT3> centres(clusters.size());
+		std::vector<XMFLOAT3> normals(clusters.size());
+		XMVECTOR meshCentre = XMVectorZero();
+		float meshArea = 0.0f;
+		for(int c=0; c<(int)clusters.size(); c++)
+		{
+			XMVECTOR centre = XMVectorZero();
+			XMVECTOR normal = XMVectorZero();
+			float area = 0.0f;
+			for(int t=clusters[c].start; t<clusters[c].start+clusters[c].count; t++)
+			{
+				XMVECTOR p0 = XMLoadFloat3(&vertices[indices[t*3]].Position);
+				XMVECTOR p1 = XMLoadFloat3(&vertices[indices[t*3+1]].Position);
+				XMVECTOR p2 = XMLoadFloat3(&vertices[indices[t*3+2]].Position);
+				XMVECTOR n = XMVector3Cross(p1-p0, p2-p0);
+				float a = XMVectorGetX(XMVector3Length(n))*0.5f;
+				centre += (p0+p1+p2)*(a/3.0f);
+				normal += n;
+				area += a;
+			}
+			meshCentre += centre;
+			meshArea += area;
+			XMStoreFloat3(&centres[c], area > 0.0f ? centre/area : centre);
+			XMStoreFloat3(&normals[c], XMVector3Normalize(normal));
+		}
+		if(meshArea > 0.0f)
+			meshCentre /= meshArea;
+
+		for(int c=0; c<(int)clusters.size(); c++)
+		{
+			XMVECTOR toCluster = XMLoadFloat3(&centres[c])-meshCentre;
+			clusters[c].sortKey = XMVectorGetX(XMVector3Dot(toCluster, XMLoadFloat3(&normals[c])));
+		}
+		std::stable_sort(clusters.begin(), clusters.end(), ClusterGreater());
+
+		std::vector<UINT> out;
+		out.reserve(indices.size());
+		for(int c=0; c<(int)clusters.size(); c++)
+			out.insert(out.end(), indices.begin()+clusters[c].start*3, indices.begin()+(clusters[c].start+clusters[c].count)*3);
+		indices.swap(out);
+	};
+
+	//
+	// Vertex fetch order
+	//
+
+	// Renumbers vertices by first use and drops unused ones
+	static void reorderForFetch(MeshData& mesh)
+	{
+		std::vector<UINT> remap(mesh.Vertices.size(), UINT_MAX);
+		std::vector<Vertex> vertices;
+		vertices.reserve(mesh.Vertices.size());
+		for(int i=0; i<(int)mesh.Indices.size(); i++)
+		{
+			UINT& index = mesh.Indices[i];
+			if(remap[index] == UINT_MAX)
+			{
+				remap[index] = (UINT)vertices.size();
+				vertices.push_back(mesh.Vertices[index]);
+			}
+			index = remap[index];
+		}
+		mesh.Vertices.swap(vertices);
+	};
+
+	MeshOptimizer(const MeshOptimizer&);
+	MeshOptimizer& operator=(const MeshOptimizer&);
+
+public:
+	// Settings
+	bool reorderTriangles;
+	bool sortClusters;
+	float overdrawThreshold;	// allowed ACMR of a cut cluster, relative to uncut
+	int statsCacheSize;
+
+	// Result of one mesh, "text" is shown in the menu
+	struct Stats
+	{
+		int num_vertices;
+		int num_triangles;
+		int num_clusters;
+		float acmrBefore;
+		float acmrAfter;
+		float atvrBefore;
+		float atvrAfter;
+		float optimizeMs;
+		char text[64];
+	};
+
+	MeshOptimizer()
+	{
+		reorderTriangles = true;
+		sortClusters = true;
+		overdrawThreshold = 1.05f;
+		statsCacheSize = 16;
+	};
+
+	// ACMR and ATVR of the current order
+	void measure(const MeshData& mesh, float& acmr, float& atvr) const
+	{
+		acmr = 0.0f;
+		atvr = 0.0f;
+		int num_triangles = (int)mesh.Indices.size()/3;
+		if(num_triangles == 0)
+			return;
+
+		std::vector<UINT> stamp(mesh.Vertices.size(), 0);
+		UINT time = statsCacheSize+1;
+		int misses = countMisses(mesh.Indices, 0, num_triangles, stamp, time);
+
+		std::vector<unsigned char> used(mesh.Vertices.size(), 0);
+		int num_used = 0;
+		for(int i=0; i<(int)mesh.Indices.size(); i++)
+		{
+			if(!used[mesh.Indices[i]])
+			{
+				used[mesh.Indices[i]] = 1;
+				num_used++;
+			}
+		}
+
+		acmr = (float)misses/num_triangles;
+		atvr = (float)misses/num_used;
+	};
+
+	void optimize(MeshData& mesh, Stats& stats)
+	{
+		Stopwatch watch;
+		memset(&stats, 0, sizeof(stats));
+		stats.num_vertices = (int)mesh.Vertices.size();
+		stats.num_triangles = (int)mesh.Indices.size()/3;
+		measure(mesh, stats.acmrBefore, stats.atvrBefore);
+
+		if(stats.num_triangles > 0)
+		{
+			// Subsets are reordered on their own and stay in place
+			int num_ranges = MathUtil::Max(1, (int)mesh.Subsets.size());
+			std::vector<UINT> indices;
+			for(int i=0; i<num_ranges; i++)
+			{
+				UINT start = mesh.Subsets.empty() ? 0 : mesh.Subsets[i].StartIndex;
+				UINT count = mesh.Subsets.empty() ? (UINT)mesh.Indices.size() : mesh.Subsets[i].IndexCount;
+				if(count == 0)
+					continue;
+
+				indices.assign(mesh.Indices.begin()+start, mesh.Indices.begin()+start+count);
+				if(reorderTriangles)
+					reorderForCache(indices, (int)mesh.Vertices.size());
+				if(sortClusters)
+					reorderForOverdraw(mesh.Vertices, indices, stats.num_clusters);
+				std::copy(indices.begin(), indices.end(), mesh.Indices.begin()+start);
+			}
+			reorderForFetch(mesh);
+		}
+
+		measure(mesh, stats.acmrAfter, stats.atvrAfter);
+		stats.optimizeMs = watch.elapsedMs();
+		sprintf_s(stats.text, sizeof(stats.text), "ACMR %.2f -> %.2f, ATVR %.2f -> %.2f",
+			stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter);
+	};
+};
+
+#endif
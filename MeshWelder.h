@@ -0,0 +1,311 @@
+#ifndef MESHWELDER_H
+#define MESHWELDER_H
+
+#include <vector>
+#include <string.h>
+#include <math.h>
+#include <ppl.h>
+#include "GeometryFactory.h"
+#include "GameTimer.h"
+
+//
+// Vertex welding and tangent frames
+//
+// Vertices with the same position, normal and uv are merged into one.
+// Every vertex is hashed on a worker, then the hashes are split into
+// partitions by their top bits and each partition finds its duplicates
+// in its own open addressed table. The first vertex of every group stays
+// and the kept vertices are numbered in their old order, so the output is
+// compact and the same on every run.
+//
+// Tangents are then rebuilt from the uv layout. The tangent and bitangent
+// of every triangle are summed into its corners, weighted by the size of
+// the triangle, and each vertex makes its sum orthogonal to the normal
+// with Gram-Schmidt. The handedness is -1 where the summed bitangent
+// points against cross(normal, tangent), which is where the texture is
+// mirrored.
+//
+
+class MeshWelder
+{
+private:
+	typedef GeometryFactory::Vertex Vertex;
+	typedef GeometryFactory::MeshData MeshData;
+
+	// Position, normal and uv
+	struct Key
+	{
+		float v[8];
+	};
+
+	static const int partitionBits = 6;
+	static const int num_partitions = 1 << partitionBits;
+	static const int chunkSize = 4096;
+
+	std::vector<Key> keys;
+	std::vector<UINT> hashes;
+	std::vector<int> groups;		// first vertex with the same key
+	std::vector<int> order;			// vertices by partition
+	std::vector<int> remap;
+
+	// Calls fn(i) for i in [0, count) on workers, in chunks
+	template<typename Fn>
+	static void forRange(int count, Fn fn)
+	{
+		int num_chunks = (count+chunkSize-1)/chunkSize;
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int end = MathUtil::Min(count, (chunk+1)*chunkSize);
+			for(int i=chunk*chunkSize; i<end; i++)
+				fn(i);
+		});
+	};
+
+	static void makeKey(const Vertex& vertex, Key& key)
+	{
+		key.v[0] = vertex.Position.x;
+		key.v[1] = vertex.Position.y;
+		key.v[2] = vertex.Position.z;
+		key.v[3] = vertex.Normal.x;
+		key.v[4] = vertex.Normal.y;
+		key.v[5] = vertex.Normal.z;
+		key.v[6] = vertex.TexC.x;
+		key.v[7] = vertex.TexC.y;
+
+		// -0 and 0 hash the same
+		for(int i=0; i<8; i++)
+		{
+			if(key.v[i] == 0.0f)
+				key.v[i] = 0.0f;
+		}
+	};
+
+	// FNV-1a over the bits, with a final mix so the top bits used for
+	// partitions are spread too
+	static UINT hashKey(const Key& key)
+	{
+		UINT bits[8];
+		memcpy(bits, key.v, sizeof(bits));
+		UINT h = 2166136261u;
+		for(int i=0; i<8; i++)
+			h = (h ^ bits[i])*16777619u;
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		return h;
+	};
+
+	static bool equalKey(const Key& a, const Key& b)
+	{
+		for(int i=0; i<8; i++)
+		{
+			if(a.v[i] != b.v[i])
+				return false;
+		}
+		return true;
+	};
+
+	void findGroups(int num_vertices)
+	{
+		std::vector<int> offset(num_partitions+1, 0);
+		for(int i=0; i<num_vertices; i++)
+			offset[(hashes[i] >> (32-partitionBits))+1]++;
+		for(int p=0; p<num_partitions; p++)
+			offset[p+1] += offset[p];
+
+		// Vertices keep their order inside a partition, so the first of a
+		// group is the one found first
+		order.resize(num_vertices);
+		std::vector<int> fill(offset.begin(), offset.end()-1);
+		for(int i=0; i<num_vertices; i++)
+			order[fill[hashes[i] >> (32-partitionBits)]++] = i;
+
+		groups.resize(num_vertices);
+		Concurrency::parallel_for(0, num_partitions, [&](int p)
+		{
+			int count = offset[p+1]-offset[p];
+			UINT size = 16;
+			while(size < (UINT)count*2)
+				size *= 2;
+			std::vector<int> table(size, -1);
+
+			for(int k=offset[p]; k<offset[p+1]; k++)
+			{
+				int i = order[k];
+				UINT slot = hashes[i] & (size-1);
+				groups[i] = i;
+				while(table[slot] >= 0)
+				{
+					int j = table[slot];
+					if(hashes[j] == hashes[i] && equalKey(keys[j], keys[i]))
+					{
+						groups[i] = j;
+						break;
+					}
+					slot = (slot+1) & (size-1);
+				}
+				if(groups[i] == i)
+					table[slot] = i;
+			}
+		});
+	};
+
+	// Tangent and bitangent of a triangle along increasing u and v, scaled
+	// by its size in position over its size in uv
+	static void faceFrame(const Vertex& a, const Vertex& b, const Vertex& c, XMVECTOR& tangent, XMVECTOR& bitangent)
+	{
+		float s1 = b.TexC.x - a.TexC.x;
+		float s2 = c.TexC.x - a.TexC.x;
+		float t1 = b.TexC.y - a.TexC.y;
+		float t2 = c.TexC.y - a.TexC.y;
+		float det = s1*t2 - s2*t1;
+		if(det == 0.0f)
+		{
+			tangent = XMVectorZero();
+			bitangent = XMVectorZero();
+			return;
+		}
+
+		XMVECTOR e1 = XMLoadFloat3(&b.Position) - XMLoadFloat3(&a.Position);
+		XMVECTOR e2 = XMLoadFloat3(&c.Position) - XMLoadFloat3(&a.Position);
+		tangent = (e1*t2 - e2*t1)/det;
+		bitangent = (e2*s1 - e1*s2)/det;
+	};
+
+	// Any unit vector at a right angle to "n"
+	static XMVECTOR perpendicular(XMVECTOR n)
+	{
+		XMFLOAT3 v;
+		XMStoreFloat3(&v, n);
+		XMFLOAT3 axis = fabsf(v.x) < 0.9f ? XMFLOAT3(1.0f, 0.0f, 0.0f) : XMFLOAT3(0.0f, 1.0f, 0.0f);
+		return XMVector3Normalize(XMVector3Cross(n, XMLoadFloat3(&axis)));
+	};
+
+	void buildTangents(MeshData& mesh, int& num_mirrored)
+	{
+		int num_vertices = (int)mesh.Vertices.size();
+		int num_triangles = (int)mesh.Indices.size()/3;
+
+		std::vector<XMFLOAT3> faceTangents(num_triangles);
+		std::vector<XMFLOAT3> faceBitangents(num_triangles);
+		forRange(num_triangles, [&](int t)
+		{
+			const UINT* tri = &mesh.Indices[t*3];
+			XMVECTOR tangent, bitangent;
+			faceFrame(mesh.Vertices[tri[0]], mesh.Vertices[tri[1]], mesh.Vertices[tri[2]], tangent, bitangent);
+			XMStoreFloat3(&faceTangents[t], tangent);
+			XMStoreFloat3(&faceBitangents[t], bitangent);
+		});
+
+		// Triangles around every vertex
+		std::vector<int> offset(num_vertices+1, 0);
+		for(int i=0; i<(int)mesh.Indices.size(); i++)
+			offset[mesh.Indices[i]+1]++;
+		for(int v=0; v<num_vertices; v++)
+			offset[v+1] += offset[v];
+		std::vector<int> adjacency(mesh.Indices.size());
+		std::vector<int> fill(offset.begin(), offset.end()-1);
+		for(int i=0; i<(int)mesh.Indices.size(); i++)
+			adjacency[fill[mesh.Indices[i]]++] = i/3;
+
+		Concurrency::combinable<int> mirrored;
+		forRange(num_vertices, [&](int v)
+		{
+			XMVECTOR tangent = XMVectorZero();
+			XMVECTOR bitangent = XMVectorZero();
+			for(int k=offset[v]; k<offset[v+1]; k++)
+			{
+				tangent += XMLoadFloat3(&faceTangents[adjacency[k]]);
+				bitangent += XMLoadFloat3(&faceBitangents[adjacency[k]]);
+			}
+
+			Vertex& vertex = mesh.Vertices[v];
+			XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&vertex.Normal));
+			XMVECTOR t = tangent - n*XMVectorGetX(XMVector3Dot(n, tangent));
+			if(XMVectorGetX(XMVector3LengthSq(t)) < 1e-12f)
+				t = perpendicular(n);
+			t = XMVector3Normalize(t);
+			XMStoreFloat3(&vertex.TangentU, t);
+
+			vertex.Handedness = XMVectorGetX(XMVector3Dot(XMVector3Cross(n, t), bitangent)) < 0.0f ? -1.0f : 1.0f;
+			if(vertex.Handedness < 0.0f)
+				mirrored.local()++;
+		});
+		num_mirrored = 0;
+		mirrored.combine_each([&](int count)
+		{
+			num_mirrored += count;
+		});
+	};
+
+	MeshWelder(const MeshWelder&);
+	MeshWelder& operator=(const MeshWelder&);
+
+public:
+	// Settings
+	bool rebuildTangents;
+
+	// Result of one mesh
+	struct Stats
+	{
+		int num_vertices;		// before welding
+		int num_welded;			// vertices merged into another
+		int num_mirrored;		// vertices with handedness -1
+		float weldMs;
+		float tangentMs;
+	};
+
+	MeshWelder()
+	{
+		rebuildTangents = true;
+	};
+
+	void weld(MeshData& mesh, Stats& stats)
+	{
+		memset(&stats, 0, sizeof(stats));
+		int num_vertices = (int)mesh.Vertices.size();
+		stats.num_vertices = num_vertices;
+		if(num_vertices == 0)
+			return;
+
+		Stopwatch watch;
+		keys.resize(num_vertices);
+		hashes.resize(num_vertices);
+		forRange(num_vertices, [&](int i)
+		{
+			makeKey(mesh.Vertices[i], keys[i]);
+			hashes[i] = hashKey(keys[i]);
+		});
+		findGroups(num_vertices);
+
+		// Kept vertices in their old order, groups point back so their
+		// number is already known
+		remap.resize(num_vertices);
+		int num_kept = 0;
+		for(int i=0; i<num_vertices; i++)
+			remap[i] = groups[i] == i ? num_kept++ : remap[groups[i]];
+
+		std::vector<Vertex> welded(num_kept);
+		forRange(num_vertices, [&](int i)
+		{
+			if(groups[i] == i)
+				welded[remap[i]] = mesh.Vertices[i];
+		});
+		forRange((int)mesh.Indices.size(), [&](int i)
+		{
+			mesh.Indices[i] = remap[mesh.Indices[i]];
+		});
+		mesh.Vertices.swap(welded);
+		stats.num_welded = num_vertices-num_kept;
+		stats.weldMs = watch.elapsedMs();
+
+		if(rebuildTangents)
+		{
+			Stopwatch tangentWatch;
+			buildTangents(mesh, stats.num_mirrored);
+			stats.tangentMs = tangentWatch.elapsedMs();
+		}
+	};
+};
+
+#endif
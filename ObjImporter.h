@@ -0,0 +1,634 @@
+#ifndef OBJIMPORTER_H
+#define OBJIMPORTER_H
+
+#include <vector>
+#include <string>
+#include <string.h>
+#include <ppl.h>
+#include "GeometryFactory.h"
+#include "MappedFile.h"
+#include "GameTimer.h"
+
+//
+// Wavefront OBJ importer
+//
+// The file is mapped and cut into chunks at line starts, and every chunk
+// is parsed on its own worker with a hand written number scanner. Only
+// the lines a mesh needs are read: "v", "vt", "vn", "f" and "usemtl",
+// everything else is skipped.
+//
+// Face corners are read in the order of the OBJ format, position/uv/normal.
+// The reader this replaced took them as position/normal/uv, so files
+// written for it need their last two indices swapped.
+//
+// Faces with more than three corners are cut into a fan of triangles.
+// Negative indices count back from the last element read, inside a chunk
+// they are resolved against the chunk and moved by the chunk's offset
+// once every chunk is done.
+//
+// Chunks are joined in file order, and corners with the same position,
+// uv and normal index become one vertex. Normals left out of the file
+// are averaged from the faces around the vertex, tangents are left to
+// MeshWelder. Each "usemtl" starts a subset of the mesh.
+//
+// runBenchmark parses a file serially and in parallel without building a
+// mesh, so the speedup of the chunks can be measured on any file.
+//
+
+class ObjImporter
+{
+private:
+	// Indices are 0-based and -1 when left out. Negative indices of the
+	// file are relative to the chunk until flagged otherwise.
+	struct Corner
+	{
+		int v;
+		int vt;
+		int vn;
+		int relative;
+	};
+	enum
+	{
+		relative_v = 1,
+		relative_vt = 2,
+		relative_vn = 4
+	};
+
+	struct MaterialUse
+	{
+		std::string name;
+		int triangle;			// first triangle of the chunk using it
+	};
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<XMFLOAT3> positions;
+		std::vector<XMFLOAT2> uvs;
+		std::vector<XMFLOAT3> normals;
+		std::vector<Corner> corners;		// three per triangle
+		std::vector<MaterialUse> materials;
+		int num_polygons;
+	};
+
+	// Chunks are cut to at least this size, and there are at most a few
+	// per worker
+	static const int minChunkBytes = 256*1024;
+	static const int chunksPerWorker = 4;
+
+	MappedFile file;
+	std::vector<Chunk> chunks;
+
+	// Whole file, joined from the chunks
+	std::vector<XMFLOAT3> positions;
+	std::vector<XMFLOAT2> uvs;
+	std::vector<XMFLOAT3> normals;
+	std::vector<Corner> corners;
+
+	//
+	// Scanner
+	//
+
+	static bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t';
+	};
+	static bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	};
+	static const char* skipSpace(const char* p, const char* end)
+	{
+		while(p < end && isSpace(*p))
+			p++;
+		return p;
+	};
+	static const char* skipLine(const char* p, const char* end)
+	{
+		while(p < end && *p != '\n')
+			p++;
+		return p < end ? p+1 : end;
+	};
+
+	static double power10(int exponent)
+	{
+		static const double table[] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		double scale = 1.0;
+		while(exponent > 22)
+		{
+			scale *= 1e22;
+			exponent -= 22;
+		}
+		return scale*table[exponent];
+	};
+
+	// Leaves "value" at 0 if there is no number, the sign is consumed
+	// either way
+	static const char* parseInt(const char* p, const char* end, int& value)
+	{
+		bool negative = false;
+		if(p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+		int result = 0;
+		while(p < end && isDigit(*p))
+		{
+			result = result*10 + (*p-'0');
+			p++;
+		}
+		value = negative ? -result : result;
+		return p;
+	};
+
+	// Decimal with optional fraction and exponent. The first 19
+	// significant digits are kept, which is more than a float holds.
+	static const char* parseFloat(const char* p, const char* end, float& value)
+	{
+		p = skipSpace(p, end);
+		bool negative = false;
+		if(p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		unsigned long long mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		while(p < end && isDigit(*p))
+		{
+			if(digits < 19)
+			{
+				mantissa = mantissa*10 + (*p-'0');
+				if(mantissa != 0)
+					digits++;
+			}
+			else
+				exponent++;
+			p++;
+		}
+		if(p < end && *p == '.')
+		{
+			p++;
+			while(p < end && isDigit(*p))
+			{
+				if(digits < 19)
+				{
+					mantissa = mantissa*10 + (*p-'0');
+					if(mantissa != 0)
+						digits++;
+					exponent--;
+				}
+				p++;
+			}
+		}
+		if(p < end && (*p == 'e' || *p == 'E'))
+		{
+			int e;
+			p = parseInt(p+1, end, e);
+			exponent += e;
+		}
+
+		double result = (double)mantissa;
+		if(exponent < 0)
+			result /= power10(-exponent);
+		else if(exponent > 0)
+			result *= power10(exponent);
+		value = (float)(negative ? -result : result);
+		return p;
+	};
+
+	// Index of the file to 0-based, "count" is how many elements of its
+	// kind the chunk has read so far
+	static void resolve(int index, int count, int flag, int& out, int& relative)
+	{
+		if(index > 0)
+			out = index-1;
+		else if(index < 0)
+		{
+			out = count+index;
+			relative |= flag;
+		}
+		else
+			out = -1;
+	};
+
+	static const char* parseFace(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& polygon)
+	{
+		polygon.clear();
+		for(;;)
+		{
+			p = skipSpace(p, end);
+			if(p >= end || !(isDigit(*p) || *p == '-' || *p == '+'))
+				break;
+
+			Corner corner = {-1, -1, -1, 0};
+			int index;
+			p = parseInt(p, end, index);
+			resolve(index, (int)chunk.positions.size(), relative_v, corner.v, corner.relative);
+			if(p < end && *p == '/')
+			{
+				p = parseInt(p+1, end, index);
+				resolve(index, (int)chunk.uvs.size(), relative_vt, corner.vt, corner.relative);
+				if(p < end && *p == '/')
+				{
+					p = parseInt(p+1, end, index);
+					resolve(index, (int)chunk.normals.size(), relative_vn, corner.vn, corner.relative);
+				}
+			}
+			polygon.push_back(corner);
+		}
+
+		int num_corners = (int)polygon.size();
+		for(int i=1; i<num_corners-1; i++)
+		{
+			chunk.corners.push_back(polygon[0]);
+			chunk.corners.push_back(polygon[i]);
+			chunk.corners.push_back(polygon[i+1]);
+		}
+		if(num_corners > 3)
+			chunk.num_polygons++;
+		return p;
+	};
+
+	static void parseChunk(Chunk& chunk)
+	{
+		std::vector<Corner> polygon;
+		const char* p = chunk.begin;
+		const char* end = chunk.end;
+		while(p < end)
+		{
+			p = skipSpace(p, end);
+			if(end-p > 2 && p[0] == 'v' && isSpace(p[1]))
+			{
+				XMFLOAT3 v(0.0f, 0.0f, 0.0f);
+				p = parseFloat(p+2, end, v.x);
+				p = parseFloat(p, end, v.y);
+				p = parseFloat(p, end, v.z);
+				chunk.positions.push_back(v);
+			}
+			else if(end-p > 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2]))
+			{
+				XMFLOAT2 uv(0.0f, 0.0f);
+				p = parseFloat(p+3, end, uv.x);
+				p = parseFloat(p, end, uv.y);
+				chunk.uvs.push_back(uv);
+			}
+			else if(end-p > 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+			{
+				XMFLOAT3 n(0.0f, 0.0f, 0.0f);
+				p = parseFloat(p+3, end, n.x);
+				p = parseFloat(p, end, n.y);
+				p = parseFloat(p, end, n.z);
+				chunk.normals.push_back(n);
+			}
+			else if(end-p > 2 && p[0] == 'f' && isSpace(p[1]))
+				p = parseFace(p+2, end, chunk, polygon);
+			else if(end-p > 7 && strncmp(p, "usemtl", 6) == 0 && isSpace(p[6]))
+			{
+				const char* name = skipSpace(p+7, end);
+				const char* nameEnd = name;
+				while(nameEnd < end && *nameEnd != '\n' && *nameEnd != '\r')
+					nameEnd++;
+				while(nameEnd > name && isSpace(nameEnd[-1]))
+					nameEnd--;
+
+				MaterialUse use;
+				use.name.assign(name, nameEnd);
+				use.triangle = (int)chunk.corners.size()/3;
+				chunk.materials.push_back(use);
+				p = nameEnd;
+			}
+			p = skipLine(p, end);
+		}
+	};
+
+	//
+	// Merge
+	//
+
+	static int getMaxChunks()
+	{
+		return Concurrency::GetProcessorCount()*chunksPerWorker;
+	};
+
+	void splitChunks(const char* data, size_t size, size_t maxChunks)
+	{
+		int num_chunks = (int)MathUtil::Max<size_t>(1, MathUtil::Min<size_t>(size/minChunkBytes, maxChunks));
+
+		chunks.clear();
+		chunks.resize(num_chunks);
+		const char* end = data+size;
+		const char* begin = data;
+		for(int i=0; i<num_chunks; i++)
+		{
+			Chunk& chunk = chunks[i];
+			chunk.begin = begin;
+			chunk.end = i == num_chunks-1 ? end : MathUtil::Max(begin, skipLine(data+size*(i+1)/num_chunks, end));
+			chunk.num_polygons = 0;
+			begin = chunk.end;
+		}
+	};
+
+	// Copies every chunk into place and makes its relative indices
+	// absolute
+	void joinChunks()
+	{
+		int num_chunks = (int)chunks.size();
+		std::vector<int> basePosition(num_chunks+1, 0);
+		std::vector<int> baseUv(num_chunks+1, 0);
+		std::vector<int> baseNormal(num_chunks+1, 0);
+		std::vector<int> baseCorner(num_chunks+1, 0);
+		for(int i=0; i<num_chunks; i++)
+		{
+			basePosition[i+1] = basePosition[i] + (int)chunks[i].positions.size();
+			baseUv[i+1] = baseUv[i] + (int)chunks[i].uvs.size();
+			baseNormal[i+1] = baseNormal[i] + (int)chunks[i].normals.size();
+			baseCorner[i+1] = baseCorner[i] + (int)chunks[i].corners.size();
+		}
+		positions.resize(basePosition[num_chunks]);
+		uvs.resize(baseUv[num_chunks]);
+		normals.resize(baseNormal[num_chunks]);
+		corners.resize(baseCorner[num_chunks]);
+
+		Concurrency::parallel_for(0, num_chunks, [&](int i)
+		{
+			Chunk& chunk = chunks[i];
+			if(!chunk.positions.empty())
+				memcpy(&positions[basePosition[i]], &chunk.positions[0], chunk.positions.size()*sizeof(XMFLOAT3));
+			if(!chunk.uvs.empty())
+				memcpy(&uvs[baseUv[i]], &chunk.uvs[0], chunk.uvs.size()*sizeof(XMFLOAT2));
+			if(!chunk.normals.empty())
+				memcpy(&normals[baseNormal[i]], &chunk.normals[0], chunk.normals.size()*sizeof(XMFLOAT3));
+
+			for(int c=0; c<(int)chunk.corners.size(); c++)
+			{
+				Corner corner = chunk.corners[c];
+				if(corner.relative & relative_v)
+					corner.v += basePosition[i];
+				if(corner.relative & relative_vt)
+					corner.vt += baseUv[i];
+				if(corner.relative & relative_vn)
+					corner.vn += baseNormal[i];
+				corners[baseCorner[i]+c] = corner;
+			}
+		});
+	};
+
+	bool isValid(const Corner& corner) const
+	{
+		return
+			corner.v >= 0 && corner.v < (int)positions.size() &&
+			corner.vt >= -1 && corner.vt < (int)uvs.size() &&
+			corner.vn >= -1 && corner.vn < (int)normals.size();
+	};
+
+	void buildMesh(GeometryFactory::MeshData& mesh)
+	{
+		mesh.Vertices.clear();
+		mesh.Indices.clear();
+		mesh.Subsets.clear();
+		mesh.Indices.reserve(corners.size());
+
+		// Corners already made into vertices, listed by position
+		std::vector<int> first(positions.size(), -1);
+		std::vector<int> next;
+		std::vector<Corner> keys;
+		next.reserve(corners.size()/2);
+		keys.reserve(corners.size()/2);
+
+		std::vector<XMFLOAT3> faceNormals;
+
+		// Material uses in file order, with triangles counted from the start
+		std::vector<MaterialUse> uses;
+		int triangleBase = 0;
+		for(int i=0; i<(int)chunks.size(); i++)
+		{
+			for(int m=0; m<(int)chunks[i].materials.size(); m++)
+			{
+				uses.push_back(chunks[i].materials[m]);
+				uses.back().triangle += triangleBase;
+			}
+			triangleBase += (int)chunks[i].corners.size()/3;
+		}
+		int nextUse = 0;
+
+		int num_triangles = (int)corners.size()/3;
+		for(int t=0; t<num_triangles; t++)
+		{
+			while(nextUse < (int)uses.size() && uses[nextUse].triangle <= t)
+			{
+				GeometryFactory::Subset subset;
+				subset.Material = uses[nextUse].name;
+				subset.StartIndex = (UINT)mesh.Indices.size();
+				subset.IndexCount = 0;
+				if(mesh.Subsets.empty() && subset.StartIndex > 0)
+				{
+					GeometryFactory::Subset unnamed = {"", 0, 0};
+					mesh.Subsets.push_back(unnamed);
+				}
+				mesh.Subsets.push_back(subset);
+				nextUse++;
+			}
+
+			const Corner* tri = &corners[t*3];
+			if(!isValid(tri[0]) || !isValid(tri[1]) || !isValid(tri[2]))
+			{
+				num_invalidFaces++;
+				continue;
+			}
+
+			int index[3];
+			for(int k=0; k<3; k++)
+			{
+				const Corner& corner = tri[k];
+				int v = first[corner.v];
+				while(v >= 0 && (keys[v].vt != corner.vt || keys[v].vn != corner.vn))
+					v = next[v];
+				if(v < 0)
+				{
+					v = (int)keys.size();
+					keys.push_back(corner);
+					next.push_back(first[corner.v]);
+					first[corner.v] = v;
+
+					GeometryFactory::Vertex vertex;
+					vertex.Position = positions[corner.v];
+					vertex.Normal = corner.vn >= 0 ? normals[corner.vn] : XMFLOAT3(0.0f, 0.0f, 0.0f);
+					vertex.TexC = corner.vt >= 0 ? uvs[corner.vt] : XMFLOAT2(0.75f, 0.75f);
+					vertex.TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
+					mesh.Vertices.push_back(vertex);
+					faceNormals.push_back(XMFLOAT3(0.0f, 0.0f, 0.0f));
+				}
+				index[k] = v;
+				mesh.Indices.push_back(v);
+			}
+
+			// Area weighted normal goes to every corner
+			XMVECTOR p0 = XMLoadFloat3(&mesh.Vertices[index[0]].Position);
+			XMVECTOR p1 = XMLoadFloat3(&mesh.Vertices[index[1]].Position);
+			XMVECTOR p2 = XMLoadFloat3(&mesh.Vertices[index[2]].Position);
+			XMVECTOR n = XMVector3Cross(p1-p0, p2-p0);
+			for(int k=0; k<3; k++)
+				XMStoreFloat3(&faceNormals[index[k]], XMLoadFloat3(&faceNormals[index[k]]) + n);
+		}
+
+		for(int i=0; i<(int)mesh.Subsets.size(); i++)
+		{
+			UINT end = i+1 < (int)mesh.Subsets.size() ? mesh.Subsets[i+1].StartIndex : (UINT)mesh.Indices.size();
+			mesh.Subsets[i].IndexCount = end - mesh.Subsets[i].StartIndex;
+		}
+
+		Concurrency::parallel_for(0, (int)mesh.Vertices.size(), [&](int v)
+		{
+			if(keys[v].vn < 0)
+				XMStoreFloat3(&mesh.Vertices[v].Normal, XMVector3Normalize(XMLoadFloat3(&faceNormals[v])));
+		});
+	};
+
+	// Parses the mapped file in at most "maxChunks" chunks, returns
+	// milliseconds. A single chunk is parsed on the calling thread.
+	float timeParse(size_t maxChunks)
+	{
+		Stopwatch watch;
+		splitChunks(file.getData(), file.getSize(), maxChunks);
+		if(chunks.size() == 1)
+			parseChunk(chunks[0]);
+		else
+		{
+			Concurrency::parallel_for(0, (int)chunks.size(), [&](int i)
+			{
+				parseChunk(chunks[i]);
+			});
+		}
+		return watch.elapsedMs();
+	};
+
+	ObjImporter(const ObjImporter&);
+	ObjImporter& operator=(const ObjImporter&);
+
+public:
+	// Statistics of last import
+	float fileMB;
+	int num_chunks;
+	int num_positions;
+	int num_triangles;
+	int num_polygons;		// faces with more than three corners
+	int num_invalidFaces;	// triangles with an index outside the file, dropped
+	int num_vertices;
+	float parseMs;
+	float mergeMs;
+	float parseMBps;
+
+	// Last benchmark, parse only
+	struct Benchmark
+	{
+		float fileMB;
+		int num_chunks;			// of the parallel parse
+		float serialMs;
+		float parallelMs;
+		float serialMBps;
+		float parallelMBps;
+		float speedup;
+	};
+	Benchmark benchmark;
+
+	ObjImporter()
+	{
+		memset(&benchmark, 0, sizeof(benchmark));
+		fileMB = 0.0f;
+		num_chunks = 0;
+		num_positions = 0;
+		num_triangles = 0;
+		num_polygons = 0;
+		num_invalidFaces = 0;
+		num_vertices = 0;
+		parseMs = 0.0f;
+		mergeMs = 0.0f;
+		parseMBps = 0.0f;
+	};
+
+	// False if the file could not be opened
+	bool load(const char* path, GeometryFactory::MeshData& mesh)
+	{
+		mesh.Vertices.clear();
+		mesh.Indices.clear();
+		mesh.Subsets.clear();
+		if(!file.open(path))
+			return false;
+
+		Stopwatch watch;
+		splitChunks(file.getData(), file.getSize(), getMaxChunks());
+		Concurrency::parallel_for(0, (int)chunks.size(), [&](int i)
+		{
+			parseChunk(chunks[i]);
+		});
+		parseMs = watch.elapsedMs();
+
+		Stopwatch mergeWatch;
+		num_invalidFaces = 0;
+		joinChunks();
+		buildMesh(mesh);
+		mergeMs = mergeWatch.elapsedMs();
+
+		fileMB = file.getSize()/(1024.0f*1024.0f);
+		num_chunks = (int)chunks.size();
+		num_positions = (int)positions.size();
+		num_triangles = (int)mesh.Indices.size()/3;
+		num_polygons = 0;
+		for(int i=0; i<num_chunks; i++)
+			num_polygons += chunks[i].num_polygons;
+		num_vertices = (int)mesh.Vertices.size();
+		parseMBps = parseMs > 0.0f ? fileMB/(parseMs*0.001f) : 0.0f;
+
+		// Nothing is kept between imports
+		chunks.clear();
+		std::vector<XMFLOAT3>().swap(positions);
+		std::vector<XMFLOAT2>().swap(uvs);
+		std::vector<XMFLOAT3>().swap(normals);
+		std::vector<Corner>().swap(corners);
+		file.close();
+		return true;
+	};
+
+	// Parses "path" once as a single chunk on one thread and once cut into
+	// chunks on every worker, no mesh is built and no cache is involved.
+	// False if the file could not be opened.
+	bool runBenchmark(const char* path)
+	{
+		memset(&benchmark, 0, sizeof(benchmark));
+		if(!file.open(path))
+			return false;
+
+		// Touch every page first so neither run pays for reading the file
+		const char* data = file.getData();
+		size_t size = file.getSize();
+		volatile char sum = 0;
+		for(size_t i=0; i<size; i+=4096)
+			sum += data[i];
+
+		benchmark.fileMB = size/(1024.0f*1024.0f);
+		benchmark.serialMs = timeParse(1);
+		benchmark.parallelMs = timeParse(getMaxChunks());
+		benchmark.num_chunks = (int)chunks.size();
+		chunks.clear();
+		if(benchmark.serialMs > 0.0f)
+			benchmark.serialMBps = benchmark.fileMB/(benchmark.serialMs*0.001f);
+		if(benchmark.parallelMs > 0.0f)
+		{
+			benchmark.parallelMBps = benchmark.fileMB/(benchmark.parallelMs*0.001f);
+			benchmark.speedup = benchmark.serialMs/benchmark.parallelMs;
+		}
+		file.close();
+		return true;
+	};
+};
+
+#endif
@@ -0,0 +1,450 @@
+#ifndef OCCLUSIONCULL_H
+#define OCCLUSIONCULL_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <ppl.h>
+#include "Util.h"
+#include "GameTimer.h"
+#include "Profiler.h"
+
+//
+// Software occlusion culling
+//
+// Occluder boxes are rasterized into a small CPU depth buffer, keeping
+// the nearest depth of every pixel. Triangles are clipped against the
+// near plane and back faces are skipped. The buffer is split in screen
+// tiles rasterized on worker threads, and each tile walks its triangles
+// four pixels at a time with SSE. A pyramid of min and max depth is then
+// built over the buffer.
+//
+// A bounding sphere is tested with the screen rectangle of its box and
+// the nearest depth of that box. The test uses the pyramid level where
+// the rectangle spans a few texels. The sphere is occluded when every
+// texel has a max depth nearer than the sphere. Before that, a coarser
+// level of min depth can show the sphere is in front of everything there.
+// Anything the buffer cannot answer, such as spheres crossing the near
+// plane or off screen, counts as visible.
+//
+
+class OcclusionCuller
+{
+public:
+	static const int width = 256;
+	static const int height = 128;
+	static const int tileWidth = 64;	// multiple of 4, one SSE row step
+	static const int tileHeight = 32;
+	static const int num_tilesX = width/tileWidth;
+	static const int num_tilesY = height/tileHeight;
+	static const int maxLevels = 8;		// until the pyramid is 2x1
+
+private:
+	struct Corners
+	{
+		XMFLOAT3 p[8];		// corner i has x, y and z max set by bits 0, 1 and 2
+	};
+
+	// Screen space triangle, edge functions are positive inside and
+	// depth is the plane through the three vertices
+	struct Triangle
+	{
+		float a[3];
+		float b[3];
+		float c[3];
+		float za;
+		float zb;
+		float zc;
+		int minX;
+		int maxX;
+		int minY;
+		int maxY;
+	};
+
+	std::vector<Corners> occluders;
+	std::vector<Triangle> triangles;
+
+	// Level 0 holds the depth buffer in maxZ, minZ starts at level 1
+	std::vector<float> minZ[maxLevels];
+	std::vector<float> maxZ[maxLevels];
+
+	XMFLOAT4X4 viewProj;
+	Stopwatch testWatch;
+
+	OcclusionCuller(const OcclusionCuller&);
+	OcclusionCuller& operator=(const OcclusionCuller&);
+
+	static XMFLOAT4 transform(const XMFLOAT3& p, const XMFLOAT4X4& m)
+	{
+		return XMFLOAT4(
+			p.x*m._11 + p.y*m._21 + p.z*m._31 + m._41,
+			p.x*m._12 + p.y*m._22 + p.z*m._32 + m._42,
+			p.x*m._13 + p.y*m._23 + p.z*m._33 + m._43,
+			p.x*m._14 + p.y*m._24 + p.z*m._34 + m._44);
+	};
+
+	static XMFLOAT4 lerp(const XMFLOAT4& a, const XMFLOAT4& b, float t)
+	{
+		return XMFLOAT4(
+			a.x + (b.x-a.x)*t,
+			a.y + (b.y-a.y)*t,
+			a.z + (b.z-a.z)*t,
+			a.w + (b.w-a.w)*t);
+	};
+
+	// Clip space to pixels, z is the depth buffer value
+	static XMFLOAT3 toScreen(const XMFLOAT4& v)
+	{
+		float invW = 1.0f/v.w;
+		return XMFLOAT3(
+			(v.x*invW*0.5f + 0.5f)*width,
+			(-v.y*invW*0.5f + 0.5f)*height,
+			v.z*invW);
+	};
+
+	// Front faces are clockwise on screen, which gives a positive area
+	// with y pointing down
+	void setupTriangle(const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2)
+	{
+		float area = (v1.x-v0.x)*(v2.y-v0.y) - (v1.y-v0.y)*(v2.x-v0.x);
+		if(area <= 0.0f)
+			return;
+
+		Triangle t;
+		t.minX = MathUtil::Max(0, (int)floorf(MathUtil::Min(v0.x, MathUtil::Min(v1.x, v2.x))));
+		t.maxX = MathUtil::Min(width-1, (int)ceilf(MathUtil::Max(v0.x, MathUtil::Max(v1.x, v2.x))));
+		t.minY = MathUtil::Max(0, (int)floorf(MathUtil::Min(v0.y, MathUtil::Min(v1.y, v2.y))));
+		t.maxY = MathUtil::Min(height-1, (int)ceilf(MathUtil::Max(v0.y, MathUtil::Max(v1.y, v2.y))));
+		if(t.minX > t.maxX || t.minY > t.maxY)
+			return;
+
+		// Edge i lies opposite of vertex i
+		const XMFLOAT3* v[3] = {&v0, &v1, &v2};
+		for(int i=0; i<3; i++)
+		{
+			const XMFLOAT3& p = *v[(i+1)%3];
+			const XMFLOAT3& q = *v[(i+2)%3];
+			t.a[i] = p.y-q.y;
+			t.b[i] = q.x-p.x;
+			t.c[i] = (q.y-p.y)*p.x - (q.x-p.x)*p.y;
+		}
+
+		// Edge i is the barycentric weight of vertex i times the area
+		float invArea = 1.0f/area;
+		t.za = (v0.z*t.a[0] + v1.z*t.a[1] + v2.z*t.a[2])*invArea;
+		t.zb = (v0.z*t.b[0] + v1.z*t.b[1] + v2.z*t.b[2])*invArea;
+		t.zc = (v0.z*t.c[0] + v1.z*t.c[1] + v2.z*t.c[2])*invArea;
+		triangles.push_back(t);
+	};
+
+	// Polygon of the triangle in front of the near plane, z >= 0 in clip
+	// space, triangulated as a fan
+	void clipTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2)
+	{
+		if(v0.z >= 0.0f && v1.z >= 0.0f && v2.z >= 0.0f)
+		{
+			setupTriangle(toScreen(v0), toScreen(v1), toScreen(v2));
+			return;
+		}
+
+		const XMFLOAT4* in[3] = {&v0, &v1, &v2};
+		XMFLOAT4 out[4];
+		int count = 0;
+		for(int i=0; i<3; i++)
+		{
+			const XMFLOAT4& a = *in[i];
+			const XMFLOAT4& b = *in[(i+1)%3];
+			if(a.z >= 0.0f)
+				out[count++] = a;
+			if((a.z >= 0.0f) != (b.z >= 0.0f))
+				out[count++] = lerp(a, b, a.z/(a.z-b.z));
+		}
+		for(int i=2; i<count; i++)
+			setupTriangle(toScreen(out[0]), toScreen(out[i-1]), toScreen(out[i]));
+	};
+
+	void rasterizeTile(int tile)
+	{
+		PROFILE_SCOPE("Occlusion tile");
+		int tileX0 = (tile%num_tilesX)*tileWidth;
+		int tileY0 = (tile/num_tilesX)*tileHeight;
+		int tileX1 = tileX0+tileWidth-1;
+		int tileY1 = tileY0+tileHeight-1;
+		float* depth = &maxZ[0][0];
+
+		for(int i=0; i<(int)triangles.size(); i++)
+		{
+			const Triangle& t = triangles[i];
+			int minX = MathUtil::Max(t.minX, tileX0) & ~3;
+			int maxX = MathUtil::Min(t.maxX, tileX1);
+			int minY = MathUtil::Max(t.minY, tileY0);
+			int maxY = MathUtil::Min(t.maxY, tileY1);
+			if(minX > maxX || minY > maxY)
+				continue;
+
+			__m128 a0 = _mm_set1_ps(t.a[0]);
+			__m128 a1 = _mm_set1_ps(t.a[1]);
+			__m128 a2 = _mm_set1_ps(t.a[2]);
+			__m128 za = _mm_set1_ps(t.za);
+			__m128 zero = _mm_setzero_ps();
+			__m128 four = _mm_set1_ps(4.0f);
+			__m128 startX = _mm_add_ps(_mm_set1_ps(minX+0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+
+			for(int y=minY; y<=maxY; y++)
+			{
+				// Row constants of every edge and the depth plane
+				float py = y+0.5f;
+				__m128 r0 = _mm_set1_ps(t.b[0]*py + t.c[0]);
+				__m128 r1 = _mm_set1_ps(t.b[1]*py + t.c[1]);
+				__m128 r2 = _mm_set1_ps(t.b[2]*py + t.c[2]);
+				__m128 rz = _mm_set1_ps(t.zb*py + t.zc);
+
+				float* row = depth + y*width;
+				__m128 px = startX;
+				for(int x=minX; x<=maxX; x+=4)
+				{
+					__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+					__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+					__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+					__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+					if(_mm_movemask_ps(inside) != 0)
+					{
+						__m128 z = _mm_add_ps(_mm_mul_ps(za, px), rz);
+						__m128 old = _mm_loadu_ps(row+x);
+						__m128 nearer = _mm_min_ps(old, z);
+						_mm_storeu_ps(row+x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+					}
+					px = _mm_add_ps(px, four);
+				}
+			}
+		}
+	};
+
+	void buildPyramid()
+	{
+		for(int level=1; level<maxLevels; level++)
+		{
+			int w = width>>level;
+			int h = height>>level;
+			int srcW = w*2;
+			const float* srcMin = level == 1 ? &maxZ[0][0] : &minZ[level-1][0];
+			const float* srcMax = &maxZ[level-1][0];
+			float* dstMin = &minZ[level][0];
+			float* dstMax = &maxZ[level][0];
+			for(int y=0; y<h; y++)
+			{
+				for(int x=0; x<w; x++)
+				{
+					int s = 2*x + 2*y*srcW;
+					dstMin[x+y*w] = MathUtil::Min(MathUtil::Min(srcMin[s], srcMin[s+1]), MathUtil::Min(srcMin[s+srcW], srcMin[s+srcW+1]));
+					dstMax[x+y*w] = MathUtil::Max(MathUtil::Max(srcMax[s], srcMax[s+1]), MathUtil::Max(srcMax[s+srcW], srcMax[s+srcW+1]));
+				}
+			}
+		}
+	};
+
+public:
+	bool useThreads;
+
+	// Statistics of last frame
+	int num_occluders;
+	int num_triangles;		// front facing after clipping
+	int num_tested;
+	int num_occluded;
+	float occludedPercent;
+	float rasterMs;
+	float testMs;
+	float cullMs;			// raster and tests
+
+	OcclusionCuller()
+	{
+		useThreads = true;
+		for(int level=0; level<maxLevels; level++)
+		{
+			maxZ[level].resize((width>>level)*(height>>level), 1.0f);
+			if(level > 0)
+				minZ[level].resize((width>>level)*(height>>level), 1.0f);
+		}
+		memset(&viewProj, 0, sizeof(viewProj));
+		num_occluders = 0;
+		num_triangles = 0;
+		num_tested = 0;
+		num_occluded = 0;
+		occludedPercent = 0.0f;
+		rasterMs = 0.0f;
+		testMs = 0.0f;
+		cullMs = 0.0f;
+	};
+
+	void clearOccluders()
+	{
+		occluders.clear();
+	};
+
+	// Box spanning [minP, maxP] in the space of "world"
+	void addOccluderBox(CXMMATRIX world, const XMFLOAT3& minP, const XMFLOAT3& maxP)
+	{
+		XMFLOAT4X4 m;
+		XMStoreFloat4x4(&m, world);
+
+		Corners box;
+		for(int i=0; i<8; i++)
+		{
+			XMFLOAT3 p(i&1 ? maxP.x : minP.x, i&2 ? maxP.y : minP.y, i&4 ? maxP.z : minP.z);
+			XMFLOAT4 w = transform(p, m);
+			box.p[i] = XMFLOAT3(w.x, w.y, w.z);
+		}
+		occluders.push_back(box);
+	};
+
+	int getOccluderCount() const
+	{
+		return (int)occluders.size();
+	};
+
+	// Rasterizes the occluders as seen through "viewProjMatrix"
+	void render(CXMMATRIX viewProjMatrix)
+	{
+		PROFILE_SCOPE("Occlusion raster");
+		Stopwatch watch;
+		XMStoreFloat4x4(&viewProj, viewProjMatrix);
+
+		// Faces clockwise seen from outside, two triangles each
+		static const int faces[6][4] =
+		{
+			{0, 2, 3, 1},	// -z
+			{5, 7, 6, 4},	// +z
+			{4, 6, 2, 0},	// -x
+			{1, 3, 7, 5},	// +x
+			{4, 0, 1, 5},	// -y
+			{2, 6, 7, 3}	// +y
+		};
+
+		triangles.clear();
+		for(int i=0; i<(int)occluders.size(); i++)
+		{
+			XMFLOAT4 v[8];
+			for(int c=0; c<8; c++)
+				v[c] = transform(occluders[i].p[c], viewProj);
+
+			for(int f=0; f<6; f++)
+			{
+				const int* q = faces[f];
+				clipTriangle(v[q[0]], v[q[1]], v[q[2]]);
+				clipTriangle(v[q[0]], v[q[2]], v[q[3]]);
+			}
+		}
+
+		std::fill(maxZ[0].begin(), maxZ[0].end(), 1.0f);
+		int num_tiles = num_tilesX*num_tilesY;
+		if(useThreads)
+		{
+			Concurrency::parallel_for(0, num_tiles, [&](int tile)
+			{
+				rasterizeTile(tile);
+			});
+		}
+		else
+		{
+			for(int tile=0; tile<num_tiles; tile++)
+				rasterizeTile(tile);
+		}
+		buildPyramid();
+
+		num_occluders = (int)occluders.size();
+		num_triangles = (int)triangles.size();
+		num_tested = 0;
+		num_occluded = 0;
+		rasterMs = watch.elapsedMs();
+		testMs = 0.0f;
+	};
+
+	// Tests of a frame go between these two
+	void beginTests()
+	{
+		testWatch.start();
+	};
+	void endTests()
+	{
+		testMs += testWatch.elapsedMs();
+		cullMs = rasterMs+testMs;
+		occludedPercent = num_tested > 0 ? 100.0f*num_occluded/num_tested : 0.0f;
+	};
+
+	// False if the sphere is hidden behind the occluders
+	bool testSphere(const XMFLOAT3& center, float radius)
+	{
+		num_tested++;
+
+		// Screen rectangle and nearest depth of the bounding box
+		float minX = FLT_MAX, maxX = -FLT_MAX;
+		float minY = FLT_MAX, maxY = -FLT_MAX;
+		float nearZ = FLT_MAX;
+		for(int i=0; i<8; i++)
+		{
+			XMFLOAT3 p(
+				center.x + (i&1 ? radius : -radius),
+				center.y + (i&2 ? radius : -radius),
+				center.z + (i&4 ? radius : -radius));
+			XMFLOAT4 v = transform(p, viewProj);
+			if(v.z < 0.0f)
+				return true;
+			XMFLOAT3 s = toScreen(v);
+			minX = MathUtil::Min(minX, s.x);
+			maxX = MathUtil::Max(maxX, s.x);
+			minY = MathUtil::Min(minY, s.y);
+			maxY = MathUtil::Max(maxY, s.y);
+			nearZ = MathUtil::Min(nearZ, s.z);
+		}
+
+		int x0 = MathUtil::Max(0, (int)floorf(minX));
+		int x1 = MathUtil::Min(width-1, (int)ceilf(maxX)-1);
+		int y0 = MathUtil::Max(0, (int)floorf(minY));
+		int y1 = MathUtil::Min(height-1, (int)ceilf(maxY)-1);
+		if(x0 > x1 || y0 > y1 || nearZ > 1.0f)
+			return true;
+
+		// Level where the rectangle spans at most 4 texels per side
+		int level = 0;
+		while(level+1 < maxLevels && ((x1>>level)-(x0>>level) >= 4 || (y1>>level)-(y0>>level) >= 4))
+			level++;
+
+		// In front of the nearest occluder of a coarser level means in
+		// front of every texel below it
+		int coarse = MathUtil::Min(level+2, maxLevels-1);
+		if(coarse > 0)
+		{
+			int w = width>>coarse;
+			float nearest = FLT_MAX;
+			for(int y=y0>>coarse; y<=(y1>>coarse); y++)
+				for(int x=x0>>coarse; x<=(x1>>coarse); x++)
+					nearest = MathUtil::Min(nearest, minZ[coarse][x+y*w]);
+			if(nearZ <= nearest)
+				return true;
+		}
+
+		int w = width>>level;
+		for(int y=y0>>level; y<=(y1>>level); y++)
+		{
+			for(int x=x0>>level; x<=(x1>>level); x++)
+			{
+				if(nearZ <= maxZ[level][x+y*w])
+					return true;
+			}
+		}
+
+		num_occluded++;
+		return false;
+	};
+
+	// Depth buffer, width*height values, 1 where no occluder was drawn
+	const float* getDepth() const
+	{
+		return &maxZ[0][0];
+	};
+};
+
+#endif
@@ -0,0 +1,514 @@
+#ifndef PATHFINDER_H
+#define PATHFINDER_H
+
+#include <windows.h>
+#include <ppl.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "GameEntity.h"
+#include "GameTimer.h"
+#include "BitGrid.h"
+
+struct PathRequest
+{
+	PathRequest(){}
+	PathRequest(Int2 start, Int2 goal){this->start = start; this->goal = goal;}
+
+	Int2 start;
+	Int2 goal;
+};
+
+struct PathResult
+{
+	std::vector<Int2> path;	// tiles from start to goal, both included
+	bool found;
+	bool cached;
+	float latencyMs;
+};
+
+// Shortest paths between maze tiles, moves are restricted to the four
+// axis directions. Searches use Jump Point Search over a packed copy of
+// the maze walls, finished paths are cached on (start, goal) until the
+// maze revision changes. Batches are resolved on worker threads.
+class Pathfinder
+{
+private:
+	struct Node
+	{
+		int tile;
+		int f;
+		bool operator<(const Node& other) const
+		{
+			// heap functions build a max heap, smallest f on top
+			return f > other.f;
+		};
+	};
+
+	// Per search state, one per worker thread. Stamps avoid clearing
+	// the arrays between searches.
+	struct Scratch
+	{
+		std::vector<int> g;
+		std::vector<int> parent;
+		std::vector<unsigned int> seen;
+		std::vector<unsigned int> closed;
+		std::vector<Node> heap;
+		unsigned int stamp;
+
+		Scratch()
+		{
+			stamp = 0;
+		};
+
+		void begin(int num_tiles)
+		{
+			if((int)g.size() != num_tiles)
+			{
+				g.assign(num_tiles, 0);
+				parent.assign(num_tiles, -1);
+				seen.assign(num_tiles, 0);
+				closed.assign(num_tiles, 0);
+				stamp = 0;
+			}
+			stamp++;
+			heap.clear();
+		};
+	};
+
+	Maze* maze;
+	BitGrid walls;
+	int sizeX;
+	int sizeY;
+	int revision;
+
+	std::unordered_map<unsigned int, std::vector<Int2>> cache;
+	Scratch scratch;
+	Concurrency::combinable<Scratch> workerScratch;
+
+	// Batch in flight
+	Concurrency::task_group batchTasks;
+	std::vector<PathRequest> batchRequests;
+	std::vector<PathResult> batchResults;
+	bool batchPending;
+	float batchMs;
+
+	// Copy of useJumpPoints read by searches, only changes between
+	// batches so the menu can't switch modes under a worker
+	bool searchJumpPoints;
+
+	double totalLatencyMs;
+
+	bool isOpen(int x, int y) const
+	{
+		// outside of maze counts as wall
+		return walls.isValidIndex(x,y) && !walls.test(x,y);
+	};
+
+	unsigned int cacheKey(Int2 start, Int2 goal) const
+	{
+		int num_tiles = sizeX*sizeY;
+		return (unsigned int)walls.index(start.x, start.y)*num_tiles + walls.index(goal.x, goal.y);
+	};
+
+	//
+	// Jump Point Search, four connected
+	//
+	// Canonical paths move vertically and only leave a vertical line
+	// sideways, horizontal runs only turn at forced neighbors. Horizontal
+	// runs stop at tiles whose vertical neighbor is open while the tile
+	// behind it is not, vertical runs stop where a horizontal run from
+	// the tile finds anything.
+	//
+
+	bool jumpHorizontal(int x, int y, int dx, Int2 goal, Int2& out) const
+	{
+		for(;;)
+		{
+			x += dx;
+			if(!isOpen(x,y))
+				return false;
+			if(x==goal.x && y==goal.y)
+				break;
+			if((isOpen(x,y+1) && !isOpen(x-dx,y+1)) ||
+			   (isOpen(x,y-1) && !isOpen(x-dx,y-1)))
+				break;
+		}
+		out = Int2(x,y);
+		return true;
+	};
+
+	bool jumpVertical(int x, int y, int dy, Int2 goal, Int2& out) const
+	{
+		Int2 unused;
+		for(;;)
+		{
+			y += dy;
+			if(!isOpen(x,y))
+				return false;
+			if(x==goal.x && y==goal.y)
+				break;
+			if(jumpHorizontal(x, y, 1, goal, unused) || jumpHorizontal(x, y, -1, goal, unused))
+				break;
+		}
+		out = Int2(x,y);
+		return true;
+	};
+
+	bool jump(int x, int y, int dx, int dy, Int2 goal, Int2& out) const
+	{
+		// Plain A*, successors are the direct neighbors
+		if(!searchJumpPoints)
+		{
+			if(!isOpen(x+dx,y+dy))
+				return false;
+			out = Int2(x+dx,y+dy);
+			return true;
+		}
+
+		if(dx != 0)
+			return jumpHorizontal(x, y, dx, goal, out);
+		return jumpVertical(x, y, dy, goal, out);
+	};
+
+	static int sign(int v)
+	{
+		return (v > 0) - (v < 0);
+	};
+
+	static int distance(Int2 a, Int2 b)
+	{
+		return abs(a.x-b.x) + abs(a.y-b.y);
+	};
+
+	// Directions worth searching from a tile given the direction it was
+	// entered with, returns number of directions written to "dirs"
+	int successorDirections(int x, int y, int dx, int dy, Int2* dirs) const
+	{
+		int num_dirs = 0;
+
+		// Start tile or plain A*, all directions
+		if((dx==0 && dy==0) || !searchJumpPoints)
+		{
+			dirs[num_dirs++] = Int2(1,0);
+			dirs[num_dirs++] = Int2(-1,0);
+			dirs[num_dirs++] = Int2(0,1);
+			dirs[num_dirs++] = Int2(0,-1);
+			return num_dirs;
+		}
+
+		// Horizontal, straight on and forced turns
+		if(dx != 0)
+		{
+			dirs[num_dirs++] = Int2(dx,0);
+			if(isOpen(x,y+1) && !isOpen(x-dx,y+1))
+				dirs[num_dirs++] = Int2(0,1);
+			if(isOpen(x,y-1) && !isOpen(x-dx,y-1))
+				dirs[num_dirs++] = Int2(0,-1);
+			return num_dirs;
+		}
+
+		// Vertical, straight on and both sides
+		dirs[num_dirs++] = Int2(0,dy);
+		dirs[num_dirs++] = Int2(1,0);
+		dirs[num_dirs++] = Int2(-1,0);
+		return num_dirs;
+	};
+
+	bool search(Int2 start, Int2 goal, Scratch& s, std::vector<Int2>& out) const
+	{
+		out.clear();
+		if(!isOpen(start.x,start.y) || !isOpen(goal.x,goal.y))
+			return false;
+
+		s.begin(sizeX*sizeY);
+		int startTile = walls.index(start.x, start.y);
+		int goalTile = walls.index(goal.x, goal.y);
+		s.g[startTile] = 0;
+		s.parent[startTile] = -1;
+		s.seen[startTile] = s.stamp;
+		Node node = {startTile, distance(start, goal)};
+		s.heap.push_back(node);
+
+		while(!s.heap.empty())
+		{
+			std::pop_heap(s.heap.begin(), s.heap.end());
+			Node current = s.heap.back();
+			s.heap.pop_back();
+
+			int tile = current.tile;
+			if(s.closed[tile] == s.stamp)
+				continue;
+			s.closed[tile] = s.stamp;
+
+			if(tile == goalTile)
+			{
+				buildPath(s, goalTile, out);
+				return true;
+			}
+
+			int x = tile % sizeX;
+			int y = tile / sizeX;
+			int dx = 0;
+			int dy = 0;
+			if(s.parent[tile] != -1)
+			{
+				dx = sign(x - s.parent[tile] % sizeX);
+				dy = sign(y - s.parent[tile] / sizeX);
+			}
+
+			Int2 dirs[4];
+			int num_dirs = successorDirections(x, y, dx, dy, dirs);
+			for(int d=0; d<num_dirs; d++)
+			{
+				Int2 next;
+				if(!jump(x, y, dirs[d].x, dirs[d].y, goal, next))
+					continue;
+
+				int nextTile = walls.index(next.x, next.y);
+				if(s.closed[nextTile] == s.stamp)
+					continue;
+				int g = s.g[tile] + distance(Int2(x,y), next);
+				if(s.seen[nextTile] == s.stamp && g >= s.g[nextTile])
+					continue;
+
+				s.seen[nextTile] = s.stamp;
+				s.g[nextTile] = g;
+				s.parent[nextTile] = tile;
+				Node nextNode = {nextTile, g + distance(next, goal)};
+				s.heap.push_back(nextNode);
+				std::push_heap(s.heap.begin(), s.heap.end());
+			}
+		}
+		return false;
+	};
+
+	// Walks parents back from goal and fills in the tiles between jump points
+	void buildPath(const Scratch& s, int goalTile, std::vector<Int2>& out) const
+	{
+		for(int tile=goalTile; tile!=-1; tile=s.parent[tile])
+		{
+			Int2 to(tile % sizeX, tile / sizeX);
+			out.push_back(to);
+			if(s.parent[tile] == -1)
+				break;
+
+			Int2 from(s.parent[tile] % sizeX, s.parent[tile] / sizeX);
+			int dx = sign(from.x - to.x);
+			int dy = sign(from.y - to.y);
+			for(Int2 p(to.x+dx, to.y+dy); p.x!=from.x || p.y!=from.y; p.x+=dx, p.y+=dy)
+				out.push_back(p);
+		}
+		std::reverse(out.begin(), out.end());
+	};
+
+	// Takes a new copy of the walls and drops every cached path if the
+	// maze changed since last call
+	void syncMaze()
+	{
+		if(maze->getRevision() == revision)
+			return;
+
+		walls = maze->getWalls();
+		sizeX = walls.getSizeX();
+		sizeY = walls.getSizeY();
+		revision = maze->getRevision();
+		cache.clear();
+		num_invalidations++;
+	};
+
+	const std::vector<Int2>* lookup(Int2 start, Int2 goal) const
+	{
+		if(!isOpen(start.x,start.y) || !isOpen(goal.x,goal.y))
+			return 0;
+		std::unordered_map<unsigned int, std::vector<Int2>>::const_iterator it = cache.find(cacheKey(start, goal));
+		if(it == cache.end())
+			return 0;
+		return &it->second;
+	};
+
+	void store(Int2 start, Int2 goal, const std::vector<Int2>& path)
+	{
+		// Simple bound on memory, maze sized caches never get close
+		if((int)cache.size() >= maxCacheEntries)
+			cache.clear();
+		cache[cacheKey(start, goal)] = path;
+	};
+
+	void recordQuery(const PathResult& result)
+	{
+		num_queries++;
+		if(result.cached)
+			num_cacheHits++;
+		totalLatencyMs += result.latencyMs;
+		maxLatencyMs = MathUtil::Max(maxLatencyMs, result.latencyMs);
+		avgLatencyMs = (float)(totalLatencyMs/num_queries);
+		hitRate = 100.0f*num_cacheHits/num_queries;
+		num_cacheEntries = (int)cache.size();
+	};
+
+	void runBatch()
+	{
+		int num_requests = (int)batchRequests.size();
+		batchResults.resize(num_requests);
+
+		// Cache lookups, misses are collected for the workers
+		std::vector<int> misses;
+		for(int i=0; i<num_requests; i++)
+		{
+			Stopwatch watch;
+			PathResult& result = batchResults[i];
+			const std::vector<Int2>* path = lookup(batchRequests[i].start, batchRequests[i].goal);
+			result.cached = path != 0;
+			result.found = path != 0;
+			if(path)
+				result.path = *path;
+			else
+				misses.push_back(i);
+			result.latencyMs = watch.elapsedMs();
+		}
+
+		// Searches only read the walls, each worker has its own scratch
+		int num_misses = (int)misses.size();
+		Concurrency::parallel_for(0, num_misses, [&](int m)
+		{
+			Stopwatch watch;
+			int i = misses[m];
+			PathResult& result = batchResults[i];
+			result.found = search(batchRequests[i].start, batchRequests[i].goal, workerScratch.local(), result.path);
+			result.latencyMs += watch.elapsedMs();
+		});
+
+		for(int m=0; m<num_misses; m++)
+		{
+			int i = misses[m];
+			if(batchResults[i].found)
+				store(batchRequests[i].start, batchRequests[i].goal, batchResults[i].path);
+		}
+	};
+
+public:
+	static const int maxCacheEntries = 65536;
+
+	// Setting, takes effect with the next search or batch
+	bool useJumpPoints;
+
+	// Statistics
+	int num_queries;
+	int num_cacheHits;
+	int num_invalidations;
+	int num_cacheEntries;
+	float hitRate;			// percent of queries answered from cache
+	float avgLatencyMs;
+	float maxLatencyMs;
+	float lastBatchMs;
+	int lastBatchSize;
+
+	Pathfinder(Maze* maze)
+	{
+		this->maze = maze;
+		revision = -1;
+		sizeX = 0;
+		sizeY = 0;
+		batchPending = false;
+		useJumpPoints = true;
+		searchJumpPoints = true;
+		lastBatchMs = 0.0f;
+		lastBatchSize = 0;
+		num_invalidations = 0;
+		resetStats();
+		syncMaze();
+	};
+
+	~Pathfinder()
+	{
+		batchTasks.wait();
+	};
+
+	void resetStats()
+	{
+		num_queries = 0;
+		num_cacheHits = 0;
+		num_cacheEntries = (int)cache.size();
+		hitRate = 0.0f;
+		avgLatencyMs = 0.0f;
+		maxLatencyMs = 0.0f;
+		totalLatencyMs = 0.0;
+	};
+
+	void clearCache()
+	{
+		waitBatch();
+		cache.clear();
+		num_cacheEntries = 0;
+	};
+
+	// Finds path on calling thread, returns false if goal is unreachable
+	bool findPath(Int2 start, Int2 goal, std::vector<Int2>& out)
+	{
+		waitBatch();
+		syncMaze();
+		searchJumpPoints = useJumpPoints;
+
+		Stopwatch watch;
+		PathResult result;
+		const std::vector<Int2>* path = lookup(start, goal);
+		result.cached = path != 0;
+		if(path)
+		{
+			out = *path;
+			result.found = true;
+		}
+		else
+		{
+			result.found = search(start, goal, scratch, out);
+			if(result.found)
+				store(start, goal, out);
+		}
+		result.latencyMs = watch.elapsedMs();
+		recordQuery(result);
+		return result.found;
+	};
+
+	// Starts resolving "requests" on worker threads. The cache and the
+	// results may not be touched until waitBatch() returns, the maze may
+	// change since searches work on a copy of the walls.
+	void beginBatch(const std::vector<PathRequest>& requests)
+	{
+		waitBatch();
+		syncMaze();
+		searchJumpPoints = useJumpPoints;
+
+		batchRequests = requests;
+		batchPending = true;
+		batchTasks.run([this]()
+		{
+			Stopwatch watch;
+			runBatch();
+			batchMs = watch.elapsedMs();
+		});
+	};
+
+	bool isBatchPending() const
+	{
+		return batchPending;
+	};
+
+	// Blocks until the batch in flight is done, results are in the
+	// same order as the requests
+	const std::vector<PathResult>& waitBatch()
+	{
+		if(batchPending)
+		{
+			batchTasks.wait();
+			batchPending = false;
+
+			for(int i=0; i<(int)batchResults.size(); i++)
+				recordQuery(batchResults[i]);
+			lastBatchMs = batchMs;
+			lastBatchSize = (int)batchResults.size();
+		}
+		return batchResults;
+	};
+};
+#endif
@@ -0,0 +1,178 @@
+#ifndef PELLETS_H
+#define PELLETS_H
+
+#include <vector>
+#include "BitGrid.h"
+#include "GameEntity.h"
+
+// Pellet state of the maze stored as one bit per tile. Every pellet also
+// owns a fixed slot in the instance buffer used to draw pellets, tiles
+// that change during a frame are queued so only their slots are updated.
+class Pellets
+{
+private:
+	BitGrid alive;
+	BitGrid dirtyMask;
+	std::vector<int> dirtyTiles;	// tile indices changed since last clearDirty()
+	std::vector<int> tileSlot;		// instance slot of each tile, -1 if no pellet
+	std::vector<Int2> slotTile;		// tile of each instance slot
+	int num_total;
+	int revision;	// increased every time a pellet changes
+
+	void markDirty(int tile)
+	{
+		revision++;
+		if(dirtyMask.test(tile))
+			return;
+		dirtyMask.set(tile);
+		dirtyTiles.push_back(tile);
+	};
+
+public:
+	Pellets()
+	{
+		num_total = 0;
+		revision = 0;
+	};
+
+	// Places a pellet on every empty tile, all slots are marked dirty
+	void reset(Maze* maze)
+	{
+		int sizeX = maze->getSizeX();
+		int sizeY = maze->getSizeY();
+		alive.resize(sizeX, sizeY);
+		dirtyMask.resize(sizeX, sizeY);
+		dirtyTiles.clear();
+		tileSlot.assign(sizeX*sizeY, -1);
+		slotTile.clear();
+
+		for(int y=0; y<sizeY; y++)
+		{
+			for(int x=0; x<sizeX; x++)
+			{
+				if(maze->getTile(x,y) == 0)
+				{
+					int tile = alive.index(x,y);
+					tileSlot[tile] = (int)slotTile.size();
+					slotTile.push_back(Int2(x,y));
+					alive.set(tile);
+					markDirty(tile);
+				}
+			}
+		}
+		num_total = (int)slotTile.size();
+	};
+
+	// Returns true if there was a pellet to eat
+	bool consume(int x, int y)
+	{
+		if(!alive.safe_test(x,y))
+			return false;
+
+		int tile = alive.index(x,y);
+		alive.clear(tile);
+		markDirty(tile);
+		return true;
+	};
+
+	// Brings back every eaten pellet, only eaten pellets become dirty
+	void respawn()
+	{
+		for(int slot=0; slot<num_total; slot++)
+		{
+			int tile = alive.index(slotTile[slot].x, slotTile[slot].y);
+			if(!alive.test(tile))
+			{
+				alive.set(tile);
+				markDirty(tile);
+			}
+		}
+	};
+
+	// Lets caches built from the pellets detect that they are stale
+	int getRevision() const
+	{
+		return revision;
+	};
+
+	bool isAlive(int x, int y) const
+	{
+		return alive.safe_test(x,y);
+	};
+
+	int getRemaining() const
+	{
+		return alive.count();
+	};
+	int getTotal() const
+	{
+		return num_total;
+	};
+
+	// Instance slots
+	int getSlotCount() const
+	{
+		return (int)slotTile.size();
+	};
+	int getSlot(int tile) const
+	{
+		return tileSlot[tile];
+	};
+	Int2 getSlotTile(int slot) const
+	{
+		return slotTile[slot];
+	};
+	Int2 getTile(int tile) const
+	{
+		return Int2(tile % alive.getSizeX(), tile / alive.getSizeX());
+	};
+
+	// Dirty tracking, consumer clears the list once changes are uploaded
+	const std::vector<int>& getDirtyTiles() const
+	{
+		return dirtyTiles;
+	};
+	void clearDirty()
+	{
+		for(int i=0; i<(int)dirtyTiles.size(); i++)
+			dirtyMask.clear(dirtyTiles[i]);
+		dirtyTiles.clear();
+	};
+
+	const BitGrid& getBits() const
+	{
+		return alive;
+	};
+
+	// Restores pellet state, only tiles that differ become dirty
+	void setBits(const BitGrid& bits)
+	{
+		if(bits.getSizeX()!=alive.getSizeX() || bits.getSizeY()!=alive.getSizeY())
+			return;
+
+		int num_tiles = alive.getSizeX()*alive.getSizeY();
+		for(int w=0; w<alive.getWordCount(); w++)
+		{
+			unsigned int diff = (alive.getWord(w) ^ bits.getWord(w));
+
+			// Bits of the last word past the grid have no tile
+			int bitsLeft = num_tiles - w*32;
+			if(bitsLeft < 32)
+				diff &= (1u << bitsLeft) - 1u;
+			for(int b=0; diff!=0; b++, diff>>=1)
+			{
+				int tile = w*32+b;
+				if((diff & 1u) && tileSlot[tile] != -1)
+				{
+					if(bits.test(tile))
+						alive.set(tile);
+					else
+						alive.clear(tile);
+					markDirty(tile);
+				}
+			}
+		}
+	};
+};
+
+#endif
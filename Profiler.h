@@ -0,0 +1,514 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <string.h>
+#include "RenderDevice.h"
+
+//
+// Profiler
+//
+// Scoped markers record when named pieces of code begin and end. Every
+// thread records into its own ring of events, which only that thread
+// writes and publishes by raising its event count, so recording never
+// takes a lock. The frame summary and the trace export read the rings
+// while threads keep recording. Events overwritten during the read are
+// dropped.
+//
+// GPU scopes write timestamps through the render device. They are
+// resolved a few frames later, once the device can return them without
+// stalling, and go to a ring of their own. On the trace they are placed
+// relative to the CPU time their frame began.
+//
+
+struct ProfileEvent
+{
+	const char* name;	// string literal, compared by pointer first
+	__int64 begin;		// performance counter ticks
+	__int64 end;
+	int depth;			// open scopes around it
+};
+
+class ProfileRing
+{
+public:
+	static const int capacity = 1<<14;
+
+	DWORD threadId;
+	int depth;			// only used by the owning thread
+
+	ProfileRing(DWORD threadId)
+	{
+		this->threadId = threadId;
+		depth = 0;
+		count = 0;
+	};
+
+	// Called by the owning thread only
+	void push(const char* name, __int64 begin, __int64 end, int depth)
+	{
+		LONG64 n = count;
+		ProfileEvent& e = events[n & (capacity-1)];
+		e.name = name;
+		e.begin = begin;
+		e.end = end;
+		e.depth = depth;
+		InterlockedExchange64(&count, n+1);	// publishes the event
+	};
+
+	// Appends events that ended at or after "since", oldest first. Events
+	// are pushed when they end, so the ring is ordered by end time.
+	void copy(std::vector<ProfileEvent>& out, __int64 since)
+	{
+		LONG64 last = InterlockedCompareExchange64(&count, 0, 0);
+		LONG64 first = last;
+		while(first > 0 && last-first < capacity-1 && events[(first-1) & (capacity-1)].end >= since)
+			first--;
+
+		size_t start = out.size();
+		for(LONG64 i=first; i<last; i++)
+			out.push_back(events[i & (capacity-1)]);
+
+		// Slots the owner wrote to while they were copied
+		LONG64 now = InterlockedCompareExchange64(&count, 0, 0);
+		LONG64 overwritten = now-capacity+1 - first;
+		if(overwritten > 0)
+			out.erase(out.begin()+start, out.begin()+start+(size_t)MathUtil::Min(overwritten, last-first));
+	};
+
+private:
+	ProfileEvent events[capacity];
+	volatile LONG64 count;	// events ever pushed
+
+	ProfileRing(const ProfileRing&);
+	ProfileRing& operator=(const ProfileRing&);
+};
+
+class Profiler
+{
+private:
+	DWORD tlsIndex;
+	DWORD mainThreadId;
+	CRITICAL_SECTION ringLock;		// held while threads register and rings are listed
+	std::vector<ProfileRing*> rings;
+	ProfileRing gpuRing;			// written by the frame thread only
+	double msPerTick;
+	__int64 startTicks;
+	__int64 frameStart;
+	std::vector<ProfileEvent> scratch;
+
+	// GPU scopes of every frame in flight, indices of their timestamps
+	struct GpuScope
+	{
+		const char* name;
+		int begin;
+		int end;
+		int depth;
+	};
+	std::vector<GpuScope> gpuScopes[RenderDevice::num_timerFrames];
+	__int64 gpuFrameStart[RenderDevice::num_timerFrames];
+	RenderDevice* gpuDevice;		// device of the open GPU frame
+	UINT64 gpuFrame;
+	UINT64 gpuResolved;				// frames up to this one are resolved or lost
+	int gpuDepth;
+	std::vector<float> gpuMs;
+
+	// Summary, a fixed array so the menu can point into it
+	struct ScopeStats
+	{
+		const char* name;
+		bool gpu;
+		int depth;
+		int calls;			// last frame
+		float ms;			// last frame
+		float avgMs;		// moving average
+		float maxMs;		// since reset
+		bool inMenu;
+	};
+	static const int maxScopes = 48;
+	ScopeStats scopes[maxScopes];
+	int num_scopes;
+	TwBar* menu;
+
+	Profiler() : gpuRing(0)
+	{
+		__int64 countsPerSec;
+		QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+		msPerTick = 1000.0/(double)countsPerSec;
+		QueryPerformanceCounter((LARGE_INTEGER*)&startTicks);
+		frameStart = startTicks;
+
+		tlsIndex = TlsAlloc();
+		mainThreadId = GetCurrentThreadId();
+		InitializeCriticalSection(&ringLock);
+
+		gpuDevice = 0;
+		gpuFrame = 0;
+		gpuResolved = 0;
+		gpuDepth = 0;
+		memset(gpuFrameStart, 0, sizeof(gpuFrameStart));
+
+		num_scopes = 0;
+		menu = 0;
+		enabled = true;
+		frameMs = 0.0f;
+		gpuFrameMs = 0.0f;
+		num_exportedEvents = 0;
+	};
+	~Profiler()
+	{
+		for(int i=0; i<(int)rings.size(); i++)
+			delete rings[i];
+		DeleteCriticalSection(&ringLock);
+		TlsFree(tlsIndex);
+	};
+	Profiler(const Profiler&);
+	Profiler& operator=(const Profiler&);
+
+	void listRings(std::vector<ProfileRing*>& out)
+	{
+		EnterCriticalSection(&ringLock);
+		out = rings;
+		LeaveCriticalSection(&ringLock);
+	};
+
+	ScopeStats* findScope(const char* name, bool gpu, int depth)
+	{
+		for(int i=0; i<num_scopes; i++)
+		{
+			if(scopes[i].gpu == gpu && (scopes[i].name == name || strcmp(scopes[i].name, name) == 0))
+				return &scopes[i];
+		}
+		if(num_scopes == maxScopes)
+			return 0;
+
+		ScopeStats& s = scopes[num_scopes++];
+		memset(&s, 0, sizeof(s));
+		s.name = name;
+		s.gpu = gpu;
+		s.depth = depth;
+		return &s;
+	};
+
+	void addToSummary(const ProfileEvent& e, bool gpu)
+	{
+		ScopeStats* s = findScope(e.name, gpu, e.depth);
+		if(!s)
+			return;
+		s->calls++;
+		s->ms += (float)((e.end-e.begin)*msPerTick);
+	};
+
+	// Scopes seen for the first time get a row in the menu, indented by depth
+	void addMenuRows()
+	{
+		if(!menu)
+			return;
+		for(int i=0; i<num_scopes; i++)
+		{
+			ScopeStats& s = scopes[i];
+			if(s.inMenu)
+				continue;
+			s.inMenu = true;
+			std::string name = std::string(s.gpu ? "GPU " : "CPU ") + s.name;
+			std::string label = std::string(s.gpu ? "GPU " : "") + std::string(s.depth*2, ' ') + s.name + " (ms)";
+			std::string def = "group=Profiler precision=3 label='" + label + "'";
+			TwAddVarRO(menu, name.c_str(), TW_TYPE_FLOAT, &s.avgMs, def.c_str());
+		}
+	};
+
+	// Turns timestamps of finished frames into events
+	void resolveGpuFrames(RenderDevice* device)
+	{
+		const int latency = RenderDevice::num_timerFrames;
+		for(UINT64 f=gpuResolved+1; f<gpuFrame; f++)
+		{
+			bool last = gpuFrame-f >= latency-1;	// slot is reused by the next frame
+			if(!device->readTimerFrame(f, gpuMs))
+			{
+				if(!last)
+					break;
+				gpuResolved = f;
+				continue;
+			}
+			gpuResolved = f;
+
+			std::vector<GpuScope>& list = gpuScopes[f % latency];
+			__int64 base = gpuFrameStart[f % latency];
+			for(int i=0; i<(int)list.size(); i++)
+			{
+				const GpuScope& scope = list[i];
+				if(scope.end < 0)
+					continue;
+				ProfileEvent e;
+				e.name = scope.name;
+				e.begin = base + (__int64)(gpuMs[scope.begin]/msPerTick);
+				e.end = base + (__int64)(gpuMs[scope.end]/msPerTick);
+				e.depth = scope.depth;
+				gpuRing.push(e.name, e.begin, e.end, e.depth);
+				addToSummary(e, true);
+			}
+			gpuFrameMs = gpuMs.back();
+		}
+	};
+
+public:
+	bool enabled;
+
+	// Last frame
+	float frameMs;
+	float gpuFrameMs;		// first to last timestamp of the last resolved frame
+	int num_exportedEvents;
+
+	static Profiler* getInstance()
+	{
+		static Profiler instance;
+		return &instance;
+	};
+
+	// Ring of the calling thread, created on its first event
+	ProfileRing* threadRing()
+	{
+		ProfileRing* ring = (ProfileRing*)TlsGetValue(tlsIndex);
+		if(!ring)
+		{
+			ring = new ProfileRing(GetCurrentThreadId());
+			EnterCriticalSection(&ringLock);
+			rings.push_back(ring);
+			LeaveCriticalSection(&ringLock);
+			TlsSetValue(tlsIndex, ring);
+		}
+		return ring;
+	};
+
+	static __int64 now()
+	{
+		__int64 t;
+		QueryPerformanceCounter((LARGE_INTEGER*)&t);
+		return t;
+	};
+
+	//
+	// Frames
+	//
+
+	void beginFrame()
+	{
+		frameStart = now();
+		for(int i=0; i<num_scopes; i++)
+		{
+			scopes[i].calls = 0;
+			scopes[i].ms = 0.0f;
+		}
+	};
+
+	// Summarises CPU events of every thread since beginFrame
+	void endFrame()
+	{
+		__int64 frameEnd = now();
+		frameMs = (float)((frameEnd-frameStart)*msPerTick);
+
+		std::vector<ProfileRing*> list;
+		listRings(list);
+		for(int r=0; r<(int)list.size(); r++)
+		{
+			scratch.clear();
+			list[r]->copy(scratch, frameStart);
+			for(int i=0; i<(int)scratch.size(); i++)
+				addToSummary(scratch[i], false);
+		}
+
+		// GPU scopes were summed when resolved
+		for(int i=0; i<num_scopes; i++)
+		{
+			ScopeStats& s = scopes[i];
+			if(s.calls == 0)
+				continue;
+			s.avgMs += (s.ms-s.avgMs)*0.05f;
+			s.maxMs = MathUtil::Max(s.maxMs, s.ms);
+		}
+		addMenuRows();
+	};
+
+	// GPU frame inside the CPU frame, only for devices with a GPU
+	void beginGpuFrame(RenderDevice* device)
+	{
+		if(!enabled || device->isHeadless())
+			return;
+		resolveGpuFrames(device);
+
+		gpuFrame++;
+		int slot = (int)(gpuFrame % RenderDevice::num_timerFrames);
+		gpuScopes[slot].clear();
+		gpuFrameStart[slot] = now();
+		gpuDepth = 0;
+		gpuDevice = device;
+		device->beginTimerFrame(gpuFrame);
+		device->writeTimestamp();	// frame start, timestamp 0
+	};
+	void endGpuFrame(RenderDevice* device)
+	{
+		if(gpuDevice != device)
+			return;
+		device->endTimerFrame();
+		gpuDevice = 0;
+	};
+
+	// Index of the scope within the frame, -1 if not timed
+	int beginGpuScope(RenderDevice* device, const char* name)
+	{
+		if(gpuDevice != device || !device)
+			return -1;
+		int timestamp = device->writeTimestamp();
+		if(timestamp < 0)
+			return -1;
+
+		std::vector<GpuScope>& list = gpuScopes[gpuFrame % RenderDevice::num_timerFrames];
+		GpuScope scope;
+		scope.name = name;
+		scope.begin = timestamp;
+		scope.end = -1;
+		scope.depth = gpuDepth++;
+		list.push_back(scope);
+		return (int)list.size()-1;
+	};
+	void endGpuScope(RenderDevice* device, int scope)
+	{
+		if(scope < 0 || gpuDevice != device)
+			return;
+		gpuDepth--;
+		gpuScopes[gpuFrame % RenderDevice::num_timerFrames][scope].end = device->writeTimestamp();
+	};
+
+	void resetStats()
+	{
+		for(int i=0; i<num_scopes; i++)
+			scopes[i].maxMs = 0.0f;
+	};
+
+	//
+	// Export
+	//
+
+	// Writes every event still in the rings as Chrome trace JSON, which
+	// chrome://tracing loads. Returns false if the file could not be opened.
+	bool exportTrace(const char* path)
+	{
+		std::ofstream file(path);
+		if(!file.is_open())
+			return false;
+
+		std::vector<ProfileRing*> list;
+		listRings(list);
+		list.push_back(&gpuRing);
+
+		file.setf(std::ios::fixed);
+		file.precision(3);
+		file << "{\"traceEvents\":[\n";
+		num_exportedEvents = 0;
+		bool first = true;
+		for(int r=0; r<(int)list.size(); r++)
+		{
+			bool gpu = list[r] == &gpuRing;
+			DWORD tid = gpu ? 0 : list[r]->threadId;
+
+			// Thread name
+			if(!first)
+				file << ",\n";
+			first = false;
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+				<< ",\"args\":{\"name\":\"" << (gpu ? "GPU" : (tid == mainThreadId ? "Main" : "Worker")) << "\"}}";
+
+			scratch.clear();
+			list[r]->copy(scratch, 0);
+			for(int i=0; i<(int)scratch.size(); i++)
+			{
+				const ProfileEvent& e = scratch[i];
+				double ts = (e.begin-startTicks)*msPerTick*1000.0;
+				double dur = (e.end-e.begin)*msPerTick*1000.0;
+				file << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << (gpu ? "gpu" : "cpu")
+					<< "\",\"ph\":\"X\",\"ts\":" << ts << ",\"dur\":" << dur
+					<< ",\"pid\":1,\"tid\":" << tid << "}";
+				num_exportedEvents++;
+			}
+		}
+		file << "\n]}\n";
+		return true;
+	};
+
+	// Rows of scopes are added as they are first seen
+	void buildMenu(TwBar* menu)
+	{
+		this->menu = menu;
+		TwAddVarRW(menu, "Profile", TW_TYPE_BOOLCPP, &enabled, "group=Profiler");
+		TwAddVarRO(menu, "Profiled frame (ms)", TW_TYPE_FLOAT, &frameMs, "group=Profiler precision=3");
+		TwAddVarRO(menu, "Profiled GPU frame (ms)", TW_TYPE_FLOAT, &gpuFrameMs, "group=Profiler precision=3");
+		TwAddVarRO(menu, "Exported events", TW_TYPE_INT32, &num_exportedEvents, "group=Profiler");
+		addMenuRows();
+	};
+};
+
+// Records the enclosing scope on the calling thread
+class ProfileScope
+{
+private:
+	ProfileRing* ring;
+	const char* name;
+	__int64 begin;
+	int depth;
+
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator=(const ProfileScope&);
+
+public:
+	ProfileScope(const char* name)
+	{
+		Profiler* profiler = Profiler::getInstance();
+		ring = profiler->enabled ? profiler->threadRing() : 0;
+		if(!ring)
+			return;
+		this->name = name;
+		depth = ring->depth++;
+		begin = Profiler::now();
+	};
+	~ProfileScope()
+	{
+		if(!ring)
+			return;
+		__int64 end = Profiler::now();
+		ring->depth--;
+		ring->push(name, begin, end, depth);
+	};
+};
+
+// Times the GPU work issued through "device" within the enclosing scope
+class GpuProfileScope
+{
+private:
+	RenderDevice* device;
+	int scope;
+
+	GpuProfileScope(const GpuProfileScope&);
+	GpuProfileScope& operator=(const GpuProfileScope&);
+
+public:
+	GpuProfileScope(RenderDevice* device, const char* name)
+	{
+		this->device = device;
+		scope = Profiler::getInstance()->beginGpuScope(device, name);
+	};
+	~GpuProfileScope()
+	{
+		Profiler::getInstance()->endGpuScope(device, scope);
+	};
+};
+
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_JOIN(profileScope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(device, name) GpuProfileScope PROFILE_JOIN(gpuProfileScope_, __LINE__)(device, name)
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef RENDERDEVICE_H
+#define RENDERDEVICE_H
+
+#include <vector>
+#include <string.h>
+
+//
+// Render device
+//
+// Thin layer over the pipeline calls the renderer makes each frame.
+// Resources, views and states are still created with ID3D11Device, the
+// device only decides what happens to the calls binding and drawing them:
+// D3D11RenderDevice forwards them to a device context,
+// RecordingRenderDevice stores them in a command stream without touching
+// the GPU so the CPU side of a frame can be run and measured on its own.
+//
+// This header needs no Windows or D3D headers, resources are only passed
+// through as pointers and enums as plain integers, so the recording
+// device builds and runs on its own. D3D11RenderDevice lives in
+// D3D11RenderDevice.h.
+//
+
+// Passed through as pointers only
+struct ID3D11InputLayout;
+struct ID3D11Buffer;
+struct ID3D11Resource;
+struct ID3D11RasterizerState;
+struct ID3D11DepthStencilState;
+struct ID3D11RenderTargetView;
+struct ID3D11DepthStencilView;
+struct ID3D11ShaderResourceView;
+struct ID3DX11EffectPass;
+struct D3D11_VIEWPORT;
+
+// Topologies told apart when counting, same values as
+// D3D11_PRIMITIVE_TOPOLOGY
+enum RenderTopology
+{
+	topology_undefined = 0,
+	topology_triangleList = 4,
+	topology_triangleStrip = 5,
+	topology_firstPatchList = 33,	// 1 control point
+	topology_lastPatchList = 64		// 32 control points
+};
+
+// Counted by every device
+struct RenderDeviceStats
+{
+	int num_draws;
+	int num_instances;
+	int num_indices;		// indices or vertices submitted
+	int num_triangles;		// of triangle topologies
+	int num_patches;		// of control point patch topologies
+	int num_stateBinds;
+	int num_passes;
+	int num_bufferUpdates;
+	int num_updatedBytes;
+
+	RenderDeviceStats()
+	{
+		reset();
+	};
+
+	void reset()
+	{
+		memset(this, 0, sizeof(*this));
+	};
+};
+
+class RenderDevice
+{
+protected:
+	unsigned int topology;	// last set
+
+	// Counts what "num_indices" make in the bound topology
+	void countPrimitives(unsigned int num_indices)
+	{
+		if(topology == topology_triangleList)
+		{
+			stats.num_triangles += num_indices/3;
+		}
+		else if(topology == topology_triangleStrip)
+		{
+			stats.num_triangles += num_indices > 2 ? num_indices-2 : 0;
+		}
+		else if(topology >= topology_firstPatchList && topology <= topology_lastPatchList)
+		{
+			unsigned int controlPoints = topology - topology_firstPatchList + 1;
+			stats.num_patches += num_indices/controlPoints;
+		}
+	};
+
+public:
+	RenderDeviceStats stats;
+
+	RenderDevice()
+	{
+		topology = topology_undefined;
+	};
+	virtual ~RenderDevice() {};
+
+	// True when calls never reach a GPU
+	virtual bool isHeadless() const = 0;
+
+	// Input assembler, "topology" is a D3D11_PRIMITIVE_TOPOLOGY and
+	// "format" a DXGI_FORMAT
+	virtual void setInputLayout(ID3D11InputLayout* layout) = 0;
+	virtual void setPrimitiveTopology(unsigned int topology) = 0;
+	virtual void setVertexBuffers(unsigned int startSlot, unsigned int num_buffers, ID3D11Buffer* const* buffers, const unsigned int* strides, const unsigned int* offsets) = 0;
+	virtual void setIndexBuffer(ID3D11Buffer* buffer, unsigned int format, unsigned int offset) = 0;
+
+	// States and targets
+	virtual void setRasterizerState(ID3D11RasterizerState* state) = 0;
+	virtual void setDepthStencilState(ID3D11DepthStencilState* state, unsigned int stencilRef) = 0;
+	virtual void setViewports(unsigned int num_viewports, const D3D11_VIEWPORT* viewports) = 0;
+	virtual void setRenderTargets(unsigned int num_views, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil) = 0;
+	virtual void setPSShaderResources(unsigned int startSlot, unsigned int num_views, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void clearTessellation() = 0;	// effects set hull and domain shaders but never unset them
+	virtual void clearRenderTarget(ID3D11RenderTargetView* view, const float color[4]) = 0;
+	virtual void clearDepthStencil(ID3D11DepthStencilView* view, unsigned int flags, float depth, unsigned char stencil) = 0;
+
+	// Effect pass, binds shaders, constant buffers and states of the pass
+	virtual void applyPass(ID3DX11EffectPass* pass) = 0;
+
+	// Draws
+	virtual void draw(unsigned int num_vertices, unsigned int startVertex) = 0;
+	virtual void drawIndexed(unsigned int num_indices, unsigned int startIndex, int baseVertex) = 0;
+	virtual void drawIndexedInstanced(unsigned int num_indices, unsigned int num_instances, unsigned int startIndex, int baseVertex, unsigned int startInstance) = 0;
+
+	// Buffer updates, writes "bytes" bytes at byte "offset" of the buffer.
+	// Map returns the address of byte "offset" of the buffer, "type" is a
+	// D3D11_MAP.
+	virtual void updateBuffer(ID3D11Buffer* buffer, unsigned int offset, const void* data, unsigned int bytes) = 0;
+	virtual void* map(ID3D11Buffer* buffer, unsigned int type, unsigned int offset, unsigned int bytes) = 0;
+	virtual void unmap(ID3D11Buffer* buffer) = 0;
+
+	// Copies all of "source" to "dest", both of equal size and format
+	virtual void copyResource(ID3D11Resource* dest, ID3D11Resource* source) = 0;
+
+	// Fills the lower mips of a render target from its top level
+	virtual void generateMips(ID3D11ShaderResourceView* view) = 0;
+
+	// GPU timestamps, grouped by frame. A frame can be read back
+	// num_timerFrames-1 frames after it ended without stalling. Write
+	// returns the index of the timestamp within its frame, -1 if the
+	// device has no GPU or the frame is full.
+	static const int num_timerFrames = 4;
+	static const int maxTimestamps = 64;
+	virtual void beginTimerFrame(unsigned long long frame) = 0;
+	virtual int writeTimestamp() = 0;
+	virtual void endTimerFrame() = 0;
+
+	// Milliseconds from the first timestamp of "frame" to every other one,
+	// false while the GPU has not reached it or when its clock was disjoint
+	virtual bool readTimerFrame(unsigned long long frame, std::vector<float>& ms) = 0;
+};
+
+//
+// Recording
+//
+
+enum RenderCommandType
+{
+	cmd_setInputLayout,
+	cmd_setPrimitiveTopology,
+	cmd_setVertexBuffers,
+	cmd_setIndexBuffer,
+	cmd_setRasterizerState,
+	cmd_setDepthStencilState,
+	cmd_setViewports,
+	cmd_setRenderTargets,
+	cmd_setPSShaderResources,
+	cmd_clearTessellation,
+	cmd_clearRenderTarget,
+	cmd_clearDepthStencil,
+	cmd_applyPass,
+	cmd_draw,
+	cmd_drawIndexed,
+	cmd_drawIndexedInstanced,
+	cmd_updateBuffer,
+	cmd_map,
+	cmd_unmap,
+	cmd_copyResource,
+	cmd_generateMips,
+	num_renderCommandTypes
+};
+
+// One call, "object" is the bound resource, view, state or pass (first
+// one for calls taking arrays) and "args" the integer arguments in call
+// order
+struct RenderCommand
+{
+	RenderCommandType type;
+	const void* object;
+	unsigned int args[5];
+};
+
+class RecordingRenderDevice : public RenderDevice
+{
+private:
+	std::vector<RenderCommand> commands;
+	std::vector<unsigned char> mapScratch;	// written to instead of mapped buffers
+
+	RenderCommand& record(RenderCommandType type, const void* object)
+	{
+		RenderCommand command;
+		command.type = type;
+		command.object = object;
+		memset(command.args, 0, sizeof(command.args));
+		commands.push_back(command);
+		return commands.back();
+	};
+
+public:
+	bool isHeadless() const
+	{
+		return true;
+	};
+
+	// Commands since last clear
+	const std::vector<RenderCommand>& getCommands() const
+	{
+		return commands;
+	};
+
+	int countCommands(RenderCommandType type) const
+	{
+		int count = 0;
+		for(int i=0; i<(int)commands.size(); i++)
+		{
+			if(commands[i].type == type)
+				count++;
+		}
+		return count;
+	};
+
+	// Keeps the storage so recording the next frame does not allocate
+	void clear()
+	{
+		commands.clear();
+		stats.reset();
+	};
+
+	void setInputLayout(ID3D11InputLayout* layout)
+	{
+		stats.num_stateBinds++;
+		record(cmd_setInputLayout, layout);
+	};
+	void setPrimitiveTopology(unsigned int topology)
+	{
+		stats.num_stateBinds++;
+		this->topology = topology;
+		record(cmd_setPrimitiveTopology, 0).args[0] = topology;
+	};
+	void setVertexBuffers(unsigned int startSlot, unsigned int num_buffers, ID3D11Buffer* const* buffers, const unsigned int* strides, const unsigned int* offsets)
+	{
+		stats.num_stateBinds++;
+		RenderCommand& command = record(cmd_setVertexBuffers, num_buffers > 0 ? buffers[0] : 0);
+		command.args[0] = startSlot;
+		command.args[1] = num_buffers;
+		command.args[2] = num_buffers > 0 ? strides[0] : 0;
+		command.args[3] = num_buffers > 0 ? offsets[0] : 0;
+	};
+	void setIndexBuffer(ID3D11Buffer* buffer, unsigned int format, unsigned int offset)
+	{
+		stats.num_stateBinds++;
+		RenderCommand& command = record(cmd_setIndexBuffer, buffer);
+		command.args[0] = format;
+		command.args[1] = offset;
+	};
+
+	void setRasterizerState(ID3D11RasterizerState* state)
+	{
+		stats.num_stateBinds++;
+		record(cmd_setRasterizerState, state);
+	};
+	void setDepthStencilState(ID3D11DepthStencilState* state, unsigned int stencilRef)
+	{
+		stats.num_stateBinds++;
+		record(cmd_setDepthStencilState, state).args[0] = stencilRef;
+	};
+	void setViewports(unsigned int num_viewports, const D3D11_VIEWPORT* viewports)
+	{
+		stats.num_stateBinds++;
+		record(cmd_setViewports, num_viewports > 0 ? viewports : 0).args[0] = num_viewports;
+	};
+	void setRenderTargets(unsigned int num_views, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil)
+	{
+		stats.num_stateBinds++;
+		RenderCommand& command = record(cmd_setRenderTargets, num_views > 0 ? renderTargets[0] : 0);
+		command.args[0] = num_views;
+		command.args[1] = depthStencil != 0;
+	};
+	void setPSShaderResources(unsigned int startSlot, unsigned int num_views, ID3D11ShaderResourceView* const* views)
+	{
+		stats.num_stateBinds++;
+		RenderCommand& command = record(cmd_setPSShaderResources, num_views > 0 ? views[0] : 0);
+		command.args[0] = startSlot;
+		command.args[1] = num_views;
+	};
+	void clearTessellation()
+	{
+		stats.num_stateBinds++;
+		record(cmd_clearTessellation, 0);
+	};
+	void clearRenderTarget(ID3D11RenderTargetView* view, const float color[4])
+	{
+		record(cmd_clearRenderTarget, view);
+	};
+	void clearDepthStencil(ID3D11DepthStencilView* view, unsigned int flags, float depth, unsigned char stencil)
+	{
+		RenderCommand& command = record(cmd_clearDepthStencil, view);
+		command.args[0] = flags;
+		command.args[1] = stencil;
+	};
+
+	// Effect variables are still written by the caller, only the upload
+	// and binding Apply would do is skipped
+	void applyPass(ID3DX11EffectPass* pass)
+	{
+		stats.num_passes++;
+		record(cmd_applyPass, pass);
+	};
+
+	void draw(unsigned int num_vertices, unsigned int startVertex)
+	{
+		stats.num_draws++;
+		stats.num_instances++;
+		stats.num_indices += num_vertices;
+		countPrimitives(num_vertices);
+		RenderCommand& command = record(cmd_draw, 0);
+		command.args[0] = num_vertices;
+		command.args[1] = startVertex;
+	};
+	void drawIndexed(unsigned int num_indices, unsigned int startIndex, int baseVertex)
+	{
+		stats.num_draws++;
+		stats.num_instances++;
+		stats.num_indices += num_indices;
+		countPrimitives(num_indices);
+		RenderCommand& command = record(cmd_drawIndexed, 0);
+		command.args[0] = num_indices;
+		command.args[1] = startIndex;
+		command.args[2] = (unsigned int)baseVertex;
+	};
+	void drawIndexedInstanced(unsigned int num_indices, unsigned int num_instances, unsigned int startIndex, int baseVertex, unsigned int startInstance)
+	{
+		stats.num_draws++;
+		stats.num_instances += num_instances;
+		stats.num_indices += num_indices*num_instances;
+		countPrimitives(num_indices*num_instances);
+		RenderCommand& command = record(cmd_drawIndexedInstanced, 0);
+		command.args[0] = num_indices;
+		command.args[1] = num_instances;
+		command.args[2] = startIndex;
+		command.args[3] = (unsigned int)baseVertex;
+		command.args[4] = startInstance;
+	};
+
+	void updateBuffer(ID3D11Buffer* buffer, unsigned int offset, const void* data, unsigned int bytes)
+	{
+		stats.num_bufferUpdates++;
+		stats.num_updatedBytes += bytes;
+		RenderCommand& command = record(cmd_updateBuffer, buffer);
+		command.args[0] = offset;
+		command.args[1] = bytes;
+	};
+	void* map(ID3D11Buffer* buffer, unsigned int type, unsigned int offset, unsigned int bytes)
+	{
+		stats.num_bufferUpdates++;
+		stats.num_updatedBytes += bytes;
+		RenderCommand& command = record(cmd_map, buffer);
+		command.args[0] = type;
+		command.args[1] = offset;
+		command.args[2] = bytes;
+
+		if(mapScratch.size() < bytes)
+			mapScratch.resize(bytes);
+		return mapScratch.empty() ? 0 : &mapScratch[0];
+	};
+	void unmap(ID3D11Buffer* buffer)
+	{
+		record(cmd_unmap, buffer);
+	};
+
+	void copyResource(ID3D11Resource* dest, ID3D11Resource* source)
+	{
+		record(cmd_copyResource, dest);
+	};
+	void generateMips(ID3D11ShaderResourceView* view)
+	{
+		record(cmd_generateMips, view);
+	};
+
+	// Nothing reaches a GPU, so there is nothing to time
+	void beginTimerFrame(unsigned long long frame)
+	{
+	};
+	int writeTimestamp()
+	{
+		return -1;
+	};
+	void endTimerFrame()
+	{
+	};
+	bool readTimerFrame(unsigned long long frame, std::vector<float>& ms)
+	{
+		return false;
+	};
+};
+
+#endif
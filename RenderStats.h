@@ -0,0 +1,261 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <fstream>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "RenderDevice.h"
+
+//
+// Render statistics per pass
+//
+// The renderer marks where each pass begins, and everything the device
+// counts between two marks is put on the pass that was current. Effect
+// variable writes are passed in the same way. Every frame goes into a
+// window of recent frames, which gives the min, average and max of each
+// counter. Frames can also be written to a CSV file, one row per frame.
+//
+
+enum RenderPass
+{
+	pass_shadow,
+	pass_cubeMap,
+	pass_main,
+	pass_sky,
+	pass_debug,
+	num_renderPasses
+};
+
+enum RenderCounter
+{
+	counter_draws,
+	counter_applies,
+	counter_stateChanges,
+	counter_triangles,
+	counter_patches,
+	counter_effectWrites,
+	counter_bufferUpdates,
+	num_renderCounters
+};
+
+class RenderStats
+{
+private:
+	struct PassCounters
+	{
+		int value[num_renderCounters];
+	};
+
+	static const int window = 120;		// frames
+
+	PassCounters frame[num_renderPasses];
+	PassCounters history[window][num_renderPasses];
+	int num_history;
+	int historyCursor;
+	int frameIndex;
+
+	// Device and effect counts at the last mark
+	RenderDeviceStats markDevice;
+	int markEffectWrites;
+	int currentPass;
+
+	std::ofstream csv;
+
+	static const char* passName(int pass)
+	{
+		static const char* names[num_renderPasses] = {"shadow", "cubemap", "main", "sky", "debug"};
+		return names[pass];
+	};
+	static const char* counterName(int counter)
+	{
+		static const char* names[num_renderCounters] = {"draws", "applies", "state changes", "triangles", "patches", "effect writes", "buffer updates"};
+		return names[counter];
+	};
+
+	// Counts since the last mark go to the current pass
+	void attribute(const RenderDeviceStats& device, int effectWrites)
+	{
+		if(currentPass >= 0)
+		{
+			int* v = frame[currentPass].value;
+			v[counter_draws] += device.num_draws-markDevice.num_draws;
+			v[counter_applies] += device.num_passes-markDevice.num_passes;
+			v[counter_stateChanges] += device.num_stateBinds-markDevice.num_stateBinds;
+			v[counter_triangles] += device.num_triangles-markDevice.num_triangles;
+			v[counter_patches] += device.num_patches-markDevice.num_patches;
+			v[counter_effectWrites] += effectWrites-markEffectWrites;
+			v[counter_bufferUpdates] += device.num_bufferUpdates-markDevice.num_bufferUpdates;
+		}
+		markDevice = device;
+		markEffectWrites = effectWrites;
+	};
+
+	void updateSummary()
+	{
+		for(int p=0; p<num_renderPasses; p++)
+		{
+			for(int c=0; c<num_renderCounters; c++)
+			{
+				int lo = INT_MAX;
+				int hi = 0;
+				double sum = 0.0;
+				for(int i=0; i<num_history; i++)
+				{
+					int v = history[i][p].value[c];
+					lo = MathUtil::Min(lo, v);
+					hi = MathUtil::Max(hi, v);
+					sum += v;
+				}
+				Summary& s = summary[p][c];
+				s.minValue = num_history > 0 ? lo : 0;
+				s.maxValue = hi;
+				s.avgValue = num_history > 0 ? (float)(sum/num_history) : 0.0f;
+				sprintf_s(s.text, sizeof(s.text), "%.0f (%d - %d)", s.avgValue, s.minValue, s.maxValue);
+			}
+		}
+	};
+
+	void writeCsvRow()
+	{
+		csv << frameIndex;
+		for(int p=0; p<num_renderPasses; p++)
+		{
+			for(int c=0; c<num_renderCounters; c++)
+				csv << "," << frame[p].value[c];
+		}
+		csv << "\n";
+	};
+
+	RenderStats(const RenderStats&);
+	RenderStats& operator=(const RenderStats&);
+
+public:
+	// Min, average and max over the window, "text" is shown in the menu
+	struct Summary
+	{
+		int minValue;
+		int maxValue;
+		float avgValue;
+		char text[48];
+	};
+	Summary summary[num_renderPasses][num_renderCounters];
+	int num_csvRows;
+
+	RenderStats()
+	{
+		memset(frame, 0, sizeof(frame));
+		memset(summary, 0, sizeof(summary));
+		num_history = 0;
+		historyCursor = 0;
+		frameIndex = 0;
+		markEffectWrites = 0;
+		currentPass = -1;
+		num_csvRows = 0;
+	};
+
+	void beginFrame(const RenderDeviceStats& device, int effectWrites)
+	{
+		memset(frame, 0, sizeof(frame));
+		currentPass = -1;
+		attribute(device, effectWrites);
+	};
+
+	// Ends the current pass and makes "pass" current
+	void beginPass(int pass, const RenderDeviceStats& device, int effectWrites)
+	{
+		attribute(device, effectWrites);
+		currentPass = pass;
+	};
+
+	void endFrame(const RenderDeviceStats& device, int effectWrites)
+	{
+		attribute(device, effectWrites);
+		currentPass = -1;
+
+		memcpy(history[historyCursor], frame, sizeof(frame));
+		historyCursor = (historyCursor+1) % window;
+		num_history = MathUtil::Min(num_history+1, (int)window);
+		updateSummary();
+
+		if(csv.is_open())
+		{
+			writeCsvRow();
+			num_csvRows++;
+		}
+		frameIndex++;
+	};
+
+	// Counters of last frame
+	int get(int pass, int counter) const
+	{
+		return frame[pass].value[counter];
+	};
+
+	void resetWindow()
+	{
+		num_history = 0;
+		historyCursor = 0;
+	};
+
+	//
+	// CSV
+	//
+
+	// Header names every column as pass_counter, false if the file could
+	// not be opened
+	bool beginCsv(const char* path)
+	{
+		endCsv();
+		csv.open(path);
+		if(!csv.is_open())
+			return false;
+
+		csv << "frame";
+		for(int p=0; p<num_renderPasses; p++)
+		{
+			for(int c=0; c<num_renderCounters; c++)
+			{
+				std::string name = counterName(c);
+				for(int i=0; i<(int)name.size(); i++)
+				{
+					if(name[i] == ' ')
+						name[i] = '_';
+				}
+				csv << "," << passName(p) << "_" << name;
+			}
+		}
+		csv << "\n";
+		num_csvRows = 0;
+		return true;
+	};
+	void endCsv()
+	{
+		if(csv.is_open())
+			csv.close();
+	};
+	bool isWritingCsv() const
+	{
+		return csv.is_open();
+	};
+
+	// One subgroup per pass, every counter shown as "avg (min - max)"
+	void buildMenu(TwBar* menu)
+	{
+		for(int p=0; p<num_renderPasses; p++)
+		{
+			std::string group = std::string("'Pass ") + passName(p) + "'";
+			for(int c=0; c<num_renderCounters; c++)
+			{
+				std::string name = std::string(passName(p)) + " " + counterName(c);
+				std::string def = "group=" + group + " label='" + counterName(c) + "'";
+				TwAddVarRO(menu, name.c_str(), TW_TYPE_CSSTRING(sizeof(summary[p][c].text)), summary[p][c].text, def.c_str());
+			}
+			TwDefine((std::string("Settings/") + group + " group='Pass stats' opened=false").c_str());
+		}
+		TwAddVarRO(menu, "CSV rows", TW_TYPE_INT32, &num_csvRows, "group='Pass stats'");
+	};
+};
+
+#endif
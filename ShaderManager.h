@@ -20,6 +20,7 @@ namespace Vertex
 		XMFLOAT3 Normal;
 		XMFLOAT2 Tex;
 		XMFLOAT3 TangentU;
+		float Handedness;
 	};
 
 	struct posTexBondsY
@@ -29,6 +30,19 @@ namespace Vertex
 		XMFLOAT2 BoundsY;
 	};
 
+	// Vertex of the mesh arena, 20 bytes against 48 of posNormTexTan.
+	// Position is snorm16 inside the bounds of its mesh with the
+	// handedness of the tangent frame in w, normal and tangent are
+	// octahedral snorm16 and texture coordinates half floats. Decoded by
+	// VertexPacking.fx.
+	struct packed
+	{
+		short Pos[4];
+		short Normal[2];
+		HALF Tex[2];
+		short TangentU[2];
+	};
+
 	struct InstancedData
 	{
 		XMFLOAT4X4 World;
@@ -40,11 +54,11 @@ class ShaderManager
 private:
 	ShaderManager()
 	{
-		layout_pos = 0;
 		layout_posNormTex = 0;
-		layout_posNormTexTan = 0;
+		layout_packed = 0;
 		layout_posTexBoundY = 0;
-		layout_inst_posNormTexTan = 0;
+		layout_inst_packed = 0;
+		layout_unpacked = 0;
 	}
 	void createLayout(ID3D11Device* device, D3D11_INPUT_ELEMENT_DESC *desc_inputElement, UINT numElements, ID3D11InputLayout **layout, ID3DX11EffectTechnique *technique)
 	{
@@ -58,11 +72,11 @@ private:
 public:
 	Effects effects;
 	RenderStates states;
-	ID3D11InputLayout* layout_pos;
 	ID3D11InputLayout* layout_posNormTex;
-	ID3D11InputLayout* layout_posNormTexTan;
+	ID3D11InputLayout* layout_packed;
 	ID3D11InputLayout* layout_posTexBoundY;
-	ID3D11InputLayout* layout_inst_posNormTexTan;
+	ID3D11InputLayout* layout_inst_packed;
+	ID3D11InputLayout* layout_unpacked;
 
 	static ShaderManager* getInstance()
 	{
@@ -71,11 +85,11 @@ public:
 	};
 	~ShaderManager()
 	{
-		ReleaseCOM(layout_pos);
 		ReleaseCOM(layout_posNormTex);
-		ReleaseCOM(layout_posNormTexTan);
+		ReleaseCOM(layout_packed);
 		ReleaseCOM(layout_posTexBoundY);
-		ReleaseCOM(layout_inst_posNormTexTan);
+		ReleaseCOM(layout_inst_packed);
+		ReleaseCOM(layout_unpacked);
 
 		effects.~Effects();
 		states.~RenderStates();
@@ -90,28 +104,25 @@ public:
 		// Create input layouts
 		//
 
-		D3D11_INPUT_ELEMENT_DESC desc_pos[] =
-		{
-			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0}
-		};
-		createLayout(device, desc_pos, 1, &layout_pos, effects.fx_skybox->SkyTech);
-
+		// Screen quad
 		D3D11_INPUT_ELEMENT_DESC desc_posNormTex[] =
 		{
 			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
 			{"NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
 			{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0}
 		};
-		createLayout(device, desc_posNormTex, 3, &layout_posNormTex, effects.fx_buildShadowMap->BuildShadowMapTech);
+		createLayout(device, desc_posNormTex, 3, &layout_posNormTex, effects.fx_showTexture->ViewArgbTech);
 
-		D3D11_INPUT_ELEMENT_DESC desc_posNormTexTan[] =
+		// Mesh arena, also used by shadow and sky shaders which read
+		// fewer elements
+		D3D11_INPUT_ELEMENT_DESC desc_packed[] =
 		{
-			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"TANGENT",  0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0}
+			{"POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"NORMAL",   0, DXGI_FORMAT_R16G16_SNORM,       0, 8,  D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT,       0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TANGENT",  0, DXGI_FORMAT_R16G16_SNORM,       0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0}
 		};
-		createLayout(device, desc_posNormTexTan, 4, &layout_posNormTexTan, effects.fx_standard->tech_light1);
+		createLayout(device, desc_packed, 4, &layout_packed, effects.fx_standard->tech_tess);
 
 		D3D11_INPUT_ELEMENT_DESC desc_posTexBoundY[] =
 		{
@@ -121,19 +132,31 @@ public:
 		};
 		createLayout(device, desc_posTexBoundY, 3, &layout_posTexBoundY, effects.fx_standard->tech_terrain);
 
-		D3D11_INPUT_ELEMENT_DESC desc_inst_posNormTexTan[] =
+		D3D11_INPUT_ELEMENT_DESC desc_inst_packed[] =
 		{
-			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"TANGENT",  0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"NORMAL",   0, DXGI_FORMAT_R16G16_SNORM,       0, 8,  D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT,       0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TANGENT",  0, DXGI_FORMAT_R16G16_SNORM,       0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0},
 
 			{ "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
 			{ "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
 			{ "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
 			{ "WORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
 		};
-		createLayout(device, desc_inst_posNormTexTan, 8, &layout_inst_posNormTexTan, effects.fx_standard->tech_tess_inst);
+		createLayout(device, desc_inst_packed, 8, &layout_inst_packed, effects.fx_standard->tech_tess_inst);
+
+		// Vertex::posNormTexTan, the arena vertex before packing, only
+		// drawn by the vertex fetch benchmark
+		D3D11_INPUT_ELEMENT_DESC desc_unpacked[] =
+		{
+			{"POSITION",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"NORMAL",     0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TEXCOORD",   0, DXGI_FORMAT_R32G32_FLOAT,    0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TANGENT",    0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"HANDEDNESS", 0, DXGI_FORMAT_R32_FLOAT,       0, 44, D3D11_INPUT_PER_VERTEX_DATA, 0}
+		};
+		createLayout(device, desc_unpacked, 5, &layout_unpacked, effects.fx_vertexFetch->UnpackedTech);
 	}
 };
 
@@ -0,0 +1,142 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include <math.h>
+#include <float.h>
+#include "Util.h"
+#include "Camera.h"
+
+//
+// Cascaded shadow maps
+//
+// The camera frustum up to "shadowDistance" is split in slices with the
+// practical split scheme, a blend of uniform and logarithmic splits. Each
+// slice is enclosed by a sphere, whose radius only depends on the lens, and
+// gets an orthographic light projection around it. Projections are moved
+// in whole texels so shadow edges do not crawl while the camera moves, and
+// a cascade keeps the same transform as long as the camera stays within
+// one texel, so its contents can be cached.
+//
+
+class ShadowCascades
+{
+public:
+	static const int maxCascades = 4;
+
+	// Settings
+	int num_cascades;
+	int mapSize;			// texels per side of each cascade
+	float lambda;			// 0 uniform splits, 1 logarithmic splits
+	float shadowDistance;	// view depth where shadows end
+
+	// View depth where each cascade ends
+	float splits[maxCascades];
+
+	XMFLOAT4X4 view[maxCascades];
+	XMFLOAT4X4 proj[maxCascades];
+	XMFLOAT4X4 transform[maxCascades];	// world to shadow map texture space
+
+	ShadowCascades()
+	{
+		num_cascades = 3;
+		mapSize = 2048;
+		lambda = 0.75f;
+		shadowDistance = 400.0f;
+		for(int i=0; i<maxCascades; i++)
+		{
+			splits[i] = 0.0f;
+			XMStoreFloat4x4(&view[i], XMMatrixIdentity());
+			XMStoreFloat4x4(&proj[i], XMMatrixIdentity());
+			XMStoreFloat4x4(&transform[i], XMMatrixIdentity());
+		}
+	};
+
+	// Depth of every cascade reaches back to the light side of the scene
+	// sphere, so casters between the light and a cascade are kept
+	void update(Camera& cam, const XMFLOAT3& lightDir, const XMFLOAT3& sceneCenter, float sceneRadius)
+	{
+		num_cascades = MathUtil::Clamp(num_cascades, 1, (int)maxCascades);
+		float nearZ = cam.GetNearZ();
+		float farZ = MathUtil::Max(nearZ+1.0f, MathUtil::Min(cam.GetFarZ(), shadowDistance));
+
+		// Squared distance of frustum corners from the view axis per unit depth
+		float tanY = tanf(0.5f*cam.GetFovY());
+		float tanX = tanY*cam.GetAspect();
+		float k2 = tanX*tanX + tanY*tanY;
+
+		// Light view shared by all cascades, looking along the light
+		XMVECTOR dir = XMVector3Normalize(XMLoadFloat3(&lightDir));
+		XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		if(fabsf(XMVectorGetY(dir)) > 0.99f)
+			up = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+		XMMATRIX V = XMMatrixLookAtLH(XMVectorZero(), dir, up);
+
+		XMFLOAT3 sceneLS;
+		XMStoreFloat3(&sceneLS, XMVector3TransformCoord(XMLoadFloat3(&sceneCenter), V));
+
+		XMVECTOR eye = cam.GetPositionXM();
+		XMVECTOR look = XMVector3Normalize(cam.GetLookXM());
+
+		// Transform NDC space [-1,+1]^2 to texture space [0,1]^2
+		XMMATRIX T(
+			0.5f, 0.0f, 0.0f, 0.0f,
+			0.0f, -0.5f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.5f, 0.5f, 0.0f, 1.0f);
+
+		float sliceNear = nearZ;
+		for(int i=0; i<num_cascades; i++)
+		{
+			float p = (float)(i+1)/num_cascades;
+			float logSplit = nearZ*powf(farZ/nearZ, p);
+			float uniformSplit = nearZ + (farZ-nearZ)*p;
+			float sliceFar = lambda*logSplit + (1.0f-lambda)*uniformSplit;
+			splits[i] = sliceFar;
+
+			// Smallest sphere on the view axis through the corners of the
+			// slice, its centre never goes past the far plane
+			float center = 0.5f*(sliceNear+sliceFar)*(1.0f+k2);
+			center = MathUtil::Min(center, sliceFar);
+			float toNear = (center-sliceNear)*(center-sliceNear) + sliceNear*sliceNear*k2;
+			float toFar = (sliceFar-center)*(sliceFar-center) + sliceFar*sliceFar*k2;
+			float radius = sqrtf(MathUtil::Max(toNear, toFar));
+			float texel = 2.0f*radius/mapSize;
+
+			// Centre in light space, snapped to whole texels
+			XMFLOAT3 centerLS;
+			XMStoreFloat3(&centerLS, XMVector3TransformCoord(eye + center*look, V));
+			centerLS.x = floorf(centerLS.x/texel)*texel;
+			centerLS.y = floorf(centerLS.y/texel)*texel;
+
+			// Depth reaches back to casters of the scene, snapped as well
+			float n = MathUtil::Min(centerLS.z-radius, sceneLS.z-sceneRadius);
+			float f = centerLS.z+radius;
+			n = floorf(n/texel)*texel;
+			f = ceilf(f/texel)*texel;
+
+			XMMATRIX P = XMMatrixOrthographicOffCenterLH(
+				centerLS.x-radius, centerLS.x+radius,
+				centerLS.y-radius, centerLS.y+radius, n, f);
+
+			XMStoreFloat4x4(&view[i], V);
+			XMStoreFloat4x4(&proj[i], P);
+			XMStoreFloat4x4(&transform[i], V*P*T);
+			sliceNear = sliceFar;
+		}
+
+		// Unused cascades are never selected
+		for(int i=num_cascades; i<maxCascades; i++)
+			splits[i] = FLT_MAX;
+	};
+
+	XMMATRIX getView(int cascade) const
+	{
+		return XMLoadFloat4x4(&view[cascade]);
+	};
+	XMMATRIX getViewProj(int cascade) const
+	{
+		return XMMatrixMultiply(XMLoadFloat4x4(&view[cascade]), XMLoadFloat4x4(&proj[cascade]));
+	};
+};
+
+#endif
@@ -3,14 +3,18 @@
 
 #include "Util.h"
 #include "Camera.h"
+#include "RenderDevice.h"
 
+// Depth map with one slice per cascade, every slice has its own depth
+// stencil view, shaders read all of them through one array view.
 class ShadowMap
 {
 public:
-	ShadowMap(ID3D11Device* device, UINT width, UINT height)
+	ShadowMap(ID3D11Device* device, UINT width, UINT height, UINT num_slices)
 	{
 		mWidth = width;
 		mHeight = height;
+		mSliceCount = num_slices;
 
 		mViewport.TopLeftX = 0.0f;
 		mViewport.TopLeftY = 0.0f;
@@ -26,7 +30,7 @@ public:
 		texDesc.Width     = mWidth;
 		texDesc.Height    = mHeight;
 		texDesc.MipLevels = 1;
-		texDesc.ArraySize = 1;
+		texDesc.ArraySize = mSliceCount;
 		texDesc.Format    = DXGI_FORMAT_R24G8_TYPELESS;
 		texDesc.SampleDesc.Count   = 1;  
 		texDesc.SampleDesc.Quality = 0;  
@@ -38,44 +42,86 @@ public:
 		ID3D11Texture2D* depthMap = 0;
 		HR(device->CreateTexture2D(&texDesc, 0, &depthMap));
 
-		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc;
-		dsvDesc.Flags = 0;
-		dsvDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-		dsvDesc.Texture2D.MipSlice = 0;
-		HR(device->CreateDepthStencilView(depthMap, &dsvDesc, &mDepthMapDSV));
+		mDepthMapDSV.resize(mSliceCount);
+		for(UINT i = 0; i < mSliceCount; ++i)
+		{
+			D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc;
+			dsvDesc.Flags = 0;
+			dsvDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+			dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+			dsvDesc.Texture2DArray.MipSlice = 0;
+			dsvDesc.Texture2DArray.FirstArraySlice = i;
+			dsvDesc.Texture2DArray.ArraySize = 1;
+			HR(device->CreateDepthStencilView(depthMap, &dsvDesc, &mDepthMapDSV[i]));
+		}
 
 		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
 		srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = texDesc.MipLevels;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = mSliceCount;
+		HR(device->CreateShaderResourceView(depthMap, &srvDesc, &mDepthMapSRV));
+
+		// First slice alone, for shaders reading a plain texture
 		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
 		srvDesc.Texture2D.MipLevels = texDesc.MipLevels;
 		srvDesc.Texture2D.MostDetailedMip = 0;
-		HR(device->CreateShaderResourceView(depthMap, &srvDesc, &mDepthMapSRV));
+		HR(device->CreateShaderResourceView(depthMap, &srvDesc, &mFirstSliceSRV));
 
-		// View saves a reference to the texture so we can release our reference.
-		ReleaseCOM(depthMap);
+		// Kept for copies between maps, views hold their own references.
+		mDepthMap = depthMap;
 	}
 	~ShadowMap()
 	{
 		ReleaseCOM(mDepthMapSRV);
-		ReleaseCOM(mDepthMapDSV);
+		ReleaseCOM(mFirstSliceSRV);
+		for(UINT i = 0; i < mSliceCount; ++i)
+			ReleaseCOM(mDepthMapDSV[i]);
+		ReleaseCOM(mDepthMap);
 	}
 
 	ID3D11ShaderResourceView* DepthMapSRV()
 	{
 		return mDepthMapSRV;
 	}
+	ID3D11ShaderResourceView* FirstSliceSRV()
+	{
+		return mFirstSliceSRV;
+	}
 
-	void BindDsvAndSetNullRenderTarget(ID3D11DeviceContext* dc)
+	UINT Width()const
+	{
+		return mWidth;
+	}
+	UINT SliceCount()const
 	{
-		dc->RSSetViewports(1, &mViewport);
+		return mSliceCount;
+	}
+
+	void BindDsvAndSetNullRenderTarget(RenderDevice* dc, UINT slice)
+	{
+		BindDsv(dc, slice);
+		dc->clearDepthStencil(mDepthMapDSV[slice], D3D11_CLEAR_DEPTH, 1.0f, 0);
+	}
+
+	// Binds without clearing, so more casters can be drawn on top of
+	// depth already in the map
+	void BindDsv(RenderDevice* dc, UINT slice)
+	{
+		dc->setViewports(1, &mViewport);
 
 		// Set null render target because we are only going to draw to depth buffer.
 		// Setting a null render target will disable color writes.
 		ID3D11RenderTargetView* renderTargets[1] = {0};
-		dc->OMSetRenderTargets(1, renderTargets, mDepthMapDSV);
+		dc->setRenderTargets(1, renderTargets, mDepthMapDSV[slice]);
+	}
 
-		dc->ClearDepthStencilView(mDepthMapDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
+	// Replaces depth with that of "other", which must have the same size
+	void CopyFrom(RenderDevice* dc, ShadowMap* other)
+	{
+		dc->copyResource(mDepthMap, other->mDepthMap);
 	}
 
 private:
@@ -85,9 +131,12 @@ private:
 private:
 	UINT mWidth;
 	UINT mHeight;
+	UINT mSliceCount;
 
+	ID3D11Texture2D* mDepthMap;
 	ID3D11ShaderResourceView* mDepthMapSRV;
-	ID3D11DepthStencilView* mDepthMapDSV;
+	ID3D11ShaderResourceView* mFirstSliceSRV;
+	std::vector<ID3D11DepthStencilView*> mDepthMapDSV;
 
 	D3D11_VIEWPORT mViewport;
 };
@@ -6,74 +6,53 @@
 #include "GeometryFactory.h"
 #include "Camera.h"
 #include "ShaderManager.h"
+#include "RenderDevice.h"
+#include "Profiler.h"
+#include "MeshArena.h"
+#include "MeshWelder.h"
+#include "MeshCache.h"
 
 class Sky
 {
 private:
-	ID3D11Buffer* mVB;
-	ID3D11Buffer* mIB;
+	// Sphere lives in the arena of the draw manager and goes with it
+	MeshArena* arena;
+	MeshHandle mesh;
 
 	float height_scale;
 	float height_offset;
 
 	ID3D11ShaderResourceView* mCubeMapSRV;
 
-	UINT mIndexCount;
 public:
-	Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySphereRadius)
+	Sky(ID3D11Device* device, MeshArena* arena, RenderDevice* dc, const std::wstring& cubemapFilename, float skySphereRadius)
 	{
 		HR(D3DX11CreateShaderResourceViewFromFile(device, cubemapFilename.c_str(), 0, 0, &mCubeMapSRV, 0));
 
-		GeometryFactory::MeshData sphere;
-		GeometryFactory geoGen;
-		geoGen.CreateSphere(skySphereRadius, 30, 30, sphere);
-
-		std::vector<XMFLOAT3> vertices(sphere.Vertices.size());
-
-		for(size_t i = 0; i < sphere.Vertices.size(); ++i)
+		// Only the position is read, the sphere is cached by its size
+		float sphereSize[] = {skySphereRadius, 30.0f, 30.0f};
+		UINT64 stamp = MeshCache::hashStamp(sphereSize, sizeof(sphereSize));
+		MeshCache cache;
+		if(!cache.open("Cache/sky.mesh", stamp))
 		{
-			vertices[i] = sphere.Vertices[i].Position;
+			GeometryFactory::MeshData sphere;
+			GeometryFactory geoGen;
+			geoGen.CreateSphere(skySphereRadius, 30, 30, sphere);
+			MeshWelder welder;
+			MeshWelder::Stats weldStats;
+			welder.weld(sphere, weldStats);
+			cache.build(sphere, stamp);
+			cache.save("Cache/sky.mesh");
 		}
 
-		D3D11_BUFFER_DESC vbd;
-		vbd.Usage = D3D11_USAGE_IMMUTABLE;
-		vbd.ByteWidth = sizeof(XMFLOAT3) * vertices.size();
-		vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		vbd.CPUAccessFlags = 0;
-		vbd.MiscFlags = 0;
-		vbd.StructureByteStride = 0;
-
-		D3D11_SUBRESOURCE_DATA vinitData;
-		vinitData.pSysMem = &vertices[0];
-
-		HR(device->CreateBuffer(&vbd, &vinitData, &mVB));
-
-
-		mIndexCount = sphere.Indices.size();
-
-		D3D11_BUFFER_DESC ibd;
-		ibd.Usage = D3D11_USAGE_IMMUTABLE;
-		ibd.ByteWidth = sizeof(USHORT) * mIndexCount;
-		ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		ibd.CPUAccessFlags = 0;
-		ibd.StructureByteStride = 0;
-		ibd.MiscFlags = 0;
-
-		std::vector<USHORT> indices16;
-		indices16.assign(sphere.Indices.begin(), sphere.Indices.end());
-
-		D3D11_SUBRESOURCE_DATA iinitData;
-		iinitData.pSysMem = &indices16[0];
-
-		HR(device->CreateBuffer(&ibd, &iinitData, &mIB));
+		this->arena = arena;
+		mesh = cache.addTo(arena, dc);
 
 		height_offset = 0.0f;
 		height_scale = 1.0f;
 	}
 	~Sky()
 	{
-		ReleaseCOM(mVB);
-		ReleaseCOM(mIB);
 		ReleaseCOM(mCubeMapSRV);
 	}
 
@@ -82,8 +61,11 @@ public:
 		return mCubeMapSRV;
 	}
 
-	void Draw(ID3D11DeviceContext* dc, Camera* camera)
+	void Draw(RenderDevice* dc, Camera* camera)
 	{
+		PROFILE_SCOPE("Sky");
+		PROFILE_GPU_SCOPE(dc, "Sky");
+
 		// center Sky about eye in world space
 		XMFLOAT3 eyePos = camera->GetPosition();
 		XMMATRIX T = XMMatrixTranslation(eyePos.x, eyePos.y+height_offset, eyePos.z);
@@ -95,14 +77,14 @@ public:
 		FXSkybox* fx = shaderManager->effects.fx_skybox;
 		fx->SetWorldViewProj(WVP);
 		fx->SetCubeMap(mCubeMapSRV);
+		const MeshRange& range = arena->getRange(mesh);
+		fx->SetPosBounds(range.posScale, range.posOffset);
 
 
-		UINT stride = sizeof(XMFLOAT3);
-		UINT offset = 0;
-		dc->IASetVertexBuffers(0, 1, &mVB, &stride, &offset);
-		dc->IASetIndexBuffer(mIB, DXGI_FORMAT_R16_UINT, 0);
-		dc->IASetInputLayout(shaderManager->layout_pos);
-		dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		arena->bind(dc);
+		arena->bindIndices(dc, mesh);
+		dc->setInputLayout(shaderManager->layout_packed);
+		dc->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 		D3DX11_TECHNIQUE_DESC techDesc;
 		fx->SkyTech->GetDesc( &techDesc );
@@ -111,9 +93,9 @@ public:
 		{
 			ID3DX11EffectPass* pass = fx->SkyTech->GetPassByIndex(p);
 
-			pass->Apply(0, dc);
+			dc->applyPass(pass);
 
-			dc->DrawIndexed(mIndexCount, 0, 0);
+			arena->drawIndexed(dc, mesh);
 		}
 	}
 
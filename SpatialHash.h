@@ -0,0 +1,228 @@
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <windows.h>
+#include <ppl.h>
+#include <concrt.h>
+#include <vector>
+#include "EntityStore.h"
+
+// Uniform grid hashed on maze tile coordinates. Agents are bucketed by
+// counting sort so every cell is one contiguous range in "cellEntries".
+class SpatialHash
+{
+private:
+	// Number of agents below which building stays on calling thread
+	static const int parallelThreshold = 4096;
+
+	int tableSize;
+	int mask;
+
+	// Agent layer
+	std::vector<int> cellStart;		// first entry of each cell, tableSize+1 elements
+	std::vector<int> cellEntries;	// agent indices sorted by cell
+	std::vector<int> agentCell;		// cell of each agent at last build
+	std::vector<Int2> agentTile;	// nearest tile of each agent at last build
+	std::vector<int> chunkCounts;	// per chunk histograms, num_chunks*tableSize
+
+	int hashCell(int x, int y) const
+	{
+		return (int)(((unsigned int)x*73856093u) ^ ((unsigned int)y*19349663u)) & mask;
+	};
+
+	int chunkCount(int num_agents) const
+	{
+		if(num_agents < parallelThreshold)
+			return 1;
+		int num_chunks = (int)Concurrency::GetProcessorCount();
+		return MathUtil::Clamp(num_chunks, 1, num_agents/1024);
+	};
+
+	// Calls fn(i) for i in [0, count), on worker threads if count is large
+	template<typename Fn>
+	void forRange(int count, Fn fn) const
+	{
+		if(count < parallelThreshold)
+		{
+			for(int i=0; i<count; i++)
+				fn(i);
+			return;
+		}
+
+		const int chunkSize = 1024;
+		int num_chunks = (count+chunkSize-1)/chunkSize;
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int end = MathUtil::Min(count, (chunk+1)*chunkSize);
+			for(int i=chunk*chunkSize; i<end; i++)
+				fn(i);
+		});
+	};
+
+public:
+	int num_rebuilds;
+	int num_skippedUpdates;
+
+	SpatialHash(int num_tiles)
+	{
+		// Round up to power of two so hashing is a mask
+		tableSize = 1;
+		while(tableSize < num_tiles)
+			tableSize <<= 1;
+		mask = tableSize-1;
+
+		cellStart.assign(tableSize+1, 0);
+		num_rebuilds = 0;
+		num_skippedUpdates = 0;
+	};
+
+	//
+	// Agent layer
+	//
+
+	void build(const EntityStore& store)
+	{
+		int num_agents = store.size();
+		agentCell.resize(num_agents);
+		agentTile.resize(num_agents);
+		cellEntries.resize(num_agents);
+
+		forRange(num_agents, [&](int i)
+		{
+			Int2 tile = store.getNearestTile(i);
+			agentTile[i] = tile;
+			agentCell[i] = hashCell(tile.x, tile.y);
+		});
+
+		// Counting sort, each chunk counts its own range so no atomics are
+		// needed and the result stays stable
+		int num_chunks = chunkCount(num_agents);
+		int chunkSize = (num_agents+num_chunks-1)/num_chunks;
+		chunkCounts.assign(num_chunks*tableSize, 0);
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int* counts = &chunkCounts[chunk*tableSize];
+			int end = MathUtil::Min(num_agents, (chunk+1)*chunkSize);
+			for(int i=chunk*chunkSize; i<end; i++)
+				counts[agentCell[i]]++;
+		});
+
+		// Prefix sum over (cell, chunk), turns counts into write offsets
+		int sum = 0;
+		for(int cell=0; cell<tableSize; cell++)
+		{
+			cellStart[cell] = sum;
+			for(int chunk=0; chunk<num_chunks; chunk++)
+			{
+				int count = chunkCounts[chunk*tableSize+cell];
+				chunkCounts[chunk*tableSize+cell] = sum;
+				sum += count;
+			}
+		}
+		cellStart[tableSize] = sum;
+
+		// Scatter
+		Concurrency::parallel_for(0, num_chunks, [&](int chunk)
+		{
+			int* offsets = &chunkCounts[chunk*tableSize];
+			int end = MathUtil::Min(num_agents, (chunk+1)*chunkSize);
+			for(int i=chunk*chunkSize; i<end; i++)
+				cellEntries[offsets[agentCell[i]]++] = i;
+		});
+
+		num_rebuilds++;
+	};
+
+	// Rebuilds only if some agent has changed tile since last build,
+	// returns true if a rebuild was needed
+	bool update(const EntityStore& store)
+	{
+		int num_agents = store.size();
+		if(num_agents != (int)agentTile.size())
+		{
+			build(store);
+			return true;
+		}
+
+		volatile LONG changed = 0;
+		forRange(num_agents, [&](int i)
+		{
+			if(changed)
+				return;
+			Int2 tile = store.getNearestTile(i);
+			if(tile.x != agentTile[i].x || tile.y != agentTile[i].y)
+				InterlockedExchange(&changed, 1);
+		});
+
+		if(!changed)
+		{
+			num_skippedUpdates++;
+			return false;
+		}
+		build(store);
+		return true;
+	};
+
+	// Appends agents whose tile lies within "radius" tiles of (x, y)
+	void queryNeighbors(int x, int y, int radius, std::vector<int>& out) const
+	{
+		for(int ny=y-radius; ny<=y+radius; ny++)
+		{
+			for(int nx=x-radius; nx<=x+radius; nx++)
+			{
+				int cell = hashCell(nx, ny);
+				for(int k=cellStart[cell]; k<cellStart[cell+1]; k++)
+				{
+					// Cells may be shared by other tiles, filter hash collisions
+					int i = cellEntries[k];
+					if(agentTile[i].x == nx && agentTile[i].y == ny)
+						out.push_back(i);
+				}
+			}
+		}
+	};
+
+	// Finds every pair of agents closer than two radii, each pair once
+	// with the lower index first. Overlapping agents are at most one tile
+	// apart so only the 3x3 neighborhood needs to be visited.
+	void findOverlapPairs(const EntityStore& store, std::vector<Int2>& out) const
+	{
+		out.clear();
+		int num_agents = (int)agentTile.size();
+		float minDist = 2.0f*store.radius;
+		float minDistSq = minDist*minDist;
+
+		Concurrency::combinable<std::vector<Int2>> localPairs;
+		forRange(num_agents, [&](int i)
+		{
+			std::vector<Int2>& pairs = localPairs.local();
+			Float2 p = store.getTilePos(i);
+			Int2 tile = agentTile[i];
+			for(int ny=tile.y-1; ny<=tile.y+1; ny++)
+			{
+				for(int nx=tile.x-1; nx<=tile.x+1; nx++)
+				{
+					int cell = hashCell(nx, ny);
+					for(int k=cellStart[cell]; k<cellStart[cell+1]; k++)
+					{
+						int j = cellEntries[k];
+						if(j <= i || agentTile[j].x != nx || agentTile[j].y != ny)
+							continue;
+
+						Float2 q = store.getTilePos(j);
+						float dx = p.x-q.x;
+						float dy = p.y-q.y;
+						if(dx*dx+dy*dy < minDistSq)
+							pairs.push_back(Int2(i, j));
+					}
+				}
+			}
+		});
+
+		localPairs.combine_each([&](const std::vector<Int2>& pairs)
+		{
+			out.insert(out.end(), pairs.begin(), pairs.end());
+		});
+	};
+};
+#endif
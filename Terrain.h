@@ -5,6 +5,8 @@
 #include "LightHelper.h"
 #include "ShaderManager.h"
 #include "Camera.h"
+#include "RenderDevice.h"
+#include "Profiler.h"
 
 class Terrain
 {
@@ -152,17 +154,20 @@ public:
 			info.path_blendMap.c_str(), 0, 0, &view_blendMap, 0));
 	}
 
-	void draw(ID3D11DeviceContext* dc, Camera *cam)
+	void draw(RenderDevice* dc, Camera *cam)
 	{
+		PROFILE_SCOPE("Terrain");
+		PROFILE_GPU_SCOPE(dc, "Terrain");
+
 		ShaderManager* sm = ShaderManager::getInstance();
-		dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
-		dc->IASetInputLayout(sm->layout_posTexBoundY);
+		dc->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
+		dc->setInputLayout(sm->layout_posTexBoundY);
 		
 
 		UINT stride = sizeof(Vertex::posTexBondsY);
 		UINT offset = 0;
-		dc->IASetVertexBuffers(0, 1, &vbuff_patches, &stride, &offset);
-		dc->IASetIndexBuffer(ibuff_patches, DXGI_FORMAT_R16_UINT, 0);
+		dc->setVertexBuffers(0, 1, &vbuff_patches, &stride, &offset);
+		dc->setIndexBuffer(ibuff_patches, DXGI_FORMAT_R16_UINT, 0);
 
 		XMMATRIX viewProj = cam->ViewProj();
 		XMMATRIX world  = XMLoadFloat4x4(&mWorld);
@@ -200,15 +205,14 @@ public:
 		for(UINT i = 0; i < techDesc.Passes; ++i)
 		{
 			ID3DX11EffectPass* pass = tech->GetPassByIndex(i);
-			pass->Apply(0, dc);
+			dc->applyPass(pass);
 
-			dc->DrawIndexed(num_patchCells_total*4, 0, 0);
+			dc->drawIndexed(num_patchCells_total*4, 0, 0);
 		}	
 
 		// FX sets tessellation stages, but it does not disable them.  So do that here
 		// to turn off tessellation.
-		dc->HSSetShader(0, 0, 0);
-		dc->DSSetShader(0, 0, 0);
+		dc->clearTessellation();
 	}
 	float getTerrainHeight(float x, float z)
 	{
@@ -0,0 +1,173 @@
+#ifndef VERTEXFETCHBENCHMARK_H
+#define VERTEXFETCHBENCHMARK_H
+
+#include "Util.h"
+#include "GeometryFactory.h"
+#include "ShaderManager.h"
+#include "RenderDevice.h"
+#include "Profiler.h"
+#include "MeshArena.h"
+#include "MeshOptimizer.h"
+
+//
+// Vertex fetch benchmark
+//
+// Draws one dense sphere in the vertex formats the arena has used, each
+// under its own GPU profiler scope:
+//  - 48 byte Vertex::posNormTexTan with 32-bit indices, as before packing
+//  - 20 byte Vertex::packed with 32-bit indices
+//  - 20 byte Vertex::packed with 16-bit indices, as the arena draws now
+// The sphere covers a few pixels so the draws are bound by vertex work,
+// and is drawn before the back buffer is cleared so it is never seen.
+// Timings are read from the GPU rows of the Profiler group.
+//
+
+class VertexFetchBenchmark
+{
+private:
+	ID3D11Buffer* vb_unpacked;
+	ID3D11Buffer* vb_packed;
+	ID3D11Buffer* ib_wide;
+	ID3D11Buffer* ib_narrow;
+	MeshRange range;
+
+	template<typename T>
+	static ID3D11Buffer* createBuffer(ID3D11Device* device, const std::vector<T>& data, UINT bindFlags)
+	{
+		D3D11_BUFFER_DESC desc;
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.ByteWidth = sizeof(T) * data.size();
+		desc.BindFlags = bindFlags;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+		desc.StructureByteStride = 0;
+		D3D11_SUBRESOURCE_DATA initData;
+		initData.pSysMem = &data[0];
+		ID3D11Buffer* buffer;
+		HR(device->CreateBuffer(&desc, &initData, &buffer));
+		return buffer;
+	};
+
+	void drawSphere(RenderDevice* dc, ID3DX11EffectTechnique* tech, ID3D11InputLayout* layout, ID3D11Buffer* vb, UINT stride, ID3D11Buffer* ib, DXGI_FORMAT indexFormat)
+	{
+		UINT offset = 0;
+		dc->setInputLayout(layout);
+		dc->setVertexBuffers(0, 1, &vb, &stride, &offset);
+		dc->setIndexBuffer(ib, indexFormat, 0);
+		dc->applyPass(tech->GetPassByIndex(0));
+		for(int i=0; i<num_draws; i++)
+			dc->drawIndexed(num_indices, 0, 0);
+	};
+
+	VertexFetchBenchmark(const VertexFetchBenchmark&);
+	VertexFetchBenchmark& operator=(const VertexFetchBenchmark&);
+
+public:
+	bool enabled;
+	int num_draws;			// of each format per frame
+	int num_vertices;
+	int num_indices;
+	int bytes_unpacked;		// vertex buffer of each format
+	int bytes_packed;
+
+	VertexFetchBenchmark()
+	{
+		vb_unpacked = 0;
+		vb_packed = 0;
+		ib_wide = 0;
+		ib_narrow = 0;
+		enabled = false;
+		num_draws = 20;
+		num_vertices = 0;
+		num_indices = 0;
+		bytes_unpacked = 0;
+		bytes_packed = 0;
+	};
+	~VertexFetchBenchmark()
+	{
+		ReleaseCOM(vb_unpacked);
+		ReleaseCOM(vb_packed);
+		ReleaseCOM(ib_wide);
+		ReleaseCOM(ib_narrow);
+	};
+
+	void init(ID3D11Device* device)
+	{
+		// Most vertices 16-bit indices can address, reordered like
+		// imported meshes
+		GeometryFactory::MeshData sphere;
+		GeometryFactory geoGen;
+		geoGen.CreateSphere(1.0f, 256, 200, sphere);
+		MeshOptimizer optimizer;
+		MeshOptimizer::Stats stats;
+		optimizer.optimize(sphere, stats);
+
+		num_vertices = (int)sphere.Vertices.size();
+		num_indices = (int)sphere.Indices.size();
+		std::vector<Vertex::posNormTexTan> unpacked(num_vertices);
+		for(int i=0; i<num_vertices; i++)
+		{
+			unpacked[i].Pos = sphere.Vertices[i].Position;
+			unpacked[i].Normal = sphere.Vertices[i].Normal;
+			unpacked[i].Tex = sphere.Vertices[i].TexC;
+			unpacked[i].TangentU = sphere.Vertices[i].TangentU;
+			unpacked[i].Handedness = sphere.Vertices[i].Handedness;
+		}
+		std::vector<Vertex::packed> packed(num_vertices);
+		MeshArena::pack(&unpacked[0], num_vertices, &packed[0], range);
+		std::vector<USHORT> narrow(num_indices);
+		for(int i=0; i<num_indices; i++)
+			narrow[i] = (USHORT)sphere.Indices[i];
+
+		vb_unpacked = createBuffer(device, unpacked, D3D11_BIND_VERTEX_BUFFER);
+		vb_packed = createBuffer(device, packed, D3D11_BIND_VERTEX_BUFFER);
+		ib_wide = createBuffer(device, sphere.Indices, D3D11_BIND_INDEX_BUFFER);
+		ib_narrow = createBuffer(device, narrow, D3D11_BIND_INDEX_BUFFER);
+		bytes_unpacked = num_vertices*(int)sizeof(Vertex::posNormTexTan);
+		bytes_packed = num_vertices*(int)sizeof(Vertex::packed);
+	};
+
+	// Expects the render target and viewport of the frame to be set,
+	// leaves default rasterizer and depth states
+	void draw(RenderDevice* dc)
+	{
+		if(!enabled || dc->isHeadless())
+			return;
+
+		ShaderManager* shaderManager = ShaderManager::getInstance();
+		FXVertexFetch* fx = shaderManager->effects.fx_vertexFetch;
+		fx->SetWorldViewProj(XMMatrixScaling(0.02f, 0.02f, 0.02f)*XMMatrixTranslation(0.0f, 0.0f, 0.5f));
+		fx->SetPosBounds(range.posScale, range.posOffset);
+		dc->clearTessellation();	// left bound by the shadow pass
+		dc->setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+		{
+			PROFILE_GPU_SCOPE(dc, "Fetch 48B 32-bit");
+			drawSphere(dc, fx->UnpackedTech, shaderManager->layout_unpacked, vb_unpacked, sizeof(Vertex::posNormTexTan), ib_wide, DXGI_FORMAT_R32_UINT);
+		}
+		{
+			PROFILE_GPU_SCOPE(dc, "Fetch 20B 32-bit");
+			drawSphere(dc, fx->PackedTech, shaderManager->layout_packed, vb_packed, sizeof(Vertex::packed), ib_wide, DXGI_FORMAT_R32_UINT);
+		}
+		{
+			PROFILE_GPU_SCOPE(dc, "Fetch 20B 16-bit");
+			drawSphere(dc, fx->PackedTech, shaderManager->layout_packed, vb_packed, sizeof(Vertex::packed), ib_narrow, DXGI_FORMAT_R16_UINT);
+		}
+
+		dc->setRasterizerState(0);
+		dc->setDepthStencilState(0, 0);
+	};
+
+	void buildMenu(TwBar* menu)
+	{
+		TwAddVarRW(menu, "Vertex fetch benchmark", TW_TYPE_BOOLCPP, &enabled, "group='Vertex fetch' help='Times the sphere in every vertex format, see the GPU Fetch rows of the Profiler group'");
+		TwAddVarRW(menu, "Vertex fetch draws", TW_TYPE_INT32, &num_draws, "group='Vertex fetch' min=1 max=200");
+		TwAddVarRO(menu, "Vertex fetch vertices", TW_TYPE_INT32, &num_vertices, "group='Vertex fetch'");
+		TwAddVarRO(menu, "Vertex fetch indices", TW_TYPE_INT32, &num_indices, "group='Vertex fetch'");
+		TwAddVarRO(menu, "Unpacked vertices (bytes)", TW_TYPE_INT32, &bytes_unpacked, "group='Vertex fetch'");
+		TwAddVarRO(menu, "Packed vertices (bytes)", TW_TYPE_INT32, &bytes_packed, "group='Vertex fetch'");
+		TwDefine("Settings/'Vertex fetch' group=Render opened=false");
+	};
+};
+
+#endif
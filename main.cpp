@@ -1,6 +1,32 @@
 
 #include "MainWindow.h"
 #include <QtGui/QApplication>
+#include <string.h>
+#include "ObjImporter.h"
+#include "MeshWelder.h"
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
+
+// Builds the mesh cache file of an OBJ file, the same way the game does
+// when the cache is missing or older than the OBJ
+static bool convertMesh(const char* objPath, const char* cachePath)
+{
+	GeometryFactory::MeshData mesh;
+	ObjImporter importer;
+	if(!importer.load(objPath, mesh))
+		return false;
+
+	MeshWelder welder;
+	MeshWelder::Stats weldStats;
+	welder.weld(mesh, weldStats);
+	MeshOptimizer optimizer;
+	MeshOptimizer::Stats meshStats;
+	optimizer.optimize(mesh, meshStats);
+
+	MeshCache cache;
+	cache.build(mesh, MeshCache::fileStamp(objPath));
+	return cache.save(cachePath);
+}
 
 int main(int argc, char *argv[])
 {
@@ -9,6 +35,11 @@ int main(int argc, char *argv[])
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	//Convert mesh without starting the game:
+	//  Aberrant -convertmesh <file.obj> <file.mesh>
+	if(argc == 4 && strcmp(argv[1], "-convertmesh") == 0)
+		return convertMesh(argv[2], argv[3]) ? 0 : 1;
+
 	//Create mainwindow
 	QApplication a(argc, argv);
 	MainWindow w;